@@ -23,6 +23,8 @@ class ModbusRegisters {
         void addValue(uint16_t val) { appendValue(val); }
 
         void appendValue(uint16_t val) { mRegisters.push_back(val); }
+        // remove all values, keeps allocated memory
+        void clear() { mRegisters.clear(); }
         void prependValue(uint16_t val) { mRegisters.insert(mRegisters.begin(), val); }
     private:
         std::vector<uint16_t> mRegisters;
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <locale>
 #include <memory>
 #include <sstream>
 #include <iostream>
@@ -59,22 +61,15 @@ class MqttValue {
         }
 
         MqttValue(const std::string& pVal) {
-            setString(pVal.c_str());
+            setBinary(pVal.data(), pVal.size());
         }
 
         MqttValue(const void* ptr, size_t size){
-            mBinaryValue = std::shared_ptr<void>(malloc(size), free);
-            memcpy(mBinaryValue.get(), ptr, size);
-            mType = SourceType::BINARY;
-            mBinarySize = size;
+            setBinary(ptr, size);
         }
 
         void setString(const char* val) {
-            size_t len = strlen(val);
-            mBinaryValue = std::shared_ptr<void>(malloc(len), free);
-            memcpy(mBinaryValue.get(), val, len);
-            mBinarySize = len;
-            mType = SourceType::BINARY;
+            setBinary(val, strlen(val));
         }
 
         void setDouble(double val, int precision) {
@@ -96,6 +91,7 @@ class MqttValue {
         void setBinary(const void* ptr, size_t size) {
             mBinaryValue = std::shared_ptr<void>(malloc(size), free);
             memcpy(mBinaryValue.get(), ptr, size);
+            mBinarySize = size;
             mType = SourceType::BINARY;
         }
 
@@ -220,9 +216,11 @@ class MqttValue {
             double v_double;
         } Variant;
 
+        // MqttValue is passed to converter plugins,
+        // do not change its data layout
         Variant mValue;
         std::shared_ptr<void> mBinaryValue;
-        size_t mBinarySize;
+        size_t mBinarySize = 0;
         int mDoublePrecision = MqttValue::NO_PRECISION;
         SourceType mType;
 
@@ -235,11 +233,22 @@ class MqttValue {
             if (intpart == value && mDoublePrecision == NO_PRECISION)
                 return std::to_string(int64_t(intpart));
 
+            // default stream precision
+            int precision = mDoublePrecision != NO_PRECISION ? mDoublePrecision : 6;
+
+#if __cpp_lib_to_chars >= 201611L
+            // the same output as std::fixed stream with classic locale,
+            // without creating a stringstream for every value
+            char buf[64];
+            std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+            if (res.ec == std::errc())
+                return std::string(buf, res.ptr);
+#endif
+            // decimal point must not depend on global locale
             std::stringstream sstream;
+            sstream.imbue(std::locale::classic());
             sstream.setf(std::ios::fixed);
-
-            if (mDoublePrecision != NO_PRECISION)
-                sstream.precision(mDoublePrecision);
+            sstream.precision(precision);
 
             sstream << value;
             return sstream.str();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "defs.h"
 #include "exceptions.hpp"
 #include "logging.hpp"
@@ -27,4 +29,12 @@ typedef enum {
     ONCE=3
 } PublishMode;
 
+// flags and MQTT 5 properties of a published message
+struct MqttPublishProps {
+    bool mRetain = false;
+    int mQos = 0;
+    // message expiry interval in seconds, 0 for none. MQTT 5 only
+    uint32_t mMessageExpiry = 0;
+};
+
 }
@@ -55,6 +55,29 @@ ModbusNetworkConfig::ModbusNetworkConfig(const YAML::Node& source) {
     ConfigTools::readOptionalValue<unsigned short>(mMaxWriteRetryCount, source, "write_retries");
     ConfigTools::readOptionalValue<unsigned short>(mMaxReadRetryCount, source, "read_retries");
 
+    YAML::Node pbsNode(ConfigTools::setOptionalValueFromNode<int>(mPollBatchSize, source, "poll_batch_size"));
+    if (pbsNode.IsDefined() && mPollBatchSize < 1)
+        throw ConfigurationException(pbsNode.Mark(), "poll_batch_size must be greater than 0");
+
+    YAML::Node pbdNode(ConfigTools::setOptionalValueFromNode<std::chrono::milliseconds>(mPollBatchDelay, source, "poll_batch_delay"));
+    if (pbdNode.IsDefined() && mPollBatchDelay < std::chrono::milliseconds::zero())
+        throw ConfigurationException(pbdNode.Mark(), "poll_batch_delay cannot be negative");
+
+    YAML::Node qhwNode(ConfigTools::setOptionalValueFromNode<int>(mQueueHighWaterMark, source, "queue_high_water_mark"));
+    if (qhwNode.IsDefined() && mQueueHighWaterMark < 1)
+        throw ConfigurationException(qhwNode.Mark(), "queue_high_water_mark must be greater than 0");
+
+    YAML::Node rmpNode(ConfigTools::setOptionalValueFromNode<int>(mRpcMaxPending, source, "rpc_max_pending"));
+    if (rmpNode.IsDefined() && mRpcMaxPending < 1)
+        throw ConfigurationException(rmpNode.Mark(), "rpc_max_pending must be greater than 0");
+
+    YAML::Node rbsNode(ConfigTools::setOptionalValueFromNode<double>(mRpcBusShare, source, "rpc_bus_share"));
+    if (rbsNode.IsDefined() && (mRpcBusShare <= 0 || mRpcBusShare > 1))
+        throw ConfigurationException(rbsNode.Mark(), "rpc_bus_share must be in range (0, 1]");
+
+    YAML::Node rbbNode(ConfigTools::setOptionalValueFromNode<std::chrono::milliseconds>(mRpcBusBurst, source, "rpc_bus_burst"));
+    if (rbbNode.IsDefined() && mRpcBusBurst <= std::chrono::milliseconds::zero())
+        throw ConfigurationException(rbbNode.Mark(), "rpc_bus_burst must be greater than 0");
 
     if (source["device"]) {
         mType = Type::RTU;
@@ -100,6 +123,29 @@ MqttBrokerConfig::MqttBrokerConfig(const YAML::Node& source) {
     ConfigTools::readOptionalValue<int>(mKeepalive, source, "keepalive");
     ConfigTools::readOptionalValue<std::string>(mUsername, source, "username");
     ConfigTools::readOptionalValue<std::string>(mPassword, source, "password");
+    ConfigTools::readOptionalValue<bool>(mCleanSession, source, "clean_session");
+
+    YAML::Node inflightNode(ConfigTools::setOptionalValueFromNode<int>(mMaxInflight, source, "max_inflight"));
+    if (mMaxInflight < 0)
+        throw ConfigurationException(inflightNode.Mark(), "max_inflight cannot be negative");
+    YAML::Node queuedNode(ConfigTools::setOptionalValueFromNode<int>(mMaxQueued, source, "max_queued"));
+    if (mMaxQueued < 0)
+        throw ConfigurationException(queuedNode.Mark(), "max_queued cannot be negative");
+
+    ConfigTools::readOptionalValue<bool>(mProtocolV5, source, "mqtt5");
+    YAML::Node aliasNode(ConfigTools::setOptionalValueFromNode<int>(mTopicAliasMaximum, source, "topic_alias_maximum"));
+    if (mTopicAliasMaximum < 0 || mTopicAliasMaximum > 65535)
+        throw ConfigurationException(aliasNode.Mark(), "topic_alias_maximum must be between 0 and 65535");
+
+    std::string policy;
+    if (ConfigTools::readOptionalValue<std::string>(policy, source, "on_queue_full")) {
+        if (policy == "drop_old")
+            mQueueFullPolicy = QueueFullPolicy::DROP_OLD;
+        else if (policy == "pause_polling")
+            mQueueFullPolicy = QueueFullPolicy::PAUSE_POLLING;
+        else
+            throw ConfigurationException(source["on_queue_full"].Mark(), "Unknown on_queue_full policy: " + policy);
+    }
 }
 
 
@@ -18,6 +18,22 @@ enum class RpcMode {
     READ_WRITE
 };
 
+// how command topics are subscribed after connect
+enum class CommandSubscriptions {
+    // subscribe every command topic
+    TOPICS,
+    // subscribe wildcard filters computed from command topics
+    WILDCARD
+};
+
+// what to do if max_queued messages are waiting in mqtt library
+enum class QueueFullPolicy {
+    // hold new messages, keep only the latest one for a topic
+    DROP_OLD,
+    // hold all new messages and stop modbus polling until they are sent
+    PAUSE_POLLING
+};
+
 class ConfigurationException : public ModMqttException {
     public:
         ConfigurationException(const YAML::Mark& mark, const char* what);
@@ -153,6 +169,20 @@ class ModbusNetworkConfig {
         unsigned short mMaxWriteRetryCount = 2;
         unsigned short mMaxReadRetryCount = 1;
 
+        // max number of changed register values sent to main thread at once
+        int mPollBatchSize = 32;
+        // max time changed register values can wait for batch to fill
+        std::chrono::milliseconds mPollBatchDelay = std::chrono::milliseconds(50);
+        // stop polling if main thread has more messages to process
+        int mQueueHighWaterMark = 1000;
+
+        // RPC requests waiting for modbus reply, new ones are rejected
+        int mRpcMaxPending = 32;
+        // max share of bus time used by RPC reads, 1 for no limit
+        double mRpcBusShare = 1.0;
+        // bus time RPC reads can use at once after idle period
+        std::chrono::milliseconds mRpcBusBurst = std::chrono::seconds(1);
+
 
         //RTU only
         std::string mDevice = "";
@@ -185,7 +215,13 @@ class MqttBrokerConfig {
                     mUsername == other.mUsername &&
                     mPassword == other.mPassword &&
                     mTLS == other.mTLS &&
-                    mCafile == other.mCafile;
+                    mCafile == other.mCafile &&
+                    mCleanSession == other.mCleanSession &&
+                    mMaxInflight == other.mMaxInflight &&
+                    mMaxQueued == other.mMaxQueued &&
+                    mQueueFullPolicy == other.mQueueFullPolicy &&
+                    mTopicAliasMaximum == other.mTopicAliasMaximum &&
+                    mProtocolV5 == other.mProtocolV5;
         }
 
         //defaults are from mosquittopp.h
@@ -198,6 +234,17 @@ class MqttBrokerConfig {
         bool mTLS = false;
         std::string mCafile;
 
+        // if false, then broker resumes previous session after reconnect
+        bool mCleanSession = true;
+
+        // QoS 1 and 2 messages sent without acknowledgment, 0 for mosquitto default
+        int mMaxInflight = 0;
+        // messages passed to mosquitto and not sent yet, 0 for no limit
+        int mMaxQueued = 0;
+        QueueFullPolicy mQueueFullPolicy = QueueFullPolicy::DROP_OLD;
+
+        // topic aliases used for state and availability messages. MQTT 5 only
+        int mTopicAliasMaximum = 0;
         bool mProtocolV5 = false;
 };
 
@@ -0,0 +1,37 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "event_notifier.hpp"
+#include "exceptions.hpp"
+
+namespace modmqttd {
+
+EventNotifier::EventNotifier() {
+    mFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mFd == -1)
+        throw ModMqttException(std::string("Cannot create eventfd: ") + std::strerror(errno));
+}
+
+void
+EventNotifier::notify() {
+    uint64_t val = 1;
+    // counter overflow (EAGAIN) means that there is
+    // already a pending notification
+    while (write(mFd, &val, sizeof(val)) == -1 && errno == EINTR);
+}
+
+void
+EventNotifier::consume() {
+    uint64_t val;
+    while (read(mFd, &val, sizeof(val)) == -1 && errno == EINTR);
+}
+
+EventNotifier::~EventNotifier() {
+    if (mFd != -1)
+        close(mFd);
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace modmqttd {
+
+/**
+ * Wrapper for linux eventfd. Used by other threads to wake up
+ * main thread event loop waiting on epoll.
+ * */
+class EventNotifier {
+    public:
+        EventNotifier();
+        EventNotifier(const EventNotifier&) = delete;
+        EventNotifier& operator=(const EventNotifier&) = delete;
+        ~EventNotifier();
+
+        int getFd() const { return mFd; }
+
+        // can be called from any thread
+        void notify();
+        // reset notification counter after wakeup
+        void consume();
+    private:
+        int mFd = -1;
+};
+
+}
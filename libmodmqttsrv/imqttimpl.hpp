@@ -1,8 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "common.hpp"
 #include "config.hpp"
 
 namespace modmqttd {
@@ -14,20 +16,38 @@ class MqttClient;
 */
 class IMqttImpl {
     public:
-        virtual void init(MqttClient* owner, const char* clientId) = 0;
+        // pConnection is passed back to MqttClient in all callbacks
+        virtual void init(MqttClient* owner, const char* clientId, int pConnection) = 0;
+        // new instance for another connection to the same broker
+        virtual std::shared_ptr<IMqttImpl> createConnection() = 0;
         virtual void connect(const MqttBrokerConfig& config) = 0;
         virtual void reconnect() = 0;
         virtual void disconnect() = 0;
         virtual void stop() = 0;
 
         virtual void subscribe(const char* topic) = 0;
-        virtual int publish(const char* topic, int len, const void* data, bool retain) = 0;
+        virtual int publish(const char* topic, int len, const void* data, const MqttPublishProps& props) = 0;
         virtual int publishResponse(const char* pTopic, int pLen, const void* pData,
                                     const void* pCorrelationData, int pCorrelationLen,
                                     const std::vector<std::pair<std::string, std::string>>& pUserProperties = {}) = 0;
 
+        /**
+            Network loop integration. Implementation does not run
+            its own thread. ModMqtt main loop waits on getSocket()
+            and calls loop* methods when socket is ready.
+            All callbacks to MqttClient are made from those methods.
+        */
+        // returns -1 if there is no connection
+        virtual int getSocket() = 0;
+        virtual bool wantWrite() = 0;
+        virtual void loopRead() = 0;
+        virtual void loopWrite() = 0;
+        // keepalive and reconnect handling, must be called periodically
+        virtual void loopMisc() = 0;
+
         virtual void on_disconnect(int rc) = 0;
-        virtual void on_connect(int rc)= 0;
+        // pSessionPresent is set if broker resumed previous session
+        virtual void on_connect(int rc, bool pSessionPresent)= 0;
         virtual void on_log(int level, const char* message)= 0;
         virtual void on_publish(int messageId) = 0;
         virtual ~IMqttImpl() {};
@@ -6,11 +6,17 @@
 namespace modmqttd {
 
 void
-ModbusClient::start(const ModbusNetworkConfig& config) {
+ModbusClient::start(const ModbusNetworkConfig& config, const std::shared_ptr<ModbusWorkerPool>& pPool) {
     mNetworkName = config.mName;
-    mThreadImpl.reset(new ModbusThread(config.mName, mToModbusQueue, mFromModbusQueue));
-    mThread.reset(new std::thread(threadLoop, std::ref(*mThreadImpl)));
+    mRpcMaxPending = config.mRpcMaxPending;
+    mThreadImpl.reset(new ModbusThread(config.mName, mToModbusQueue, mFromModbusQueue, mFromModbusNotifier));
     mToModbusQueue.enqueue(QueueItem::create(config));
+    if (pPool != nullptr) {
+        mWorkerPoolEntry = pPool->add(*mThreadImpl);
+        mWorkerPool = pPool;
+    } else {
+        mThread.reset(new std::thread(threadLoop, std::ref(*mThreadImpl)));
+    }
 };
 
 void ModbusClient::stop() {
@@ -18,6 +24,11 @@ void ModbusClient::stop() {
         mToModbusQueue.enqueue(QueueItem::create(EndWorkMessage()));
         mThread->join();
         mThread.reset();
+    } else if (mWorkerPool != nullptr) {
+        enqueue(QueueItem::create(EndWorkMessage()));
+        mWorkerPool->waitForStop(mWorkerPoolEntry);
+        mWorkerPool.reset();
+        mWorkerPoolEntry.reset();
     }
 };
 
@@ -2,8 +2,12 @@
 
 #include <thread>
 #include "queue_item.hpp"
+#include "event_notifier.hpp"
+#include "mpsc_queue.hpp"
+#include "modbus_result_queue.hpp"
 #include "mqttobject.hpp"
 #include "modbus_thread.hpp"
+#include "modbus_worker_pool.hpp"
 #include "mqttcommand.hpp"
 #include "modbus_messages.hpp"
 #include "../readerwriterqueue/readerwriterqueue.h"
@@ -16,12 +20,31 @@ namespace modmqttd {
 class ModbusClient {
     public:
         ModbusClient() {};
-        moodycamel::BlockingReaderWriterQueue<QueueItem> mFromModbusQueue;
-        moodycamel::BlockingReaderWriterQueue<QueueItem> mToModbusQueue;
+        ModbusResultQueue mFromModbusQueue;
+        // can be written from multiple threads
+        MpscQueue<QueueItem> mToModbusQueue;
+        // signalled by modbus thread after adding items to mFromModbusQueue
+        EventNotifier mFromModbusNotifier;
 
-        void start(const ModbusNetworkConfig& config);
+        // run in a dedicated thread or on pPool workers if set
+        void start(const ModbusNetworkConfig& config, const std::shared_ptr<ModbusWorkerPool>& pPool = nullptr);
 
-        void sendCommand(const MqttObjectCommand& cmd, const ModbusRegisters& reg_values) {
+        // can be called from any thread
+        void enqueue(const QueueItem& item) {
+            mToModbusQueue.enqueue(item);
+            if (mWorkerPool != nullptr)
+                mWorkerPool->notify(mWorkerPoolEntry);
+        }
+
+        // number of messages waiting for processing in main thread
+        size_t getQueueDepth() const { return mFromModbusQueue.size_approx(); }
+        // number of polled values replaced by newer ones before processing
+        uint64_t getConflatedCount() const { return mFromModbusQueue.getConflatedCount(); }
+
+        // can be called from MqttCommandWorker thread. pReceived is the time
+        // when mqtt message was received, used to log command latency
+        void sendCommand(const MqttObjectCommand& cmd, const ModbusRegisters& reg_values,
+                         const std::chrono::steady_clock::time_point& pReceived = std::chrono::steady_clock::now()) {
             MsgRegisterValues val(
                 cmd.mSlaveId,
                 cmd.mRegisterType,
@@ -30,28 +53,34 @@ class ModbusClient {
                 cmd.getCommandId(),
                 cmd.mWriteMode
             );
+            val.setCreationTime(pReceived);
             // TODO add max queue size
             // here or at mqtt level - add configurable global limit for all queues
             // to i.e. 15Mb and cut the largest one after reaching this limit
-            mToModbusQueue.enqueue(QueueItem::create(val));
+            enqueue(QueueItem::create(val));
         }
 
         void sendReadRequest(const MsgRegisterReadRequest& pReq) {
-            mToModbusQueue.enqueue(QueueItem::create(pReq));
+            enqueue(QueueItem::create(pReq));
         }
 
         void sendWriteRequest(const MsgRegisterValues& pMsg) {
-            mToModbusQueue.enqueue(QueueItem::create(pMsg));
+            enqueue(QueueItem::create(pMsg));
         }
 
         void sendMqttNetworkIsUp(bool up) {
             // TODO send all control messages at the front of queue, add time period
             // after receiving shutdown request to empty write queues
-            mToModbusQueue.enqueue(QueueItem::create(MsgMqttNetworkState(up)));
+            enqueue(QueueItem::create(MsgMqttNetworkState(up)));
         }
 
         std::string mNetworkName;
 
+        // main thread only: RPC requests sent to modbus thread
+        // and not answered yet, limited to mRpcMaxPending
+        int mRpcPending = 0;
+        int mRpcMaxPending = 32;
+
         void stop();
         ~ModbusClient() { stop(); }
 
@@ -63,6 +92,8 @@ class ModbusClient {
 
         std::unique_ptr<ModbusThread> mThreadImpl;
         std::shared_ptr<std::thread> mThread;
+        std::shared_ptr<ModbusWorkerPool> mWorkerPool;
+        ModbusWorkerPool::EntryHandle mWorkerPoolEntry;
 };
 
 
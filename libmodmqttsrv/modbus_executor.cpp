@@ -15,10 +15,11 @@ constexpr short ModbusExecutor::WRITE_BATCH_SIZE;
 #endif
 
 ModbusExecutor::ModbusExecutor(
-    moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue,
-    moodycamel::BlockingReaderWriterQueue<QueueItem>& toModbusQueue
+    ModbusResultQueue& fromModbusQueue,
+    MpscQueue<QueueItem>& toModbusQueue,
+    EventNotifier* fromModbusNotifier
 )
-    : mFromModbusQueue(fromModbusQueue), mToModbusQueue(toModbusQueue)
+    : mFromModbusQueue(fromModbusQueue), mToModbusQueue(toModbusQueue), mFromModbusNotifier(fromModbusNotifier)
 {
     //some random past value, not using steady_clock:min() due to overflow
     mLastCommandTime = std::chrono::steady_clock::now() - std::chrono::hours(100000);
@@ -30,7 +31,58 @@ ModbusExecutor::ModbusExecutor(
 
 void
 ModbusExecutor::sendMessage(const QueueItem& item) {
-    ModbusThread::sendMessageFromModbus(mFromModbusQueue, item);
+    // keep message order, main thread must get
+    // collected values before write results or errors
+    flushRegisterValues();
+    ModbusThread::sendMessageFromModbus(mFromModbusQueue, mFromModbusNotifier, item);
+}
+
+void
+ModbusExecutor::setBatchLimits(int pMaxSize, std::chrono::milliseconds pMaxDelay) {
+    flushRegisterValues();
+    mBatchMaxSize = pMaxSize;
+    mBatchMaxDelay = pMaxDelay;
+    mPendingValues.mValues.reserve(mBatchMaxSize);
+}
+
+void
+ModbusExecutor::queueRegisterValues(const MsgRegisterValues& pValues) {
+    if (mBatchMaxSize <= 1) {
+        sendMessage(QueueItem::create(pValues));
+        return;
+    }
+
+    if (mPendingValues.mValues.empty())
+        mFirstPendingTime = std::chrono::steady_clock::now();
+    mPendingValues.mValues.push_back(pValues);
+
+    if (mPendingValues.mValues.size() >= static_cast<size_t>(mBatchMaxSize))
+        flushRegisterValues();
+}
+
+void
+ModbusExecutor::flushRegisterValues() {
+    if (mPendingValues.mValues.empty())
+        return;
+
+    spdlog::trace("Sending {} register values", mPendingValues.mValues.size());
+    if (mPendingValues.mValues.size() == 1) {
+        ModbusThread::sendMessageFromModbus(mFromModbusQueue, mFromModbusNotifier, QueueItem::create(mPendingValues.mValues.front()));
+    } else {
+        ModbusThread::sendMessageFromModbus(mFromModbusQueue, mFromModbusNotifier, QueueItem::create(mPendingValues));
+    }
+    mPendingValues.mValues.clear();
+}
+
+std::chrono::steady_clock::duration
+ModbusExecutor::getBatchTimeLeft() const {
+    if (mPendingValues.mValues.empty())
+        return std::chrono::steady_clock::duration::max();
+
+    std::chrono::steady_clock::duration left = mFirstPendingTime + mBatchMaxDelay - std::chrono::steady_clock::now();
+    if (left < std::chrono::steady_clock::duration::zero())
+        return std::chrono::steady_clock::duration::zero();
+    return left;
 }
 
 void
@@ -127,6 +179,32 @@ ModbusExecutor::addReadCommand(const std::shared_ptr<RegisterPoll>& pCommand) {
         mCurrentSlaveQueue = mSlaveQueues.find(pCommand->mSlaveId);
         resetCommandsCounter();
     }
+    if (pCommand->isRpc())
+        mRpcReadsQueued++;
+}
+
+void
+ModbusExecutor::dropExpiredRpcReads(const std::chrono::steady_clock::time_point& pNow) {
+    if (mRpcReadsQueued == 0)
+        return;
+
+    int dropped = 0;
+    for (auto& queue: mSlaveQueues)
+        dropped += queue.second.removeExpired(pNow);
+
+    // also if waiting for delay or retry
+    if (mWaitingCommand != nullptr && typeid(*mWaitingCommand) == typeid(RegisterPoll)
+        && static_cast<const RegisterPoll&>(*mWaitingCommand).isExpired(pNow))
+    {
+        mWaitingCommand.reset();
+        dropped++;
+    }
+
+    if (dropped != 0) {
+        mRpcReadsQueued -= dropped;
+        assert(mRpcReadsQueued >= 0);
+        spdlog::debug("Dropped {} expired RPC read(s)", dropped);
+    }
 }
 
 void
@@ -166,6 +244,7 @@ ModbusExecutor::pollRegisters(RegisterPoll& reg, bool forceSend) {
         reg.mLastReadOk = true;
 
         std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        reg.mLastValuesTime = end;
         spdlog::trace("Register {}.{} polled in {}",
             reg.mSlaveId,
             reg.mRegister,
@@ -177,7 +256,11 @@ ModbusExecutor::pollRegisters(RegisterPoll& reg, bool forceSend) {
 
         if ((reg.getValues() != newValues) || forceSend || (reg.mReadErrors != 0)) {
             MsgRegisterValues val(reg.mSlaveId, reg.mRegisterType, reg.mRegister, newValues, reg.getCommandId());
-            sendMessage(QueueItem::create(val));
+            // RPC replies are not batched
+            if (reg.hasCommandId())
+                sendMessage(QueueItem::create(val));
+            else
+                queueRegisterValues(val);
             reg.update(newValues);
             if (reg.mReadErrors != 0) {
                 spdlog::debug("Register {}.{} read ok after {} error(s)",
@@ -242,11 +325,12 @@ ModbusExecutor::writeRegisters(RegisterWrite& cmd) {
         cmd.mLastWriteOk = true;
 
         std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-        spdlog::debug("Register {}.{} written in {}, processing time {}",
+        // mCreationTime is the time when mqtt command was received
+        spdlog::debug("Register {}.{} written in {}, command latency {}",
             cmd.mSlaveId,
             cmd.mRegister,
             std::chrono::duration_cast<std::chrono::milliseconds>(end - start),
-            std::chrono::duration_cast<std::chrono::milliseconds>(start - cmd.mCreationTime)
+            std::chrono::duration_cast<std::chrono::microseconds>(start - cmd.mCreationTime)
         );
 
         if (cmd.mReturnMessage != nullptr) {
@@ -327,6 +411,9 @@ ModbusExecutor::executeNext() {
         sendCommand();
     }
 
+    if (pollDone() || getBatchTimeLeft() == std::chrono::steady_clock::duration::zero())
+        flushRegisterValues();
+
     if (mInitialPoll && pollDone()) {
         if (mCurrentSlaveQueue == mSlaveQueues.end()) {
             spdlog::info("Nothing to do for initial poll");
@@ -384,6 +471,8 @@ ModbusExecutor::sendCommand() {
     // to retry just leave mCurrentCommand
     // for next executeNext() call
     if (!retry) {
+        if (mWaitingCommand->isRpc() && typeid(*mWaitingCommand) == typeid(RegisterPoll))
+            mRpcReadsQueued--;
         mWaitingCommand.reset();
         if (mCommandsLeft > 0)
             mCommandsLeft--;
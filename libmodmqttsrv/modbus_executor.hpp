@@ -3,6 +3,10 @@
 #include "../readerwriterqueue/readerwriterqueue.h"
 
 #include "common.hpp"
+#include "event_notifier.hpp"
+#include "mpsc_queue.hpp"
+#include "modbus_result_queue.hpp"
+#include "modbus_messages.hpp"
 #include "register_poll.hpp"
 #include "modbus_request_queues.hpp"
 #include "modbus_context.hpp"
@@ -15,8 +19,9 @@ class ModbusExecutor {
         static constexpr short WRITE_BATCH_SIZE = 10;
 
         ModbusExecutor(
-            moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue,
-            moodycamel::BlockingReaderWriterQueue<QueueItem>& toModbusQueue
+            ModbusResultQueue& fromModbusQueue,
+            MpscQueue<QueueItem>& toModbusQueue,
+            EventNotifier* fromModbusNotifier = nullptr
         );
         void init(const std::shared_ptr<IModbusContext>& modbus) { mModbus = modbus; }
         void setupInitialPoll(const std::map<int, std::vector<std::shared_ptr<RegisterPoll>>>& pRegisters);
@@ -26,6 +31,27 @@ class ModbusExecutor {
         void addPollList(const std::map<int, std::vector<std::shared_ptr<RegisterPoll>>>& pRegisters, bool mInitialPoll = false);
         void addWriteCommand(const std::shared_ptr<RegisterWrite>& pCommand);
         void addReadCommand(const std::shared_ptr<RegisterPoll>& pCommand);
+        // RPC reads added by addReadCommand() and not finished yet
+        int getRpcReadsQueued() const { return mRpcReadsQueued; }
+        // remove RPC reads with deadline before pNow from queues
+        void dropExpiredRpcReads(const std::chrono::steady_clock::time_point& pNow);
+
+        /**
+         * Collect up to pMaxSize polled register values before sending them
+         * to the main thread as a single MsgRegisterValuesBatch. Values are
+         * also sent when poll round ends, before any other message or
+         * when the first one waits longer than pMaxDelay.
+         * pMaxSize=1 sends every MsgRegisterValues immediately.
+         */
+        void setBatchLimits(int pMaxSize, std::chrono::milliseconds pMaxDelay);
+        void flushRegisterValues();
+        /*
+            Returns how long collected register values can wait
+            before flushRegisterValues() should be called or duration::max()
+            if there is nothing to send
+        */
+        std::chrono::steady_clock::duration getBatchTimeLeft() const;
+        int getPendingValuesCount() const { return mPendingValues.mValues.size(); }
         /**
          *  Get next request R to send from modbus queues
          *  If R needs delay then return how much time we should wait before
@@ -51,8 +77,9 @@ class ModbusExecutor {
 
     private:
         std::shared_ptr<IModbusContext> mModbus;
-        moodycamel::BlockingReaderWriterQueue<QueueItem>& mFromModbusQueue;
-        moodycamel::BlockingReaderWriterQueue<QueueItem>& mToModbusQueue;
+        ModbusResultQueue& mFromModbusQueue;
+        MpscQueue<QueueItem>& mToModbusQueue;
+        EventNotifier* mFromModbusNotifier;
 
         std::map<int, ModbusRequestsQueues> mSlaveQueues;
         std::map<int, ModbusRequestsQueues>::iterator mCurrentSlaveQueue;
@@ -64,6 +91,7 @@ class ModbusExecutor {
         int mCommandsLeft = 0;
 
         int mWriteCommandsQueued = 0;
+        int mRpcReadsQueued = 0;
 
         short mMaxReadRetryCount = 0;
         short mMaxWriteRetryCount = 0;
@@ -79,10 +107,16 @@ class ModbusExecutor {
         bool mInitialPoll;
         std::chrono::time_point<std::chrono::steady_clock> mInitialPollStart;
 
+        MsgRegisterValuesBatch mPendingValues;
+        std::chrono::steady_clock::time_point mFirstPendingTime;
+        int mBatchMaxSize = 1;
+        std::chrono::milliseconds mBatchMaxDelay = std::chrono::milliseconds::zero();
+
         void sendCommand();
         void pollRegisters(RegisterPoll& reg_ptr, bool forceSend);
         void writeRegisters(RegisterWrite& cmd);
         void sendMessage(const QueueItem& item);
+        void queueRegisterValues(const MsgRegisterValues& pValues);
         void handleRegisterReadError(RegisterPoll& reg, const char* errorMessage);
         void resetCommandsCounter();
 
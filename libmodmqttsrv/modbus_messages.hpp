@@ -26,6 +26,7 @@ class MsgRegisterValues : public ModbusMessageBase {
               mCreationTime(std::chrono::steady_clock::now()) {}
 
         const std::chrono::steady_clock::time_point& getCreationTime() const { return mCreationTime; }
+        void setCreationTime(const std::chrono::steady_clock::time_point& pTime) { mCreationTime = pTime; }
 
         ModbusRegisters mRegisters;
         ModbusWriteMode mWriteMode = ModbusWriteMode::AUTO;
@@ -34,6 +35,15 @@ class MsgRegisterValues : public ModbusMessageBase {
         std::chrono::steady_clock::time_point mCreationTime;
 };
 
+/**
+ * Register values collected by modbus thread in a single poll round.
+ * Sent to the main thread as one queue item with a single notification.
+ */
+class MsgRegisterValuesBatch {
+    public:
+        std::vector<MsgRegisterValues> mValues;
+};
+
 class MsgRegisterReadFailed : public ModbusMessageBase {
     public:
         MsgRegisterReadFailed(int pSlaveId, RegisterType pRegType, int pRegisterNumber, int pRegisterCount, int pCommandId = 0)
@@ -48,8 +58,19 @@ class MsgRegisterWriteFailed : public ModbusMessageBase {
 
 class MsgRegisterReadRequest : public ModbusMessageBase {
     public:
-        MsgRegisterReadRequest(int pSlaveId, RegisterType pRegType, int pRegisterNumber, int pRegisterCount, int pCommandId)
-            : ModbusMessageBase(pSlaveId, pRegisterNumber, pRegType, pRegisterCount, pCommandId) {}
+        MsgRegisterReadRequest(int pSlaveId, RegisterType pRegType, int pRegisterNumber, int pRegisterCount, int pCommandId,
+                               std::chrono::milliseconds pMaxAge = std::chrono::milliseconds::zero(),
+                               std::chrono::steady_clock::time_point pDeadline = std::chrono::steady_clock::time_point::max())
+            : ModbusMessageBase(pSlaveId, pRegisterNumber, pRegType, pRegisterCount, pCommandId),
+              mMaxAge(pMaxAge),
+              mDeadline(pDeadline) {}
+
+        // values read by scheduled poll not older than mMaxAge
+        // are returned without modbus request, zero disables cache
+        std::chrono::milliseconds mMaxAge;
+        // main thread answers with timeout error after this time,
+        // read is dropped if not executed yet
+        std::chrono::steady_clock::time_point mDeadline;
 };
 
 
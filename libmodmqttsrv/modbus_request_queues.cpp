@@ -1,5 +1,7 @@
 #include "modbus_request_queues.hpp"
 
+#include <algorithm>
+
 namespace modmqttd {
 
 void
@@ -98,6 +100,17 @@ check_cache:
     return ret;
 }
 
+int
+ModbusRequestsQueues::removeExpired(const std::chrono::steady_clock::time_point& pNow) {
+    size_t size = mPollQueue.size();
+    mPollQueue.erase(
+        std::remove_if(mPollQueue.begin(), mPollQueue.end(),
+            [&pNow](const std::shared_ptr<RegisterPoll>& pPoll) -> bool { return pPoll->isExpired(pNow); }),
+        mPollQueue.end()
+    );
+    return size - mPollQueue.size();
+}
+
 void
 ModbusRequestsQueues::addWriteCommand(const std::shared_ptr<RegisterWrite>& pReq) {
     mWriteQueue.push_back(pReq);
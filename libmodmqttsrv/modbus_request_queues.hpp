@@ -31,6 +31,9 @@ class ModbusRequestsQueues {
         // mNextPollQueue and return the first one
         std::shared_ptr<RegisterCommand> popNext();
 
+        // remove RPC reads with deadline before pNow, returns number of removed reads
+        int removeExpired(const std::chrono::steady_clock::time_point& pNow);
+
         bool empty() const { return mPollQueue.empty() && mWriteQueue.empty(); }
 
         // registers to poll next
@@ -0,0 +1,138 @@
+#include <algorithm>
+
+#include "modbus_result_queue.hpp"
+
+namespace modmqttd {
+
+// value replaced by a newer one queued after it
+static bool
+isReplaced(const MsgRegisterValues& pValues) {
+    return pValues.mCount == 0;
+}
+
+static void
+setReplaced(MsgRegisterValues& pValues) {
+    pValues.mCount = 0;
+    pValues.mRegisters = ModbusRegisters();
+}
+
+void
+ModbusResultQueue::enqueue(const QueueItem& pItem) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (pItem.isSameAs(typeid(MsgRegisterValuesBatch))) {
+        QueueItem item(pItem);
+        addValues(item.getData<MsgRegisterValuesBatch>());
+    } else if (pItem.isSameAs(typeid(MsgRegisterValues)) && !pItem.peekData<MsgRegisterValues>().hasCommandId()) {
+        QueueItem item(pItem);
+        std::unique_ptr<MsgRegisterValuesBatch> batch(new MsgRegisterValuesBatch());
+        batch->mValues.push_back(std::move(*item.getData<MsgRegisterValues>()));
+        addValues(std::move(batch));
+    } else {
+        addItem(pItem);
+    }
+}
+
+void
+ModbusResultQueue::addItem(const QueueItem& pItem) {
+    Entry entry;
+    entry.mItem = pItem;
+    mEntries.push_back(std::move(entry));
+    mDepth++;
+}
+
+void
+ModbusResultQueue::addValues(std::unique_ptr<MsgRegisterValuesBatch> pBatch) {
+    std::vector<MsgRegisterValues>& values(pBatch->mValues);
+    bool lastIsBatch = !mEntries.empty() && mEntries.back().mValues != nullptr;
+    if (!lastIsBatch
+        && std::none_of(values.begin(), values.end(), [](const MsgRegisterValues& v) { return v.hasCommandId(); }))
+    {
+        // queue received batch without copying its values
+        Entry entry;
+        entry.mValues = std::move(pBatch);
+        mEntries.push_back(std::move(entry));
+        size_t count = mEntries.back().mValues->mValues.size();
+        for (size_t i = 0; i < count; i++)
+            indexValue(i);
+        return;
+    }
+
+    for (MsgRegisterValues& v: values) {
+        if (v.hasCommandId()) {
+            addItem(QueueItem::create(v));
+            continue;
+        }
+        if (mEntries.empty() || mEntries.back().mValues == nullptr) {
+            Entry entry;
+            entry.mValues.reset(new MsgRegisterValuesBatch());
+            mEntries.push_back(std::move(entry));
+        }
+        std::vector<MsgRegisterValues>& queued(mEntries.back().mValues->mValues);
+        queued.push_back(std::move(v));
+        indexValue(queued.size() - 1);
+    }
+}
+
+void
+ModbusResultQueue::indexValue(size_t pIndex) {
+    uint64_t entryNum = mFirstEntry + mEntries.size() - 1;
+    std::vector<MsgRegisterValues>& queued(mEntries.back().mValues->mValues);
+    MsgRegisterValues& values(queued[pIndex]);
+    ValueKey key(values.mSlaveId, values.mRegisterType, values.mRegister, values.mCount);
+
+    auto it = mQueuedValues.find(key);
+    if (it == mQueuedValues.end()) {
+        mQueuedValues.emplace(key, ValueSlot{entryNum, pIndex});
+        mDepth++;
+        return;
+    }
+
+    ValueSlot& slot(it->second);
+    if (slot.mEntry >= mFirstEntry) {
+        mConflatedCount++;
+        if (slot.mEntry == entryNum) {
+            // nothing was queued after the old value, overwrite it
+            queued[slot.mIndex] = std::move(values);
+            if (pIndex == queued.size() - 1)
+                queued.pop_back();
+            else
+                setReplaced(values);
+            return;
+        }
+        setReplaced(mEntries[slot.mEntry - mFirstEntry].mValues->mValues[slot.mIndex]);
+        mDepth--;
+    }
+    slot = ValueSlot{entryNum, pIndex};
+    mDepth++;
+}
+
+bool
+ModbusResultQueue::try_dequeue(QueueItem& pItem) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mEntries.empty()) {
+        Entry entry(std::move(mEntries.front()));
+        mEntries.pop_front();
+        mFirstEntry++;
+
+        if (entry.mValues == nullptr) {
+            pItem = entry.mItem;
+            mDepth--;
+            return true;
+        }
+
+        std::vector<MsgRegisterValues>& values(entry.mValues->mValues);
+        values.erase(std::remove_if(values.begin(), values.end(), isReplaced), values.end());
+        if (values.empty())
+            continue;
+
+        mDepth -= values.size();
+        if (values.size() == 1)
+            pItem = QueueItem::create(values.front());
+        else
+            pItem = QueueItem::create(std::move(entry.mValues));
+        return true;
+    }
+    return false;
+}
+
+}
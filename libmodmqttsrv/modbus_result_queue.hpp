@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "queue_item.hpp"
+#include "modbus_messages.hpp"
+
+namespace modmqttd {
+
+/**
+ * Queue for messages sent from modbus thread to the main thread.
+ *
+ * Polled register values (MsgRegisterValues without command id) are
+ * conflated: a new value for the same slave and register range replaces
+ * the queued one, so queue size is bounded by the number of polled
+ * registers when the main thread is not able to keep up.
+ *
+ * Polled values are kept in MsgRegisterValuesBatch entries. Values enqueued
+ * after the last batch are added to it or overwrite the queued value in place.
+ * If other messages were queued after the batch, the old value is dropped
+ * and the new one is added to a new batch, to keep its order with read errors
+ * sent for the same registers. try_dequeue returns the whole batch,
+ * or a single MsgRegisterValues if only one value is left in it.
+ *
+ * Command results, errors and state messages are not conflated and not capped.
+ * Dropping them would lose write errors and RPC replies. There is at most one
+ * result for every command or RPC request executed by modbus thread, RPC
+ * requests are limited by rpc_max_pending and polling errors stop together
+ * with polling at queue_high_water_mark.
+ * */
+class ModbusResultQueue {
+    public:
+        // modbus thread
+        void enqueue(const QueueItem& pItem);
+
+        // main thread
+        bool try_dequeue(QueueItem& pItem);
+
+        // number of queued messages. Values from batches are counted separately
+        size_t size_approx() const { return mDepth; }
+        // total number of polled values replaced by a newer one
+        uint64_t getConflatedCount() const { return mConflatedCount; }
+    private:
+        // slave, register type, register, count
+        typedef std::tuple<int, RegisterType, int, int> ValueKey;
+
+        // position of polled value in mEntries
+        struct ValueSlot {
+            uint64_t mEntry;
+            size_t mIndex;
+        };
+
+        struct Entry {
+            // set for all messages except polled values
+            QueueItem mItem;
+            std::unique_ptr<MsgRegisterValuesBatch> mValues;
+        };
+
+        void addValues(std::unique_ptr<MsgRegisterValuesBatch> pBatch);
+        // conflate value at pIndex of the last batch with queued one
+        void indexValue(size_t pIndex);
+        void addItem(const QueueItem& pItem);
+
+        std::mutex mMutex;
+        std::deque<Entry> mEntries;
+        // sequence number of mEntries.front()
+        uint64_t mFirstEntry = 0;
+        // Last queued position of every polled range. Not removed
+        // on dequeue, the number of polled ranges is limited
+        std::map<ValueKey, ValueSlot> mQueuedValues;
+
+        std::atomic<size_t> mDepth = 0;
+        std::atomic<uint64_t> mConflatedCount = 0;
+};
+
+}
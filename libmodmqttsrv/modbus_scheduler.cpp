@@ -111,4 +111,42 @@ ModbusScheduler::notifyRpcRead(const RegisterPoll& pCompleted) {
                       poll->mRegister, poll->mCount);
     }
 }
+
+void
+ModbusScheduler::invalidatePolls(const RegisterWrite& pWrite) {
+    std::map<int, std::vector<std::shared_ptr<RegisterPoll>>>::iterator sit = mRegisterMap.find(pWrite.mSlaveId);
+    if (sit == mRegisterMap.end()) {
+        return;
+    }
+
+    for (const std::shared_ptr<RegisterPoll>& poll: sit->second) {
+        if (poll->overlaps(pWrite)) {
+            poll->mLastValuesTime = std::chrono::steady_clock::time_point::min();
+        }
+    }
+}
+
+const RegisterPoll*
+ModbusScheduler::findFreshPoll(
+    int pSlaveId,
+    const ModbusAddressRange& pRange,
+    const std::chrono::steady_clock::duration& pMaxAge,
+    const std::chrono::time_point<std::chrono::steady_clock>& pTimePoint
+) const {
+    std::map<int, std::vector<std::shared_ptr<RegisterPoll>>>::const_iterator sit = mRegisterMap.find(pSlaveId);
+    if (sit == mRegisterMap.end()) {
+        return nullptr;
+    }
+
+    for (const std::shared_ptr<RegisterPoll>& poll: sit->second) {
+        // getCount() is zero until the first successful read
+        if (poll->getCount() != poll->mCount || !poll->contains(pRange)) {
+            continue;
+        }
+        if (poll->mLastValuesTime >= pTimePoint - pMaxAge) {
+            return poll.get();
+        }
+    }
+    return nullptr;
+}
 }
@@ -48,6 +48,24 @@ namespace modmqttd {
              */
             void notifyRpcRead(const RegisterPoll& pCompleted);
 
+            /**
+             * Marks values of all scheduled polls overlapping pWrite as outdated,
+             * so findFreshPoll() will not return them until they are read again.
+             */
+            void invalidatePolls(const RegisterWrite& pWrite);
+
+            /**
+             * Returns a scheduled poll of pSlaveId that covers pRange and
+             * was successfully read not earlier than pMaxAge before pTimePoint,
+             * nullptr if there is no such poll.
+             */
+            const RegisterPoll* findFreshPoll(
+                int pSlaveId,
+                const ModbusAddressRange& pRange,
+                const std::chrono::steady_clock::duration& pMaxAge,
+                const std::chrono::time_point<std::chrono::steady_clock>& pTimePoint
+            ) const;
+
         private:
             std::map<int, std::vector<std::shared_ptr<RegisterPoll>>> mRegisterMap;
     };
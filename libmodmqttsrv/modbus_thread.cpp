@@ -18,19 +18,23 @@ setCommandDelays(RegisterCommand& cmd, const std::shared_ptr<const std::chrono::
 }
 
 void
-ModbusThread::sendMessageFromModbus(moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue, const QueueItem& item) {
+ModbusThread::sendMessageFromModbus(ModbusResultQueue& fromModbusQueue, EventNotifier* pNotifier, const QueueItem& item) {
     fromModbusQueue.enqueue(item);
-    modmqttd::notifyQueues();
+    // wake up main thread event loop
+    if (pNotifier != nullptr)
+        pNotifier->notify();
 }
 
 ModbusThread::ModbusThread(
     const std::string pNetworkName,
-    moodycamel::BlockingReaderWriterQueue<QueueItem>& toModbusQueue,
-    moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue)
+    MpscQueue<QueueItem>& toModbusQueue,
+    ModbusResultQueue& fromModbusQueue,
+    EventNotifier& fromModbusNotifier)
     : mNetworkName(pNetworkName),
       mToModbusQueue(toModbusQueue),
       mFromModbusQueue(fromModbusQueue),
-      mExecutor(fromModbusQueue, toModbusQueue)
+      mFromModbusNotifier(fromModbusNotifier),
+      mExecutor(fromModbusQueue, toModbusQueue, &fromModbusNotifier)
 {
 }
 
@@ -43,6 +47,9 @@ ModbusThread::configure(const ModbusNetworkConfig& config) {
     mModbus = ModMqtt::getModbusFactory().getContext(config.mName);
     mModbus->init(config);
     mExecutor.init(mModbus);
+    mExecutor.setBatchLimits(config.mPollBatchSize, config.mPollBatchDelay);
+    mQueueHighWaterMark = config.mQueueHighWaterMark;
+    mRpcBusBudget.configure(config.mRpcBusShare, config.mRpcBusBurst);
     mWatchdog.init(config.mWatchdogConfig);
 
     if (config.hasDelayBeforeCommand())
@@ -134,11 +141,40 @@ ModbusThread::applySlaveConfig(RegisterCommand& pCmd, int pSlaveId) {
 
 void
 ModbusThread::processReadRequest(const std::shared_ptr<MsgRegisterReadRequest>& pMsg) {
+    if (pMsg->mMaxAge != std::chrono::milliseconds::zero()) {
+        const RegisterPoll* poll = mScheduler.findFreshPoll(pMsg->mSlaveId, *pMsg, pMsg->mMaxAge, std::chrono::steady_clock::now());
+        if (poll != nullptr) {
+            auto begin = poll->getValues().begin() + (pMsg->mRegister - poll->mRegister);
+            std::vector<uint16_t> values(begin, begin + pMsg->mCount);
+            spdlog::trace("RPC read of {}.{} (count {}) answered from poll data",
+                          pMsg->mSlaveId, pMsg->mRegister, pMsg->mCount);
+            sendMessage(QueueItem::create(MsgRegisterValues(pMsg->mSlaveId, pMsg->mRegisterType, pMsg->mRegister, values, pMsg->getCommandId())));
+            return;
+        }
+    }
+
     std::shared_ptr<RegisterPoll> reg(new RegisterPoll(
         pMsg->mSlaveId, pMsg->mRegister, pMsg->mRegisterType, pMsg->mCount,
         std::chrono::milliseconds(0), PublishMode::ONCE, pMsg->getCommandId()));
+    reg->mDeadline = pMsg->mDeadline;
     applySlaveConfig(*reg, pMsg->mSlaveId);
-    mExecutor.addReadCommand(reg);
+    if (mRpcBusBudget.isLimited())
+        mRpcReads.push_back(reg);
+    else
+        mExecutor.addReadCommand(reg);
+}
+
+void
+ModbusThread::releaseRpcReads(const std::chrono::steady_clock::time_point& pNow) {
+    // main thread already answered expired reads
+    while (!mRpcReads.empty() && mRpcReads.front()->isExpired(pNow))
+        mRpcReads.pop_front();
+
+    if (mRpcReads.empty() || mExecutor.getRpcReadsQueued() != 0 || !mRpcBusBudget.isAvailable(pNow))
+        return;
+
+    mExecutor.addReadCommand(mRpcReads.front());
+    mRpcReads.pop_front();
 }
 
 void
@@ -151,6 +187,10 @@ ModbusThread::processWrite(const std::shared_ptr<MsgRegisterValues>& msg) {
 
     applySlaveConfig(*cmd, msg->mSlaveId);
 
+    // reads received after this write should not
+    // be answered with values polled before it
+    mScheduler.invalidatePolls(*cmd);
+
     std::map<int, ModbusSlaveConfig>::const_iterator it = mSlaves.find(msg->mSlaveId);
     if (it != mSlaves.end()) {
         // mqtt command value has precedence
@@ -193,7 +233,8 @@ ModbusThread::dispatchMessages(const QueueItem& read) {
 
 void
 ModbusThread::sendMessage(const QueueItem& item) {
-    sendMessageFromModbus(mFromModbusQueue, item);
+    mExecutor.flushRegisterValues();
+    sendMessageFromModbus(mFromModbusQueue, &mFromModbusNotifier, item);
 }
 
 void
@@ -214,6 +255,21 @@ ModbusThread::updateFromSlaveConfig(const ModbusSlaveConfig& pConfig) {
 }
 
 
+bool
+ModbusThread::isQueueFull() {
+    size_t depth = mFromModbusQueue.size_approx();
+    if (!mQueueFull && depth >= static_cast<size_t>(mQueueHighWaterMark)) {
+        mExecutor.flushRegisterValues();
+        spdlog::warn("{} messages waiting for publish, polling paused. Values replaced by newer ones so far: {}",
+            depth, mFromModbusQueue.getConflatedCount());
+        mQueueFull = true;
+    } else if (mQueueFull && depth <= static_cast<size_t>(mQueueHighWaterMark / 2)) {
+        spdlog::info("{} messages waiting for publish, polling resumed", depth);
+        mQueueFull = false;
+    }
+    return mQueueFull;
+}
+
 std::string
 constructIdleWaitMessage(const std::chrono::steady_clock::duration& idleWaitDuration) {
     std::stringstream out;
@@ -228,110 +284,133 @@ constructIdleWaitMessage(const std::chrono::steady_clock::duration& idleWaitDura
     return out.str();
 }
 
-void
-ModbusThread::run() {
-    try {
-        ThreadUtils::set_thread_name(mNetworkName.c_str());
-        spdlog::debug("Modbus thread started");
-        const int maxReconnectTime = 60;
-        std::chrono::steady_clock::duration idleWaitDuration = std::chrono::steady_clock::duration::max();
-        std::chrono::steady_clock::time_point nextPollTimePoint = std::chrono::steady_clock::now();
-
-        while(mShouldRun) {
-            if (mModbus) {
-                if (!mModbus->isConnected()) {
-                    if (idleWaitDuration > std::chrono::seconds(maxReconnectTime))
-                        idleWaitDuration = std::chrono::seconds(0);
-                    spdlog::info("Connecting to modbus network");
-                    mModbus->connect();
-                    if (mModbus->isConnected()) {
-                        spdlog::info("Connected to modbus network");
-                        mWatchdog.reset();
-                        sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, true)));
-                        // if modbus network was disconnected
-                        // we need to refresh everything
-                        if (!mExecutor.isInitialPollInProgress()) {
-                            mExecutor.setupInitialPoll(mScheduler.getPollSpecification());
-                        }
-                    }
+std::chrono::steady_clock::duration
+ModbusThread::step() {
+    if (mModbus) {
+        if (!mModbus->isConnected()) {
+            if (mIdleWaitDuration > MAX_RECONNECT_TIME)
+                mIdleWaitDuration = std::chrono::seconds(0);
+            spdlog::info("Connecting to modbus network");
+            mModbus->connect();
+            if (mModbus->isConnected()) {
+                spdlog::info("Connected to modbus network");
+                mWatchdog.reset();
+                sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, true)));
+                // if modbus network was disconnected
+                // we need to refresh everything
+                if (!mExecutor.isInitialPollInProgress()) {
+                    mExecutor.setupInitialPoll(mScheduler.getPollSpecification());
                 }
+            }
+        }
 
-                if (mModbus->isConnected()) {
-                    // start polling only if Mosquitto
-                    // have succesfully connected to Mqtt broker
-                    // to avoid growing mFromModbusQueue with queued register updates
-                    // and if we already got the first MsgPollSpecification
-                    if (mMqttConnected) {
-
-                        auto now = std::chrono::steady_clock::now();
-                        if (!mExecutor.isInitialPollInProgress() && nextPollTimePoint < now) {
-                            std::chrono::steady_clock::duration schedulerWaitDuration;
-                            std::map<int, std::vector<std::shared_ptr<RegisterPoll>>> regsToPoll = mScheduler.getRegistersToPoll(schedulerWaitDuration, now);
-                            nextPollTimePoint = now + schedulerWaitDuration;
-                            mExecutor.addPollList(regsToPoll);
-                            spdlog::trace("Scheduling {} registers to execute, next schedule in {}",
-                                regsToPoll.size(),
-                                std::chrono::duration_cast<std::chrono::milliseconds>(schedulerWaitDuration)
-                            );
-                        }
+        if (mModbus->isConnected()) {
+            // start polling only if Mosquitto
+            // have succesfully connected to Mqtt broker
+            // and main thread is able to process our messages
+            // to avoid growing mFromModbusQueue with queued register updates
+            // and if we already got the first MsgPollSpecification
+            if (mMqttConnected && !isQueueFull()) {
+
+                auto now = std::chrono::steady_clock::now();
+                mExecutor.dropExpiredRpcReads(now);
+                releaseRpcReads(now);
+                if (!mExecutor.isInitialPollInProgress() && mNextPollTimePoint < now) {
+                    std::chrono::steady_clock::duration schedulerWaitDuration;
+                    std::map<int, std::vector<std::shared_ptr<RegisterPoll>>> regsToPoll = mScheduler.getRegistersToPoll(schedulerWaitDuration, now);
+                    mNextPollTimePoint = now + schedulerWaitDuration;
+                    mExecutor.addPollList(regsToPoll);
+                    spdlog::trace("Scheduling {} registers to execute, next schedule in {}",
+                        regsToPoll.size(),
+                        std::chrono::duration_cast<std::chrono::milliseconds>(schedulerWaitDuration)
+                    );
+                }
 
-                        if (mExecutor.allDone()) {
-                            idleWaitDuration = (nextPollTimePoint - now);
-                        } else {
-                            idleWaitDuration = mExecutor.executeNext();
-                            if (idleWaitDuration == std::chrono::steady_clock::duration::zero()) {
-                                const std::shared_ptr<RegisterCommand>& cmd = mExecutor.getLastCommand();
-                                mWatchdog.inspectCommand(*cmd);
+                if (mExecutor.allDone()) {
+                    mIdleWaitDuration = (mNextPollTimePoint - now);
+                    if (!mRpcReads.empty())
+                        mIdleWaitDuration = std::min(mIdleWaitDuration, mRpcBusBudget.getWaitTime(now));
+                } else {
+                    mIdleWaitDuration = mExecutor.executeNext();
+                    if (mIdleWaitDuration == std::chrono::steady_clock::duration::zero()) {
+                        const std::shared_ptr<RegisterCommand>& cmd = mExecutor.getLastCommand();
+                        mWatchdog.inspectCommand(*cmd);
+                        if (cmd->isRpc()) {
+                            // process read calls only
+                            if (const RegisterPoll* rpcRead = dynamic_cast<const RegisterPoll*>(cmd.get())) {
+                                // every attempt uses the bus, successful or not
+                                mRpcBusBudget.charge(rpcRead->mLastReadFinishTime - rpcRead->mLastReadStartTime);
                                 // a successful one-shot RPC read can stand in for a scheduled
                                 // poll of the same (or a narrower) range - defer that poll so
                                 // we do not read the same registers twice within a refresh cycle
-                                if (cmd->isRpc() && cmd->executedOk()) {
-                                    // process read calls only
-                                    if (const RegisterPoll* rpcRead = dynamic_cast<const RegisterPoll*>(cmd.get())) {
-                                        mScheduler.notifyRpcRead(*rpcRead);
-                                    }
-                                }
+                                if (cmd->executedOk())
+                                    mScheduler.notifyRpcRead(*rpcRead);
                             }
                         }
-                    } else {
-                        if (!mMqttConnected)
-                            spdlog::info("Waiting for mqtt network to become online");
-
-                        idleWaitDuration = std::chrono::steady_clock::duration::max();
+                        // a scheduled poll could be executed before the write,
+                        // also a failed write could be applied by the slave
+                        if (const RegisterWrite* write = dynamic_cast<const RegisterWrite*>(cmd.get()))
+                            mScheduler.invalidatePolls(*write);
                     }
-                } else {
-                    sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, false)));
-                    if (idleWaitDuration < std::chrono::seconds(maxReconnectTime))
-                        idleWaitDuration += std::chrono::seconds(5);
-                };
+                }
+            } else if (!mMqttConnected) {
+                spdlog::info("Waiting for mqtt network to become online");
+                mIdleWaitDuration = std::chrono::steady_clock::duration::max();
             } else {
-                //wait for modbus network config
-                idleWaitDuration = std::chrono::steady_clock::duration::max();
+                // main thread does not notify us when queue is drained
+                mIdleWaitDuration = QUEUE_FULL_RECHECK_PERIOD;
             }
+        } else {
+            sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, false)));
+            if (mIdleWaitDuration < MAX_RECONNECT_TIME)
+                mIdleWaitDuration += std::chrono::seconds(5);
+        };
+    } else {
+        //wait for modbus network config
+        mIdleWaitDuration = std::chrono::steady_clock::duration::max();
+    }
+
+    if (mModbus && mModbus->isConnected() && mWatchdog.isReconnectRequired()) {
+        if (mWatchdog.isDeviceRemoved()) {
+            spdlog::error("Device {} was removed, forcing reconnect");
+        } else {
+            spdlog::error("Cannot execute any command in last {}, reconnecting",
+                std::chrono::duration_cast<std::chrono::seconds>(mWatchdog.getCurrentErrorPeriod())
+            );
+        }
+        mWatchdog.reset();
+        mModbus->disconnect();
+        sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, false)));
+        return std::chrono::steady_clock::duration::zero();
+    }
+
+    // collect register values only when commands are executed
+    // back to back, do not hold them while waiting
+    if (mIdleWaitDuration != std::chrono::steady_clock::duration::zero()
+        || mExecutor.getBatchTimeLeft() == std::chrono::steady_clock::duration::zero())
+    {
+        mExecutor.flushRegisterValues();
+    }
+    return mIdleWaitDuration;
+}
+
+void
+ModbusThread::run() {
+    try {
+        ThreadUtils::set_thread_name(mNetworkName.c_str());
+        spdlog::debug("Modbus thread started");
+
+        while(mShouldRun) {
+            std::chrono::steady_clock::duration waitDuration = step();
 
             //dispatchMessages can change mShouldRun flag, do not wait
             //for next poll if we are exiting
             if (mShouldRun) {
-                if (mModbus && mModbus->isConnected() && mWatchdog.isReconnectRequired()) {
-                    if (mWatchdog.isDeviceRemoved()) {
-                        spdlog::error("Device {} was removed, forcing reconnect");
-                    } else {
-                        spdlog::error("Cannot execute any command in last {}, reconnecting",
-                            std::chrono::duration_cast<std::chrono::seconds>(mWatchdog.getCurrentErrorPeriod())
-                        );
-                    }
-                    mWatchdog.reset();
-                    mModbus->disconnect();
-                    sendMessage(QueueItem::create(MsgModbusNetworkState(mNetworkName, false)));
-                } else {
-                    QueueItem item;
-                    spdlog::trace(constructIdleWaitMessage(idleWaitDuration));
-                    if (!mToModbusQueue.wait_dequeue_timed(item, idleWaitDuration))
-                        continue;
-                    dispatchMessages(item);
-                    while(mToModbusQueue.try_dequeue(item))
-                        dispatchMessages(item);
-                }
+                QueueItem item;
+                spdlog::trace(constructIdleWaitMessage(waitDuration));
+                if (!mToModbusQueue.wait_dequeue_timed(item, waitDuration))
+                    continue;
+                dispatchMessages(item);
             }
         };
         if (mModbus && mModbus->isConnected())
@@ -344,4 +423,19 @@ ModbusThread::run() {
     }
 }
 
+std::chrono::steady_clock::duration
+ModbusThread::runOnce() {
+    QueueItem item;
+    if (mToModbusQueue.try_dequeue(item))
+        dispatchMessages(item);
+
+    if (!mShouldRun) {
+        if (mModbus && mModbus->isConnected())
+            mModbus->disconnect();
+        spdlog::debug("Modbus network {} stopped", mNetworkName);
+        return std::chrono::steady_clock::duration::max();
+    }
+    return step();
+}
+
 }
@@ -3,11 +3,15 @@
 #include "../readerwriterqueue/readerwriterqueue.h"
 
 #include "common.hpp"
+#include "event_notifier.hpp"
+#include "mpsc_queue.hpp"
+#include "modbus_result_queue.hpp"
 #include "modbus_messages.hpp"
 #include "modbus_scheduler.hpp"
 #include "modbus_slave.hpp"
 #include "modbus_executor.hpp"
 #include "modbus_watchdog.hpp"
+#include "rpc_bus_budget.hpp"
 
 #include "imodbuscontext.hpp"
 
@@ -15,20 +19,32 @@ namespace modmqttd {
 
 class ModbusThread {
     public:
-        static void sendMessageFromModbus(moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue, const QueueItem& item);
+        static void sendMessageFromModbus(ModbusResultQueue& fromModbusQueue, EventNotifier* pNotifier, const QueueItem& item);
 
         ModbusThread(
             const std::string pNetworkName,
-            moodycamel::BlockingReaderWriterQueue<QueueItem>& toModbusQueue,
-            moodycamel::BlockingReaderWriterQueue<QueueItem>& fromModbusQueue);
+            MpscQueue<QueueItem>& toModbusQueue,
+            ModbusResultQueue& fromModbusQueue,
+            EventNotifier& fromModbusNotifier);
 
+        // thread per network mode
         void run();
 
+        // worker pool mode: process queued messages and execute
+        // a single step. Returns time to wait before next call
+        // if no new messages arrive
+        std::chrono::steady_clock::duration runOnce();
+        bool isRunning() const { return mShouldRun; }
+        const std::string& getNetworkName() const { return mNetworkName; }
+
         const ModbusWatchdog getWatchdog() const { return mWatchdog; }
     private:
+        static constexpr std::chrono::milliseconds QUEUE_FULL_RECHECK_PERIOD = std::chrono::milliseconds(100);
+        static constexpr std::chrono::seconds MAX_RECONNECT_TIME = std::chrono::seconds(60);
 
-        moodycamel::BlockingReaderWriterQueue<QueueItem>& mToModbusQueue;
-        moodycamel::BlockingReaderWriterQueue<QueueItem>& mFromModbusQueue;
+        MpscQueue<QueueItem>& mToModbusQueue;
+        ModbusResultQueue& mFromModbusQueue;
+        EventNotifier& mFromModbusNotifier;
 
         // global config
         std::string mNetworkName;
@@ -43,6 +59,9 @@ class ModbusThread {
         bool mShouldRun = true;
 
         bool mMqttConnected = false;
+        // polling is paused when main thread has too many messages to process
+        int mQueueHighWaterMark = 1000;
+        bool mQueueFull = false;
         bool mGotRegisters = false;
 
         std::shared_ptr<IModbusContext> mModbus;
@@ -50,6 +69,14 @@ class ModbusThread {
         ModbusExecutor mExecutor;
         ModbusWatchdog mWatchdog;
 
+        // RPC reads are sent to executor one by one
+        // when bus time budget is limited
+        RpcBusBudget mRpcBusBudget;
+        std::deque<std::shared_ptr<RegisterPoll>> mRpcReads;
+
+        std::chrono::steady_clock::duration mIdleWaitDuration = std::chrono::steady_clock::duration::max();
+        std::chrono::steady_clock::time_point mNextPollTimePoint = std::chrono::steady_clock::now();
+
         void configure(const ModbusNetworkConfig& config);
         void setPollSpecification(const MsgRegisterPollSpecification& spec);
         void updateFromSlaveConfig(const ModbusSlaveConfig& pSlaveConfig);
@@ -60,8 +87,14 @@ class ModbusThread {
         void processWrite(const std::shared_ptr<MsgRegisterValues>& msg);
         void processReadRequest(const std::shared_ptr<MsgRegisterReadRequest>& pMsg);
         void applySlaveConfig(RegisterCommand& pCmd, int pSlaveId);
+        // pass next waiting RPC read to executor if bus time budget allows
+        void releaseRpcReads(const std::chrono::steady_clock::time_point& pNow);
 
         void processCommands();
+        // connect, poll or execute next command, returns idle wait duration
+        std::chrono::steady_clock::duration step();
+        // update mQueueFull with hysteresis
+        bool isQueueFull();
 };
 
 }
@@ -0,0 +1,131 @@
+#include "modbus_worker_pool.hpp"
+
+#include <algorithm>
+
+#include "logging.hpp"
+#include "modbus_thread.hpp"
+#include "threadutils.hpp"
+
+namespace modmqttd {
+
+void
+ModbusWorkerPool::start(int pThreadCount) {
+    for (int i = 0; i < pThreadCount; i++)
+        mWorkers.emplace_back(&ModbusWorkerPool::workerLoop, this, i);
+    spdlog::debug("Started {} modbus worker thread(s)", pThreadCount);
+}
+
+ModbusWorkerPool::EntryHandle
+ModbusWorkerPool::add(ModbusThread& pThread) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    EntryHandle entry(new Entry());
+    entry->mThread = &pThread;
+    schedule(entry, std::chrono::steady_clock::now());
+    return entry;
+}
+
+void
+ModbusWorkerPool::schedule(const EntryHandle& pEntry, const std::chrono::steady_clock::time_point& pNextRun) {
+    pEntry->mNextRun = pNextRun;
+    pEntry->mScheduled = ++mNextSeq;
+    mHeap.push_back(HeapItem{pNextRun, pEntry->mScheduled, pEntry});
+    std::push_heap(mHeap.begin(), mHeap.end());
+    mCondition.notify_one();
+}
+
+void
+ModbusWorkerPool::notify(const EntryHandle& pEntry) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    pEntry->mNotified = true;
+    if (pEntry->mRunning || pEntry->mFinished)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    if (pEntry->mScheduled == 0 || pEntry->mNextRun > now)
+        schedule(pEntry, now);
+}
+
+void
+ModbusWorkerPool::waitForStop(const EntryHandle& pEntry) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this, &pEntry]{ return pEntry->mFinished || !mShouldRun; });
+}
+
+void
+ModbusWorkerPool::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mShouldRun = false;
+    }
+    mCondition.notify_all();
+    for (auto& worker: mWorkers)
+        worker.join();
+    mWorkers.clear();
+}
+
+void
+ModbusWorkerPool::workerLoop(int pIdx) {
+    std::string workerName("modbus-" + std::to_string(pIdx));
+    ThreadUtils::set_thread_name(workerName.c_str());
+    spdlog::debug("Modbus worker thread started");
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mShouldRun) {
+        while (!mHeap.empty() && mHeap.front().mSeq != mHeap.front().mEntry->mScheduled) {
+            std::pop_heap(mHeap.begin(), mHeap.end());
+            mHeap.pop_back();
+        }
+
+        if (mHeap.empty()) {
+            mCondition.wait(lock);
+            continue;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (mHeap.front().mNextRun > now) {
+            mCondition.wait_until(lock, mHeap.front().mNextRun);
+            continue;
+        }
+
+        std::pop_heap(mHeap.begin(), mHeap.end());
+        EntryHandle entryHandle(std::move(mHeap.back().mEntry));
+        mHeap.pop_back();
+        Entry& entry(*entryHandle);
+        entry.mScheduled = 0;
+        entry.mRunning = true;
+        entry.mNotified = false;
+        ModbusThread& thread(*entry.mThread);
+        lock.unlock();
+
+        // log lines should point to the network, not a worker
+        g_thread_name = thread.getNetworkName();
+        std::chrono::steady_clock::duration waitDuration = std::chrono::steady_clock::duration::max();
+        bool failed = false;
+        try {
+            waitDuration = thread.runOnce();
+        } catch (const std::exception& ex) {
+            spdlog::critical("Error in modbus thread: {}", ex.what());
+            failed = true;
+        } catch (...) {
+            spdlog::critical("Unknown error in modbus thread");
+            failed = true;
+        }
+        g_thread_name = workerName;
+
+        lock.lock();
+        entry.mRunning = false;
+        if (failed || !thread.isRunning()) {
+            entry.mFinished = true;
+            mCondition.notify_all();
+            continue;
+        }
+
+        now = std::chrono::steady_clock::now();
+        if (entry.mNotified)
+            schedule(entryHandle, now);
+        else if (waitDuration < std::chrono::steady_clock::time_point::max() - now)
+            schedule(entryHandle, now + waitDuration);
+        // otherwise wait for notify
+    }
+    spdlog::debug("Modbus worker thread ended");
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace modmqttd {
+
+class ModbusThread;
+
+/**
+ * Runs many ModbusThread state machines on a fixed number of threads.
+ *
+ * Each network is executed by one worker at a time with
+ * ModbusThread::runOnce(). The worker reschedules it after the returned
+ * idle wait time or as soon as a new message is queued for it (notify).
+ * Networks waiting the longest since their due time are run first,
+ * scheduled entries are kept in a min-heap ordered by run time.
+ *
+ * libmodbus calls are blocking, so a slow or unreachable device holds
+ * its worker for up to response timeout.
+ * */
+class ModbusWorkerPool {
+    public:
+        ModbusWorkerPool() {}
+        ModbusWorkerPool(const ModbusWorkerPool&) = delete;
+        ModbusWorkerPool& operator=(const ModbusWorkerPool&) = delete;
+
+        // state of ModbusThread in the pool
+        struct Entry {
+            ModbusThread* mThread;
+            std::chrono::steady_clock::time_point mNextRun;
+            // sequence number of valid heap item, 0 if not scheduled
+            uint64_t mScheduled = 0;
+            bool mRunning = false;
+            bool mNotified = false;
+            bool mFinished = false;
+        };
+        // returned by add(), identifies ModbusThread in the pool
+        typedef std::shared_ptr<Entry> EntryHandle;
+
+        void start(int pThreadCount);
+        int getThreadCount() const { return mWorkers.size(); }
+
+        EntryHandle add(ModbusThread& pThread);
+        // can be called from any thread after a message is queued for pEntry
+        void notify(const EntryHandle& pEntry);
+        // wait until pEntry thread processes EndWorkMessage
+        void waitForStop(const EntryHandle& pEntry);
+
+        void stop();
+        ~ModbusWorkerPool() { stop(); }
+    private:
+        struct HeapItem {
+            std::chrono::steady_clock::time_point mNextRun;
+            uint64_t mSeq;
+            EntryHandle mEntry;
+            // reversed, std heap functions keep the earliest run time in front
+            bool operator<(const HeapItem& pOther) const { return mNextRun > pOther.mNextRun; }
+        };
+
+        void workerLoop(int pIdx);
+        // items of rescheduled entries are left in heap and skipped
+        void schedule(const EntryHandle& pEntry, const std::chrono::steady_clock::time_point& pNextRun);
+
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::vector<HeapItem> mHeap;
+        uint64_t mNextSeq = 0;
+        std::vector<std::thread> mWorkers;
+        bool mShouldRun = true;
+};
+
+}
@@ -3,6 +3,11 @@
 #include <filesystem>
 #include <csignal>
 #include <iostream>
+#include <cstring>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
 #include <yaml-cpp/yaml.h>
 
@@ -24,22 +29,8 @@
 #include "strutils.hpp"
 #include "version.hpp"
 
-namespace
-{
-  volatile std::sig_atomic_t gSignalStatus = -1;
-}
-
-void signal_handler(int signal)
-{
-  gSignalStatus = signal;
-  modmqttd::notifyQueues();
-}
-
 namespace modmqttd {
 
-std::mutex gQueueMutex;
-std::condition_variable gHasMessagesCondition;
-bool gHasMessages = false;
 std::shared_ptr<IModbusFactory> ModMqtt::mModbusFactory;
 
 
@@ -90,13 +81,6 @@ class RegisterConfigName {
         int mRegisterNumber;
 };
 
-void
-notifyQueues() {
-    std::unique_lock<std::mutex> lock(gQueueMutex);
-    gHasMessages = true;
-	gHasMessagesCondition.notify_one();
-}
-
 RegisterType
 parseRegisterType(const YAML::Node& data) {
     std::string rtype = "holding";
@@ -129,6 +113,45 @@ parsePublishMode(const YAML::Node& data, PublishMode pDefault = PublishMode::ON_
     throw ConfigurationException(data.Mark(), std::string("Invalid publish mode '") + pmode + "', valid values are: on_change, every_poll");
 }
 
+MqttValueFilter
+parseValueFilter(const YAML::Node& data) {
+    std::chrono::milliseconds maxInterval = std::chrono::milliseconds::zero();
+    const YAML::Node& yMaxInterval = ConfigTools::setOptionalValueFromNode<std::chrono::milliseconds>(maxInterval, data, "filter_max_interval");
+
+    std::string deadband;
+    const YAML::Node& yDeadband = ConfigTools::setOptionalValueFromNode<std::string>(deadband, data, "deadband");
+    double swingingDoor = 0;
+    const YAML::Node& ySwingingDoor = ConfigTools::setOptionalValueFromNode<double>(swingingDoor, data, "swinging_door");
+
+    if (yDeadband.IsDefined()) {
+        if (ySwingingDoor.IsDefined())
+            throw ConfigurationException(ySwingingDoor.Mark(), "deadband and swinging_door cannot be used together");
+
+        MqttValueFilter::Type type = MqttValueFilter::Type::DEADBAND;
+        if (!deadband.empty() && deadband.back() == '%') {
+            type = MqttValueFilter::Type::DEADBAND_PERCENT;
+            deadband.pop_back();
+        }
+        double deviation;
+        size_t pos = 0;
+        try {
+            deviation = std::stod(deadband, &pos);
+        } catch (const std::logic_error&) {
+            pos = 0;
+        }
+        if (pos == 0 || pos != deadband.size() || deviation < 0)
+            throw ConfigurationException(yDeadband.Mark(), "deadband must be a positive number or a percentage");
+        return MqttValueFilter(type, deviation, maxInterval);
+    } else if (ySwingingDoor.IsDefined()) {
+        if (swingingDoor <= 0)
+            throw ConfigurationException(ySwingingDoor.Mark(), "swinging_door must be a positive number");
+        return MqttValueFilter(MqttValueFilter::Type::SWINGING_DOOR, swingingDoor, maxInterval);
+    } else if (yMaxInterval.IsDefined()) {
+        throw ConfigurationException(yMaxInterval.Mark(), "filter_max_interval needs deadband or swinging_door");
+    }
+    return MqttValueFilter();
+}
+
 MqttObjectCommand::PayloadType
 parsePayloadType(const YAML::Node& data) {
     //for future support for int and float mqtt command payload types
@@ -136,14 +159,34 @@ parsePayloadType(const YAML::Node& data) {
     ConfigTools::readOptionalValue<std::string>(ptype, data, "payload_type");
     if (ptype == "string")
         return MqttObjectCommand::PayloadType::STRING;
+    if (ptype == "cbor")
+        return MqttObjectCommand::PayloadType::CBOR;
+    if (ptype == "msgpack")
+        return MqttObjectCommand::PayloadType::MSGPACK;
+    if (ptype == "raw")
+        return MqttObjectCommand::PayloadType::RAW;
     throw ConfigurationException(data.Mark(), std::string("Unknown payload type ") + ptype);
 }
 
+static void
+addToEpoll(int pEpollFd, int pFd, const char* pName) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = pFd;
+    if (epoll_ctl(pEpollFd, EPOLL_CTL_ADD, pFd, &ev) == -1)
+        throw ModMqttException(std::string("Cannot add ") + pName + " to epoll: " + std::strerror(errno));
+}
+
 ModMqtt::ModMqtt()
 {
-    // unit tests create main class multiple times
-    // reset global flag at each creation
-    gSignalStatus = -1;
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd == -1)
+        throw ModMqttException(std::string("Cannot create epoll instance: ") + std::strerror(errno));
+
+    // stop() can be called before start(), eventfd will
+    // keep notification until main loop is entered
+    addToEpoll(mEpollFd, mStopNotifier.getFd(), "stop notifier");
+
     Mosquitto::libInit();
     mMqtt.reset(new MqttClient(*this));
     mModbusFactory.reset(new ModbusFactory());
@@ -171,6 +214,10 @@ ModMqtt::init(int logLevelNum, const std::string& configPath) {
 
 void
 ModMqtt::init(const YAML::Node& config, bool overrideLogLevel) {
+    // must be before modbus threads are created
+    // so they inherit signal mask
+    blockSignals();
+
     initServer(config, overrideLogLevel);
     initBroker(config);
 
@@ -210,7 +257,7 @@ ModMqtt::init(const YAML::Node& config, bool overrideLogLevel) {
             spdlog::error("Modbus client for network [{}] not initialized, ignoring specification", netname);
         } else {
             spdlog::debug("Sending register specification to modbus thread for network {}", netname);
-            (*client)->mToModbusQueue.enqueue(QueueItem::create(*sit));
+            (*client)->enqueue(QueueItem::create(*sit));
         }
     };
 
@@ -242,6 +289,11 @@ ModMqtt::init(const YAML::Node& config, bool overrideLogLevel) {
 
     mMqtt->setObjects(mappedPollObjects);
     mMqtt->setCommandObjects(mappedCommandObjects);
+
+    if (mPublishWorkerCount > 0)
+        mMqtt->startPublishWorkers(mPublishWorkerCount);
+    if (mCommandWorker)
+        mMqtt->startCommandWorker();
 }
 
 void
@@ -362,15 +414,56 @@ void ModMqtt::initBroker(const YAML::Node& config) {
         } else {
             throw ConfigurationException(rpc["mode"].Mark(), "Unknown rpc mode: " + modeStr);
         }
+
+        std::chrono::milliseconds rpcTimeout = std::chrono::seconds(10);
+        YAML::Node rtNode(ConfigTools::setOptionalValueFromNode<std::chrono::milliseconds>(rpcTimeout, rpc, "timeout"));
+        if (rpcTimeout < std::chrono::milliseconds::zero())
+            throw ConfigurationException(rtNode.Mark(), "rpc timeout cannot be negative");
+        mMqtt->setRpcTimeout(rpcTimeout);
     }
     mMqtt->setRpcMode(rpcMode);
 
+    std::string subscriptions("topics");
+    YAML::Node subNode(ConfigTools::setOptionalValueFromNode<std::string>(subscriptions, mqtt, "command_subscriptions"));
+    if (subscriptions == "topics")
+        mMqtt->setCommandSubscriptions(CommandSubscriptions::TOPICS);
+    else if (subscriptions == "wildcard")
+        mMqtt->setCommandSubscriptions(CommandSubscriptions::WILDCARD);
+    else
+        throw ConfigurationException(subNode.Mark(), "Unknown command_subscriptions value: " + subscriptions);
+
+    YAML::Node pwNode(ConfigTools::setOptionalValueFromNode<int>(mPublishWorkerCount, mqtt, "publish_workers"));
+    if (mPublishWorkerCount < 0)
+        throw ConfigurationException(pwNode.Mark(), "publish_workers cannot be negative");
+
+    ConfigTools::readOptionalValue<bool>(mCommandWorker, mqtt, "command_worker");
+
+    int publishConnections = 1;
+    YAML::Node pcNode(ConfigTools::setOptionalValueFromNode<int>(publishConnections, mqtt, "publish_connections"));
+    if (publishConnections < 1)
+        throw ConfigurationException(pcNode.Mark(), "publish_connections must be at least 1");
+    mMqtt->setPublishConnections(publishConnections);
+
+    int republishRate = 0;
+    YAML::Node rrNode(ConfigTools::setOptionalValueFromNode<int>(republishRate, mqtt, "republish_rate"));
+    if (republishRate < 0)
+        throw ConfigurationException(rrNode.Mark(), "republish_rate cannot be negative");
+    mMqtt->setRepublishRate(republishRate);
+
+    std::chrono::milliseconds statsInterval = std::chrono::milliseconds::zero();
+    ConfigTools::readOptionalValue<std::chrono::milliseconds>(statsInterval, mqtt, "stats_interval");
+    mMqtt->setStatsInterval(statsInterval);
+
     const YAML::Node& broker = mqtt["broker"];
     if (!broker.IsDefined())
         throw ConfigurationException(config.Mark(), "no broker configuration in mqtt section");
 
     MqttBrokerConfig brokerConfig(broker);
-    brokerConfig.mProtocolV5 = (rpcMode != RpcMode::DISABLED);
+    // RPC needs MQTT 5 request/response properties
+    if (rpcMode != RpcMode::DISABLED)
+        brokerConfig.mProtocolV5 = true;
+    if (brokerConfig.mTopicAliasMaximum != 0 && !brokerConfig.mProtocolV5)
+        throw ConfigurationException(broker["topic_alias_maximum"].Mark(), "topic_alias_maximum requires mqtt5");
 
     mMqtt->setBrokerConfig(brokerConfig);
     spdlog::debug("Broker configuration initialized");
@@ -417,6 +510,16 @@ ModMqtt::initModbusClients(const YAML::Node& config) {
     if (networks.size() == 0)
         throw ConfigurationException(networks.Mark(), "No modbus networks defined");
 
+    int workerThreads = 0;
+    YAML::Node wtNode(ConfigTools::setOptionalValueFromNode<int>(workerThreads, modbus, "worker_threads"));
+    if (workerThreads < 0)
+        throw ConfigurationException(wtNode.Mark(), "worker_threads cannot be negative");
+
+    if (workerThreads > 0) {
+        mModbusWorkerPool.reset(new ModbusWorkerPool());
+        mModbusWorkerPool->start(workerThreads);
+    }
+
     ModbusInitData ret;
 
     for(std::size_t i = 0; i < networks.size(); i++) {
@@ -425,7 +528,11 @@ ModMqtt::initModbusClients(const YAML::Node& config) {
 
         //initialize modbus thread
         std::shared_ptr<ModbusClient> modbus(new ModbusClient());
-        modbus->start(modbus_config);
+        // RTU line is a single serial device, it always gets its own thread
+        if (modbus_config.mType == ModbusNetworkConfig::Type::TCPIP)
+            modbus->start(modbus_config, mModbusWorkerPool);
+        else
+            modbus->start(modbus_config);
         mModbusClients.push_back(modbus);
 
         MsgRegisterPollSpecification spec(modbus_config.mName);
@@ -447,7 +554,7 @@ ModMqtt::initModbusClients(const YAML::Node& config) {
 
                     for(int addr = addr_range.first; addr <= addr_range.second; addr++) {
                         ModbusSlaveConfig slave_config(addr, ySlave);
-                        modbus->mToModbusQueue.enqueue(QueueItem::create(slave_config));
+                        modbus->enqueue(QueueItem::create(slave_config));
                         spec.merge(readModbusPollGroups(modbus_config.mName, slave_config.mAddress, ySlave["poll_groups"]));
 
                         if (!slave_config.mSlaveName.empty())
@@ -469,24 +576,21 @@ ModMqtt::initModbusClients(const YAML::Node& config) {
     return ret;
 }
 
-MqttObject
-ModMqtt::parseObject(
-    const YAML::Node& pData,
+// replace ${network}, ${slave_address} and ${slave_name} in pTopic
+static void
+fillTopicPlaceholders(
+    std::string& topic,
+    const YAML::Node& pTopicNode,
     const std::string& pDefaultNetwork,
     int pDefaultSlaveId,
-    const std::string& pSlaveName,
-    std::chrono::milliseconds pDefaultRefresh,
-    PublishMode pDefaultPublishMode,
-    std::vector<MsgRegisterPollSpecification>& pSpecsOut)
+    const std::string& pSlaveName)
 {
-    std::string topic(ConfigTools::readRequiredString(pData, "topic"));
-
     // fill network placeholder if any
     const std::string netPhVar("${network}");
     size_t netPhPos = topic.find(netPhVar);
     if (netPhPos != std::string::npos) {
         if (pDefaultNetwork.empty()) {
-            throw ConfigurationException(pData["topic"].Mark(), "default network name must be set for topic " + topic);
+            throw ConfigurationException(pTopicNode.Mark(), "default network name must be set for topic " + topic);
         } else {
             topic.replace(netPhPos, netPhVar.length(), pDefaultNetwork);
         }
@@ -497,7 +601,7 @@ ModMqtt::parseObject(
     size_t saPhPos = topic.find(saPhVar);
     if (saPhPos != std::string::npos) {
         if (pDefaultSlaveId == -1)
-            throw ConfigurationException(pData["topic"].Mark(), "default slave address must be set for topic " + topic);
+            throw ConfigurationException(pTopicNode.Mark(), "default slave address must be set for topic " + topic);
         else
         {
             topic.replace(saPhPos, saPhVar.length(), std::to_string(pDefaultSlaveId));
@@ -509,15 +613,31 @@ ModMqtt::parseObject(
     size_t snPhPos = topic.find(snPhVar);
     if (snPhPos != std::string::npos) {
         if (pDefaultSlaveId == -1) {
-            throw ConfigurationException(pData["topic"].Mark(), "cannot find slave name, default slave address must be set for topic" + topic);
+            throw ConfigurationException(pTopicNode.Mark(), "cannot find slave name, default slave address must be set for topic" + topic);
         } else if (pDefaultNetwork.empty()) {
-            throw ConfigurationException(pData["topic"].Mark(), "default network name must be set for topic " + topic);
+            throw ConfigurationException(pTopicNode.Mark(), "default network name must be set for topic " + topic);
         } else if (pSlaveName.empty()) {
-            throw ConfigurationException(pData["topic"].Mark(), std::string("missing name for slave id=") + std::to_string(pDefaultSlaveId) + " needed for placeholder in topic " + topic);
+            throw ConfigurationException(pTopicNode.Mark(), std::string("missing name for slave id=") + std::to_string(pDefaultSlaveId) + " needed for placeholder in topic " + topic);
         } else {
             topic.replace(snPhPos, snPhVar.length(), pSlaveName);
         }
     }
+}
+
+
+MqttObject
+ModMqtt::parseObject(
+    const YAML::Node& pData,
+    const std::string& pDefaultNetwork,
+    int pDefaultSlaveId,
+    const std::string& pSlaveName,
+    std::chrono::milliseconds pDefaultRefresh,
+    PublishMode pDefaultPublishMode,
+    std::vector<MsgRegisterPollSpecification>& pSpecsOut)
+{
+    std::string topic(ConfigTools::readRequiredString(pData, "topic"));
+
+    fillTopicPlaceholders(topic, pData["topic"], pDefaultNetwork, pDefaultSlaveId, pSlaveName);
 
     MqttObject ret(topic);
     spdlog::debug("processing object ", ret.getTopic());
@@ -526,14 +646,78 @@ ModMqtt::parseObject(
     if (ConfigTools::readOptionalValue<bool>(retain, pData, "retain"))
         ret.setRetain(retain);
 
+    bool republishOnResume = true;
+    if (ConfigTools::readOptionalValue<bool>(republishOnResume, pData, "republish_on_resume"))
+        ret.setRepublishOnResume(republishOnResume);
+
+    std::string format;
+    YAML::Node formatNode(ConfigTools::setOptionalValueFromNode<std::string>(format, pData, "payload_format"));
+    if (format == "cbor")
+        ret.setPayloadFormat(PayloadFormat::CBOR);
+    else if (format == "msgpack")
+        ret.setPayloadFormat(PayloadFormat::MSGPACK);
+    else if (format == "raw")
+        ret.setPayloadFormat(PayloadFormat::RAW);
+    else if (!format.empty() && format != "json")
+        throw ConfigurationException(formatNode.Mark(), "Unknown payload_format " + format + ", valid values are: json, cbor, msgpack, raw");
+
+    std::string deviceTopic;
+    YAML::Node deviceNode(ConfigTools::setOptionalValueFromNode<std::string>(deviceTopic, pData, "device_topic"));
+    if (!deviceTopic.empty()) {
+        if (ret.getPayloadFormat() == PayloadFormat::RAW)
+            throw ConfigurationException(deviceNode.Mark(), "device_topic cannot be used with raw payload_format");
+        fillTopicPlaceholders(deviceTopic, deviceNode, pDefaultNetwork, pDefaultSlaveId, pSlaveName);
+        bool deviceOnly = false;
+        ConfigTools::readOptionalValue<bool>(deviceOnly, pData, "device_topic_only");
+        ret.setDeviceTopic(deviceTopic, deviceOnly);
+    }
+
+    int qos = 0;
+    YAML::Node qosNode(ConfigTools::setOptionalValueFromNode<int>(qos, pData, "qos"));
+    if (qos < 0 || qos > 2)
+        throw ConfigurationException(qosNode.Mark(), "qos must be 0, 1 or 2");
+    ret.setQos(qos);
+
     std::chrono::milliseconds everyPollRefresh = pDefaultRefresh;
     const YAML::Node& yState = pData["state"];
 
     PublishMode pmode = parsePublishMode(pData, pDefaultPublishMode);
 
+    const YAML::Node& yAggregate = pData["aggregate"];
+    if (yAggregate.IsDefined()) {
+        if (!yAggregate.IsMap())
+            throw ConfigurationException(yAggregate.Mark(), "aggregate must be a map");
+
+        std::chrono::milliseconds window = ConfigTools::readRequiredValue<std::chrono::milliseconds>(yAggregate, "window");
+        if (window.count() <= 0)
+            throw ConfigurationException(yAggregate["window"].Mark(), "aggregate window must be greater than zero");
+
+        int functions = MqttAggregate::ALL;
+        const YAML::Node& yFunctions = yAggregate["functions"];
+        if (yFunctions.IsDefined()) {
+            if (!yFunctions.IsSequence())
+                throw ConfigurationException(yFunctions.Mark(), "aggregate functions must be a list");
+            functions = 0;
+            for (size_t i = 0; i < yFunctions.size(); i++) {
+                std::string name(ConfigTools::readRequiredValue<std::string>(yFunctions[i]));
+                int function = MqttAggregate::parseFunction(name);
+                if (function == 0)
+                    throw ConfigurationException(yFunctions[i].Mark(), std::string("Unknown aggregate function '") + name + "', valid values are: min, max, mean, last, count, stddev");
+                functions |= function;
+            }
+        }
+
+        std::string topic;
+        ConfigTools::readOptionalValue<std::string>(topic, yAggregate, "topic");
+        ret.setAggregate(MqttAggregate(window, functions, topic));
+    }
+
+    // aggregation needs values from every poll, not only changes
+    PublishMode pollMode = ret.getAggregate().isSet() ? PublishMode::EVERY_POLL : pmode;
+
     if (yState.IsDefined()) {
         if (yState.IsMap()) {
-            MqttObjectDataNode node(parseObjectDataNode(yState, pDefaultNetwork, pDefaultSlaveId, pDefaultRefresh, pmode, everyPollRefresh, pSpecsOut));
+            MqttObjectDataNode node(parseObjectDataNode(yState, pDefaultNetwork, pDefaultSlaveId, pDefaultRefresh, pollMode, everyPollRefresh, pSpecsOut));
             // a map that contains register with optional count
             // should output a list or a scalar value
             // in this case we do not need parsed parent level
@@ -547,7 +731,7 @@ ModMqtt::parseObject(
             bool isUnnamed = false;
             for(size_t i = 0; i < yState.size(); i++) {
                 const YAML::Node& yData = yState[i];
-                MqttObjectDataNode node(parseObjectDataNode(yData, pDefaultNetwork, pDefaultSlaveId, pDefaultRefresh, pmode, everyPollRefresh, pSpecsOut));
+                MqttObjectDataNode node(parseObjectDataNode(yData, pDefaultNetwork, pDefaultSlaveId, pDefaultRefresh, pollMode, everyPollRefresh, pSpecsOut));
                 //the first element defines if we have named or unnamed list
                 if (i == 0)
                     isUnnamed = node.isUnnamed();
@@ -562,6 +746,10 @@ ModMqtt::parseObject(
         }
     }
 
+    MqttValueFilter filter(parseValueFilter(pData));
+    if (filter.isSet())
+        ret.mState.setDefaultValueFilter(filter);
+
     const YAML::Node& yAvail = pData["availability"];
 
     ret.setPublishMode(pmode, everyPollRefresh);
@@ -569,6 +757,34 @@ ModMqtt::parseObject(
         spdlog::debug("Min publish rate for {} set to {}ms", ret.getStateTopic(), std::chrono::duration_cast<std::chrono::milliseconds>(everyPollRefresh).count());
     }
 
+    MqttObjectPublishLimits& limits(ret.mPublishLimits);
+    ConfigTools::readOptionalValue<std::chrono::milliseconds>(limits.mMinInterval, pData, "min_publish_interval");
+    ConfigTools::readOptionalValue<std::chrono::milliseconds>(limits.mDebounce, pData, "debounce");
+    if (ConfigTools::readOptionalValue<std::chrono::milliseconds>(limits.mMaxInterval, pData, "max_publish_interval")) {
+        if (limits.mMaxInterval.count() != 0 && limits.mMaxInterval <= limits.mMinInterval)
+            throw ConfigurationException(pData["max_publish_interval"].Mark(), "max_publish_interval must be greater than min_publish_interval");
+    }
+
+    const YAML::Node& yExpiry = pData["message_expiry"];
+    if (yExpiry.IsDefined()) {
+        std::chrono::milliseconds expiry;
+        if (yExpiry.IsScalar() && yExpiry.as<std::string>() == "refresh") {
+            // state is published again after this period, allow one missed publish
+            if (limits.mMaxInterval.count() != 0)
+                expiry = limits.mMaxInterval * 2;
+            else if (pmode == PublishMode::EVERY_POLL)
+                expiry = everyPollRefresh * 2;
+            else
+                throw ConfigurationException(yExpiry.Mark(), "message_expiry: refresh requires every_poll publish mode or max_publish_interval");
+        } else {
+            expiry = ConfigTools::readRequiredValue<std::chrono::milliseconds>(yExpiry);
+            if (expiry.count() <= 0)
+                throw ConfigurationException(yExpiry.Mark(), "message_expiry must be greater than zero");
+        }
+        // MQTT expiry interval has one second resolution
+        ret.setMessageExpiry(std::chrono::ceil<std::chrono::seconds>(expiry).count());
+    }
+
     if (!yAvail.IsDefined())
         return ret;
 
@@ -617,6 +833,8 @@ ModMqtt::parseObjectDataNode(
         node.setConverter(createConverter(converter));
     }
 
+    MqttValueFilter filter(parseValueFilter(pNode));
+
     const YAML::Node& yRegisters = pNode["registers"];
     if (yRegisters.IsDefined()) {
         bool isUnnamed = false;
@@ -652,6 +870,9 @@ ModMqtt::parseObjectDataNode(
         }
     }
 
+    if (filter.isSet())
+        node.setDefaultValueFilter(filter);
+
     return node;
 }
 
@@ -690,6 +911,8 @@ ModMqtt::parseObjectCommand(
 
     const YAML::Node& converter = node["converter"];
     if (converter.IsDefined()) {
+        if (pType == MqttObjectCommand::PayloadType::RAW)
+            throw ConfigurationException(converter.Mark(), "converter cannot be used with raw payload_type");
         cmd.setConverter(createConverter(converter));
     }
 
@@ -846,6 +1069,17 @@ ModMqtt::initObjects(const YAML::Node& config, const ModMqtt::ModbusInitData& mo
                     if (oit != objects.end())
                         throw ConfigurationException(objdata.Mark(), std::string("Topic ") + baseTopic + " already defined. Missing network or slave placeholder?");
 
+                    // objects are combined in a single device payload
+                    const std::string& deviceTopic(object.getDeviceTopic());
+                    if (!deviceTopic.empty()) {
+                        oit = std::find_if(
+                            objects.begin(),  objects.end(),
+                            [&deviceTopic](const MqttObject& old) -> bool { return old.getDeviceTopic() == deviceTopic; }
+                            );
+                        if (oit != objects.end() && oit->getPayloadFormat() != object.getPayloadFormat())
+                            throw ConfigurationException(objdata["device_topic"].Mark(), std::string("All objects on device topic ") + deviceTopic + " must use the same payload_format");
+                    }
+
 
                     objects.push_back(object);
                     nextCommandId = parseObjectCommands(object.getTopic(), nextCommandId, objdata["commands"], currentNetwork, defaultSlaveId);
@@ -892,44 +1126,39 @@ ModMqtt::updateSpecification(
 }
 
 void ModMqtt::start() {
-    std::signal(SIGTERM, signal_handler);
-
-    // mosquitto does not use reconnect_delay_set
-    // when doing inital connection. We also do not want to
-    // process queues before connection to mqtt broker is
-    // established - this will cause availability messages to be dropped.
-
-    // TODO if broker is down and modbus is up then mSlaveQueues will grow forever and
-    // memory allocated by queues will never be released. Add MsgStartPolling?
+    // We do not want to process queues before connection
+    // to mqtt broker is established - this will cause availability
+    // messages to be dropped. Modbus notifiers are not
+    // registered in epoll until then.
+
+    // modbus threads do not poll until mqtt broker is connected
+    // and stop polling if messages are not processed fast enough,
+    // see ModbusResultQueue
     spdlog::debug("Performing initial connection to mqtt broker");
-    do {
-        mMqtt->start();
-        if (mMqtt->isConnected()) {
-            spdlog::debug("Broker connected, entering main loop");
-            break;
-        }
-        waitForSignal();
-    } while(gSignalStatus == -1);
-
-    while(mMqtt->isStarted()) {
-        if (gSignalStatus == -1) {
-            waitForQueues();
-            processModbusMessages();
-        } else if (gSignalStatus > 0) {
-            int currentSignal = gSignalStatus;
-            gSignalStatus = -1;
-            if (currentSignal == SIGTERM) {
-                spdlog::info("Got SIGTERM, exiting…");
-                break;
-            } else if (currentSignal == SIGHUP) {
-                //TODO reload configuration, reconnect broker and
-                //create new list of modbus clients if needed
-            }
-            currentSignal = -1;
-        } else if (gSignalStatus == 0) {
-            spdlog::info("Got stop request, exiting…");
-            break;
+    mMqtt->start();
+
+    // state published after connection is generated by publish workers
+    int publishFd = mMqtt->getPublishNotifierFd();
+    if (publishFd != -1)
+        addToEpoll(mEpollFd, publishFd, "publish notifier");
+    bool running = true;
+    while(running && mMqtt->isStarted() && !mMqtt->isConnected()) {
+        running = processEvents(MAIN_LOOP_TIMEOUT);
+    }
+
+    if (running) {
+        spdlog::debug("Broker connected, entering main loop");
+        for(std::vector<std::shared_ptr<ModbusClient>>::iterator client = mModbusClients.begin();
+            client < mModbusClients.end(); client++)
+        {
+            addToEpoll(mEpollFd, (*client)->mFromModbusNotifier.getFd(), "modbus notifier");
         }
+        // messages sent before broker connection
+        processModbusMessages();
+    }
+
+    while(running && mMqtt->isStarted()) {
+        running = processEvents(MAIN_LOOP_TIMEOUT);
     };
 
     spdlog::info("Stopping modbus clients");
@@ -954,25 +1183,173 @@ void ModMqtt::start() {
     spdlog::debug("Shutting down mosquitto client");
     // If connected, then shutdown()
     // will send disconnection request to mqtt broker.
-    // After disconnection mMqtt will notify global queue mutex
-    // Otherwise we are already stopped.
+    // We need to run network loop until disconnection
+    // callback is called. Otherwise we are already stopped.
     mMqtt->shutdown();
     if (mMqtt->isStarted()) {
         spdlog::debug("Waiting for disconnection event");
-        waitForQueues();
+        auto deadline = std::chrono::steady_clock::now() + SHUTDOWN_TIMEOUT;
+        while (mMqtt->isStarted() && std::chrono::steady_clock::now() < deadline) {
+            processEvents(MAIN_LOOP_TIMEOUT);
+        }
+        if (mMqtt->isStarted())
+            spdlog::warn("Timeout waiting for mqtt broker disconnection");
     }
 
-    //TODO mosquitto thread could add some messages to
-    //mModbusClients queue between ModbusClient::stop() and MqttClient::shutdown()
-    //Cleanup those messages here
     spdlog::info("Shutdown finished");
 }
 
 void
 ModMqtt::stop() {
     spdlog::debug("Sending stop request to ModMqtt server");
-    gSignalStatus = 0;
-    notifyQueues();
+    mStopNotifier.notify();
+}
+
+void
+ModMqtt::blockSignals() {
+    if (mSignalFd != -1)
+        return;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    mSignalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (mSignalFd == -1)
+        throw ModMqttException(std::string("Cannot create signalfd: ") + std::strerror(errno));
+
+    addToEpoll(mEpollFd, mSignalFd, "signalfd");
+}
+
+void
+ModMqtt::updateMqttSockets() {
+    mMqttSockets.resize(mMqtt->getConnectionCount());
+    for (int i = 0; i < mMqtt->getConnectionCount(); i++)
+        updateMqttSocket(i);
+}
+
+void
+ModMqtt::updateMqttSocket(int pConnection) {
+    // mosquitto creates new socket after each reconnection
+    MqttSocket& current(mMqttSockets[pConnection]);
+    int sock = mMqtt->getSocket(pConnection);
+    bool wantWrite = sock != -1 && mMqtt->wantWrite(pConnection);
+    if (sock == current.mFd && wantWrite == current.mWantWrite)
+        return;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+    ev.data.fd = sock;
+    int rc = 0;
+    if (sock != current.mFd) {
+        // closed sockets are removed from epoll set automatically
+        if (current.mFd != -1
+            && epoll_ctl(mEpollFd, EPOLL_CTL_DEL, current.mFd, nullptr) == -1
+            && errno != ENOENT && errno != EBADF)
+        {
+            spdlog::warn("Cannot remove mqtt socket {} from epoll: {}", current.mFd, std::strerror(errno));
+        }
+        if (sock != -1)
+            rc = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, sock, &ev);
+    } else {
+        rc = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, sock, &ev);
+        // socket was closed and a new one got the same number
+        if (rc == -1 && errno == ENOENT)
+            rc = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, sock, &ev);
+    }
+    if (rc == -1) {
+        spdlog::error("Cannot add mqtt socket {} to epoll: {}", sock, std::strerror(errno));
+        // retry on next update
+        current.mFd = -1;
+        return;
+    }
+    current.mFd = sock;
+    current.mWantWrite = wantWrite;
+}
+
+int
+ModMqtt::findMqttConnection(int pFd) const {
+    for (int i = 0; i < (int)mMqttSockets.size(); i++)
+        if (mMqttSockets[i].mFd == pFd)
+            return i;
+    return -1;
+}
+
+bool
+ModMqtt::processEvents(std::chrono::milliseconds pTimeout) {
+    static constexpr int MAX_EVENTS = 16;
+
+    updateMqttSockets();
+
+    if (mNextPublishTimer != std::chrono::steady_clock::time_point::max()) {
+        auto timerWait = std::chrono::ceil<std::chrono::milliseconds>(mNextPublishTimer - std::chrono::steady_clock::now());
+        pTimeout = std::max(std::chrono::milliseconds::zero(), std::min(pTimeout, timerWait));
+    }
+
+    epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(mEpollFd, events, MAX_EVENTS, pTimeout.count());
+    if (count == -1) {
+        if (errno != EINTR)
+            throw ModMqttException(std::string("epoll_wait failed: ") + std::strerror(errno));
+        count = 0;
+    }
+
+    bool running = true;
+    bool hasModbusMessages = false;
+    bool hasPublishMessages = false;
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        int connection = findMqttConnection(fd);
+        if (fd == mSignalFd) {
+            signalfd_siginfo info;
+            while (read(mSignalFd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGTERM) {
+                    spdlog::info("Got SIGTERM, exiting…");
+                    running = false;
+                } else if (info.ssi_signo == SIGHUP) {
+                    //TODO reload configuration, reconnect broker and
+                    //create new list of modbus clients if needed
+                }
+            }
+        } else if (fd == mStopNotifier.getFd()) {
+            mStopNotifier.consume();
+            spdlog::info("Got stop request, exiting…");
+            running = false;
+        } else if (fd == mMqtt->getPublishNotifierFd()) {
+            hasPublishMessages = true;
+        } else if (connection != -1) {
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                mMqtt->loopRead(connection);
+            // socket may be closed by loopRead
+            if ((events[i].events & EPOLLOUT) && mMqtt->getSocket(connection) == fd)
+                mMqtt->loopWrite(connection);
+            updateMqttSocket(connection);
+        } else {
+            for(std::vector<std::shared_ptr<ModbusClient>>::iterator client = mModbusClients.begin();
+                client < mModbusClients.end(); client++)
+            {
+                if ((*client)->mFromModbusNotifier.getFd() == fd) {
+                    (*client)->mFromModbusNotifier.consume();
+                    hasModbusMessages = true;
+                }
+            }
+        }
+    }
+
+    if (hasModbusMessages)
+        processModbusMessages();
+
+    if (hasPublishMessages)
+        mMqtt->processPublishQueue();
+
+    mNextPublishTimer = mMqtt->processPublishTimers();
+
+    // keepalive and scheduled reconnects
+    mMqtt->loopMisc();
+
+    return running;
 }
 
 void
@@ -985,6 +1362,9 @@ ModMqtt::processModbusMessages() {
             if (item.isSameAs(typeid(MsgRegisterValues))) {
                 std::unique_ptr<MsgRegisterValues> val(item.getData<MsgRegisterValues>());
                 mMqtt->processRegisterValues((*client)->mNetworkName, *val);
+            } else if (item.isSameAs(typeid(MsgRegisterValuesBatch))) {
+                std::unique_ptr<MsgRegisterValuesBatch> batch(item.getData<MsgRegisterValuesBatch>());
+                mMqtt->processRegisterValues((*client)->mNetworkName, *batch);
             } else if (item.isSameAs(typeid(MsgRegisterReadFailed))) {
                 std::unique_ptr<MsgRegisterReadFailed> val(item.getData<MsgRegisterReadFailed>());
                 if (val->isRpc()) {
@@ -1023,19 +1403,6 @@ ModMqtt::hasConverterPlugin(const std::string& name) const {
 
 
 
-void
-ModMqtt::waitForSignal() {
-    std::unique_lock<std::mutex> lock(gQueueMutex);
-    gHasMessagesCondition.wait_for(lock, std::chrono::seconds(5));
-}
-
-void
-ModMqtt::waitForQueues() {
-    std::unique_lock<std::mutex> lock(gQueueMutex);
-    gHasMessagesCondition.wait(lock, []{ return gHasMessages;});
-    gHasMessages = false;
-}
-
 void
 ModMqtt::setMqttImplementation(const std::shared_ptr<IMqttImpl>& impl) {
     mMqtt->setMqttImplementation(impl);
@@ -1065,6 +1432,10 @@ ModMqtt::~ModMqtt() {
     // we need to delete all conveter instances
     // from plugins before unloading plugin libraries
     mMqtt = nullptr;
+
+    if (mSignalFd != -1)
+        close(mSignalFd);
+    close(mEpollFd);
 }
 
 } //namespace
@@ -1,13 +1,13 @@
 #pragma once
 #include <vector>
 #include <stack>
-#include <mutex>
-#include <condition_variable>
+#include <chrono>
 
 #include "libmodmqttconv/converterplugin.hpp"
 
 #include "common.hpp"
 #include "modbus_client.hpp"
+#include "event_notifier.hpp"
 #include "mosquitto.hpp"
 #include "modbus_messages.hpp"
 #include "mqttobject.hpp"
@@ -16,13 +16,6 @@
 
 namespace modmqttd {
 
-// global shared lock for modbus threads and main loop
-// to wait on empty queues and posix singals processing
-extern std::mutex gQueueMutex;
-extern std::condition_variable gHasMessagesCondition;
-void notifyQueues();
-
-
 class ModMqtt {
     public:
         static void setModbusContextFactory(const std::shared_ptr<IModbusFactory>& factory);
@@ -34,24 +27,30 @@ class ModMqtt {
         void init(const YAML::Node& config, bool overrideLogLevel);
         void start();
         /**
-            Stop server. Can be called only from controlling thread
+            Stop server. Can be called from any thread
             Used by unit tests only
         */
         void stop();
-        void waitForQueues();
-        void setMqttFinished() { mMqttFinished = true; }
 
         void setMqttImplementation(const std::shared_ptr<IMqttImpl>& impl);
         ~ModMqtt();
 
         // currently for unit tests only
         const ModbusClient& getModbusClient(const std::string& networkName) const;
+        ModbusClient& getModbusClient(const std::string& networkName) {
+            return const_cast<ModbusClient&>(static_cast<const ModMqtt&>(*this).getModbusClient(networkName));
+        }
 
         // Build a converter from a "plugin.name(args)" spec string (e.g. for RPC requests).
         // Throws ConvNameParserException/ConvException on a bad spec; both derive from std::exception.
         std::shared_ptr<DataConverter> createConverterFromString(const std::string& pSpec) const;
 
     private:
+        // max time between mqtt keepalive checks
+        static constexpr std::chrono::milliseconds MAIN_LOOP_TIMEOUT = std::chrono::milliseconds(1000);
+        // max time to wait for clean broker disconnection
+        static constexpr std::chrono::seconds SHUTDOWN_TIMEOUT = std::chrono::seconds(5);
+
         struct ModbusInitData {
             std::vector<MsgRegisterPollSpecification> mPollSpecification;
 
@@ -75,6 +74,12 @@ class ModMqtt {
 
         std::shared_ptr<MqttClient> mMqtt;
         std::vector<std::shared_ptr<ModbusClient>> mModbusClients;
+        // shared by TCP networks if modbus.worker_threads is set
+        std::shared_ptr<ModbusWorkerPool> mModbusWorkerPool;
+        // mqtt.publish_workers
+        int mPublishWorkerCount = 0;
+        // mqtt.command_worker
+        bool mCommandWorker = false;
 
         std::vector<std::shared_ptr<ConverterPlugin>> mConverterPlugins;
 
@@ -82,7 +87,17 @@ class ModMqtt {
         void initBroker(const YAML::Node& config);
         ModbusInitData initModbusClients(const YAML::Node& config);
         std::vector<MqttObject> initObjects(const YAML::Node& config, const ModbusInitData& modbusData, std::vector<MsgRegisterPollSpecification>& pSpecsOut);
-        void waitForSignal();
+        /**
+            Wait for events on modbus queues, mqtt socket, signals
+            and stop requests and dispatch them.
+            Returns false if stop was requested or SIGTERM received.
+        */
+        bool processEvents(std::chrono::milliseconds pTimeout);
+        void updateMqttSockets();
+        void updateMqttSocket(int pConnection);
+        // returns -1 if pFd is not a broker connection socket
+        int findMqttConnection(int pFd) const;
+        void blockSignals();
 
         MqttObjectRegisterIdent updateSpecification(
             const YAML::Node& pData,
@@ -142,7 +157,18 @@ class ModMqtt {
         std::shared_ptr<DataConverter> createConverter(const YAML::Node& data) const;
 
 
-        bool mMqttFinished = false;
+        // main loop event sources
+        int mEpollFd = -1;
+        int mSignalFd = -1;
+        struct MqttSocket {
+            int mFd = -1;
+            bool mWantWrite = false;
+        };
+        // for every broker connection
+        std::vector<MqttSocket> mMqttSockets;
+        EventNotifier mStopNotifier;
+        // next object publish limit timer in the main thread
+        std::chrono::steady_clock::time_point mNextPublishTimer = std::chrono::steady_clock::time_point::max();
 
         std::vector<std::string> mConverterPaths;
 };
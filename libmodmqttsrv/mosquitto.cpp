@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 
 #include "mosquitto.hpp"
@@ -11,25 +12,13 @@
 
 #include "exceptions.hpp"
 #include "mqttclient.hpp"
-#include "threadutils.hpp"
 
 namespace modmqttd {
 
-static void on_connect_wrapper(struct mosquitto *mosq, void *userdata, int rc)
-{
-    if (g_thread_name.empty()) {
-        ThreadUtils::set_thread_name("mqtt");
-    }
-
-    class Mosquitto *m = (class Mosquitto *)userdata;
-	m->on_connect(rc);
-}
-
-
-static void on_connect_with_flags_wrapper(struct mosquitto *mosq, void *userdata, int rc, int flags)
+static void on_connect_v5_wrapper(struct mosquitto *mosq, void *userdata, int rc, int flags, const mosquitto_property *props)
 {
 	class Mosquitto *m = (class Mosquitto *)userdata;
-//	m->on_connect_with_flags(rc, flags);
+	m->onConnectV5(rc, flags, props);
 }
 
 
@@ -117,8 +106,16 @@ void
 Mosquitto::connect(const MqttBrokerConfig& config) {
     spdlog::info("Connecting to {}:{}", config.mHost, config.mPort);
     mProtocolV5 = config.mProtocolV5;
+    mTopicAliasLimit = config.mTopicAliasMaximum;
 
     int rc = 0;
+    if (!config.mCleanSession) {
+        // broker keeps our subscriptions and queued messages
+        // between connections, so they need a stable client id
+        rc = mosquitto_reinitialise(mMosq, mClientId.c_str(), false, this);
+        throwOnCriticalError(rc);
+    }
+
     if (config.mProtocolV5) {
         rc = mosquitto_int_option(mMosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
         throwOnCriticalError(rc);
@@ -138,6 +135,30 @@ Mosquitto::connect(const MqttBrokerConfig& config) {
       throwOnCriticalError(rc);
     }
 
+    if (config.mMaxInflight != 0) {
+        // for MQTT 5 broker Receive Maximum is used if it is lower
+        rc = mosquitto_int_option(mMosq, MOSQ_OPT_SEND_MAXIMUM, config.mMaxInflight);
+        throwOnCriticalError(rc);
+    }
+
+    // callbacks are called from loop* methods
+    // in ModMqtt main thread
+    // called for all protocol versions, props are NULL for MQTT 3.1.1
+    mosquitto_connect_v5_callback_set(mMosq, on_connect_v5_wrapper);
+    mosquitto_disconnect_callback_set(mMosq, on_disconnect_wrapper);
+    mosquitto_publish_callback_set(mMosq, on_publish_wrapper);
+    if (config.mProtocolV5) {
+        mosquitto_message_v5_callback_set(mMosq, onMessageV5Wrapper);
+    } else {
+        mosquitto_message_callback_set(mMosq, on_message_wrapper);
+    }
+    //mosquitto_subscribe_callback_set(mMosq, on_subscribe_wrapper);
+    //mosquitto_unsubscribe_callback_set(mMosq, on_unsubscribe_wrapper);
+    mosquitto_log_callback_set(mMosq, on_log_wrapper);
+
+    mReconnectDelay = std::chrono::seconds(0);
+    mReconnectPending = false;
+
     rc = mosquitto_connect_async(
         mMosq, config.mHost.c_str(),
         config.mPort,
@@ -151,33 +172,33 @@ Mosquitto::connect(const MqttBrokerConfig& config) {
 
     if (rc != MOSQ_ERR_SUCCESS) {
         spdlog::error("Error connecting to mqtt broker: {}", returnCodeToStr(rc));
+        // connect_async stores broker address, so we can
+        // retry with mosquitto_reconnect_async later
+        mReconnectDelay = RECONNECT_DELAY_MIN;
+        scheduleReconnect();
     } else {
-        mosquitto_reconnect_delay_set(mMosq, 3,60, true);
-        mosquitto_connect_callback_set(mMosq, on_connect_wrapper);
-        mosquitto_connect_with_flags_callback_set(mMosq, on_connect_with_flags_wrapper);
-        mosquitto_disconnect_callback_set(mMosq, on_disconnect_wrapper);
-        mosquitto_publish_callback_set(mMosq, on_publish_wrapper);
-        if (config.mProtocolV5) {
-            mosquitto_message_v5_callback_set(mMosq, onMessageV5Wrapper);
-        } else {
-            mosquitto_message_callback_set(mMosq, on_message_wrapper);
-        }
-        //mosquitto_subscribe_callback_set(mMosq, on_subscribe_wrapper);
-        //mosquitto_unsubscribe_callback_set(mMosq, on_unsubscribe_wrapper);
-        mosquitto_log_callback_set(mMosq, on_log_wrapper);
-
-
         spdlog::debug("Waiting for connection event");
-        int rc = mosquitto_loop_start(mMosq);
-        if (rc != MOSQ_ERR_SUCCESS) {
-            spdlog::error("Error processing network traffic: {}", returnCodeToStr(rc));
-        }
     }
 }
 
 void
 Mosquitto::reconnect() {
-    mosquitto_reconnect(mMosq);
+    scheduleReconnect();
+}
+
+void
+Mosquitto::scheduleReconnect() {
+    auto now = std::chrono::steady_clock::now();
+    if (mReconnectDelay.count() == 0) {
+        // first attempt after connection loss is immediate
+        mNextReconnectTime = now;
+        mReconnectDelay = RECONNECT_DELAY_MIN;
+    } else {
+        spdlog::debug("Next reconnection attempt in {}s", mReconnectDelay.count());
+        mNextReconnectTime = now + mReconnectDelay;
+        mReconnectDelay = std::min(mReconnectDelay * 2, RECONNECT_DELAY_MAX);
+    }
+    mReconnectPending = true;
 }
 
 void
@@ -187,15 +208,66 @@ Mosquitto::disconnect() {
 
 void
 Mosquitto::stop() {
-    mosquitto_loop_stop(mMosq, false);
+    mReconnectPending = false;
+}
+
+int
+Mosquitto::getSocket() {
+    return mosquitto_socket(mMosq);
 }
 
-void Mosquitto::init(MqttClient* owner, const char* clientId) {
+bool
+Mosquitto::wantWrite() {
+    return mosquitto_want_write(mMosq);
+}
+
+void
+Mosquitto::loopRead() {
+    handleLoopError(mosquitto_loop_read(mMosq, 1));
+}
+
+void
+Mosquitto::loopWrite() {
+    handleLoopError(mosquitto_loop_write(mMosq, 1));
+}
+
+void
+Mosquitto::loopMisc() {
+    if (mReconnectPending && std::chrono::steady_clock::now() >= mNextReconnectTime) {
+        mReconnectPending = false;
+        int rc = mosquitto_reconnect_async(mMosq);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            spdlog::error("Error connecting to mqtt broker: {}", returnCodeToStr(rc));
+            throwOnCriticalError(rc);
+            scheduleReconnect();
+        }
+        return;
+    }
+    // keepalive pings, returns MOSQ_ERR_NO_CONN when disconnected
+    mosquitto_loop_misc(mMosq);
+}
+
+void
+Mosquitto::handleLoopError(int rc) {
+    // mosquitto closes socket and calls on_disconnect
+    // on network errors, MqttClient will request reconnection
+    if (rc != MOSQ_ERR_SUCCESS && rc != MOSQ_ERR_NO_CONN)
+        spdlog::debug("Mqtt network loop error: {}", returnCodeToStr(rc));
+}
+
+void Mosquitto::init(MqttClient* owner, const char* clientId, int pConnection) {
     mOwner = owner;
+    mClientId = clientId;
+    mConnection = pConnection;
     //TODO check return code?
 	mosquitto_reinitialise(mMosq, clientId, true, this);
 }
 
+std::shared_ptr<IMqttImpl>
+Mosquitto::createConnection() {
+    return std::shared_ptr<IMqttImpl>(new Mosquitto());
+}
+
 void
 Mosquitto::subscribe(const char* topic) {
     int msgId;
@@ -203,9 +275,36 @@ Mosquitto::subscribe(const char* topic) {
 }
 
 int
-Mosquitto::publish(const char* topic, int len, const void* data, bool retain) {
+Mosquitto::publish(const char* topic, int len, const void* data, const MqttPublishProps& props) {
     int msgId;
-    int rc = mosquitto_publish(mMosq, &msgId, topic, len, data, 0, retain);
+    if (!mProtocolV5) {
+        int rc = mosquitto_publish(mMosq, &msgId, topic, len, data, props.mQos, props.mRetain);
+        throwOnCriticalError(rc);
+        return msgId;
+    }
+
+    mosquitto_property* rawProps = nullptr;
+    if (props.mMessageExpiry != 0)
+        mosquitto_property_add_int32(&rawProps, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, props.mMessageExpiry);
+
+    // QoS 1 and 2 messages can be resent after reconnect,
+    // when topic aliases from previous connection are not valid
+    const char* pubTopic = topic;
+    if (props.mQos == 0 && mTopicAliases.getMax() != 0) {
+        bool isNew;
+        uint16_t alias = mTopicAliases.get(topic, isNew);
+        if (alias != 0) {
+            mosquitto_property_add_int16(&rawProps, MQTT_PROP_TOPIC_ALIAS, alias);
+            // the first publish with alias sets it on broker side
+            if (!isNew)
+                pubTopic = "";
+        }
+    }
+
+    int rc = mosquitto_publish_v5(mMosq, &msgId, pubTopic, len, data, props.mQos, props.mRetain, rawProps);
+    // nothing to free if there is no alias and no expiry
+    if (rawProps != nullptr)
+        mosquitto_property_free_all(&rawProps);
     throwOnCriticalError(rc);
     return msgId;
 }
@@ -214,18 +313,34 @@ Mosquitto::publish(const char* topic, int len, const void* data, bool retain) {
 void
 Mosquitto::on_disconnect(int rc) {
     spdlog::info("Disconnected from mqtt broker, code: {}", returnCodeToStr(rc));
-    mOwner->onDisconnect();
+    mOwner->onDisconnect(mConnection);
+}
+
+void
+Mosquitto::onConnectV5(int rc, int flags, const mosquitto_property* pProps) {
+    // aliases are valid for a single network connection
+    uint16_t brokerMax = 0;
+    if (pProps != nullptr)
+        mosquitto_property_read_int16(pProps, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &brokerMax, false);
+    mTopicAliases.reset(std::min<int>(mTopicAliasLimit, brokerMax));
+    if (mTopicAliasLimit != 0)
+        spdlog::debug("Using {} topic aliases, broker maximum is {}", mTopicAliases.getMax(), brokerMax);
+
+    // bit 0 of CONNACK flags is session present
+    on_connect(rc, flags & 0x01);
 }
 
 void
-Mosquitto::on_connect(int rc) {
+Mosquitto::on_connect(int rc, bool pSessionPresent) {
     spdlog::info("Connection established");
-    mOwner->onConnect();
+    if (rc == 0)
+        mReconnectDelay = std::chrono::seconds(0);
+    mOwner->onConnect(pSessionPresent, mConnection);
 }
 
 void
 Mosquitto::on_publish(int messageId) {
-    mOwner->onPublish(messageId);
+    mOwner->onPublish(messageId, mConnection);
 }
 
 void
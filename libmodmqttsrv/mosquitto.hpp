@@ -1,11 +1,13 @@
 #pragma once
 
+#include <chrono>
 #include <mosquitto.h>
 #include "config.hpp"
 #include "common.hpp"
 #include "mqttobject.hpp"
 #include "modbus_client.hpp"
 #include "imqttimpl.hpp"
+#include "mqtt_topic_aliases.hpp"
 
 namespace modmqttd {
 
@@ -17,7 +19,8 @@ class Mosquitto : public IMqttImpl {
         static void libCleanup();
 
         Mosquitto();
-        virtual void init(MqttClient* owner, const char* clientId);
+        virtual void init(MqttClient* owner, const char* clientId, int pConnection);
+        virtual std::shared_ptr<IMqttImpl> createConnection() override;
         virtual void connect(const MqttBrokerConfig& config);
         virtual void stop();
 
@@ -25,13 +28,20 @@ class Mosquitto : public IMqttImpl {
         virtual void disconnect();
 
         virtual void subscribe(const char* topic);
-        virtual int publish(const char* topic, int len, const void* data, bool retain);
+        virtual int publish(const char* topic, int len, const void* data, const MqttPublishProps& props);
         virtual int publishResponse(const char* pTopic, int pLen, const void* pData,
                                     const void* pCorrelationData, int pCorrelationLen,
                                     const std::vector<std::pair<std::string, std::string>>& pUserProperties = {}) override;
 
+        virtual int getSocket() override;
+        virtual bool wantWrite() override;
+        virtual void loopRead() override;
+        virtual void loopWrite() override;
+        virtual void loopMisc() override;
+
         virtual void on_disconnect(int rc);
-        virtual void on_connect(int rc);
+        virtual void on_connect(int rc, bool pSessionPresent);
+        void onConnectV5(int rc, int flags, const mosquitto_property* pProps);
         virtual void on_log(int level, const char* message);
         virtual void on_message(const struct mosquitto_message *message);
         virtual void onMessageV5(const struct mosquitto_message* pMessage, const mosquitto_property* pRops);
@@ -40,8 +50,26 @@ class Mosquitto : public IMqttImpl {
     private:
         mosquitto *mMosq = NULL;
         MqttClient* mOwner;
+        std::string mClientId;
+        int mConnection = 0;
         bool mProtocolV5 = false;
 
+        // topic_alias_maximum from config
+        int mTopicAliasLimit = 0;
+        // limited by broker Topic Alias Maximum
+        MqttTopicAliases mTopicAliases;
+
+        // reconnect is done from loopMisc() with exponential backoff
+        // like mosquitto_reconnect_delay_set(3, 60, true) in threaded mode
+        static constexpr std::chrono::seconds RECONNECT_DELAY_MIN = std::chrono::seconds(3);
+        static constexpr std::chrono::seconds RECONNECT_DELAY_MAX = std::chrono::seconds(60);
+        bool mReconnectPending = false;
+        std::chrono::steady_clock::time_point mNextReconnectTime;
+        std::chrono::seconds mReconnectDelay = std::chrono::seconds(0);
+
+        void scheduleReconnect();
+        void handleLoopError(int rc);
+
         const char* returnCodeToStr(int code);
         void throwOnCriticalError(int code);
 };
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../readerwriterqueue/readerwriterqueue.h"
+
+namespace modmqttd {
+
+/**
+ * Multi producer, single consumer queue.
+ *
+ * Each producer thread gets its own moodycamel SPSC lane on the first
+ * enqueue. The consumer drains lanes in round-robin order, so a single
+ * busy producer cannot starve others. When all lanes are taken, remaining
+ * producers share lane 0 and serialize on a mutex.
+ *
+ * Lane is released when its producer thread exits and given to the next
+ * new producer after the consumer takes all its items.
+ *
+ * Interface mirrors moodycamel::BlockingReaderWriterQueue
+ * */
+template <typename T>
+class MpscQueue {
+    public:
+        static constexpr int MAX_PRODUCER_LANES = 8;
+
+        MpscQueue() : mId(nextQueueId()) {
+            mLanes[0].reset(new Lane());
+            mLanes[0]->mShared = true;
+        }
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        // can be called from any thread
+        void enqueue(const T& pItem) {
+            Lane& lane(getProducerLane());
+            if (lane.mShared) {
+                std::unique_lock<std::mutex> lock(mSharedLaneMutex);
+                lane.mQueue.enqueue(pItem);
+            } else {
+                lane.mQueue.enqueue(pItem);
+            }
+            mSema.signal();
+        }
+
+        // consumer thread only
+        bool try_dequeue(T& pItem) {
+            if (!mSema.tryWait())
+                return false;
+            takeItem(pItem);
+            return true;
+        }
+
+        // consumer thread only
+        template<typename Rep, typename Period>
+        bool wait_dequeue_timed(T& pItem, const std::chrono::duration<Rep, Period>& pTimeout) {
+            if (!mSema.wait(std::chrono::duration_cast<std::chrono::microseconds>(pTimeout).count()))
+                return false;
+            takeItem(pItem);
+            return true;
+        }
+
+        size_t size_approx() const { return mSema.availableApprox(); }
+
+        int getLaneCount() const { return mLaneCount.load(std::memory_order_acquire); }
+    private:
+        struct Lane {
+            moodycamel::ReaderWriterQueue<T> mQueue;
+            bool mShared = false;
+            // set by producer thread on exit
+            std::atomic<bool> mReleased = false;
+        };
+
+        // lanes used by the current thread, released on thread exit
+        class ProducerLanes {
+            public:
+                struct Entry {
+                    uint64_t mQueueId;
+                    Lane* mLane;
+                    std::weak_ptr<Lane> mOwner;
+                };
+
+                Lane* find(uint64_t pQueueId) {
+                    if (mLast < mEntries.size() && mEntries[mLast].mQueueId == pQueueId)
+                        return mEntries[mLast].mLane;
+                    for (size_t i = 0; i < mEntries.size(); i++) {
+                        if (mEntries[i].mQueueId == pQueueId) {
+                            mLast = i;
+                            return mEntries[i].mLane;
+                        }
+                    }
+                    return nullptr;
+                }
+
+                void add(uint64_t pQueueId, const std::shared_ptr<Lane>& pLane) {
+                    // forget lanes of deleted queues
+                    for (auto it = mEntries.begin(); it != mEntries.end();) {
+                        if (it->mOwner.expired())
+                            it = mEntries.erase(it);
+                        else
+                            it++;
+                    }
+                    mEntries.push_back(Entry{pQueueId, pLane.get(), pLane});
+                    mLast = mEntries.size() - 1;
+                }
+
+                ~ProducerLanes() {
+                    for (const Entry& entry: mEntries) {
+                        std::shared_ptr<Lane> lane(entry.mOwner.lock());
+                        if (lane != nullptr && !lane->mShared)
+                            lane->mReleased.store(true, std::memory_order_release);
+                    }
+                }
+            private:
+                std::vector<Entry> mEntries;
+                size_t mLast = 0;
+        };
+
+        static uint64_t nextQueueId() {
+            static std::atomic<uint64_t> nextId(1);
+            return nextId++;
+        }
+
+        Lane& getProducerLane() {
+            // queue ids are never reused, so entries for
+            // deleted queues are never returned
+            static thread_local ProducerLanes producerLanes;
+            Lane* cached = producerLanes.find(mId);
+            if (cached != nullptr)
+                return *cached;
+
+            std::unique_lock<std::mutex> lock(mRegisterMutex);
+            int count = mLaneCount.load(std::memory_order_relaxed);
+            int idx = 0;
+            for (int i = 1; i < count; i++) {
+                // reuse empty lane of finished producer, do not mix
+                // new items with items of finished producer
+                if (mLanes[i]->mReleased.load(std::memory_order_acquire) && mLanes[i]->mQueue.size_approx() == 0) {
+                    mLanes[i]->mReleased.store(false, std::memory_order_relaxed);
+                    idx = i;
+                    break;
+                }
+            }
+            if (idx == 0 && count < MAX_PRODUCER_LANES) {
+                idx = count;
+                mLanes[idx].reset(new Lane());
+                mLaneCount.store(idx + 1, std::memory_order_release);
+            }
+            producerLanes.add(mId, mLanes[idx]);
+            return *mLanes[idx];
+        }
+
+        // called after semaphore is acquired, so at least one
+        // lane has an item or will have it after producer
+        // finishes enqueue
+        void takeItem(T& pItem) {
+            while(true) {
+                int count = mLaneCount.load(std::memory_order_acquire);
+                for (int i = 0; i < count; i++) {
+                    int idx = (mNextLane + i) % count;
+                    if (mLanes[idx]->mQueue.try_dequeue(pItem)) {
+                        mNextLane = idx + 1;
+                        return;
+                    }
+                }
+            }
+        }
+
+        const uint64_t mId;
+        std::array<std::shared_ptr<Lane>, MAX_PRODUCER_LANES> mLanes;
+        std::atomic<int> mLaneCount = 1;
+        std::mutex mRegisterMutex;
+        std::mutex mSharedLaneMutex;
+        moodycamel::spsc_sema::LightweightSemaphore mSema;
+        // consumer only
+        int mNextLane = 0;
+};
+
+}
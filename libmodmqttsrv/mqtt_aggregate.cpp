@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "mqtt_aggregate.hpp"
+#include "mqttobject.hpp"
+
+namespace modmqttd {
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> AggregateWriter;
+
+int
+MqttAggregate::parseFunction(const std::string& pName) {
+    if (pName == "min")
+        return MIN;
+    if (pName == "max")
+        return MAX;
+    if (pName == "mean")
+        return MEAN;
+    if (pName == "last")
+        return LAST;
+    if (pName == "count")
+        return COUNT;
+    if (pName == "stddev")
+        return STDDEV;
+    return 0;
+}
+
+
+void
+MqttAggregate::Stats::add(double pValue) {
+    mCount++;
+    if (mCount == 1) {
+        mMin = mMax = pValue;
+    } else {
+        mMin = std::min(mMin, pValue);
+        mMax = std::max(mMax, pValue);
+    }
+    double delta = pValue - mMean;
+    mMean += delta / mCount;
+    mM2 += delta * (pValue - mMean);
+    mLast = pValue;
+}
+
+
+void
+MqttAggregate::addField(const MqttObjectDataNode& pNode) {
+    Field field;
+    field.mNode = &pNode;
+    pNode.getSlots(field.mSlots);
+    for (int slot: field.mSlots)
+        mSlotFields[slot].push_back(mFields.size());
+    mFields.push_back(field);
+}
+
+
+void
+MqttAggregate::addFields(const MqttObjectDataNodeList& pNodes) {
+    for (const MqttObjectDataNode& node: pNodes) {
+        if (node.isScalar() || node.hasConverter())
+            addField(node);
+        else
+            addFields(node.getChildNodes());
+    }
+}
+
+
+void
+MqttAggregate::build(const MqttObjectState& pState) {
+    mFields.clear();
+    mSlotFields.clear();
+    mSlotFields.resize(pState.getValues().size());
+    addFields(pState.getNodes());
+    mBuiltGeneration = pState.getGeneration();
+}
+
+
+void
+MqttAggregate::addSamples(const MqttObjectState& pState, const std::vector<int>& pSlots, const std::chrono::steady_clock::time_point& pNow) {
+    if (mBuiltGeneration != pState.getGeneration())
+        build(pState);
+
+    const MqttObjectRegisterValues& values(pState.getValues());
+    mSampled.clear();
+    for (int slot: pSlots) {
+        for (int idx: mSlotFields[slot]) {
+            if (std::find(mSampled.begin(), mSampled.end(), idx) != mSampled.end())
+                continue;
+            mSampled.push_back(idx);
+
+            Field& field(mFields[idx]);
+            bool hasValues = std::all_of(field.mSlots.begin(), field.mSlots.end(), [&values](int s) {
+                return values[s].hasValue();
+            });
+            if (!hasValues)
+                continue;
+
+            MqttValue v = field.mNode->getConvertedValue(values);
+            if (v.getSourceType() == MqttValue::SourceType::BINARY)
+                continue;
+            field.mStats.add(v.getDouble());
+            mHasSamples = true;
+        }
+    }
+
+    if (mHasSamples && mWindowEnd == std::chrono::steady_clock::time_point::max())
+        mWindowEnd = pNow + mWindow;
+}
+
+
+static void
+writeStats(AggregateWriter& pWriter, int pFunctions, long pCount, double pMin, double pMax, double pMean, double pM2, double pLast) {
+    pWriter.StartObject();
+    auto writeValue = [&pWriter, pCount](const char* pName, double pValue) {
+        pWriter.Key(pName);
+        // JSON has no NaN and Infinity
+        if (pCount == 0 || !std::isfinite(pValue))
+            pWriter.Null();
+        else
+            pWriter.Double(pValue);
+    };
+    if (pFunctions & MqttAggregate::MIN)
+        writeValue("min", pMin);
+    if (pFunctions & MqttAggregate::MAX)
+        writeValue("max", pMax);
+    if (pFunctions & MqttAggregate::MEAN)
+        writeValue("mean", pMean);
+    if (pFunctions & MqttAggregate::LAST)
+        writeValue("last", pLast);
+    if (pFunctions & MqttAggregate::COUNT) {
+        pWriter.Key("count");
+        pWriter.Int64(pCount);
+    }
+    if (pFunctions & MqttAggregate::STDDEV)
+        writeValue("stddev", pCount == 0 ? 0 : std::sqrt(pM2 / pCount));
+    pWriter.EndObject();
+}
+
+
+static void
+writeNodes(AggregateWriter& pWriter, const MqttObjectDataNodeList& pNodes, const std::function<void(const MqttObjectDataNode&)>& pWriteField) {
+    auto writeNode = [&pWriter, &pWriteField](const MqttObjectDataNode& node) {
+        if (node.isScalar() || node.hasConverter())
+            pWriteField(node);
+        else
+            writeNodes(pWriter, node.getChildNodes(), pWriteField);
+    };
+
+    if (!pNodes.front().isUnnamed()) {
+        pWriter.StartObject();
+        for (const MqttObjectDataNode& node: pNodes) {
+            pWriter.Key(node.getName().c_str());
+            writeNode(node);
+        }
+        pWriter.EndObject();
+    } else if (pNodes.outputAsList() || pNodes.size() > 1) {
+        pWriter.StartArray();
+        for (const MqttObjectDataNode& node: pNodes)
+            writeNode(node);
+        pWriter.EndArray();
+    } else {
+        writeNode(pNodes.front());
+    }
+}
+
+
+std::string
+MqttAggregate::finishWindow(const MqttObjectState& pState) {
+    if (mBuiltGeneration != pState.getGeneration())
+        build(pState);
+
+    rapidjson::StringBuffer out;
+    AggregateWriter writer(out);
+    writer.SetMaxDecimalPlaces(6);
+
+    int idx = 0;
+    auto writeField = [this, &writer, &idx](const MqttObjectDataNode&) {
+        Stats& s(mFields[idx++].mStats);
+        writeStats(writer, mFunctions, s.mCount, s.mMin, s.mMax, s.mMean, s.mM2, s.mLast);
+    };
+    if (!pState.getNodes().empty())
+        writeNodes(writer, pState.getNodes(), writeField);
+
+    for (Field& field: mFields)
+        field.mStats = Stats();
+    mHasSamples = false;
+    // next window is started by the next sample
+    mWindowEnd = std::chrono::steady_clock::time_point::max();
+    return out.GetString();
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace modmqttd {
+
+class MqttObjectState;
+class MqttObjectDataNode;
+class MqttObjectDataNodeList;
+
+/**
+ * Statistics of converted state values collected over a time window.
+ *
+ * Every state field keeps running min, max, mean and variance (Welford)
+ * so memory does not depend on number of samples. Aggregated payload has
+ * the same structure as state payload with every value replaced by
+ * an object with requested statistics.
+ * */
+class MqttAggregate {
+    public:
+        enum Function {
+            MIN = 1,
+            MAX = 2,
+            MEAN = 4,
+            LAST = 8,
+            COUNT = 16,
+            STDDEV = 32,
+            ALL = MIN | MAX | MEAN | LAST | COUNT | STDDEV
+        };
+
+        static int parseFunction(const std::string& pName);
+
+        MqttAggregate() {}
+        MqttAggregate(std::chrono::milliseconds pWindow, int pFunctions, const std::string& pTopic)
+            : mWindow(pWindow), mFunctions(pFunctions), mTopic(pTopic)
+        {}
+
+        bool isSet() const { return mWindow.count() != 0; }
+        // empty if aggregate is published on state topic
+        const std::string& getTopic() const { return mTopic; }
+
+        // add samples for fields that use one of pSlots, starts a new window
+        // if there is no current one
+        void addSamples(const MqttObjectState& pState, const std::vector<int>& pSlots, const std::chrono::steady_clock::time_point& pNow);
+        // window is started by the first sample after previous window,
+        // time_point::max() if there are no samples
+        const std::chrono::steady_clock::time_point& getWindowEnd() const { return mWindowEnd; }
+        // renders payload for current window and starts the next one
+        std::string finishWindow(const MqttObjectState& pState);
+
+    private:
+        struct Stats {
+            long mCount = 0;
+            double mMin = 0;
+            double mMax = 0;
+            double mMean = 0;
+            // sum of squared differences from the mean
+            double mM2 = 0;
+            double mLast = 0;
+
+            void add(double pValue);
+        };
+
+        struct Field {
+            const MqttObjectDataNode* mNode;
+            std::vector<int> mSlots;
+            Stats mStats;
+        };
+
+        void build(const MqttObjectState& pState);
+        void addFields(const MqttObjectDataNodeList& pNodes);
+        void addField(const MqttObjectDataNode& pNode);
+
+        std::chrono::milliseconds mWindow = std::chrono::milliseconds::zero();
+        int mFunctions = ALL;
+        std::string mTopic;
+
+        std::chrono::steady_clock::time_point mWindowEnd = std::chrono::steady_clock::time_point::max();
+        bool mHasSamples = false;
+
+        // MqttObjectState generation, nodes are owned by the state
+        // so fields are rebuilt if it was copied or changed
+        uint64_t mBuiltGeneration = 0;
+        // in the same order as they are rendered
+        std::vector<Field> mFields;
+        // value slot -> indexes of fields that use it
+        std::vector<std::vector<int>> mSlotFields;
+        // addSamples() buffer, fields already sampled
+        std::vector<int> mSampled;
+};
+
+}
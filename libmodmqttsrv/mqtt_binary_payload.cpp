@@ -0,0 +1,347 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "mqtt_binary_payload.hpp"
+#include "exceptions.hpp"
+
+namespace modmqttd {
+
+// CBOR major types
+static constexpr uint8_t CBOR_UINT = 0;
+static constexpr uint8_t CBOR_NEGINT = 1;
+static constexpr uint8_t CBOR_BYTES = 2;
+static constexpr uint8_t CBOR_TEXT = 3;
+static constexpr uint8_t CBOR_ARRAY = 4;
+static constexpr uint8_t CBOR_MAP = 5;
+static constexpr uint8_t CBOR_SIMPLE = 7;
+
+void
+BinaryPayloadWriter::appendBE(uint64_t pVal, int pBytes) {
+    for (int i = pBytes - 1; i >= 0; i--)
+        mOut += static_cast<char>((pVal >> (i * 8)) & 0xff);
+}
+
+
+void
+BinaryPayloadWriter::cborHead(uint8_t pMajor, uint64_t pVal) {
+    const uint8_t major = pMajor << 5;
+    if (pVal < 24) {
+        mOut += static_cast<char>(major | pVal);
+    } else if (pVal <= UINT8_MAX) {
+        mOut += static_cast<char>(major | 24);
+        appendBE(pVal, 1);
+    } else if (pVal <= UINT16_MAX) {
+        mOut += static_cast<char>(major | 25);
+        appendBE(pVal, 2);
+    } else if (pVal <= UINT32_MAX) {
+        mOut += static_cast<char>(major | 26);
+        appendBE(pVal, 4);
+    } else {
+        mOut += static_cast<char>(major | 27);
+        appendBE(pVal, 8);
+    }
+}
+
+
+void
+BinaryPayloadWriter::msgpackLength(uint8_t pFix, uint8_t pFixMax, uint8_t p8, uint8_t p16, uint8_t p32, size_t pLen) {
+    if (pLen <= pFixMax) {
+        mOut += static_cast<char>(pFix | pLen);
+    } else if (p8 != 0 && pLen <= UINT8_MAX) {
+        mOut += static_cast<char>(p8);
+        appendBE(pLen, 1);
+    } else if (pLen <= UINT16_MAX) {
+        mOut += static_cast<char>(p16);
+        appendBE(pLen, 2);
+    } else {
+        mOut += static_cast<char>(p32);
+        appendBE(pLen, 4);
+    }
+}
+
+
+void
+BinaryPayloadWriter::mapHeader(size_t pCount) {
+    if (mFormat == PayloadFormat::CBOR)
+        cborHead(CBOR_MAP, pCount);
+    else
+        msgpackLength(0x80, 15, 0, 0xde, 0xdf, pCount);
+}
+
+
+void
+BinaryPayloadWriter::arrayHeader(size_t pCount) {
+    if (mFormat == PayloadFormat::CBOR)
+        cborHead(CBOR_ARRAY, pCount);
+    else
+        msgpackLength(0x90, 15, 0, 0xdc, 0xdd, pCount);
+}
+
+
+void
+BinaryPayloadWriter::string(const char* pStr, size_t pLen) {
+    if (mFormat == PayloadFormat::CBOR)
+        cborHead(CBOR_TEXT, pLen);
+    else
+        msgpackLength(0xa0, 31, 0xd9, 0xda, 0xdb, pLen);
+    mOut.append(pStr, pLen);
+}
+
+
+void
+BinaryPayloadWriter::integer(int64_t pVal) {
+    if (mFormat == PayloadFormat::CBOR) {
+        if (pVal >= 0)
+            cborHead(CBOR_UINT, pVal);
+        else
+            cborHead(CBOR_NEGINT, static_cast<uint64_t>(-1 - pVal));
+        return;
+    }
+
+    if (pVal >= 0) {
+        if (pVal <= 127) {
+            mOut += static_cast<char>(pVal);
+        } else if (pVal <= UINT8_MAX) {
+            mOut += '\xcc';
+            appendBE(pVal, 1);
+        } else if (pVal <= UINT16_MAX) {
+            mOut += '\xcd';
+            appendBE(pVal, 2);
+        } else if (pVal <= UINT32_MAX) {
+            mOut += '\xce';
+            appendBE(pVal, 4);
+        } else {
+            mOut += '\xcf';
+            appendBE(pVal, 8);
+        }
+    } else {
+        if (pVal >= -32) {
+            mOut += static_cast<char>(pVal);
+        } else if (pVal >= INT8_MIN) {
+            mOut += '\xd0';
+            appendBE(static_cast<uint64_t>(pVal), 1);
+        } else if (pVal >= INT16_MIN) {
+            mOut += '\xd1';
+            appendBE(static_cast<uint64_t>(pVal), 2);
+        } else if (pVal >= INT32_MIN) {
+            mOut += '\xd2';
+            appendBE(static_cast<uint64_t>(pVal), 4);
+        } else {
+            mOut += '\xd3';
+            appendBE(static_cast<uint64_t>(pVal), 8);
+        }
+    }
+}
+
+
+void
+BinaryPayloadWriter::number(double pVal) {
+    const float single = static_cast<float>(pVal);
+    if (static_cast<double>(single) == pVal || std::isnan(pVal)) {
+        uint32_t bits;
+        std::memcpy(&bits, &single, sizeof(bits));
+        mOut += mFormat == PayloadFormat::CBOR ? '\xfa' : '\xca';
+        appendBE(bits, 4);
+    } else {
+        uint64_t bits;
+        std::memcpy(&bits, &pVal, sizeof(bits));
+        mOut += mFormat == PayloadFormat::CBOR ? '\xfb' : '\xcb';
+        appendBE(bits, 8);
+    }
+}
+
+
+void
+BinaryPayloadWriter::value(const MqttValue& pValue) {
+    switch(pValue.getSourceType()) {
+        case MqttValue::SourceType::INT:
+            integer(pValue.getInt());
+            break;
+        case MqttValue::SourceType::DOUBLE:
+            if (pValue.getDoublePrecision() == 0)
+                integer(pValue.getInt64());
+            else
+                number(pValue.getDouble());
+            break;
+        case MqttValue::SourceType::BINARY:
+            string(static_cast<const char*>(pValue.getBinaryPtr()), pValue.getBinarySize());
+            break;
+        case MqttValue::SourceType::INT64:
+            integer(pValue.getInt64());
+            break;
+    }
+}
+
+
+class BinaryInput {
+    public:
+        BinaryInput(const void* pData, size_t pLen)
+            : mPtr(static_cast<const uint8_t*>(pData)), mEnd(mPtr + pLen) {}
+
+        bool atEnd() const { return mPtr == mEnd; }
+
+        uint8_t byte() {
+            need(1);
+            return *mPtr++;
+        }
+
+        uint64_t readBE(int pBytes) {
+            need(pBytes);
+            uint64_t ret = 0;
+            for (int i = 0; i < pBytes; i++)
+                ret = (ret << 8) | *mPtr++;
+            return ret;
+        }
+
+        const void* bytes(uint64_t pLen) {
+            need(pLen);
+            const void* ret = mPtr;
+            mPtr += pLen;
+            return ret;
+        }
+
+    private:
+        const uint8_t* mPtr;
+        const uint8_t* mEnd;
+
+        void need(uint64_t pLen) const {
+            if (static_cast<uint64_t>(mEnd - mPtr) < pLen)
+                throw MqttPayloadConversionException("Conversion failed, payload is truncated");
+        }
+};
+
+
+static MqttValue
+integerValue(int64_t pVal) {
+    if (pVal >= INT32_MIN && pVal <= INT32_MAX)
+        return MqttValue::fromInt(static_cast<int32_t>(pVal));
+    return MqttValue::fromInt64(pVal);
+}
+
+
+static int64_t
+toSigned(uint64_t pVal) {
+    if (pVal > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+        throw MqttPayloadConversionException("Conversion failed, integer value out of range");
+    return static_cast<int64_t>(pVal);
+}
+
+
+static double
+floatValue(uint32_t pBits) {
+    float ret;
+    std::memcpy(&ret, &pBits, sizeof(ret));
+    return ret;
+}
+
+
+static double
+doubleValue(uint64_t pBits) {
+    double ret;
+    std::memcpy(&ret, &pBits, sizeof(ret));
+    return ret;
+}
+
+
+static double
+halfValue(uint16_t pBits) {
+    // RFC 8949 Appendix D
+    const int exp = (pBits >> 10) & 0x1f;
+    const int mant = pBits & 0x3ff;
+    double ret;
+    if (exp == 0)
+        ret = std::ldexp(mant, -24);
+    else if (exp != 31)
+        ret = std::ldexp(mant + 1024, exp - 25);
+    else
+        ret = mant == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+    return (pBits & 0x8000) ? -ret : ret;
+}
+
+
+static MqttValue
+readCbor(BinaryInput& pIn) {
+    const uint8_t head = pIn.byte();
+    const uint8_t major = head >> 5;
+    const uint8_t info = head & 0x1f;
+
+    if (major == CBOR_SIMPLE) {
+        switch(info) {
+            case 20: return MqttValue::fromInt(0);
+            case 21: return MqttValue::fromInt(1);
+            case 25: return MqttValue::fromDouble(halfValue(pIn.readBE(2)));
+            case 26: return MqttValue::fromDouble(floatValue(pIn.readBE(4)));
+            case 27: return MqttValue::fromDouble(doubleValue(pIn.readBE(8)));
+        }
+        throw MqttPayloadConversionException("Conversion failed, unsupported CBOR simple value");
+    }
+
+    uint64_t arg;
+    if (info < 24)
+        arg = info;
+    else if (info <= 27)
+        arg = pIn.readBE(1 << (info - 24));
+    else
+        throw MqttPayloadConversionException("Conversion failed, indefinite length CBOR items are not supported");
+
+    switch(major) {
+        case CBOR_UINT:
+            return integerValue(toSigned(arg));
+        case CBOR_NEGINT:
+            return integerValue(-1 - toSigned(arg));
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            return MqttValue::fromBinary(pIn.bytes(arg), arg);
+    }
+    throw MqttPayloadConversionException("Conversion failed, expecting a scalar CBOR value");
+}
+
+
+static MqttValue
+readMsgpack(BinaryInput& pIn) {
+    const uint8_t head = pIn.byte();
+
+    if (head <= 0x7f)
+        return MqttValue::fromInt(head);
+    if (head >= 0xe0)
+        return MqttValue::fromInt(static_cast<int8_t>(head));
+    if ((head & 0xe0) == 0xa0) {
+        uint64_t len = head & 0x1f;
+        return MqttValue::fromBinary(pIn.bytes(len), len);
+    }
+
+    uint64_t len;
+    switch(head) {
+        case 0xc2: return MqttValue::fromInt(0);
+        case 0xc3: return MqttValue::fromInt(1);
+        case 0xca: return MqttValue::fromDouble(floatValue(pIn.readBE(4)));
+        case 0xcb: return MqttValue::fromDouble(doubleValue(pIn.readBE(8)));
+        case 0xcc: return integerValue(pIn.readBE(1));
+        case 0xcd: return integerValue(pIn.readBE(2));
+        case 0xce: return integerValue(pIn.readBE(4));
+        case 0xcf: return integerValue(toSigned(pIn.readBE(8)));
+        case 0xd0: return integerValue(static_cast<int8_t>(pIn.readBE(1)));
+        case 0xd1: return integerValue(static_cast<int16_t>(pIn.readBE(2)));
+        case 0xd2: return integerValue(static_cast<int32_t>(pIn.readBE(4)));
+        case 0xd3: return integerValue(static_cast<int64_t>(pIn.readBE(8)));
+        case 0xc4: case 0xd9: len = pIn.readBE(1); break;
+        case 0xc5: case 0xda: len = pIn.readBE(2); break;
+        case 0xc6: case 0xdb: len = pIn.readBE(4); break;
+        default:
+            throw MqttPayloadConversionException("Conversion failed, expecting a scalar MessagePack value");
+    }
+    return MqttValue::fromBinary(pIn.bytes(len), len);
+}
+
+
+MqttValue
+BinaryPayloadReader::readValue(PayloadFormat pFormat, const void* pData, size_t pLen) {
+    BinaryInput in(pData, pLen);
+    MqttValue ret(pFormat == PayloadFormat::CBOR ? readCbor(in) : readMsgpack(in));
+    if (!in.atEnd())
+        throw MqttPayloadConversionException("Conversion failed, unexpected data after value");
+    return ret;
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "libmodmqttconv/mqttvalue.hpp"
+
+namespace modmqttd {
+
+enum class PayloadFormat {
+    JSON,
+    CBOR,
+    MSGPACK,
+    // register values as big endian 16 bit words
+    RAW
+};
+
+/**
+ * Appends CBOR (RFC 8949) or MessagePack items to a string buffer.
+ *
+ * Integers and lengths are written using the shortest encoding,
+ * doubles are written as float32 if no precision is lost.
+ * */
+class BinaryPayloadWriter {
+    public:
+        BinaryPayloadWriter(PayloadFormat pFormat, std::string& pOut) : mFormat(pFormat), mOut(pOut) {}
+
+        void mapHeader(size_t pCount);
+        void arrayHeader(size_t pCount);
+        void string(const char* pStr, size_t pLen);
+        void integer(int64_t pVal);
+        void number(double pVal);
+        // same rules as json output in MqttPayload
+        void value(const MqttValue& pValue);
+
+    private:
+        PayloadFormat mFormat;
+        std::string& mOut;
+
+        void cborHead(uint8_t pMajor, uint64_t pVal);
+        void msgpackLength(uint8_t pFix, uint8_t pFixMax, uint8_t p8, uint8_t p16, uint8_t p32, size_t pLen);
+        void appendBE(uint64_t pVal, int pBytes);
+};
+
+/**
+ * Decodes a single CBOR or MessagePack scalar used as command payload
+ * */
+class BinaryPayloadReader {
+    public:
+        // throws MqttPayloadConversionException for lists, maps,
+        // malformed and trailing data
+        static MqttValue readValue(PayloadFormat pFormat, const void* pData, size_t pLen);
+};
+
+}
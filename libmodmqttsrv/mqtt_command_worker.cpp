@@ -0,0 +1,126 @@
+#include "mqtt_command_worker.hpp"
+
+#include "default_command_converter.hpp"
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "mqtt_binary_payload.hpp"
+#include "threadutils.hpp"
+
+namespace modmqttd {
+
+static MqttValue
+createMqttValue(const MqttObjectCommand& command, const void* data, int datalen) {
+    MqttValue ret;
+
+    switch (command.mPayloadType) {
+    case MqttObjectCommand::PayloadType::STRING:
+        ret = MqttValue::fromBinary(data, datalen);
+        break;
+    case MqttObjectCommand::PayloadType::CBOR:
+        ret = BinaryPayloadReader::readValue(PayloadFormat::CBOR, data, datalen);
+        break;
+    case MqttObjectCommand::PayloadType::MSGPACK:
+        ret = BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, data, datalen);
+        break;
+    default:
+        throw MqttPayloadConversionException("Conversion failed, unknown payload type" + std::to_string(command.mPayloadType));
+    }
+
+    return ret;
+}
+
+bool
+MqttCommandWorker::convert(const MqttObjectCommand& command, const void* pPayload, int pPayloadlen, ModbusRegisters& reg_values) {
+    static const DefaultCommandConverter defaultConverter;
+    try {
+        if (command.mPayloadType == MqttObjectCommand::PayloadType::RAW) {
+            if (pPayloadlen != command.mCount * 2)
+                throw MqttPayloadConversionException(std::string("Conversion failed, expecting ") + std::to_string(command.mCount * 2) + " bytes, got " + std::to_string(pPayloadlen));
+            const uint8_t* data = static_cast<const uint8_t*>(pPayload);
+            for (int i = 0; i < command.mCount; i++)
+                reg_values.appendValue((data[i * 2] << 8) | data[i * 2 + 1]);
+        } else {
+            MqttValue tmpval(createMqttValue(command, pPayload, pPayloadlen));
+            if (command.hasConverter()) {
+                reg_values = command.getConverter().toModbus(tmpval, command.mCount);
+            } else {
+                reg_values = defaultConverter.toModbus(tmpval, command.mCount);
+            }
+        }
+
+        if (reg_values.getCount() != command.mCount) {
+            throw MqttPayloadConversionException(std::string("Conversion failed, expecting ") + std::to_string(command.mCount) + " register values, got " + std::to_string(reg_values.getCount()));
+        }
+        return true;
+    } catch (const ConvException& ex) {
+        spdlog::error("Converter error for {}: {}", command.mTopic, ex.what());
+    } catch (const MqttPayloadConversionException& ex) {
+        spdlog::error("Value error for {}: {}", command.mTopic, ex.what());
+    }
+    return false;
+}
+
+bool
+MqttCommandWorker::execute(const MqttObjectCommand& pCommand, ModbusClient& pClient,
+                           const void* pPayload, int pPayloadLen,
+                           const std::chrono::steady_clock::time_point& pReceived)
+{
+    ModbusRegisters values;
+    if (!convert(pCommand, pPayload, pPayloadLen, values))
+        return false;
+    pClient.sendCommand(pCommand, values, pReceived);
+    return true;
+}
+
+void
+MqttCommandWorker::start() {
+    mThread = std::thread([this]() {
+        ThreadUtils::set_thread_name("commands");
+        run();
+    });
+    spdlog::debug("Started mqtt command worker");
+}
+
+void
+MqttCommandWorker::enqueue(Command&& pCommand) {
+    mInput.enqueue(std::move(pCommand));
+}
+
+void
+MqttCommandWorker::run() {
+    bool running = true;
+    while (running) {
+        Command cmd;
+        mInput.wait_dequeue(cmd);
+        mWrites.clear();
+
+        // convert a burst of commands first, then send
+        // all write requests to modbus threads at once
+        int count = 0;
+        do {
+            if (cmd.mCommand == nullptr) {
+                running = false;
+                break;
+            }
+            Write write;
+            write.mClient = cmd.mClient;
+            write.mCommand = cmd.mCommand;
+            write.mReceived = cmd.mReceived;
+            if (convert(*cmd.mCommand, cmd.mPayload.data(), cmd.mPayload.size(), write.mValues))
+                mWrites.push_back(std::move(write));
+        } while (++count < MAX_BATCH_SIZE && mInput.try_dequeue(cmd));
+
+        for (const Write& write: mWrites)
+            write.mClient->sendCommand(*write.mCommand, write.mValues, write.mReceived);
+    }
+}
+
+void
+MqttCommandWorker::stop() {
+    if (!mThread.joinable())
+        return;
+    mInput.enqueue(Command());
+    mThread.join();
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../readerwriterqueue/readerwriterqueue.h"
+
+#include "modbus_client.hpp"
+#include "mqttcommand.hpp"
+
+namespace modmqttd {
+
+/**
+ * Converts command payloads and sends write requests to modbus
+ * clients on a separate thread.
+ *
+ * Mosquitto network loop runs in the main thread, converters
+ * executed there delay reading of incoming messages and keepalive
+ * handling. Main thread is the only producer, commands are executed
+ * in the order they were received.
+ * */
+class MqttCommandWorker {
+    public:
+        struct Command {
+            // nullptr stops the worker
+            const MqttObjectCommand* mCommand = nullptr;
+            ModbusClient* mClient = nullptr;
+            std::string mPayload;
+            std::chrono::steady_clock::time_point mReceived;
+        };
+
+        // max number of queued commands converted before
+        // write requests are sent to modbus clients
+        static constexpr int MAX_BATCH_SIZE = 64;
+
+        MqttCommandWorker() {}
+        MqttCommandWorker(const MqttCommandWorker&) = delete;
+        MqttCommandWorker& operator=(const MqttCommandWorker&) = delete;
+
+        /**
+         * Converts payload to register values and sends write request
+         * to pClient. Conversion errors are logged.
+         * Returns false if payload cannot be converted
+         * */
+        static bool execute(const MqttObjectCommand& pCommand, ModbusClient& pClient,
+                            const void* pPayload, int pPayloadLen,
+                            const std::chrono::steady_clock::time_point& pReceived);
+
+        void start();
+        // main thread only
+        void enqueue(Command&& pCommand);
+        // execute all queued commands and stop the thread
+        void stop();
+        ~MqttCommandWorker() { stop(); }
+
+    private:
+        struct Write {
+            ModbusClient* mClient;
+            const MqttObjectCommand* mCommand;
+            ModbusRegisters mValues;
+            std::chrono::steady_clock::time_point mReceived;
+        };
+
+        moodycamel::BlockingReaderWriterQueue<Command> mInput;
+        std::thread mThread;
+        // write requests for current batch, kept to reuse its capacity
+        std::vector<Write> mWrites;
+
+        void run();
+        static bool convert(const MqttObjectCommand& pCommand, const void* pPayload, int pPayloadLen, ModbusRegisters& pValues);
+};
+
+}
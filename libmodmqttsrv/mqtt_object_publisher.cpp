@@ -0,0 +1,524 @@
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "mqtt_object_publisher.hpp"
+#include "exceptions.hpp"
+#include "logging.hpp"
+
+namespace modmqttd {
+
+void
+MqttObjectPublisher::setObjects(const MqttPollObjMap& pObjects) {
+    mObjects.clear();
+    mNetworkIds.clear();
+    mAllObjects.clear();
+    mNetworkObjects.clear();
+
+    std::set<std::shared_ptr<MqttObject>> all;
+    // object can be listed under many poll groups from the same network
+    std::set<std::pair<int, std::shared_ptr<MqttObject>>> added;
+    for (const auto& group: pObjects) {
+        int networkId = mNetworkIds.add(group.first.mNetworkName);
+        if (size_t(networkId) == mNetworkObjects.size())
+            mNetworkObjects.emplace_back();
+        mObjects[group.first.key(networkId)] = group.second;
+        for (const std::shared_ptr<MqttObject>& obj: group.second) {
+            if (all.insert(obj).second)
+                mAllObjects.push_back(obj);
+            if (added.insert(std::make_pair(networkId, obj)).second)
+                mNetworkObjects[networkId].push_back(obj);
+        }
+    }
+
+    // objects are updated by network id from this publisher
+    for (const std::shared_ptr<MqttObject>& obj: mAllObjects)
+        obj->setNetworkIds(mNetworkIds);
+    mNetworkObjects.resize(mNetworkIds.size());
+}
+
+
+void
+MqttObjectPublisher::setCommandObjects(const MqttCmdObjMap& pCmdObjects) {
+    mCommandObjects.clear();
+    for (const auto& cmd: pCmdObjects) {
+        mCommandObjects[cmd.first] = cmd.second;
+        for (const std::shared_ptr<MqttObject>& obj: cmd.second)
+            obj->setNetworkIds(mNetworkIds);
+    }
+    mNetworkObjects.resize(mNetworkIds.size());
+}
+
+
+void
+MqttObjectPublisher::processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValues& pSlaveData) {
+    std::vector<std::shared_ptr<MqttObject>>& changedObjects(mChangedObjects);
+    changedObjects.clear();
+    mUpdateRound++;
+    try {
+        updateObjects(mNetworkIds.find(pModbusNetworkName), pSlaveData, changedObjects);
+        for (const std::shared_ptr<MqttObject>& obj: changedObjects)
+            publishStateUpdate(obj, obj->needStateRepublish());
+        publishDevices();
+    } catch (const MosquittoException& ex) {
+        spdlog::error("Failed to publish mqtt state message: {}", ex.what());
+    }
+}
+
+void
+MqttObjectPublisher::processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValuesBatch& pBatch) {
+    // update all objects first, then publish every changed object once.
+    // Objects with registers from multiple poll groups are published
+    // with complete state instead of a partial update per group.
+    std::vector<std::shared_ptr<MqttObject>>& changedObjects(mChangedObjects);
+    changedObjects.clear();
+    mUpdateRound++;
+    try {
+        int networkId = mNetworkIds.find(pModbusNetworkName);
+        for (const MsgRegisterValues& values: pBatch.mValues)
+            updateObjects(networkId, values, changedObjects);
+        for (const std::shared_ptr<MqttObject>& obj: changedObjects)
+            publishStateUpdate(obj, obj->needStateRepublish());
+        publishDevices();
+    } catch (const MosquittoException& ex) {
+        spdlog::error("Failed to publish mqtt state message: {}", ex.what());
+    }
+}
+
+void
+MqttObjectPublisher::updateObjects(int pNetworkId, const MsgRegisterValues& pSlaveData, std::vector<std::shared_ptr<MqttObject>>& pChangedObjects) {
+    std::vector<std::shared_ptr<MqttObject>>* affectedObjects = nullptr;
+
+    if (pSlaveData.hasCommandId()) {
+        affectedObjects = mCommandObjects.find(pSlaveData.getCommandId());
+        if (affectedObjects == nullptr && pSlaveData.isRpc() && pNetworkId != -1) {
+            // An RPC read also feeds the matching polled object, so state-topic
+            // subscribers keep seeing values even while the scheduled poll is
+            // deferred. The object's own publish logic decides whether to emit:
+            // ON_CHANGE publishes only on a real value change (no flood, every
+            // change captured), EVERY_POLL is rate-limited to the refresh period
+            // (a burst of RPC reads cannot flood the topic). The RPC register
+            // need not be polled - a lookup miss just means no object to update.
+            affectedObjects = mObjects.find(MqttObjectRegisterIdent::key(pNetworkId, pSlaveData));
+        }
+    } else if (pNetworkId != -1) {
+        // not found if all objects for this poll group
+        // are owned by other publishers
+        affectedObjects = mObjects.find(MqttObjectRegisterIdent::key(pNetworkId, pSlaveData));
+    }
+
+    // possible if write command registers do not overlap with
+    // any MqttObject
+    if (affectedObjects == nullptr) {
+        spdlog::trace("No affected objects for received register values");
+        return;
+    }
+
+    for (std::shared_ptr<MqttObject>& obj: *affectedObjects) {
+        AvailableFlag oldAvail = obj->getAvailableFlag();
+        if (obj->updateRegisterValues(pNetworkId, pSlaveData))
+            obj->mPublishLimits.mChanged = true;
+        AvailableFlag newAvail = obj->getAvailableFlag();
+        // new samples may start aggregation window
+        if (obj->getAggregate().isSet())
+            scheduleTimer(obj);
+
+        if (oldAvail != newAvail) {
+            if (newAvail == AvailableFlag::True) {
+                // if object is not retained
+                // then publish state changes only
+                // if availability is already set to true
+                if (obj->getRetain()) {
+                    publishState(obj, true);
+                } else {
+                    // delete retained message
+                    if (oldAvail == AvailableFlag::NotSet) {
+                        mOutput.publish(obj->getStateTopic(), 0, NULL, obj->getAvailabilityProps());
+                        // remember initial payload for comparsion with subsequent modbus data updates
+                        if (!obj->getRetain())
+                            obj->setLastPublishedPayload(obj->getStatePayload());
+                        // start heartbeat for initial state
+                        if (obj->mPublishLimits.mMaxInterval.count() != 0) {
+                            obj->mPublishLimits.mHeartbeat = std::chrono::steady_clock::now() + obj->mPublishLimits.mMaxInterval;
+                            scheduleTimer(obj);
+                        }
+                    }
+                    if (obj->getPublishMode() == PublishMode::EVERY_POLL)
+                        publishState(obj, true);
+                }
+            }
+            publishAvailabilityChange(*obj);
+        } else if (obj->mPublishLimits.mUpdateRound != mUpdateRound
+            && (obj->mPublishLimits.mChanged || obj->needStateRepublish()))
+        {
+            // unchanged values are published only in every_poll mode
+            obj->mPublishLimits.mUpdateRound = mUpdateRound;
+            pChangedObjects.push_back(obj);
+        }
+    }
+}
+
+void
+MqttObjectPublisher::publishState(const std::shared_ptr<MqttObject>& obj, bool force) {
+    if (obj->getAvailableFlag() != AvailableFlag::True)
+        return;
+    // state topic is used for aggregated values only
+    if (obj->getAggregate().isSet() && obj->getAggregateTopic() == obj->getStateTopic())
+        return;
+    if (obj->getPublishMode() == PublishMode::ONCE) {
+        if (obj->getLastPublishTime() != std::chrono::steady_clock::time_point::min())
+            return;
+    }
+
+    const std::string& messageData(obj->getStatePayload());
+    if (messageData != obj->getLastPublishedPayload() || force) {
+        if (!obj->isDeviceTopicOnly())
+            mOutput.publish(obj->getStateTopic(), messageData.length(), messageData.c_str(), obj->getStateProps());
+        if (!obj->getDeviceTopic().empty()) {
+            obj->setLastDeviceValue(obj->getDeviceValue());
+            addDeviceUpdate(obj);
+        }
+        obj->setLastPublishedPayload(messageData);
+        obj->setLastPublishTime(std::chrono::steady_clock::now());
+
+        MqttObjectPublishLimits& limits(obj->mPublishLimits);
+        if (limits.isSet()) {
+            // this publish supersedes any delayed one
+            limits.mPendingPublish = std::chrono::steady_clock::time_point::max();
+            if (limits.mMaxInterval.count() != 0)
+                limits.mHeartbeat = obj->getLastPublishTime() + limits.mMaxInterval;
+            scheduleTimer(obj);
+        }
+    }
+}
+
+void
+MqttObjectPublisher::publishStateUpdate(const std::shared_ptr<MqttObject>& obj, bool force) {
+    MqttObjectPublishLimits& limits(obj->mPublishLimits);
+    bool changed = limits.mChanged;
+    // keep the flag until state can be published, unchanged
+    // values are not passed here after availability is back
+    if (obj->getAvailableFlag() == AvailableFlag::True)
+        limits.mChanged = false;
+    if (!limits.isSet() || (limits.mMinInterval.count() == 0 && limits.mDebounce.count() == 0)) {
+        publishState(obj, force);
+        return;
+    }
+
+    if (obj->getAvailableFlag() != AvailableFlag::True)
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = now;
+    bool pending = limits.mPendingPublish != std::chrono::steady_clock::time_point::max();
+
+    if (limits.mDebounce.count() != 0) {
+        // every new value restarts debounce period, unchanged
+        // values from every_poll refresh do not
+        if (changed)
+            deadline = now + limits.mDebounce;
+        else if (pending)
+            deadline = limits.mPendingPublish;
+        else if (!force)
+            return;
+    } else if (!force && !pending && obj->getStatePayload() == obj->getLastPublishedPayload()) {
+        return;
+    }
+
+    if (limits.mMinInterval.count() != 0 && obj->getLastPublishTime() != std::chrono::steady_clock::time_point::min())
+        deadline = std::max(deadline, obj->getLastPublishTime() + limits.mMinInterval);
+
+    if (deadline <= now) {
+        force = force || limits.mPendingForce;
+        limits.mPendingPublish = std::chrono::steady_clock::time_point::max();
+        limits.mPendingForce = false;
+        publishState(obj, force);
+        scheduleTimer(obj);
+        return;
+    }
+
+    // publish the latest state when deadline is reached
+    limits.mPendingPublish = deadline;
+    limits.mPendingForce = limits.mPendingForce || force;
+    scheduleTimer(obj);
+}
+
+void
+MqttObjectPublisher::publishHeartbeat(const std::shared_ptr<MqttObject>& obj) {
+    // republish last state, changes delayed by debounce
+    // or min_publish_interval are not published here
+    const std::string& messageData(obj->getLastPublishedPayload());
+    if (!obj->isDeviceTopicOnly())
+        mOutput.publish(obj->getStateTopic(), messageData.length(), messageData.c_str(), obj->getStateProps());
+    if (!obj->getDeviceTopic().empty())
+        addDeviceUpdate(obj);
+    obj->setLastPublishTime(std::chrono::steady_clock::now());
+    obj->mPublishLimits.mHeartbeat = obj->getLastPublishTime() + obj->mPublishLimits.mMaxInterval;
+}
+
+void
+MqttObjectPublisher::addDeviceUpdate(const std::shared_ptr<MqttObject>& obj) {
+    if (obj->mPublishLimits.mDeviceUpdate)
+        return;
+    obj->mPublishLimits.mDeviceUpdate = true;
+    mDeviceUpdates.push_back(obj);
+}
+
+void
+MqttObjectPublisher::publishDevices() {
+    // there are only a few device topics per poll round, so objects
+    // are grouped by scanning the list instead of building a map
+    for (size_t i = 0; i < mDeviceUpdates.size(); i++) {
+        const std::shared_ptr<MqttObject>& first(mDeviceUpdates[i]);
+        // already published with its device
+        if (!first->mPublishLimits.mDeviceUpdate)
+            continue;
+
+        const std::string& deviceTopic(first->getDeviceTopic());
+        // all objects on device topic have the same payload format, see ModMqtt::parseObjects
+        PayloadFormat format = first->getPayloadFormat();
+        MqttPublishProps props;
+        size_t count = 0;
+        for (size_t j = i; j < mDeviceUpdates.size(); j++) {
+            const MqttObject& obj(*mDeviceUpdates[j]);
+            if (obj.mPublishLimits.mDeviceUpdate && obj.getDeviceTopic() == deviceTopic) {
+                props.mQos = std::max(props.mQos, obj.getQos());
+                count++;
+            }
+        }
+
+        std::string& payload(mDevicePayload);
+        payload.clear();
+        BinaryPayloadWriter binary(format, payload);
+        if (format == PayloadFormat::JSON)
+            payload += '{';
+        else
+            binary.mapHeader(count);
+
+        rapidjson::Writer<rapidjson::StringBuffer> keyWriter(mDeviceKey);
+        for (size_t j = i; j < mDeviceUpdates.size(); j++) {
+            MqttObject& obj(*mDeviceUpdates[j]);
+            if (!obj.mPublishLimits.mDeviceUpdate || obj.getDeviceTopic() != deviceTopic)
+                continue;
+            obj.mPublishLimits.mDeviceUpdate = false;
+
+            if (format == PayloadFormat::JSON) {
+                if (payload.back() != '{')
+                    payload += ',';
+                mDeviceKey.Clear();
+                keyWriter.Reset(mDeviceKey);
+                keyWriter.String(obj.getTopic().c_str(), obj.getTopic().length());
+                payload.append(mDeviceKey.GetString(), mDeviceKey.GetSize());
+                payload += ':';
+            } else {
+                binary.string(obj.getTopic().c_str(), obj.getTopic().length());
+            }
+            payload += obj.getLastDeviceValue();
+        }
+        if (format == PayloadFormat::JSON)
+            payload += '}';
+
+        mOutput.publish(deviceTopic, payload.length(), payload.c_str(), props);
+    }
+    mDeviceUpdates.clear();
+}
+
+void
+MqttObjectPublisher::scheduleTimer(const std::shared_ptr<MqttObject>& obj) {
+    MqttObjectPublishLimits& limits(obj->mPublishLimits);
+    std::chrono::steady_clock::time_point next = std::min({limits.mPendingPublish, limits.mHeartbeat, obj->getAggregate().getWindowEnd()});
+    if (next == limits.mTimer)
+        return;
+    limits.mTimer = next;
+    if (next != std::chrono::steady_clock::time_point::max())
+        mTimers.push(Timer{next, obj});
+}
+
+std::chrono::steady_clock::time_point
+MqttObjectPublisher::processTimers(const std::chrono::steady_clock::time_point& pNow) {
+    while (!mTimers.empty() && mTimers.top().mTime <= pNow) {
+        std::shared_ptr<MqttObject> obj(mTimers.top().mObject);
+        std::chrono::steady_clock::time_point time(mTimers.top().mTime);
+        mTimers.pop();
+
+        MqttObjectPublishLimits& limits(obj->mPublishLimits);
+        if (limits.mTimer != time)
+            continue;
+        limits.mTimer = std::chrono::steady_clock::time_point::max();
+
+        try {
+            if (obj->getAvailableFlag() != AvailableFlag::True) {
+                // resumed after next publish
+                limits.mPendingPublish = std::chrono::steady_clock::time_point::max();
+                limits.mPendingForce = false;
+                limits.mHeartbeat = std::chrono::steady_clock::time_point::max();
+            } else if (limits.mPendingPublish <= pNow) {
+                bool force = limits.mPendingForce;
+                limits.mPendingPublish = std::chrono::steady_clock::time_point::max();
+                limits.mPendingForce = false;
+                publishState(obj, force);
+            }
+
+            if (limits.mHeartbeat <= pNow)
+                publishHeartbeat(obj);
+
+            if (obj->getAggregate().getWindowEnd() <= pNow) {
+                std::string payload(obj->getAggregate().finishWindow(obj->mState));
+                mOutput.publish(obj->getAggregateTopic(), payload.length(), payload.c_str(), obj->getStateProps());
+            }
+        } catch (const MosquittoException& ex) {
+            spdlog::error("Failed to publish mqtt state message: {}", ex.what());
+        }
+        scheduleTimer(obj);
+    }
+    processRepublish(pNow);
+    try {
+        publishDevices();
+    } catch (const MosquittoException& ex) {
+        spdlog::error("Failed to publish mqtt device message: {}", ex.what());
+    }
+    return getNextTimer();
+}
+
+std::chrono::steady_clock::time_point
+MqttObjectPublisher::getNextTimer() const {
+    if (mTimers.empty())
+        return getNextRepublish();
+    return std::min(mTimers.top().mTime, getNextRepublish());
+}
+
+void
+MqttObjectPublisher::processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pSlaveData) {
+    int networkId = mNetworkIds.find(pModbusNetworkName);
+    if (networkId == -1)
+        return;
+    std::vector<std::shared_ptr<MqttObject>>* objects = mObjects.find(MqttObjectRegisterIdent::key(networkId, pSlaveData));
+
+    // msg was sent after failed write and
+    // is not related MqttObjectState
+    if (objects == nullptr)
+        return;
+
+    for (std::shared_ptr<MqttObject>& obj: *objects) {
+        AvailableFlag oldAvail = obj->getAvailableFlag();
+        obj->updateRegistersReadFailed(networkId, pSlaveData);
+        AvailableFlag newAvail = obj->getAvailableFlag();
+
+        publishState(obj);
+
+        if (oldAvail != newAvail) {
+            publishAvailabilityChange(*obj);
+        }
+    }
+    publishDevices();
+}
+
+void
+MqttObjectPublisher::processModbusNetworkState(const std::string& pNetworkName, bool pIsUp) {
+    // wait for initial poll
+    if (pIsUp)
+        return;
+
+    int networkId = mNetworkIds.find(pNetworkName);
+    if (networkId == -1)
+        return;
+
+    for (const std::shared_ptr<MqttObject>& obj: mNetworkObjects[networkId]) {
+        AvailableFlag oldAvail = obj->getAvailableFlag();
+        obj->setModbusNetworkState(networkId, pIsUp);
+        if (oldAvail != obj->getAvailableFlag())
+            publishAvailabilityChange(*obj);
+    }
+}
+
+void
+MqttObjectPublisher::publishAvailabilityChange(const MqttObject& obj) {
+    if (obj.getAvailableFlag() == AvailableFlag::NotSet)
+        return;
+    try {
+        char msg = obj.getAvailableFlag() == AvailableFlag::True ? '1' : '0';
+        mOutput.publish(obj.getAvailabilityTopic(), 1, &msg, obj.getAvailabilityProps());
+    } catch (const MosquittoException& ex) {
+        spdlog::error("Failed to publish mqtt availability message: {}", ex.what());
+    }
+}
+
+int
+MqttObjectPublisher::republish(const std::shared_ptr<MqttObject>& obj) {
+    int count = 0;
+    if (obj->getAvailableFlag() == AvailableFlag::True) {
+        publishState(obj, true);
+        count++;
+    }
+    if (obj->getAvailableFlag() != AvailableFlag::NotSet) {
+        publishAvailabilityChange(*obj);
+        count++;
+    }
+    return count;
+}
+
+void
+MqttObjectPublisher::publishAll(bool pSessionPresent) {
+    mRepublishQueue.clear();
+
+    for (const std::shared_ptr<MqttObject>& obj: mAllObjects) {
+        // retained messages are still on the broker
+        if (pSessionPresent && !obj->getRepublishOnResume())
+            continue;
+        // objects without initial poll are published
+        // when their availability is set
+        if (obj->getAvailableFlag() == AvailableFlag::NotSet)
+            continue;
+        if (mRepublishRate == 0)
+            republish(obj);
+        else
+            mRepublishQueue.push_back(obj);
+    }
+
+    publishDevices();
+
+    if (!mRepublishQueue.empty()) {
+        spdlog::debug("Republishing {} object(s) at {} messages/s", mRepublishQueue.size(), mRepublishRate);
+        mRepublishBudget = 1;
+        mRepublishTime = std::chrono::steady_clock::now();
+    }
+}
+
+void
+MqttObjectPublisher::processRepublish(const std::chrono::steady_clock::time_point& pNow) {
+    if (mRepublishQueue.empty() || pNow < mRepublishTime)
+        return;
+
+    std::chrono::duration<double> elapsed(pNow - mRepublishTime);
+    // do not accumulate more than one second of budget
+    // if we were not called for a long time
+    mRepublishBudget = std::min(mRepublishBudget + elapsed.count() * mRepublishRate, std::max(mRepublishRate, 1.0));
+    mRepublishTime = pNow;
+
+    while (!mRepublishQueue.empty() && mRepublishBudget >= 1) {
+        std::shared_ptr<MqttObject> obj(mRepublishQueue.front());
+        mRepublishQueue.pop_front();
+        try {
+            mRepublishBudget -= republish(obj);
+        } catch (const MosquittoException& ex) {
+            spdlog::error("Failed to republish mqtt state message: {}", ex.what());
+            mRepublishBudget--;
+        }
+    }
+
+    if (mRepublishQueue.empty())
+        spdlog::debug("Republish finished");
+}
+
+std::chrono::steady_clock::time_point
+MqttObjectPublisher::getNextRepublish() const {
+    if (mRepublishQueue.empty())
+        return std::chrono::steady_clock::time_point::max();
+    std::chrono::duration<double> wait((1 - mRepublishBudget) / mRepublishRate);
+    return mRepublishTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait);
+}
+
+}
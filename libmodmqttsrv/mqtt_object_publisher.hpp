@@ -0,0 +1,135 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <rapidjson/stringbuffer.h>
+
+#include "mqttobject.hpp"
+#include "open_hash_map.hpp"
+
+namespace modmqttd {
+
+/**
+ * Updates MqttObjects with data received from modbus threads
+ * and generates their state and availability messages.
+ *
+ * Not thread safe. Objects are owned by a single publisher,
+ * see MqttPublishWorkers for how they are partitioned.
+ * */
+class MqttObjectPublisher {
+    public:
+        typedef std::map<MqttObjectRegisterIdent, std::vector<std::shared_ptr<MqttObject>>, MqttObjectRegisterIdent::Compare> MqttPollObjMap;
+        typedef std::map<int, std::vector<std::shared_ptr<MqttObject>>> MqttCmdObjMap;
+
+        // destination for generated mqtt messages
+        class Output {
+            public:
+                virtual void publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) = 0;
+                virtual ~Output() {}
+        };
+
+        MqttObjectPublisher(Output& pOutput) : mOutput(pOutput) {}
+
+        // builds lookup indexes, see mObjects and mNetworkObjects,
+        // and assigns network ids to objects
+        void setObjects(const MqttPollObjMap& pObjects);
+        void setCommandObjects(const MqttCmdObjMap& pCmdObjects);
+
+        void processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValues& pValues);
+        void processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValuesBatch& pBatch);
+        void processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pValues);
+        void processModbusNetworkState(const std::string& pModbusNetworkName, bool pIsUp);
+        // publish all data after broker is reconnected. Objects with
+        // republish_on_resume disabled are skipped if broker resumed our session
+        void publishAll(bool pSessionPresent = false);
+        // messages per second for publishAll(), 0 for no limit
+        void setRepublishRate(double pRate) { mRepublishRate = pRate; }
+
+        // publish delayed, heartbeat, aggregated and paced republish messages that are due,
+        // returns time of the next timer or time_point::max() if there is none
+        std::chrono::steady_clock::time_point processTimers(const std::chrono::steady_clock::time_point& pNow);
+        std::chrono::steady_clock::time_point getNextTimer() const;
+
+    private:
+        struct Timer {
+            std::chrono::steady_clock::time_point mTime;
+            std::shared_ptr<MqttObject> mObject;
+
+            bool operator>(const Timer& pOther) const { return mTime > pOther.mTime; }
+        };
+
+        Output& mOutput;
+
+        // min-heap of publish limit timers. Rescheduled objects leave
+        // their old entries behind, those are skipped when popped,
+        // see MqttObjectPublishLimits::mTimer
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> mTimers;
+
+        // objects with device topic that published their state in the
+        // current poll round, in publish order. Kept to reuse its capacity,
+        // see MqttObjectPublishLimits::mDeviceUpdate
+        std::vector<std::shared_ptr<MqttObject>> mDeviceUpdates;
+        std::string mDevicePayload;
+        // escaped JSON object key
+        rapidjson::StringBuffer mDeviceKey;
+        // updated objects in processRegisterValues(), kept to reuse its capacity
+        std::vector<std::shared_ptr<MqttObject>> mChangedObjects;
+        // incremented for every processRegisterValues() call
+        uint64_t mUpdateRound = 0;
+
+        // objects waiting for paced republish after reconnect
+        std::deque<std::shared_ptr<MqttObject>> mRepublishQueue;
+        double mRepublishRate = 0;
+        // number of messages that can be sent at mRepublishTime,
+        // negative if the last object used more than was available
+        double mRepublishBudget = 0;
+        std::chrono::steady_clock::time_point mRepublishTime;
+
+        /**
+         * Assuming that PollGroups do not overlap hold separate list
+         * per poll group ident. This way for each MsgRegisterValues we can update
+         * objects from single list only.
+         * MqttObject can be a member of multiple lists on this map.
+         * Keyed by MqttObjectRegisterIdent::key() with network id from mNetworkIds
+         */
+        OpenHashMap<std::vector<std::shared_ptr<MqttObject>>> mObjects;
+        ModbusNetworkIds mNetworkIds;
+
+        // unique objects from mObjects
+        std::vector<std::shared_ptr<MqttObject>> mAllObjects;
+
+        // unique objects that use registers from a modbus network,
+        // indexed by network id
+        std::vector<std::vector<std::shared_ptr<MqttObject>>> mNetworkObjects;
+
+        /**
+         * Direct relation between command and objects that poll the
+         * same registers, keyed by command id
+         */
+        OpenHashMap<std::vector<std::shared_ptr<MqttObject>>> mCommandObjects;
+
+        void publishState(const std::shared_ptr<MqttObject>&, bool pForce = false);
+        // publishState() for values received from modbus, applies
+        // min_publish_interval and debounce limits
+        void publishStateUpdate(const std::shared_ptr<MqttObject>&, bool pForce);
+        void publishHeartbeat(const std::shared_ptr<MqttObject>& obj);
+        void addDeviceUpdate(const std::shared_ptr<MqttObject>& obj);
+        // publish one combined message per device topic from mDeviceUpdates,
+        // objects keep their publish order in the message
+        void publishDevices();
+        void scheduleTimer(const std::shared_ptr<MqttObject>& obj);
+        void publishAvailabilityChange(const MqttObject& obj);
+        // returns number of published messages
+        int republish(const std::shared_ptr<MqttObject>& obj);
+        void processRepublish(const std::chrono::steady_clock::time_point& pNow);
+        std::chrono::steady_clock::time_point getNextRepublish() const;
+        // update objects with new register values and add
+        // those that may need state publish to pChangedObjects
+        void updateObjects(int pNetworkId, const MsgRegisterValues& pSlaveData, std::vector<std::shared_ptr<MqttObject>>& pChangedObjects);
+};
+
+}
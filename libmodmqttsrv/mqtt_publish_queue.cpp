@@ -0,0 +1,49 @@
+#include "mqtt_publish_queue.hpp"
+
+namespace modmqttd {
+
+void
+MqttPublishQueue::hold(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+    std::list<Message>::iterator it;
+    if (mPolicy == QueueFullPolicy::DROP_OLD) {
+        auto tit = mHeldTopics.find(pTopic);
+        if (tit != mHeldTopics.end()) {
+            // replace in place, so topic keeps its position in queue
+            it = tit->second;
+            mDropped++;
+        } else {
+            it = mHeld.insert(mHeld.end(), Message());
+            it->mTopic = pTopic;
+            mHeldTopics[pTopic] = it;
+        }
+    } else {
+        it = mHeld.insert(mHeld.end(), Message());
+        it->mTopic = pTopic;
+    }
+
+    if (pLen > 0)
+        it->mPayload.assign(static_cast<const char*>(pData), pLen);
+    else
+        it->mPayload.clear();
+    it->mProps = pProps;
+}
+
+bool
+MqttPublishQueue::popHeld(Message& pMessage) {
+    if (mHeld.empty())
+        return false;
+    pMessage = std::move(mHeld.front());
+    if (mPolicy == QueueFullPolicy::DROP_OLD)
+        mHeldTopics.erase(pMessage.mTopic);
+    mHeld.pop_front();
+    return true;
+}
+
+void
+MqttPublishQueue::clear() {
+    mSent.clear();
+    mHeld.clear();
+    mHeldTopics.clear();
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common.hpp"
+#include "config.hpp"
+
+namespace modmqttd {
+
+/**
+ * Flow control for messages passed to mqtt library.
+ *
+ * Messages are tracked by id until mqtt library reports that they
+ * were sent. When there are max_queued of them, new messages are held
+ * here until some are sent. With DROP_OLD policy only the latest held
+ * message for a topic is kept, older state is stale anyway.
+ *
+ * Used by the main thread only.
+ * */
+class MqttPublishQueue {
+    public:
+        struct Message {
+            std::string mTopic;
+            std::string mPayload;
+            MqttPublishProps mProps;
+        };
+
+        void setLimit(int pMaxQueued, QueueFullPolicy pPolicy) {
+            mMaxQueued = pMaxQueued;
+            mPolicy = pPolicy;
+        }
+        bool isLimited() const { return mMaxQueued != 0; }
+        QueueFullPolicy getPolicy() const { return mPolicy; }
+
+        // true if a message can be passed to mqtt library now
+        bool hasCapacity() const { return (int)mSent.size() < mMaxQueued; }
+        bool hasHeld() const { return !mHeld.empty(); }
+
+        void addSent(int pMessageId) { mSent.insert(pMessageId); }
+        // returns false if message was not tracked
+        bool removeSent(int pMessageId) { return mSent.erase(pMessageId) != 0; }
+
+        void hold(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps);
+        bool popHeld(Message& pMessage);
+
+        // forget all messages after disconnection
+        void clear();
+
+        int getSentCount() const { return mSent.size(); }
+        int getHeldCount() const { return mHeld.size(); }
+        uint64_t getDroppedCount() const { return mDropped; }
+    private:
+        int mMaxQueued = 0;
+        QueueFullPolicy mPolicy = QueueFullPolicy::DROP_OLD;
+
+        std::unordered_set<int> mSent;
+        std::list<Message> mHeld;
+        // position of held message for topic, DROP_OLD policy only
+        std::unordered_map<std::string, std::list<Message>::iterator> mHeldTopics;
+        uint64_t mDropped = 0;
+};
+
+}
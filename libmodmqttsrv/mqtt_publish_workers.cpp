@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <functional>
+
+#include "mqtt_publish_workers.hpp"
+#include "logging.hpp"
+#include "threadutils.hpp"
+
+namespace modmqttd {
+
+// limit for messages kept for reuse after a burst of publishes
+static constexpr size_t MAX_FREE_MESSAGES = 1024;
+
+void
+MqttPublishWorkers::Worker::publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+    Message msg;
+    // assign() below reuses buffers of a released message
+    mFree.try_dequeue(msg);
+    msg.mTopic = pTopic;
+    if (pLen > 0)
+        msg.mPayload.assign(static_cast<const char*>(pData), pLen);
+    else
+        msg.mPayload.clear();
+    msg.mProps = pProps;
+    mOutput.enqueue(std::move(msg));
+    mHasOutput = true;
+}
+
+void
+MqttPublishWorkers::Worker::run() {
+    bool running = true;
+    while (running) {
+        WorkItem item;
+        std::chrono::steady_clock::time_point nextTimer = mPublisher.getNextTimer();
+        bool hasItem;
+        if (nextTimer == std::chrono::steady_clock::time_point::max()) {
+            mInput.wait_dequeue(item);
+            hasItem = true;
+        } else {
+            auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(nextTimer - std::chrono::steady_clock::now());
+            hasItem = mInput.wait_dequeue_timed(item, std::max(timeout, std::chrono::microseconds::zero()));
+        }
+
+        if (!hasItem) {
+            mPublisher.processTimers(std::chrono::steady_clock::now());
+            if (mHasOutput) {
+                mHasOutput = false;
+                mNotifier.notify();
+            }
+            continue;
+        }
+
+        switch (item.mType) {
+            case WorkItem::Type::VALUES:
+                mPublisher.processRegisterValues(item.mNetworkName, item.mValues);
+                break;
+            case WorkItem::Type::OPERATION_FAILED:
+                mPublisher.processRegistersOperationFailed(item.mNetworkName, *item.mFailedRange);
+                break;
+            case WorkItem::Type::NETWORK_STATE:
+                mPublisher.processModbusNetworkState(item.mNetworkName, item.mIsUp);
+                break;
+            case WorkItem::Type::PUBLISH_ALL:
+                mPublisher.publishAll(item.mSessionPresent);
+                break;
+            case WorkItem::Type::END:
+                running = false;
+                break;
+        }
+        if (running)
+            mPublisher.processTimers(std::chrono::steady_clock::now());
+        // wake up main thread once per processed item
+        if (mHasOutput) {
+            mHasOutput = false;
+            mNotifier.notify();
+        }
+        mProcessed.fetch_add(1, std::memory_order_release);
+    }
+}
+
+// objects combined on device topic must be owned by the same worker
+static const std::string&
+partitionKey(const MqttObject& pObject) {
+    return pObject.getDeviceTopic().empty() ? pObject.getTopic() : pObject.getDeviceTopic();
+}
+
+void
+MqttPublishWorkers::start(int pCount, double pRepublishRate,
+                          const MqttObjectPublisher::MqttPollObjMap& pObjects,
+                          const MqttObjectPublisher::MqttCmdObjMap& pCmdObjects)
+{
+    std::hash<std::string> topicHash;
+    std::vector<MqttObjectPublisher::MqttPollObjMap> objects(pCount);
+    std::vector<MqttObjectPublisher::MqttCmdObjMap> cmdObjects(pCount);
+
+    for (const auto& group: pObjects) {
+        uint64_t key = group.first.key(mNetworkIds.add(group.first.mNetworkName));
+        for (const std::shared_ptr<MqttObject>& obj: group.second) {
+            int idx = topicHash(partitionKey(*obj)) % pCount;
+            std::vector<std::shared_ptr<MqttObject>>& owned(objects[idx][group.first]);
+            if (owned.empty())
+                mObjectWorkers[key].push_back(idx);
+            owned.push_back(obj);
+        }
+    }
+
+    for (const auto& cmd: pCmdObjects) {
+        for (const std::shared_ptr<MqttObject>& obj: cmd.second) {
+            int idx = topicHash(partitionKey(*obj)) % pCount;
+            std::vector<std::shared_ptr<MqttObject>>& owned(cmdObjects[idx][cmd.first]);
+            if (owned.empty())
+                mCommandWorkers[cmd.first].push_back(idx);
+            owned.push_back(obj);
+        }
+    }
+
+    for (int i = 0; i < pCount; i++) {
+        std::unique_ptr<Worker> worker(new Worker(mNotifier));
+        worker->mPublisher.setObjects(objects[i]);
+        worker->mPublisher.setCommandObjects(cmdObjects[i]);
+        worker->mPublisher.setRepublishRate(pRepublishRate / pCount);
+        Worker* wptr = worker.get();
+        worker->mThread = std::thread([wptr, i]() {
+            std::string name("publish-" + std::to_string(i));
+            ThreadUtils::set_thread_name(name.c_str());
+            wptr->run();
+        });
+        mWorkers.push_back(std::move(worker));
+    }
+    spdlog::debug("Started {} mqtt publish worker(s)", pCount);
+}
+
+void
+MqttPublishWorkers::enqueue(int pWorker, WorkItem&& pItem) {
+    Worker& worker(*mWorkers[pWorker]);
+    worker.mEnqueued++;
+    worker.mInput.enqueue(std::move(pItem));
+}
+
+void
+MqttPublishWorkers::processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValues& pValues) {
+    MsgRegisterValuesBatch batch;
+    batch.mValues.push_back(pValues);
+    processRegisterValues(pModbusNetworkName, batch);
+}
+
+void
+MqttPublishWorkers::processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValuesBatch& pBatch) {
+    // split batch between workers that own affected objects
+    std::vector<MsgRegisterValuesBatch> batches(mWorkers.size());
+    int networkId = mNetworkIds.find(pModbusNetworkName);
+    for (const MsgRegisterValues& values: pBatch.mValues) {
+        const std::vector<int>* workers = nullptr;
+        if (values.hasCommandId()) {
+            workers = mCommandWorkers.find(values.getCommandId());
+            if (workers == nullptr && values.isRpc())
+                workers = findObjectWorkers(networkId, values);
+        } else {
+            workers = findObjectWorkers(networkId, values);
+        }
+
+        if (workers == nullptr)
+            continue;
+        for (int idx: *workers)
+            batches[idx].mValues.push_back(values);
+    }
+
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        if (batches[i].mValues.empty())
+            continue;
+        WorkItem item;
+        item.mType = WorkItem::Type::VALUES;
+        item.mNetworkName = pModbusNetworkName;
+        item.mValues = std::move(batches[i]);
+        enqueue(i, std::move(item));
+    }
+}
+
+void
+MqttPublishWorkers::processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pValues) {
+    const std::vector<int>* workers = findObjectWorkers(mNetworkIds.find(pModbusNetworkName), pValues);
+    if (workers == nullptr)
+        return;
+
+    std::shared_ptr<ModbusMessageBase> range(new ModbusMessageBase(pValues));
+    for (int idx: *workers) {
+        WorkItem item;
+        item.mType = WorkItem::Type::OPERATION_FAILED;
+        item.mNetworkName = pModbusNetworkName;
+        item.mFailedRange = range;
+        enqueue(idx, std::move(item));
+    }
+}
+
+const std::vector<int>*
+MqttPublishWorkers::findObjectWorkers(int pNetworkId, const ModbusMessageBase& pValues) const {
+    if (pNetworkId == -1)
+        return nullptr;
+    return mObjectWorkers.find(MqttObjectRegisterIdent::key(pNetworkId, pValues));
+}
+
+void
+MqttPublishWorkers::processModbusNetworkState(const std::string& pModbusNetworkName, bool pIsUp) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        WorkItem item;
+        item.mType = WorkItem::Type::NETWORK_STATE;
+        item.mNetworkName = pModbusNetworkName;
+        item.mIsUp = pIsUp;
+        enqueue(i, std::move(item));
+    }
+}
+
+void
+MqttPublishWorkers::publishAll(bool pSessionPresent) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        WorkItem item;
+        item.mType = WorkItem::Type::PUBLISH_ALL;
+        item.mSessionPresent = pSessionPresent;
+        enqueue(i, std::move(item));
+    }
+}
+
+bool
+MqttPublishWorkers::try_dequeue(Message& pMessage) {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        int idx = (mNextOutput + i) % mWorkers.size();
+        if (mWorkers[idx]->mOutput.try_dequeue(pMessage)) {
+            pMessage.mWorker = idx;
+            mNextOutput = idx + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+MqttPublishWorkers::release(Message&& pMessage) {
+    if (pMessage.mWorker < 0 || size_t(pMessage.mWorker) >= mWorkers.size())
+        return;
+    Worker& worker(*mWorkers[pMessage.mWorker]);
+    if (worker.mFree.size_approx() < MAX_FREE_MESSAGES)
+        worker.mFree.enqueue(std::move(pMessage));
+}
+
+void
+MqttPublishWorkers::flush() {
+    for (const std::unique_ptr<Worker>& worker: mWorkers) {
+        while (worker->mProcessed.load(std::memory_order_acquire) < worker->mEnqueued)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void
+MqttPublishWorkers::stop() {
+    for (size_t i = 0; i < mWorkers.size(); i++)
+        enqueue(i, WorkItem());
+    for (const std::unique_ptr<Worker>& worker: mWorkers)
+        worker->mThread.join();
+    mWorkers.clear();
+}
+
+}
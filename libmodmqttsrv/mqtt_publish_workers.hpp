@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../readerwriterqueue/readerwriterqueue.h"
+
+#include "event_notifier.hpp"
+#include "mqtt_object_publisher.hpp"
+
+namespace modmqttd {
+
+/**
+ * Runs object updates, value conversion and payload generation
+ * on a set of worker threads.
+ *
+ * Every MqttObject is owned by a single worker selected by a hash
+ * of its topic or device topic, so objects are never shared between threads and
+ * updates for a single object are processed in order.
+ * Main thread is the only producer for worker input queues and the only
+ * consumer of their output queues. Generated messages are published by
+ * the main thread, mosquitto is never called from a worker.
+ * */
+class MqttPublishWorkers {
+    public:
+        struct Message {
+            std::string mTopic;
+            std::string mPayload;
+            MqttPublishProps mProps;
+            // index of worker that generated this message
+            int mWorker = -1;
+        };
+
+        MqttPublishWorkers() {}
+        MqttPublishWorkers(const MqttPublishWorkers&) = delete;
+        MqttPublishWorkers& operator=(const MqttPublishWorkers&) = delete;
+
+        // pRepublishRate is a total limit for all workers
+        void start(int pCount, double pRepublishRate,
+                   const MqttObjectPublisher::MqttPollObjMap& pObjects,
+                   const MqttObjectPublisher::MqttCmdObjMap& pCmdObjects);
+        int getWorkerCount() const { return mWorkers.size(); }
+
+        // main thread only
+        void processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValues& pValues);
+        void processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValuesBatch& pBatch);
+        void processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pValues);
+        void processModbusNetworkState(const std::string& pModbusNetworkName, bool pIsUp);
+        void publishAll(bool pSessionPresent);
+
+        // signalled when workers add messages to output queues
+        EventNotifier& getNotifier() { return mNotifier; }
+        bool try_dequeue(Message& pMessage);
+        // return published message to its worker, so its buffers
+        // can be reused for a new message without allocation
+        void release(Message&& pMessage);
+        // wait until all queued updates are processed by workers
+        void flush();
+
+        void stop();
+        ~MqttPublishWorkers() { stop(); }
+
+    private:
+        struct WorkItem {
+            enum class Type {
+                VALUES,
+                OPERATION_FAILED,
+                NETWORK_STATE,
+                PUBLISH_ALL,
+                END
+            };
+
+            Type mType = Type::END;
+            std::string mNetworkName;
+            MsgRegisterValuesBatch mValues;
+            std::shared_ptr<ModbusMessageBase> mFailedRange;
+            bool mIsUp = false;
+            bool mSessionPresent = false;
+        };
+
+        class Worker : public MqttObjectPublisher::Output {
+            public:
+                Worker(EventNotifier& pNotifier) : mPublisher(*this), mNotifier(pNotifier) {}
+                void publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps);
+                void run();
+
+                MqttObjectPublisher mPublisher;
+                moodycamel::BlockingReaderWriterQueue<WorkItem> mInput;
+                moodycamel::ReaderWriterQueue<Message> mOutput;
+                // released messages, main thread is the producer
+                moodycamel::ReaderWriterQueue<Message> mFree;
+                std::thread mThread;
+
+                // updated by main thread only
+                uint64_t mEnqueued = 0;
+                std::atomic<uint64_t> mProcessed = 0;
+            private:
+                EventNotifier& mNotifier;
+                bool mHasOutput = false;
+        };
+
+        void enqueue(int pWorker, WorkItem&& pItem);
+
+        EventNotifier mNotifier;
+        std::vector<std::unique_ptr<Worker>> mWorkers;
+
+        // workers that own at least one object for poll group or command,
+        // keyed by MqttObjectRegisterIdent::key() and command id
+        OpenHashMap<std::vector<int>> mObjectWorkers;
+        OpenHashMap<std::vector<int>> mCommandWorkers;
+        ModbusNetworkIds mNetworkIds;
+
+        // workers for poll group, nullptr if no worker owns its objects
+        const std::vector<int>* findObjectWorkers(int pNetworkId, const ModbusMessageBase& pValues) const;
+        // round robin position for try_dequeue
+        int mNextOutput = 0;
+};
+
+}
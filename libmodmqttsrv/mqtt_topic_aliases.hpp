@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace modmqttd {
+
+/**
+ * MQTT 5 topic alias table for a single network connection.
+ *
+ * Aliases are assigned to topics in order of their first publish
+ * until the limit is reached. Remaining topics are always published
+ * with full name.
+ * */
+class MqttTopicAliases {
+    public:
+        // start a new connection, pMax is the number of aliases we can use
+        void reset(int pMax) {
+            mAliases.clear();
+            mTopics.clear();
+            mMax = pMax;
+        }
+
+        int getMax() const { return mMax; }
+
+        // returns 0 if there is no alias for pTopic. pIsNew is set if
+        // alias was assigned now and must be sent with the full topic name
+        uint16_t get(std::string_view pTopic, bool& pIsNew) {
+            pIsNew = false;
+            auto it = mAliases.find(pTopic);
+            if (it != mAliases.end())
+                return it->second;
+            if ((int)mAliases.size() >= mMax)
+                return 0;
+            uint16_t alias = mAliases.size() + 1;
+            mTopics.emplace_back(pTopic);
+            mAliases[mTopics.back()] = alias;
+            pIsNew = true;
+            return alias;
+        }
+
+    private:
+        int mMax = 0;
+        // lookup without std::string construction on every publish,
+        // keys point to mTopics elements
+        std::unordered_map<std::string_view, uint16_t> mAliases;
+        std::deque<std::string> mTopics;
+};
+
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+#include "mqtt_topic_filters.hpp"
+
+namespace modmqttd {
+
+typedef std::vector<std::string> TopicLevels;
+
+// maximum number of + levels in a single filter
+static const size_t kMaxWildcardLevels = 1;
+
+static TopicLevels
+split(const std::string& pTopic) {
+    TopicLevels ret;
+    size_t start = 0;
+    while(true) {
+        size_t pos = pTopic.find('/', start);
+        if (pos == std::string::npos) {
+            ret.push_back(pTopic.substr(start));
+            return ret;
+        }
+        ret.push_back(pTopic.substr(start, pos - start));
+        start = pos + 1;
+    }
+}
+
+
+static std::string
+join(const TopicLevels& pLevels, size_t pCount) {
+    std::string ret;
+    for (size_t i = 0; i < pCount; i++) {
+        if (i != 0)
+            ret += '/';
+        ret += pLevels[i];
+    }
+    return ret;
+}
+
+
+static bool
+matchLevels(const TopicLevels& pFilter, const TopicLevels& pTopic) {
+    size_t i = 0;
+    for (; i < pFilter.size(); i++) {
+        // also matches parent level: a/# matches a
+        if (pFilter[i] == "#")
+            return true;
+        if (i >= pTopic.size())
+            return false;
+        if (pFilter[i] != "+" && pFilter[i] != pTopic[i])
+            return false;
+    }
+    return i == pTopic.size();
+}
+
+
+bool
+MqttTopicFilters::matches(const std::string& pFilter, const std::string& pTopic) {
+    return matchLevels(split(pFilter), split(pTopic));
+}
+
+
+std::vector<std::string>
+MqttTopicFilters::compute(const std::vector<std::string>& pTopics, const std::vector<std::string>& pExcluded) {
+    std::vector<TopicLevels> excluded;
+    for (const std::string& topic: pExcluded)
+        excluded.push_back(split(topic));
+
+    auto isSafe = [&excluded](const TopicLevels& pFilter) -> bool {
+        for (const TopicLevels& topic: excluded)
+            if (matchLevels(pFilter, topic))
+                return false;
+        return true;
+    };
+
+    std::vector<TopicLevels> filters;
+    size_t maxLevels = 0;
+    for (const std::string& topic: std::set<std::string>(pTopics.begin(), pTopics.end())) {
+        filters.push_back(split(topic));
+        maxLevels = std::max(maxLevels, filters.back().size());
+    }
+
+    // replace level that differs in a group of filters with +,
+    // repeat until there is nothing to merge. The first level is
+    // never replaced, +/... would match most of broker traffic.
+    // Filters with kMaxWildcardLevels are not widened further
+    std::set<std::string> rejected;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t level = 1; level < maxLevels; level++) {
+            std::unordered_map<std::string, std::vector<size_t>> groups;
+            for (size_t i = 0; i < filters.size(); i++) {
+                if (filters[i].size() <= level || filters[i][level] == "+")
+                    continue;
+                if (size_t(std::count(filters[i].begin(), filters[i].end(), "+")) >= kMaxWildcardLevels)
+                    continue;
+                TopicLevels candidate(filters[i]);
+                candidate[level] = "+";
+                groups[join(candidate, candidate.size())].push_back(i);
+            }
+
+            std::vector<bool> merged(filters.size(), false);
+            std::vector<TopicLevels> added;
+            for (const auto& group: groups) {
+                if (group.second.size() < 2 || rejected.count(group.first))
+                    continue;
+                TopicLevels candidate(filters[group.second.front()]);
+                candidate[level] = "+";
+                if (!isSafe(candidate)) {
+                    rejected.insert(group.first);
+                    continue;
+                }
+                for (size_t i: group.second)
+                    merged[i] = true;
+                added.push_back(candidate);
+            }
+
+            if (added.empty())
+                continue;
+            for (size_t i = 0; i < filters.size(); i++)
+                if (!merged[i])
+                    added.push_back(filters[i]);
+            filters.swap(added);
+            changed = true;
+        }
+    }
+
+    // merge filters with common prefix into prefix/#, shortest prefix first.
+    // Prefix must be a topic path without wildcards, a/+/# would
+    // widen a/+/set to all topics below any a/ subtree
+    for (size_t prefixLen = 1; prefixLen < maxLevels; prefixLen++) {
+        std::unordered_map<std::string, std::vector<size_t>> groups;
+        for (size_t i = 0; i < filters.size(); i++) {
+            if (filters[i].size() <= prefixLen)
+                continue;
+            if (std::find(filters[i].begin(), filters[i].begin() + prefixLen, "+") != filters[i].begin() + prefixLen)
+                continue;
+            groups[join(filters[i], prefixLen)].push_back(i);
+        }
+
+        std::vector<bool> merged(filters.size(), false);
+        std::vector<TopicLevels> added;
+        for (const auto& group: groups) {
+            if (group.second.size() < 2)
+                continue;
+            TopicLevels candidate(filters[group.second.front()].begin(), filters[group.second.front()].begin() + prefixLen);
+            candidate.push_back("#");
+            if (!isSafe(candidate))
+                continue;
+            for (size_t i: group.second)
+                merged[i] = true;
+            added.push_back(candidate);
+        }
+
+        for (size_t i = 0; i < filters.size(); i++)
+            if (!merged[i])
+                added.push_back(filters[i]);
+        filters.swap(added);
+    }
+
+    // drop filters covered by prefix/# filters
+    std::vector<std::string> ret;
+    for (const TopicLevels& filter: filters) {
+        bool covered = std::any_of(filters.begin(), filters.end(), [&filter](const TopicLevels& pOther) -> bool {
+            return pOther.back() == "#" && pOther != filter && matchLevels(pOther, filter);
+        });
+        if (!covered)
+            ret.push_back(join(filter, filter.size()));
+    }
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace modmqttd {
+
+/**
+ * Wildcard subscription filters for command topics
+ * */
+class MqttTopicFilters {
+    public:
+        // true if pTopic matches subscription filter with + and # wildcards
+        static bool matches(const std::string& pFilter, const std::string& pTopic);
+
+        /**
+         * Returns a small set of filters that match all pTopics
+         * and none of pExcluded topics.
+         *
+         * Topics that differ in a single level are merged into a filter
+         * with + on that level. Filters with a common prefix are merged
+         * into prefix/# if there are no excluded topics below the prefix.
+         * The first level and the prefix are never wildcards and a filter
+         * has at most one + level, so filters stay close to known topics.
+         * */
+        static std::vector<std::string> compute(const std::vector<std::string>& pTopics, const std::vector<std::string>& pExcluded);
+};
+
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "mqtt_value_filter.hpp"
+
+namespace modmqttd {
+
+void
+MqttValueFilter::store(double pValue, const std::chrono::steady_clock::time_point& pNow) {
+    mHasValue = true;
+    mLastValue = pValue;
+    mLastTime = pNow;
+    mUpperSlope = -std::numeric_limits<double>::infinity();
+    mLowerSlope = std::numeric_limits<double>::infinity();
+}
+
+bool
+MqttValueFilter::accept(double pValue, const std::chrono::steady_clock::time_point& pNow) {
+    bool ret = true;
+    if (mHasValue && (mMaxInterval.count() == 0 || pNow - mLastTime < mMaxInterval)) {
+        switch (mType) {
+            case Type::NONE:
+                break;
+            case Type::DEADBAND:
+                ret = pValue != mLastValue && std::abs(pValue - mLastValue) >= mDeviation;
+                break;
+            case Type::DEADBAND_PERCENT:
+                ret = pValue != mLastValue && std::abs(pValue - mLastValue) >= std::abs(mLastValue) * mDeviation / 100;
+                break;
+            case Type::SWINGING_DOOR: {
+                double dt = std::chrono::duration<double>(pNow - mLastTime).count();
+                if (dt <= 0) {
+                    ret = std::abs(pValue - mLastValue) > mDeviation;
+                    break;
+                }
+                // door is open as long as every value received after the last
+                // accepted one fits between lines from both pivot points
+                mUpperSlope = std::max(mUpperSlope, (pValue - mLastValue - mDeviation) / dt);
+                mLowerSlope = std::min(mLowerSlope, (pValue - mLastValue + mDeviation) / dt);
+                ret = mUpperSlope > mLowerSlope;
+                break;
+            }
+        }
+    }
+
+    // the door is restarted from the current value, not from the last
+    // value inside the door as in historians - this value is published now
+    if (ret)
+        store(pValue, pNow);
+    return ret;
+}
+
+}
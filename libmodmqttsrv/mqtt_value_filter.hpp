@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+
+namespace modmqttd {
+
+/**
+ * Change filter for a single converted state value.
+ *
+ * Filters compare numeric values, a rejected value does not change
+ * state payload, so it is neither rendered nor published.
+ * */
+class MqttValueFilter {
+    public:
+        enum class Type {
+            NONE,
+            // change must be at least mDeviation
+            DEADBAND,
+            // change must be at least mDeviation percent of the last value
+            DEADBAND_PERCENT,
+            // swinging door compression with mDeviation door width
+            SWINGING_DOOR
+        };
+
+        MqttValueFilter() {}
+        MqttValueFilter(Type pType, double pDeviation, std::chrono::milliseconds pMaxInterval = std::chrono::milliseconds::zero())
+            : mType(pType), mDeviation(pDeviation), mMaxInterval(pMaxInterval)
+        {}
+
+        bool isSet() const { return mType != Type::NONE; }
+        Type getType() const { return mType; }
+
+        // returns true if pValue should replace the last accepted value
+        bool accept(double pValue, const std::chrono::steady_clock::time_point& pNow);
+
+    private:
+        Type mType = Type::NONE;
+        double mDeviation = 0;
+        // accept any value if the last one was accepted before this period
+        std::chrono::milliseconds mMaxInterval = std::chrono::milliseconds::zero();
+
+        bool mHasValue = false;
+        double mLastValue = 0;
+        std::chrono::steady_clock::time_point mLastTime;
+        // swinging door slopes from upper and lower pivot, per second
+        double mUpperSlope = 0;
+        double mLowerSlope = 0;
+
+        void store(double pValue, const std::chrono::steady_clock::time_point& pNow);
+};
+
+}
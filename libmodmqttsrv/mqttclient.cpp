@@ -1,6 +1,8 @@
 #include <cstring>
+#include <algorithm>
 #include <cassert>
 #include <map>
+#include <tuple>
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
@@ -11,20 +13,29 @@
 #include "mqttclient.hpp"
 #include "exceptions.hpp"
 #include "modmqtt.hpp"
-#include "default_command_converter.hpp"
 #include "mqttpayload.hpp"
+#include "mqtt_topic_filters.hpp"
 
 namespace modmqttd {
 
-MqttClient::MqttClient(ModMqtt& modmqttd) : mOwner(modmqttd) {
-    mMqttImpl.reset(new Mosquitto());
+MqttClient::MqttClient(ModMqtt& modmqttd) : mOwner(modmqttd), mPublisher(*this) {
+    setMqttImplementation(std::shared_ptr<IMqttImpl>(new Mosquitto()));
 };
 
+void
+MqttClient::setMqttImplementation(const std::shared_ptr<IMqttImpl>& impl) {
+    mMqttImpl = impl;
+    mConnections.clear();
+    mConnections.resize(1);
+    mConnections[0].mImpl = impl;
+}
+
 void
 MqttClient::setBrokerConfig(const MqttBrokerConfig& config) {
     if (!mBrokerConfig.isSameAs(config)) {
         // TODO reconnect
         mBrokerConfig = config;
+        mPublishQueue.setLimit(config.mMaxQueued, config.mQueueFullPolicy);
     }
 };
 
@@ -33,7 +44,38 @@ MqttClient::setClientId(const std::string& clientId) {
     if (isStarted())
         throw MosquittoException("Cannot change client id when started");
     mRpcRequestTopic = clientId + "/rpc/modbus_request";
-    mMqttImpl->init(this, clientId.c_str());
+    mStatsTopic = clientId + "/stats/publish";
+    mRpcStatsTopic = clientId + "/stats/rpc";
+    mClientId = clientId;
+    mMqttImpl->init(this, clientId.c_str(), 0);
+}
+
+void
+MqttClient::setPublishConnections(int pCount) {
+    if (isStarted())
+        throw MosquittoException("Cannot change number of connections when started");
+    mConnections.resize(1);
+    for (int i = 1; i < pCount; i++) {
+        Connection conn;
+        conn.mImpl = mMqttImpl->createConnection();
+        conn.mImpl->init(this, (mClientId + "-pub" + std::to_string(i)).c_str(), i);
+        mConnections.push_back(conn);
+    }
+}
+
+void
+MqttClient::setModbusClients(const std::vector<std::shared_ptr<ModbusClient>>& clients) {
+    mModbusClients = clients;
+    for (auto& cmd: mCommandIndex)
+        cmd.second.mClient = findModbusClient(cmd.second.mCommand->mModbusNetworkName);
+}
+
+ModbusClient*
+MqttClient::findModbusClient(const std::string& pNetworkName) const {
+    for (const std::shared_ptr<ModbusClient>& client: mModbusClients)
+        if (client->mNetworkName == pNetworkName)
+            return client.get();
+    return nullptr;
 }
 
 void
@@ -45,22 +87,39 @@ MqttClient::start() /*throw(MosquittoException)*/ {
     }
     mIsStarted = true;
     mConnectionState = State::CONNECTING;
-    mMqttImpl->connect(mBrokerConfig);
+    mSessionPresent = true;
+    for (const Connection& conn: mConnections)
+        conn.mImpl->connect(mBrokerConfig);
 }
 
 void
 MqttClient::shutdown() {
     // do not add any messages to modbus queues - modbus clients
     // are already stopped
-    mModbusClients.clear();
+    mCommandWorker.reset();
+    setModbusClients(std::vector<std::shared_ptr<ModbusClient>>());
+
+    // publish everything generated from already processed modbus data
+    if (mPublishWorkers != nullptr) {
+        mPublishWorkers->flush();
+        processPublishQueue();
+        mPublishWorkers.reset();
+    }
 
     switch (mConnectionState) {
     case State::CONNECTED:
-        spdlog::info("Disconnecting from mqtt broker");
-        mConnectionState = State::DISCONNECTING;
-        mMqttImpl->disconnect();
-        break;
     case State::CONNECTING:
+        if (mConnectedCount != 0) {
+            spdlog::info("Disconnecting from mqtt broker");
+            mConnectionState = State::DISCONNECTING;
+            for (const Connection& conn: mConnections) {
+                if (conn.mIsConnected)
+                    conn.mImpl->disconnect();
+                else
+                    conn.mImpl->stop();
+            }
+            break;
+        }
         // we do not send disconnect mqtt request if not connected
         spdlog::info("Cancelling connection request");
         mIsStarted = false;
@@ -75,50 +134,92 @@ MqttClient::shutdown() {
 }
 
 void
-MqttClient::onDisconnect() {
+MqttClient::onDisconnect(int pConnection) {
+    Connection& conn(mConnections[pConnection]);
+    if (conn.mIsConnected) {
+        conn.mIsConnected = false;
+        mConnectedCount--;
+    }
+
+    // there is no one to answer after reconnect, but modbus threads
+    // still hold the requests. Deadlines are kept to release reads
+    // dropped by modbus thread without reply.
+    mPendingRpc.forEach([this](uint64_t pId, const PendingRpcRequest& pRequest) {
+        mAbandonedRpc[static_cast<int>(pId)] = pRequest.mNetworkName;
+    });
     mPendingRpc.clear();
+    mRpcReadsInFlight.clear();
+    // held messages are republished after reconnect
+    mPublishQueue.clear();
+    mPollingPaused = false;
     for (std::vector<std::shared_ptr<ModbusClient>>::iterator it = mModbusClients.begin(); it != mModbusClients.end(); it++) {
         (*it)->sendMqttNetworkIsUp(false);
     }
     switch (mConnectionState) {
     case State::CONNECTED:
+        // state is not published until all connections are up
+        mConnectionState = State::CONNECTING;
+        [[fallthrough]];
     case State::CONNECTING:
-        spdlog::info("Reconnecting to mqtt broker");
-        mMqttImpl->reconnect();
+        if (pConnection == 0)
+            spdlog::info("Reconnecting to mqtt broker");
+        else
+            spdlog::info("Reconnecting publisher connection {} to mqtt broker", pConnection);
+        conn.mImpl->reconnect();
         break;
     case State::DISCONNECTING:
+        conn.mImpl->stop();
+        if (mConnectedCount != 0)
+            break;
         spdlog::info("Stopping mosquitto message loop");
         mConnectionState = State::DISCONNECTED;
-// https://github.com/BlackZork/mqmgateway/issues/33
-#ifndef __MUSL__
-        mMqttImpl->stop();
-#endif
+        // ModMqtt main loop checks isStarted() after each event
         mIsStarted = false;
-        // signal modmqttd that is waiting on queues mutex
-        // for us to disconnect
-        modmqttd::notifyQueues();
     };
 }
 
 void
-MqttClient::onConnect() {
-    spdlog::info("Connected, sending subscriptions…");
+MqttClient::onConnect(bool pSessionPresent, int pConnection) {
+    Connection& conn(mConnections[pConnection]);
+    if (!conn.mIsConnected) {
+        conn.mIsConnected = true;
+        mConnectedCount++;
+    }
+    mSessionPresent = mSessionPresent && pSessionPresent;
 
-    for (auto cmd: mCommands) {
-        mMqttImpl->subscribe(cmd.second.mTopic.c_str());
+    if (pConnection == 0) {
+        spdlog::info("Connected{}, sending subscriptions…", pSessionPresent ? " to existing session" : "");
+
+        if (mCommandSubscriptions == CommandSubscriptions::WILDCARD) {
+            for (const std::string& filter: getCommandFilters())
+                mMqttImpl->subscribe(filter.c_str());
+        } else {
+            for (const auto& cmd: mCommands)
+                mMqttImpl->subscribe(cmd.second.mTopic.c_str());
+        }
+        if (mRpcMode != RpcMode::DISABLED) {
+            mMqttImpl->subscribe(mRpcRequestTopic.c_str());
+        }
+    } else {
+        spdlog::info("Publisher connection {} established", pConnection);
     }
-    if (mRpcMode != RpcMode::DISABLED) {
-        mMqttImpl->subscribe(mRpcRequestTopic.c_str());
+
+    if (mConnectedCount != getConnectionCount()) {
+        spdlog::info("Waiting for {} more connection(s) to mqtt broker", getConnectionCount() - mConnectedCount);
+        return;
     }
 
     mConnectionState = State::CONNECTED;
+    pSessionPresent = mSessionPresent;
+    mSessionPresent = true;
 
     // if broker was restarted
     // then all published information is gone until
     // modbus register data is changed
     // republish current object state and availability to
-    // all subscribed clients
-    publishAll();
+    // all subscribed clients. This is paced by republish_rate
+    // and runs in background while new values are published
+    publishAll(pSessionPresent);
 
     for (std::vector<std::shared_ptr<ModbusClient>>::iterator it = mModbusClients.begin(); it != mModbusClients.end(); it++) {
         (*it)->sendMqttNetworkIsUp(true);
@@ -137,187 +238,240 @@ MqttClient::processRegisterValues(const std::string& pModbusNetworkName, const M
         return;
     }
 
-    std::vector<std::shared_ptr<MqttObject>>* affectedObjects = nullptr;
-
-    if (pSlaveData.hasCommandId()) {
-        MqttCmdObjMap::iterator it = mCommandObjects.find(pSlaveData.getCommandId());
-        if (it != mCommandObjects.end()) {
-            affectedObjects = &(it->second);
-        } else if (pSlaveData.isRpc()) {
-            publishRpcResponse(pModbusNetworkName, pSlaveData);
-            // An RPC read also feeds the matching polled object, so state-topic
-            // subscribers keep seeing values even while the scheduled poll is
-            // deferred. The object's own publish logic decides whether to emit:
-            // ON_CHANGE publishes only on a real value change (no flood, every
-            // change captured), EVERY_POLL is rate-limited to the refresh period
-            // (a burst of RPC reads cannot flood the topic). The RPC register
-            // need not be polled - a lookup miss just means no object to update.
-            MqttObjectRegisterIdent ident(pModbusNetworkName, pSlaveData);
-            MqttPollObjMap::iterator oit = mObjects.find(ident);
-            if (oit != mObjects.end()) {
-                affectedObjects = &(oit->second);
-            }
-        }
-    } else {
-        MqttObjectRegisterIdent ident(pModbusNetworkName, pSlaveData);
-        MqttPollObjMap::iterator it = mObjects.find(ident);
-        assert(it != mObjects.end());
-        affectedObjects = &(it->second);
-    }
+    checkRpcResponse(pModbusNetworkName, pSlaveData);
+    if (mPublishWorkers != nullptr)
+        mPublishWorkers->processRegisterValues(pModbusNetworkName, pSlaveData);
+    else
+        mPublisher.processRegisterValues(pModbusNetworkName, pSlaveData);
+}
 
-    // possible if write command registers do not overlap with
-    // any MqttObject
-    if (affectedObjects == nullptr) {
-        spdlog::trace("No affected objects for received register values");
+void
+MqttClient::processRegisterValues(const std::string& pModbusNetworkName, const MsgRegisterValuesBatch& pBatch) {
+    if (!isConnected()) {
+        spdlog::trace("Mqtt broker not connected, dropping MsgRegisterValuesBatch data");
         return;
     }
 
+    for (const MsgRegisterValues& values: pBatch.mValues)
+        checkRpcResponse(pModbusNetworkName, values);
+    if (mPublishWorkers != nullptr)
+        mPublishWorkers->processRegisterValues(pModbusNetworkName, pBatch);
+    else
+        mPublisher.processRegisterValues(pModbusNetworkName, pBatch);
+}
+
+void
+MqttClient::checkRpcResponse(const std::string& pModbusNetworkName, const MsgRegisterValues& pSlaveData) {
+    if (!pSlaveData.isRpc())
+        return;
+    if (mCommandObjects.find(pSlaveData.getCommandId()) != mCommandObjects.end())
+        return;
     try {
-        for (std::shared_ptr<MqttObject>& obj: *affectedObjects) {
-            AvailableFlag oldAvail = obj->getAvailableFlag();
-            obj->updateRegisterValues(pModbusNetworkName, pSlaveData);
-            AvailableFlag newAvail = obj->getAvailableFlag();
-
-            if (oldAvail != newAvail) {
-                if (newAvail == AvailableFlag::True) {
-                    // if object is not retained
-                    // then publish state changes only
-                    // if availability is already set to true
-                    if (obj->getRetain()) {
-                        publishState(obj, true);
-                    } else {
-                        // delete retained message
-                        if (oldAvail == AvailableFlag::NotSet) {
-                            mMqttImpl->publish(obj->getStateTopic().c_str(), 0, NULL, true);
-                            // remember initial payload for comparsion with subsequent modbus data updates
-                            if (!obj->getRetain())
-                                obj->setLastPublishedPayload(MqttPayload::generate(*obj));
-                        }
-                        if (obj->getPublishMode() == PublishMode::EVERY_POLL)
-                            publishState(obj, true);
-                    }
-                }
-                publishAvailabilityChange(*obj);
-            } else {
-                publishState(obj, obj->needStateRepublish());
-            }
-        }
+        publishRpcResponse(pModbusNetworkName, pSlaveData);
     } catch (const MosquittoException& ex) {
         spdlog::error("Failed to publish mqtt state message: {}", ex.what());
     }
 }
 
 void
-MqttClient::publishState(const std::shared_ptr<MqttObject>& obj, bool force) {
-    if (obj->getAvailableFlag() != AvailableFlag::True)
-        return;
-    if (obj->getPublishMode() == PublishMode::ONCE) {
-        if (obj->getLastPublishTime() != std::chrono::steady_clock::time_point::min())
-            return;
-    }
+MqttClient::processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pSlaveData) {
+    if (mPublishWorkers != nullptr)
+        mPublishWorkers->processRegistersOperationFailed(pModbusNetworkName, pSlaveData);
+    else
+        mPublisher.processRegistersOperationFailed(pModbusNetworkName, pSlaveData);
+}
 
-    std::string messageData(MqttPayload::generate(*obj));
-    if (messageData != obj->getLastPublishedPayload() || force) {
-        int msgId = mMqttImpl->publish(obj->getStateTopic().c_str(), messageData.length(), messageData.c_str(), obj->getRetain());
-        spdlog::debug("Publish {} on topic {}: {}", msgId, obj->getStateTopic(), messageData);
-        obj->setLastPublishedPayload(messageData);
-        obj->setLastPublishTime(std::chrono::steady_clock::now());
-    }
+void
+MqttClient::processModbusNetworkState(const std::string& pNetworkName, bool pIsUp) {
+    if (mPublishWorkers != nullptr)
+        mPublishWorkers->processModbusNetworkState(pNetworkName, pIsUp);
+    else
+        mPublisher.processModbusNetworkState(pNetworkName, pIsUp);
 }
 
 void
-MqttClient::processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pSlaveData) {
-    MqttObjectRegisterIdent ident(pModbusNetworkName, pSlaveData);
-    MqttPollObjMap::iterator it = mObjects.find(ident);
+MqttClient::publishAll(bool pSessionPresent) {
+    if (mPublishWorkers != nullptr)
+        mPublishWorkers->publishAll(pSessionPresent);
+    else
+        mPublisher.publishAll(pSessionPresent);
+}
 
-    // msg was sent after failed write and
-    // is not related MqttObjectState
-    if (it == mObjects.end())
+void
+MqttClient::publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+    if (!mPublishQueue.isLimited()) {
+        sendMessage(pTopic, pLen, pData, pProps);
         return;
+    }
 
-    for (std::shared_ptr<MqttObject>& obj: it->second) {
-        AvailableFlag oldAvail = obj->getAvailableFlag();
-        obj->updateRegistersReadFailed(pModbusNetworkName, pSlaveData);
-        AvailableFlag newAvail = obj->getAvailableFlag();
-
-        publishState(obj);
+    // keep order of messages, if some are held
+    // then this one must wait too
+    if (mPublishQueue.hasCapacity() && !mPublishQueue.hasHeld()) {
+        mPublishQueue.addSent(sendMessage(pTopic, pLen, pData, pProps));
+        return;
+    }
 
-        if (oldAvail != newAvail) {
-            publishAvailabilityChange(*obj);
-        }
+    spdlog::trace("Mqtt publish queue is full, holding message for topic {}", pTopic);
+    mPublishQueue.hold(pTopic, pLen, pData, pProps);
+    if (mPublishQueue.getPolicy() == QueueFullPolicy::PAUSE_POLLING && !mPollingPaused) {
+        spdlog::info("Mqtt publish queue is full, pausing modbus polling");
+        mPollingPaused = true;
+        for (std::vector<std::shared_ptr<ModbusClient>>::iterator it = mModbusClients.begin(); it != mModbusClients.end(); it++)
+            (*it)->sendMqttNetworkIsUp(false);
     }
 }
 
-void
-MqttClient::processModbusNetworkState(const std::string& pNetworkName, bool pIsUp) {
-    // wait for initial poll
-    if (pIsUp)
-        return;
-
-    std::set<std::shared_ptr<MqttObject>> processed;
+int
+MqttClient::getPublishConnection(const std::string& pTopic) const {
+    if (mConnections.size() == 1)
+        return 0;
+    return mTopicHash(pTopic) % mConnections.size();
+}
 
-    for (MqttPollObjMap::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
-        if (it->first.mNetworkName != pNetworkName)
-            continue;
+int
+MqttClient::sendMessage(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+    int connection = getPublishConnection(pTopic);
+    int msgId = mConnections[connection].mImpl->publish(pTopic.c_str(), pLen, pData, pProps);
+    spdlog::debug("Publish {} on topic {}: {}", msgId, pTopic, pLen > 0 ? std::string_view(static_cast<const char*>(pData), pLen) : std::string_view());
+    // mosquitto message ids are 16 bit and unique per connection only
+    return msgId * getConnectionCount() + connection;
+}
 
-        for (std::vector<std::shared_ptr<MqttObject>>::iterator oit = it->second.begin(); oit != it->second.end(); oit++) {
-            const std::shared_ptr<MqttObject>& optr = *oit;
-            if (processed.find(optr) == processed.end()) {
+void
+MqttClient::onPublish(int messageId, int pConnection) {
+    if (!mPublishQueue.removeSent(messageId * getConnectionCount() + pConnection))
+        return;
 
-                AvailableFlag oldAvail = (*oit)->getAvailableFlag();
-                (*oit)->setModbusNetworkState(pNetworkName, pIsUp);
-                if (oldAvail != (*oit)->getAvailableFlag())
-                    publishAvailabilityChange(**oit);
-                processed.insert(optr);
-            }
+    MqttPublishQueue::Message msg;
+    while (mPublishQueue.hasCapacity() && mPublishQueue.popHeld(msg)) {
+        try {
+            mPublishQueue.addSent(sendMessage(msg.mTopic, msg.mPayload.length(), msg.mPayload.c_str(), msg.mProps));
+        } catch (const MosquittoException& ex) {
+            spdlog::error("Failed to publish mqtt message on topic {}: {}", msg.mTopic, ex.what());
         }
     }
+
+    if (mPollingPaused && !mPublishQueue.hasHeld()) {
+        spdlog::info("Mqtt publish queue drained, resuming modbus polling");
+        mPollingPaused = false;
+        for (std::vector<std::shared_ptr<ModbusClient>>::iterator it = mModbusClients.begin(); it != mModbusClients.end(); it++)
+            (*it)->sendMqttNetworkIsUp(true);
+    }
 }
 
 void
-MqttClient::publishAvailabilityChange(const MqttObject& obj) {
-    if (obj.getAvailableFlag() == AvailableFlag::NotSet)
-        return;
-    try {
-        char msg = obj.getAvailableFlag() == AvailableFlag::True ? '1' : '0';
-        mMqttImpl->publish(obj.getAvailabilityTopic().c_str(), 1, &msg, true);
-        spdlog::debug("Publish on topic {}: {}", obj.getAvailabilityTopic(), msg);
-    } catch (const MosquittoException& ex) {
-        spdlog::error("Failed to publish mqtt availability message: {}", ex.what());
+MqttClient::publishStats() {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("queued");
+    writer.Int(mPublishQueue.getSentCount());
+    writer.Key("held");
+    writer.Int(mPublishQueue.getHeldCount());
+    writer.Key("dropped");
+    writer.Uint64(mPublishQueue.getDroppedCount());
+    writer.Key("polling_paused");
+    writer.Bool(mPollingPaused);
+    writer.Key("modbus");
+    writer.StartObject();
+    for (const std::shared_ptr<ModbusClient>& client: mModbusClients) {
+        writer.Key(client->mNetworkName.c_str());
+        writer.StartObject();
+        writer.Key("queued");
+        writer.Uint64(client->getQueueDepth());
+        writer.Key("conflated");
+        writer.Uint64(client->getConflatedCount());
+        writer.EndObject();
     }
+    writer.EndObject();
+    writer.EndObject();
+    // bypass flow control, stats are needed most when queue is full
+    sendMessage(mStatsTopic, buffer.GetSize(), buffer.GetString(), MqttPublishProps());
 }
 
 void
-MqttClient::publishAll() {
-    std::set<std::shared_ptr<MqttObject>> published;
+MqttClient::publishRpcStats() {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("pending");
+    writer.Uint64(mPendingRpc.size());
+    writer.Key("served");
+    writer.Uint64(mRpcStats.mServed);
+    writer.Key("failed");
+    writer.Uint64(mRpcStats.mFailed);
+    writer.Key("rejected");
+    writer.Uint64(mRpcStats.mRejected);
+    writer.Key("expired");
+    writer.Uint64(mRpcStats.mExpired);
+    writer.EndObject();
+    sendMessage(mRpcStatsTopic, buffer.GetSize(), buffer.GetString(), MqttPublishProps());
+}
 
-    for (MqttPollObjMap::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
-        for (std::vector<std::shared_ptr<MqttObject>>::iterator oit = it->second.begin(); oit != it->second.end(); oit++) {
-            const std::shared_ptr<MqttObject>& optr = *oit;
+void
+MqttClient::processPublishQueue() {
+    if (mPublishWorkers == nullptr)
+        return;
+    // consume before reading queues, so no notification is lost
+    mPublishWorkers->getNotifier().consume();
+    MqttPublishWorkers::Message msg;
+    while (mPublishWorkers->try_dequeue(msg)) {
+        try {
+            publish(msg.mTopic, msg.mPayload.length(), msg.mPayload.c_str(), msg.mProps);
+        } catch (const MosquittoException& ex) {
+            spdlog::error("Failed to publish mqtt message on topic {}: {}", msg.mTopic, ex.what());
+        }
+        mPublishWorkers->release(std::move(msg));
+    }
+}
 
-            if (published.find(optr) == published.end()) {
-                if ((*oit)->getAvailableFlag() == AvailableFlag::True)
-                    publishState(*oit, true);
-                publishAvailabilityChange(**oit);
-                published.insert(*oit);
+std::chrono::steady_clock::time_point
+MqttClient::processPublishTimers() {
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+    if (!isConnected())
+        return next;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (mStatsInterval.count() != 0) {
+        if (mNextStatsTime <= now) {
+            try {
+                publishStats();
+                if (mRpcMode != RpcMode::DISABLED)
+                    publishRpcStats();
+            } catch (const MosquittoException& ex) {
+                spdlog::error("Failed to publish mqtt stats: {}", ex.what());
             }
+            mNextStatsTime = now + mStatsInterval;
         }
+        next = mNextStatsTime;
     }
+
+    if (!mRpcDeadlines.empty())
+        next = std::min(next, expireRpcRequests(now));
+
+    // publish workers handle their own timers
+    if (mPublishWorkers == nullptr)
+        next = std::min(next, mPublisher.processTimers(now));
+    return next;
 }
 
-MqttValue
-createMqttValue(const MqttObjectCommand& command, const void* data, int datalen) {
-    MqttValue ret;
+void
+MqttClient::startPublishWorkers(int pCount) {
+    mPublishWorkers.reset(new MqttPublishWorkers());
+    mPublishWorkers->start(pCount, mRepublishRate, mObjects, mCommandObjects);
+}
 
-    switch (command.mPayloadType) {
-    case MqttObjectCommand::PayloadType::STRING:
-        ret = MqttValue::fromBinary(data, datalen);
-        break;
-    default:
-        throw MqttPayloadConversionException("Conversion failed, unknown payload type" + std::to_string(command.mPayloadType));
-    }
+void
+MqttClient::loopMisc() {
+    for (const Connection& conn: mConnections)
+        conn.mImpl->loopMisc();
+}
 
-    return ret;
+int
+MqttClient::getPublishNotifierFd() {
+    if (mPublishWorkers == nullptr)
+        return -1;
+    return mPublishWorkers->getNotifier().getFd();
 }
 
 // Build an MqttValue from an RPC write's JSON "value" field for converter encoding.
@@ -350,62 +504,273 @@ rpcWriteValueFromJson(const rapidjson::Value& pValue) {
     throw std::invalid_argument("converter write requires a scalar value (number or string)");
 }
 
+// per-type libmodbus limits: 125 for holding/input registers, 2000 for coils/bits
+static int
+rpcMaxCount(RegisterType pType) {
+    return (pType == RegisterType::COIL || pType == RegisterType::BIT) ? 2000 : 125;
+}
+
+// Parse a single RPC operation. Throws std::invalid_argument with a message
+// for the requester. Values to write are returned in pWriteValues
+static PendingRpcRequest
+parseRpcOperation(const rapidjson::Value& pOp, RpcMode pMode, const ModMqtt& pOwner,
+                  const std::vector<std::shared_ptr<ModbusClient>>& pModbusClients,
+                  std::vector<uint16_t>& pWriteValues) {
+    if (!pOp.IsObject()) {
+        throw std::invalid_argument("object expected");
+    }
+
+    if (!pOp.HasMember("network") || !pOp["network"].IsString()) {
+        throw std::invalid_argument("missing or invalid field: network");
+    }
+    const std::string networkName(pOp["network"].GetString());
+
+    if (!pOp.HasMember("slave") || !pOp["slave"].IsInt()) {
+        throw std::invalid_argument("missing or invalid field: slave");
+    }
+    int slaveId = pOp["slave"].GetInt();
+
+    if (!pOp.HasMember("register") || !pOp["register"].IsString()) {
+        throw std::invalid_argument("missing or invalid field: register");
+    }
+    const std::string regStr(pOp["register"].GetString());
+    int regNum = ConfigTools::registerNumberFromString(regStr);
+
+    RegisterType regType = RegisterType::HOLDING;
+    if (pOp.HasMember("register_type")) {
+        if (!pOp["register_type"].IsString()) {
+            throw std::invalid_argument("invalid field: register_type");
+        }
+        const std::string rtStr(pOp["register_type"].GetString());
+        if (rtStr == "coil") {
+            regType = RegisterType::COIL;
+        } else if (rtStr == "input") {
+            regType = RegisterType::INPUT;
+        } else if (rtStr == "bit") {
+            regType = RegisterType::BIT;
+        } else if (rtStr != "holding") {
+            throw std::invalid_argument("unknown register_type: " + rtStr);
+        }
+    }
+
+    std::string converterSpec;
+    std::shared_ptr<DataConverter> converter; // null => raw register value(s)
+    if (pOp.HasMember("converter")) {
+        if (!pOp["converter"].IsString()) {
+            throw std::invalid_argument("invalid field: converter");
+        }
+        converterSpec = pOp["converter"].GetString();
+        if (!converterSpec.empty() && converterSpec != "none") {
+            converter = pOwner.createConverterFromString(converterSpec);
+        }
+    }
+
+    if (std::none_of(pModbusClients.begin(), pModbusClients.end(),
+                     [&networkName](const std::shared_ptr<ModbusClient>& pC) { return pC->mNetworkName == networkName; })) {
+        throw std::invalid_argument("network not found: " + networkName);
+    }
+
+    const bool isWrite = pOp.HasMember("value");
+    if (isWrite && pMode != RpcMode::READ_WRITE) {
+        throw std::invalid_argument("writes are disabled (mode: read)");
+    }
+    if (isWrite && (regType == RegisterType::BIT || regType == RegisterType::INPUT)) {
+        throw std::invalid_argument("register_type is read-only");
+    }
+
+    std::chrono::milliseconds maxAge(std::chrono::milliseconds::zero());
+    if (pOp.HasMember("max_age_ms")) {
+        if (isWrite) {
+            throw std::invalid_argument("max_age_ms is not allowed for writes");
+        }
+        if (!pOp["max_age_ms"].IsInt() || pOp["max_age_ms"].GetInt() < 0) {
+            throw std::invalid_argument("invalid field: max_age_ms");
+        }
+        maxAge = std::chrono::milliseconds(pOp["max_age_ms"].GetInt());
+    }
+
+    const int maxCount = rpcMaxCount(regType);
+
+    int count = 1;
+    if (isWrite && converter == nullptr) {
+        // raw write: register count is derived from the value
+        const rapidjson::Value& val = pOp["value"];
+        if (val.IsUint() && val.GetUint() <= UINT16_MAX) {
+            pWriteValues.push_back(static_cast<uint16_t>(val.GetUint()));
+        } else if (val.IsArray()) {
+            pWriteValues.reserve(val.Size());
+            for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
+                if (!val[i].IsUint() || val[i].GetUint() > UINT16_MAX) {
+                    throw std::invalid_argument("value elements must be uint16 integers");
+                }
+                pWriteValues.push_back(static_cast<uint16_t>(val[i].GetUint()));
+            }
+        } else {
+            throw std::invalid_argument("value must be a uint16 integer or an array of uint16 values");
+        }
+        count = static_cast<int>(pWriteValues.size());
+    } else {
+        // read, or converter-encoded write: honour the optional "count" field
+        // (a converter needs the register count as an explicit input)
+        if (pOp.HasMember("count")) {
+            if (!pOp["count"].IsInt()) {
+                throw std::invalid_argument("invalid field: count");
+            }
+            count = pOp["count"].GetInt();
+            if (count < 1 || count > maxCount) {
+                throw std::invalid_argument(
+                    std::string("count out of range [1, ") + std::to_string(maxCount) + "]");
+            }
+        }
+        if (isWrite) {
+            ModbusRegisters regs = converter->toModbus(rpcWriteValueFromJson(pOp["value"]), count);
+            if (regs.getCount() != count) {
+                throw std::invalid_argument(
+                    std::string("converter produced ") + std::to_string(regs.getCount()) + " register(s), expected " + std::to_string(count));
+            }
+            pWriteValues = regs.values();
+        }
+    }
+
+    // clang-format off
+    spdlog::trace("RPC request parsed: {} network={} slave={} register={} type={} count={} converter={}",
+        isWrite ? "write" : "read", networkName, slaveId, regStr,
+        regType == RegisterType::COIL ? "coil" : regType == RegisterType::INPUT ? "input" : regType == RegisterType::BIT ? "bit" : "holding",
+        count, converter != nullptr ? converterSpec : "none");
+    // clang-format on
+
+    PendingRpcRequest ret;
+    ret.mNetworkName = networkName;
+    ret.mSlaveId = slaveId;
+    ret.mRegisterNumber = regNum;
+    ret.mDisplayAddress = regStr;
+    ret.mRegisterType = regType;
+    ret.mCount = count;
+    ret.mIsWrite = isWrite;
+    ret.mConverter = converter;
+    ret.mMaxAge = maxAge;
+    return ret;
+}
+
+// batch response element with register values
+static std::string
+rpcBatchValue(const PendingRpcRequest& pOperation, const ModbusRegisters& pValues) {
+    rapidjson::StringBuffer buf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+    writer.StartObject();
+    writer.Key("value");
+    if (!pOperation.mIsWrite && pOperation.mConverter != nullptr) {
+        writer.String(pOperation.mConverter->toMqtt(pValues).getString());
+    } else if (pValues.getCount() == 1) {
+        writer.Uint(pValues.getValue(0));
+    } else {
+        writer.StartArray();
+        for (int i = 0; i < pValues.getCount(); i++)
+            writer.Uint(pValues.getValue(i));
+        writer.EndArray();
+    }
+    writer.EndObject();
+    return buf.GetString();
+}
+
+static std::string
+rpcBatchError(const std::string& pErrorMsg) {
+    rapidjson::StringBuffer buf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+    writer.StartObject();
+    writer.Key("error");
+    writer.String(pErrorMsg);
+    writer.EndObject();
+    return buf.GetString();
+}
+
 void
 MqttClient::onMessage(const char* pTopic, const void* pPayload, int pPayloadlen,
                       const char* pResponseTopic,
                       const std::shared_ptr<void>& pCorrelationData, int pCorrelationLen) {
-    auto cmd = findCommand(pTopic);
-    if (cmd == mCommands.end()) {
+    auto cmd = mCommandIndex.find(std::string_view(pTopic));
+    if (cmd == mCommandIndex.end()) {
         if (mRpcMode != RpcMode::DISABLED && mRpcRequestTopic == pTopic) {
             handleRpcRequest(pPayload, pPayloadlen, pResponseTopic, pCorrelationData, pCorrelationLen);
+        } else if (mCommandSubscriptions == CommandSubscriptions::WILDCARD) {
+            // wildcard filters can match topics of other clients
+            spdlog::debug("No command for topic {}, ignoring message", pTopic);
         } else {
             spdlog::error("No command for topic {}, dropping message", pTopic);
         }
         return;
     }
-    try {
-        const MqttObjectCommand& command = cmd->second;
-        const std::string& network = command.mModbusNetworkName;
-
-        // TODO is is thread safe to iterate on modbus clients from mosquitto callback?
-        std::vector<std::shared_ptr<ModbusClient>>::const_iterator it = std::find_if(
-            mModbusClients.begin(), mModbusClients.end(),
-            [&network](const std::shared_ptr<ModbusClient>& pClient) -> bool { return pClient->mNetworkName == network; });
-        if (it == mModbusClients.end()) {
-            spdlog::error("Modbus network {} not found for command {}, dropping message", network, pTopic);
-        } else {
-            MqttValue tmpval(createMqttValue(command, pPayload, pPayloadlen));
-
-            ModbusRegisters reg_values;
-
-            if (command.hasConverter()) {
-                reg_values = command.getConverter().toModbus(tmpval, command.mCount);
-            } else {
-                reg_values = mDefaultConverter.toModbus(tmpval, command.mCount);
-            }
-
-            if (reg_values.getCount() != command.mCount) {
-                throw MqttPayloadConversionException(std::string("Conversion failed, expecting ") + std::to_string(command.mCount) + " register values, got " + std::to_string(reg_values.getCount()));
-            }
+    const MqttObjectCommand& command = *(cmd->second.mCommand);
+    ModbusClient* client = cmd->second.mClient;
+    if (client == nullptr) {
+        spdlog::error("Modbus network {} not found for command {}, dropping message", command.mModbusNetworkName, pTopic);
+        return;
+    }
 
-            (*it)->sendCommand(command, reg_values);
-        }
-    } catch (const ConvException& ex) {
-        spdlog::error("Converter error for {}: {}", pTopic, ex.what());
-    } catch (const MqttPayloadConversionException& ex) {
-        spdlog::error("Value error for {}: {}", pTopic, ex.what());
+    std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+    if (mCommandWorker != nullptr) {
+        MqttCommandWorker::Command item;
+        item.mCommand = &command;
+        item.mClient = client;
+        item.mPayload.assign(static_cast<const char*>(pPayload), pPayloadlen);
+        item.mReceived = received;
+        mCommandWorker->enqueue(std::move(item));
+    } else {
+        MqttCommandWorker::execute(command, *client, pPayload, pPayloadlen, received);
     }
 }
 
+void
+MqttClient::startCommandWorker() {
+    mCommandWorker.reset(new MqttCommandWorker());
+    mCommandWorker->start();
+}
+
 void
 MqttClient::addCommand(const MqttObjectCommand& pCommand) {
-    mCommands.insert(std::pair<std::string, MqttObjectCommand>(pCommand.mTopic, pCommand));
+    auto added = mCommands.insert(std::pair<std::string, MqttObjectCommand>(pCommand.mTopic, pCommand));
+    if (!added.second)
+        return;
+    CommandRecord record;
+    record.mCommand = &(added.first->second);
+    record.mClient = findModbusClient(pCommand.mModbusNetworkName);
+    mCommandIndex[added.first->first] = record;
+    mCommandFilters.clear();
 }
 
+std::vector<std::string>
+MqttClient::getOwnTopics() const {
+    std::vector<std::string> ret;
+    auto add = [&ret](const std::string& pTopic) {
+        if (!pTopic.empty())
+            ret.push_back(pTopic);
+    };
+    for (const auto& group: mObjects) {
+        for (const std::shared_ptr<MqttObject>& obj: group.second) {
+            add(obj->getStateTopic());
+            add(obj->getAvailabilityTopic());
+            add(obj->getDeviceTopic());
+            add(obj->getAggregateTopic());
+        }
+    }
+    add(mStatsTopic);
+    add(mRpcStatsTopic);
+    // subscribed separately
+    if (mRpcMode != RpcMode::DISABLED)
+        add(mRpcRequestTopic);
+    return ret;
+}
 
-std::map<std::string, MqttObjectCommand>::const_iterator
-MqttClient::findCommand(const char* topic) const {
-    return mCommands.find(topic);
+const std::vector<std::string>&
+MqttClient::getCommandFilters() {
+    if (mCommandFilters.empty() && !mCommands.empty()) {
+        std::vector<std::string> topics;
+        for (const auto& cmd: mCommands)
+            topics.push_back(cmd.first);
+        mCommandFilters = MqttTopicFilters::compute(topics, getOwnTopics());
+        spdlog::info("Using {} subscription(s) for {} command topic(s)", mCommandFilters.size(), mCommands.size());
+    }
+    return mCommandFilters;
 }
 
 void
@@ -439,208 +804,347 @@ MqttClient::handleRpcRequest(const void* pPayload, int pPayloadlen,
             throw std::invalid_argument(
                 std::string("JSON parse error at ") + std::to_string(line) + ":" + std::to_string(col) + ": " + rapidjson::GetParseError_En(doc.GetParseError()));
         }
-        if (!doc.IsObject()) {
-            throw std::invalid_argument("object expected");
+        if (doc.IsArray()) {
+            if (doc.Empty()) {
+                throw std::invalid_argument("empty operation list");
+            }
+            std::shared_ptr<PendingRpcBatch> batch(new PendingRpcBatch());
+            batch->mResponseTopic = respTopic;
+            batch->mCorrelationData = corrData;
+            batch->mOperations.resize(doc.Size());
+            batch->mResults.resize(doc.Size());
+            std::vector<std::vector<uint16_t>> writeValues(doc.Size());
+            // invalid operations get an error result, others are executed
+            for (int i = 0; i < (int)doc.Size(); i++) {
+                try {
+                    batch->mOperations[i] = parseRpcOperation(doc[i], mRpcMode, mOwner, mModbusClients, writeValues[i]);
+                } catch (const std::exception& ex) {
+                    spdlog::error("RPC batch operation {} failed: {}", i, ex.what());
+                    batch->mResults[i] = rpcBatchError(ex.what());
+                }
+            }
+            sendRpcBatch(batch, writeValues);
+            return;
         }
 
-        if (!doc.HasMember("network") || !doc["network"].IsString()) {
-            throw std::invalid_argument("missing or invalid field: network");
-        }
-        const std::string networkName(doc["network"].GetString());
+        std::vector<uint16_t> writeValues;
+        PendingRpcRequest pending(parseRpcOperation(doc, mRpcMode, mOwner, mModbusClients, writeValues));
+        pending.mResponseTopic = respTopic;
+        pending.mCorrelationData = corrData;
+        sendRpcRequest(std::move(pending), writeValues);
+    } catch (const std::exception& ex) {
+        spdlog::error("RPC request failed: {}", ex.what());
+        publishRpcError(respTopic, corrData, ex.what());
+    }
+}
 
-        if (!doc.HasMember("slave") || !doc["slave"].IsInt()) {
-            throw std::invalid_argument("missing or invalid field: slave");
-        }
-        int slaveId = doc["slave"].GetInt();
+void
+MqttClient::sendRpcBatch(const std::shared_ptr<PendingRpcBatch>& pBatch,
+                         const std::vector<std::vector<uint16_t>>& pWriteValues) {
+    PendingRpcBatch& batch(*pBatch);
+    const std::vector<PendingRpcRequest>& ops(batch.mOperations);
+
+    // keep batch open until all requests are sent,
+    // a rejected one is answered immediately
+    batch.mRemaining = 1;
+    batch.mWritesRemaining = 1;
+
+    for (int i = 0; i < (int)ops.size(); i++) {
+        if (batch.mResults[i].empty() && !ops[i].mIsWrite)
+            batch.mReads.push_back(i);
+    }
 
-        if (!doc.HasMember("register") || !doc["register"].IsString()) {
-            throw std::invalid_argument("missing or invalid field: register");
-        }
-        const std::string regStr(doc["register"].GetString());
-        int regNum = ConfigTools::registerNumberFromString(regStr);
+    // writes are executed first, in request order
+    int writes = 0;
+    for (int i = 0; i < (int)ops.size(); i++) {
+        if (!batch.mResults[i].empty() || !ops[i].mIsWrite)
+            continue;
+        PendingRpcRequest pending(ops[i]);
+        pending.mBatch = pBatch;
+        pending.mBatchItems.push_back(i);
+        batch.mRemaining++;
+        batch.mWritesRemaining++;
+        writes++;
+        sendRpcRequest(std::move(pending), pWriteValues[i]);
+    }
+    spdlog::debug("RPC batch with {} operation(s), {} write(s) sent", ops.size(), writes);
 
-        RegisterType regType = RegisterType::HOLDING;
-        if (doc.HasMember("register_type")) {
-            if (!doc["register_type"].IsString()) {
-                throw std::invalid_argument("invalid field: register_type");
-            }
-            const std::string rtStr(doc["register_type"].GetString());
-            if (rtStr == "coil") {
-                regType = RegisterType::COIL;
-            } else if (rtStr == "input") {
-                regType = RegisterType::INPUT;
-            } else if (rtStr == "bit") {
-                regType = RegisterType::BIT;
-            } else if (rtStr != "holding") {
-                throw std::invalid_argument("unknown register_type: " + rtStr);
-            }
+    if (--batch.mWritesRemaining == 0)
+        sendRpcBatchReads(pBatch);
+
+    if (--batch.mRemaining == 0)
+        publishRpcBatchResponse(batch);
+}
+
+void
+MqttClient::sendRpcBatchReads(const std::shared_ptr<PendingRpcBatch>& pBatch) {
+    PendingRpcBatch& batch(*pBatch);
+    const std::vector<PendingRpcRequest>& ops(batch.mOperations);
+    std::vector<int>& reads(batch.mReads);
+    int requests = 0;
+
+    // adjacent and overlapping reads of the same slave and register type
+    // are coalesced into a single modbus read
+    std::sort(reads.begin(), reads.end(), [&ops](int a, int b) -> bool {
+        return std::tie(ops[a].mNetworkName, ops[a].mSlaveId, ops[a].mRegisterType, ops[a].mRegisterNumber, a)
+             < std::tie(ops[b].mNetworkName, ops[b].mSlaveId, ops[b].mRegisterType, ops[b].mRegisterNumber, b);
+    });
+    size_t first = 0;
+    while (first < reads.size()) {
+        const PendingRpcRequest& start(ops[reads[first]]);
+        PendingRpcRequest pending;
+        pending.mNetworkName = start.mNetworkName;
+        pending.mSlaveId = start.mSlaveId;
+        pending.mRegisterNumber = start.mRegisterNumber;
+        pending.mDisplayAddress = start.mDisplayAddress;
+        pending.mRegisterType = start.mRegisterType;
+        pending.mMaxAge = start.mMaxAge;
+        pending.mBatch = pBatch;
+        pending.mBatchItems.push_back(reads[first]);
+
+        const int maxCount = rpcMaxCount(start.mRegisterType);
+        int end = start.mRegisterNumber + start.mCount;
+        size_t next = first + 1;
+        for (; next < reads.size(); next++) {
+            const PendingRpcRequest& op(ops[reads[next]]);
+            if (op.mNetworkName != start.mNetworkName || op.mSlaveId != start.mSlaveId
+                || op.mRegisterType != start.mRegisterType || op.mRegisterNumber > end)
+                break;
+            int newEnd = std::max(end, op.mRegisterNumber + op.mCount);
+            if (newEnd - start.mRegisterNumber > maxCount)
+                break;
+            end = newEnd;
+            // poll data must be fresh enough for every operation
+            pending.mMaxAge = std::min(pending.mMaxAge, op.mMaxAge);
+            pending.mBatchItems.push_back(reads[next]);
         }
+        pending.mCount = end - start.mRegisterNumber;
+        batch.mRemaining++;
+        requests++;
+        sendRpcRequest(std::move(pending), std::vector<uint16_t>());
+        first = next;
+    }
 
-        std::string converterSpec;
-        std::shared_ptr<DataConverter> converter; // null => raw register value(s)
-        if (doc.HasMember("converter")) {
-            if (!doc["converter"].IsString()) {
-                throw std::invalid_argument("invalid field: converter");
-            }
-            converterSpec = doc["converter"].GetString();
-            if (!converterSpec.empty() && converterSpec != "none") {
-                converter = mOwner.createConverterFromString(converterSpec);
+    spdlog::debug("RPC batch with {} read(s) sent as {} modbus request(s)", reads.size(), requests);
+}
+
+void
+MqttClient::sendRpcRequest(PendingRpcRequest&& pRequest, const std::vector<uint16_t>& pWriteValues) {
+    // network is checked by parseRpcOperation()
+    ModbusClient* client = findModbusClient(pRequest.mNetworkName);
+
+    RpcReadKey key(pRequest.mNetworkName, pRequest.mSlaveId, pRequest.mRegisterType, pRequest.mRegisterNumber, pRequest.mCount);
+    if (!pRequest.mIsWrite) {
+        // join identical read in flight unless it may be answered
+        // with poll data older than this request accepts
+        std::map<RpcReadKey, int>::const_iterator it = mRpcReadsInFlight.find(key);
+        if (it != mRpcReadsInFlight.end()) {
+            PendingRpcRequest* inFlight = mPendingRpc.find(it->second);
+            if (inFlight != nullptr && inFlight->mMaxAge <= pRequest.mMaxAge) {
+                spdlog::trace("RPC read coalesced with commandId={}", it->second);
+                inFlight->mCoalesced.push_back(std::move(pRequest));
+                return;
             }
         }
+    }
 
-        std::vector<std::shared_ptr<ModbusClient>>::iterator netIt = std::find_if(
-            mModbusClients.begin(), mModbusClients.end(),
-            [&networkName](const std::shared_ptr<ModbusClient>& pC) { return pC->mNetworkName == networkName; });
-        if (netIt == mModbusClients.end()) {
-            throw std::invalid_argument("network not found: " + networkName);
-        }
+    if (client->mRpcPending >= client->mRpcMaxPending) {
+        spdlog::warn("RPC request rejected, {} requests pending for network {}", client->mRpcPending, client->mNetworkName);
+        mRpcStats.mRejected++;
+        failRpcRequest(pRequest, "too many pending requests");
+        return;
+    }
 
-        const bool isWrite = doc.HasMember("value");
-        if (isWrite && mRpcMode != RpcMode::READ_WRITE) {
-            throw std::invalid_argument("writes are disabled (mode: read)");
+    if (mNextRpcId == INT_MIN) {
+        mNextRpcId = 0;
+    }
+    const int id = --mNextRpcId;
+
+    const bool isWrite = pRequest.mIsWrite;
+    const int slaveId = pRequest.mSlaveId;
+    const RegisterType regType = pRequest.mRegisterType;
+    const int regNum = pRequest.mRegisterNumber;
+    const int count = pRequest.mCount;
+    const std::chrono::milliseconds maxAge = pRequest.mMaxAge;
+    mPendingRpc[id] = std::move(pRequest);
+    client->mRpcPending++;
+
+    if (isWrite) {
+        // reads in flight may return values from before this write,
+        // do not let later reads join them
+        const ModbusAddressRange written(regNum, regType, count);
+        for (std::map<RpcReadKey, int>::iterator it = mRpcReadsInFlight.begin(); it != mRpcReadsInFlight.end();) {
+            const ModbusAddressRange read(std::get<3>(it->first), std::get<2>(it->first), std::get<4>(it->first));
+            if (std::get<0>(it->first) == client->mNetworkName && std::get<1>(it->first) == slaveId && read.overlaps(written))
+                it = mRpcReadsInFlight.erase(it);
+            else
+                it++;
         }
-        if (isWrite && (regType == RegisterType::BIT || regType == RegisterType::INPUT)) {
-            throw std::invalid_argument("register_type is read-only");
+        MsgRegisterValues msg(slaveId, regType, regNum, ModbusRegisters(pWriteValues), id, ModbusWriteMode::AUTO);
+        client->sendWriteRequest(msg);
+    } else {
+        // writes are not timed out, they cannot be canceled
+        // after modbus thread started to execute them
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        if (mRpcTimeout != std::chrono::milliseconds::zero()) {
+            deadline = std::chrono::steady_clock::now() + mRpcTimeout;
+            mRpcDeadlines.push_back(std::make_pair(deadline, id));
         }
+        mRpcReadsInFlight[key] = id;
+        client->sendReadRequest(MsgRegisterReadRequest(slaveId, regType, regNum, count, id, maxAge, deadline));
+    }
+    spdlog::trace("RPC request enqueued: commandId={} ({})", id, isWrite ? "write" : "read");
+}
 
-        // per-type libmodbus limits: 125 for holding/input registers, 2000 for coils/bits
-        const int maxCount = (regType == RegisterType::COIL || regType == RegisterType::BIT) ? 2000 : 125;
-
-        int count = 1;
-        std::vector<uint16_t> writeValues;
-        if (isWrite && converter == nullptr) {
-            // raw write: register count is derived from the value
-            const rapidjson::Value& val = doc["value"];
-            if (val.IsUint() && val.GetUint() <= UINT16_MAX) {
-                writeValues.push_back(static_cast<uint16_t>(val.GetUint()));
-            } else if (val.IsArray()) {
-                writeValues.reserve(val.Size());
-                for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-                    if (!val[i].IsUint() || val[i].GetUint() > UINT16_MAX) {
-                        throw std::invalid_argument("value elements must be uint16 integers");
-                    }
-                    writeValues.push_back(static_cast<uint16_t>(val[i].GetUint()));
-                }
-            } else {
-                throw std::invalid_argument("value must be a uint16 integer or an array of uint16 values");
-            }
-            count = static_cast<int>(writeValues.size());
-        } else {
-            // read, or converter-encoded write: honour the optional "count" field
-            // (a converter needs the register count as an explicit input)
-            if (doc.HasMember("count")) {
-                if (!doc["count"].IsInt()) {
-                    throw std::invalid_argument("invalid field: count");
-                }
-                count = doc["count"].GetInt();
-                if (count < 1 || count > maxCount) {
-                    throw std::invalid_argument(
-                        std::string("count out of range [1, ") + std::to_string(maxCount) + "]");
-                }
-            }
-            if (isWrite) {
-                ModbusRegisters regs = converter->toModbus(rpcWriteValueFromJson(doc["value"]), count);
-                if (regs.getCount() != count) {
-                    throw std::invalid_argument(
-                        std::string("converter produced ") + std::to_string(regs.getCount()) + " register(s), expected " + std::to_string(count));
-                }
-                writeValues = regs.values();
-            }
+void
+MqttClient::setRpcBatchResults(const PendingRpcRequest& pRequest, const ModbusRegisters* pValues, const std::string& pErrorMsg) {
+    PendingRpcBatch& batch(*pRequest.mBatch);
+    for (int item: pRequest.mBatchItems) {
+        if (pValues == nullptr) {
+            batch.mResults[item] = rpcBatchError(pErrorMsg);
+            continue;
         }
+        // split coalesced read
+        const PendingRpcRequest& op(batch.mOperations[item]);
+        const int offset = op.mRegisterNumber - pRequest.mRegisterNumber;
+        try {
+            if (offset + op.mCount > pValues->getCount())
+                throw std::out_of_range("not enough registers in modbus response");
+            auto begin = pValues->values().begin() + offset;
+            batch.mResults[item] = rpcBatchValue(op, ModbusRegisters(std::vector<uint16_t>(begin, begin + op.mCount)));
+        } catch (const std::exception& ex) {
+            spdlog::error("RPC batch response serialization failed: {}", ex.what());
+            batch.mResults[item] = rpcBatchError("internal error");
+        }
+    }
 
-        // clang-format off
-        spdlog::trace("RPC request parsed: {} network={} slave={} register={} type={} count={} converter={}",
-            isWrite ? "write" : "read", networkName, slaveId, regStr,
-            regType == RegisterType::COIL ? "coil" : regType == RegisterType::INPUT ? "input" : regType == RegisterType::BIT ? "bit" : "holding",
-            count, converter != nullptr ? converterSpec : "none");
-        // clang-format on
+    // reads are sent after the last write is finished,
+    // successfully or not
+    if (pRequest.mIsWrite && --batch.mWritesRemaining == 0)
+        sendRpcBatchReads(pRequest.mBatch);
 
-        if (mNextRpcId == INT_MIN) {
-            mNextRpcId = 0;
-        }
-        const int id = --mNextRpcId;
+    if (--batch.mRemaining == 0)
+        publishRpcBatchResponse(batch);
+}
 
-        PendingRpcRequest pending;
-        pending.mNetworkName = networkName;
-        pending.mResponseTopic = respTopic;
-        pending.mCorrelationData = corrData;
-        pending.mSlaveId = slaveId;
-        pending.mRegisterNumber = regNum;
-        pending.mDisplayAddress = regStr;
-        pending.mRegisterType = regType;
-        pending.mCount = count;
-        pending.mIsWrite = isWrite;
-        pending.mConverter = converter;
-        mPendingRpc[id] = std::move(pending);
+void
+MqttClient::publishRpcBatchResponse(const PendingRpcBatch& pBatch) {
+    rapidjson::StringBuffer buf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+    writer.StartArray();
+    for (const std::string& result: pBatch.mResults)
+        writer.RawValue(result.c_str(), result.length(), rapidjson::kObjectType);
+    writer.EndArray();
 
-        if (isWrite) {
-            MsgRegisterValues msg(slaveId, regType, regNum, ModbusRegisters(writeValues), id, ModbusWriteMode::AUTO);
-            (*netIt)->sendWriteRequest(msg);
-        } else {
-            (*netIt)->sendReadRequest(MsgRegisterReadRequest(slaveId, regType, regNum, count, id));
-        }
-        spdlog::trace("RPC request enqueued: commandId={} ({})", id, isWrite ? "write" : "read");
+    try {
+        mMqttImpl->publishResponse(
+            pBatch.mResponseTopic.c_str(),
+            static_cast<int>(buf.GetSize()),
+            buf.GetString(),
+            pBatch.mCorrelationData.data(),
+            pBatch.mCorrelationData.size());
+        spdlog::debug("RPC batch ok: operations={}, responseTopic={}, payloadLen={}",
+                      pBatch.mResults.size(), pBatch.mResponseTopic, buf.GetSize());
     } catch (const std::exception& ex) {
-        spdlog::error("RPC request failed: {}", ex.what());
-        publishRpcError(respTopic, corrData, ex.what());
+        spdlog::error("Failed to publish RPC response: {}", ex.what());
     }
 }
 
 void
 MqttClient::publishRpcResponse(const std::string& pNetworkName, const MsgRegisterValues& pValues) {
-    MqttRpcPendingMap::iterator it = mPendingRpc.find(pValues.getCommandId());
-    if (it == mPendingRpc.end()) {
-        spdlog::error("RPC response for unknown commandId {}", pValues.getCommandId());
+    PendingRpcRequest* found = mPendingRpc.find(pValues.getCommandId());
+    if (found == nullptr) {
+        if (!finishAbandonedRpcRequest(pValues.getCommandId()))
+            spdlog::debug("RPC response for unknown or expired commandId {}", pValues.getCommandId());
         return;
     }
-    PendingRpcRequest pending = std::move(it->second);
-    mPendingRpc.erase(it);
-    spdlog::trace("Got modbus data for RPC response, commandId={} ({} {}.{})",
+    PendingRpcRequest pending = std::move(*found);
+    mPendingRpc.erase(pValues.getCommandId());
+    finishRpcRequest(pending, pValues.getCommandId());
+    mRpcStats.mServed += 1 + pending.mCoalesced.size();
+    spdlog::trace("Got modbus data for RPC response, commandId={} ({} {}.{}), coalesced={}",
                   pValues.getCommandId(), pending.mIsWrite ? "write" : "read",
-                  pending.mSlaveId, pending.mDisplayAddress);
+                  pending.mSlaveId, pending.mDisplayAddress, pending.mCoalesced.size());
+
+    publishRpcValues(pending, pValues.mRegisters);
+    for (const PendingRpcRequest& coalesced: pending.mCoalesced)
+        publishRpcValues(coalesced, pValues.mRegisters);
+}
+
+void
+MqttClient::finishRpcRequest(const PendingRpcRequest& pRequest, int pCommandId) {
+    ModbusClient* client = findModbusClient(pRequest.mNetworkName);
+    if (client != nullptr && client->mRpcPending > 0)
+        client->mRpcPending--;
+    if (pRequest.mIsWrite)
+        return;
+    RpcReadKey key(pRequest.mNetworkName, pRequest.mSlaveId, pRequest.mRegisterType, pRequest.mRegisterNumber, pRequest.mCount);
+    std::map<RpcReadKey, int>::iterator it = mRpcReadsInFlight.find(key);
+    if (it != mRpcReadsInFlight.end() && it->second == pCommandId)
+        mRpcReadsInFlight.erase(it);
+}
+
+bool
+MqttClient::finishAbandonedRpcRequest(int pCommandId) {
+    std::map<int, std::string>::iterator it = mAbandonedRpc.find(pCommandId);
+    if (it == mAbandonedRpc.end())
+        return false;
+    ModbusClient* client = findModbusClient(it->second);
+    if (client != nullptr && client->mRpcPending > 0)
+        client->mRpcPending--;
+    mAbandonedRpc.erase(it);
+    return true;
+}
+
+void
+MqttClient::publishRpcValues(const PendingRpcRequest& pRequest, const ModbusRegisters& pValues) {
+    if (pRequest.mBatch != nullptr) {
+        setRpcBatchResults(pRequest, &pValues, std::string());
+        return;
+    }
 
     std::string payload;
     try {
-        if (!pending.mIsWrite && pending.mConverter != nullptr) {
+        if (!pRequest.mIsWrite && pRequest.mConverter != nullptr) {
             // read with a converter: converter output is the payload, exactly as a poll would publish it
-            payload = pending.mConverter->toMqtt(pValues.mRegisters).getString();
-        } else if (pValues.mRegisters.getCount() == 1) {
+            payload = pRequest.mConverter->toMqtt(pValues).getString();
+        } else if (pValues.getCount() == 1) {
             // bare raw value: scalar string for count==1, JSON array for count>1
             // (same shape as MqttPayload::generate for a plain poll with no converter)
             // Used by reads without a converter and by all write replies — the optimistic
             // echo of the registers just written (no converter re-applied, no device re-read).
-            payload = std::to_string(pValues.mRegisters.getValue(0));
+            payload = std::to_string(pValues.getValue(0));
         } else {
             rapidjson::StringBuffer buf;
             rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
             writer.StartArray();
-            for (int i = 0; i < pValues.mRegisters.getCount(); i++) {
-                writer.Uint(pValues.mRegisters.getValue(i));
+            for (int i = 0; i < pValues.getCount(); i++) {
+                writer.Uint(pValues.getValue(i));
             }
             writer.EndArray();
             payload = buf.GetString();
         }
     } catch (const std::exception& ex) {
         spdlog::error("RPC response serialization failed: {}", ex.what());
-        publishRpcError(pending.mResponseTopic, pending.mCorrelationData, "internal error");
+        publishRpcError(pRequest.mResponseTopic, pRequest.mCorrelationData, "internal error");
         return;
     }
 
     // success: scalar or JSON-array payload for reads/writes, empty only on error
     try {
         mMqttImpl->publishResponse(
-            pending.mResponseTopic.c_str(),
+            pRequest.mResponseTopic.c_str(),
             static_cast<int>(payload.size()),
             payload.empty() ? nullptr : payload.c_str(),
-            pending.mCorrelationData.data(),
-            pending.mCorrelationData.size());
+            pRequest.mCorrelationData.data(),
+            pRequest.mCorrelationData.size());
         spdlog::debug(
             "RPC {} {}.{} ok: count={}, responseTopic={}, payloadLen={}, payload={}",
-            pending.mIsWrite ? "write" : "read",
-            pending.mSlaveId,
-            pending.mDisplayAddress,
-            pending.mCount,
-            pending.mResponseTopic,
+            pRequest.mIsWrite ? "write" : "read",
+            pRequest.mSlaveId,
+            pRequest.mDisplayAddress,
+            pRequest.mCount,
+            pRequest.mResponseTopic,
             payload.size(),
             payload);
     } catch (const std::exception& ex) {
@@ -667,17 +1171,55 @@ MqttClient::publishRpcError(const std::string& pResponseTopic,
 
 void
 MqttClient::publishRpcError(const std::string& pModbusNetworkName, const ModbusMessageBase& pSlaveData) {
-    MqttRpcPendingMap::iterator it = mPendingRpc.find(pSlaveData.getCommandId());
-    if (it == mPendingRpc.end()) {
-        spdlog::error("RPC error for unknown commandId {}", pSlaveData.getCommandId());
+    PendingRpcRequest* found = mPendingRpc.find(pSlaveData.getCommandId());
+    if (found == nullptr) {
+        if (!finishAbandonedRpcRequest(pSlaveData.getCommandId()))
+            spdlog::debug("RPC error for unknown or expired commandId {}", pSlaveData.getCommandId());
         return;
     }
-    PendingRpcRequest pending = std::move(it->second);
-    mPendingRpc.erase(it);
+    PendingRpcRequest pending = std::move(*found);
+    mPendingRpc.erase(pSlaveData.getCommandId());
+    finishRpcRequest(pending, pSlaveData.getCommandId());
+    mRpcStats.mFailed += 1 + pending.mCoalesced.size();
     const std::string errorMsg = pending.mIsWrite ? "modbus write failed" : "modbus read failed";
     spdlog::trace("RPC modbus {} failed: commandId={}, slave={}.{}",
                   pending.mIsWrite ? "write" : "read", pSlaveData.getCommandId(),
                   pending.mSlaveId, pending.mDisplayAddress);
-    publishRpcError(pending.mResponseTopic, pending.mCorrelationData, errorMsg);
+    failRpcRequest(pending, errorMsg);
+    for (const PendingRpcRequest& coalesced: pending.mCoalesced)
+        failRpcRequest(coalesced, errorMsg);
+}
+
+void
+MqttClient::failRpcRequest(const PendingRpcRequest& pRequest, const std::string& pErrorMsg) {
+    if (pRequest.mBatch != nullptr)
+        setRpcBatchResults(pRequest, nullptr, pErrorMsg);
+    else
+        publishRpcError(pRequest.mResponseTopic, pRequest.mCorrelationData, pErrorMsg);
+}
+
+std::chrono::steady_clock::time_point
+MqttClient::expireRpcRequests(const std::chrono::steady_clock::time_point& pNow) {
+    while (!mRpcDeadlines.empty() && mRpcDeadlines.front().first <= pNow) {
+        const int id = mRpcDeadlines.front().second;
+        mRpcDeadlines.pop_front();
+        // already answered
+        PendingRpcRequest* found = mPendingRpc.find(id);
+        if (found == nullptr) {
+            finishAbandonedRpcRequest(id);
+            continue;
+        }
+
+        PendingRpcRequest pending = std::move(*found);
+        mPendingRpc.erase(id);
+        finishRpcRequest(pending, id);
+        mRpcStats.mExpired += 1 + pending.mCoalesced.size();
+        spdlog::warn("RPC read {}.{} on network {} timed out: commandId={}",
+                     pending.mSlaveId, pending.mDisplayAddress, pending.mNetworkName, id);
+        failRpcRequest(pending, "request timed out");
+        for (const PendingRpcRequest& coalesced: pending.mCoalesced)
+            failRpcRequest(coalesced, "request timed out");
+    }
+    return mRpcDeadlines.empty() ? std::chrono::steady_clock::time_point::max() : mRpcDeadlines.front().first;
 }
 }
@@ -1,25 +1,36 @@
 #pragma once
 
+#include <deque>
 #include <map>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "config.hpp"
 #include "common.hpp"
 #include "mqttobject.hpp"
+#include "mqtt_object_publisher.hpp"
+#include "mqtt_publish_queue.hpp"
+#include "mqtt_command_worker.hpp"
+#include "mqtt_publish_workers.hpp"
+#include "open_hash_map.hpp"
 #include "modbus_client.hpp"
 #include "imqttimpl.hpp"
-#include "default_command_converter.hpp"
 #include "pending_rpc_request.hpp"
 
 namespace modmqttd {
 
 class ModMqtt;
 
-class MqttClient {
+class MqttClient : public MqttObjectPublisher::Output {
     public:
-        typedef std::map<MqttObjectRegisterIdent, std::vector<std::shared_ptr<MqttObject>>, MqttObjectRegisterIdent::Compare> MqttPollObjMap;
-        typedef std::map<int, std::vector<std::shared_ptr<MqttObject>>> MqttCmdObjMap;
-        typedef std::map<int, PendingRpcRequest> MqttRpcPendingMap;
+        typedef MqttObjectPublisher::MqttPollObjMap MqttPollObjMap;
+        typedef MqttObjectPublisher::MqttCmdObjMap MqttCmdObjMap;
+        // keyed by command id
+        typedef OpenHashMap<PendingRpcRequest> MqttRpcPendingMap;
+        // network, slave, register type, register number and count
+        typedef std::tuple<std::string, int, RegisterType, int, int> RpcReadKey;
 
         enum State {
             DISCONNECTED,
@@ -31,86 +42,214 @@ class MqttClient {
         MqttClient(ModMqtt& modmqttd);
         void setClientId(const std::string& clientId);
         void setBrokerConfig(const MqttBrokerConfig& config);
-        void setModbusClients(const std::vector<std::shared_ptr<ModbusClient>>& clients) { mModbusClients = clients; }
+        void setModbusClients(const std::vector<std::shared_ptr<ModbusClient>>& clients);
         void start(); // TODO throw(MosquittoException) - deprecated?;
         bool isStarted() { return mIsStarted; }
         void shutdown();
         bool isConnected() const { return mConnectionState == State::CONNECTED; }
         void reconnect() { mMqttImpl->reconnect(); }
-        void setObjects(const MqttPollObjMap& pObjects) { mObjects = pObjects; };
-        void setCommandObjects(const MqttCmdObjMap& pCmdObjects) { mCommandObjects = pCmdObjects; }
+        // open pCount connections to the broker, topics are partitioned
+        // between them. Must be called after client id is set
+        void setPublishConnections(int pCount);
+        void setObjects(const MqttPollObjMap& pObjects) {
+            mObjects = pObjects;
+            mPublisher.setObjects(pObjects);
+            mCommandFilters.clear();
+        };
+        void setCommandObjects(const MqttCmdObjMap& pCmdObjects) {
+            mCommandObjects = pCmdObjects;
+            mPublisher.setCommandObjects(pCmdObjects);
+        }
+        // process object updates on pCount threads instead of the main thread.
+        // Must be called after objects are set
+        void startPublishWorkers(int pCount);
+        // convert command payloads on a separate thread
+        // instead of the main thread
+        void startCommandWorker();
+        // returns -1 if publish workers are not started
+        int getPublishNotifierFd();
+        // publish messages generated by publish workers
+        void processPublishQueue();
+        // publish state delayed by object publish limits and stats, answer
+        // expired RPC requests. Returns time of the next timer or
+        // time_point::max() if there is none
+        std::chrono::steady_clock::time_point processPublishTimers();
         void setRpcMode(RpcMode pMode) { mRpcMode = pMode; }
+        // RPC reads are answered with error if modbus reply is not
+        // received in pTimeout, 0 to disable
+        void setRpcTimeout(std::chrono::milliseconds pTimeout) { mRpcTimeout = pTimeout; }
+        void setCommandSubscriptions(CommandSubscriptions pMode) { mCommandSubscriptions = pMode; }
+        // topic filters subscribed for commands in WILDCARD mode
+        const std::vector<std::string>& getCommandFilters();
+        // publish queue depth on client_id/stats/publish and RPC
+        // counters on client_id/stats/rpc, 0 to disable
+        void setStatsInterval(std::chrono::milliseconds pInterval) { mStatsInterval = pInterval; }
+        // limit messages per second published after reconnect, 0 for no limit.
+        // Must be called before publish workers are started
+        void setRepublishRate(int pRate) {
+            mRepublishRate = pRate;
+            mPublisher.setRepublishRate(pRate);
+        }
 
         void addCommand(const MqttObjectCommand& pCommand);
         const std::map<std::string, MqttObjectCommand>& getCommands() const { return mCommands; }
 
         void processRegisterValues(const std::string& modbusNetworkName, const MsgRegisterValues& values);
+        void processRegisterValues(const std::string& modbusNetworkName, const MsgRegisterValuesBatch& batch);
         void processRegistersOperationFailed(const std::string& pModbusNetworkName, const ModbusMessageBase& pValues);
         void processModbusNetworkState(const std::string& modbusNetworkName, bool isUp);
         void publishRpcError(const std::string& pModbusNetworkName, const ModbusMessageBase& pSlaveData);
 
-        // mqtt communication callbacks
-        void onDisconnect();
-        void onConnect();
+        // mqtt communication callbacks, pConnection is the index
+        // of broker connection. Messages are received only on the primary one
+        void onDisconnect(int pConnection = 0);
+        void onConnect(bool pSessionPresent = false, int pConnection = 0);
         void onMessage(const char* pTopic, const void* pPayload, int pPayloadLen,
                        const char* pResponseTopic = nullptr,
                        const std::shared_ptr<void>& pCorrelationData = nullptr, int pCorrelationLen = 0);
-        void onPublish(int messageId) {}
+        void onPublish(int messageId, int pConnection = 0);
+
+        // MqttObjectPublisher::Output, applies broker max_queued limit
+        void publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps);
+
+        // network loop integration, see IMqttImpl
+        int getConnectionCount() const { return mConnections.size(); }
+        int getSocket(int pConnection) { return mConnections[pConnection].mImpl->getSocket(); }
+        bool wantWrite(int pConnection) { return mConnections[pConnection].mImpl->wantWrite(); }
+        void loopRead(int pConnection) { mConnections[pConnection].mImpl->loopRead(); }
+        void loopWrite(int pConnection) { mConnections[pConnection].mImpl->loopWrite(); }
+        void loopMisc();
 
-        // for unit tests
-        void setMqttImplementation(const std::shared_ptr<IMqttImpl>& impl) { mMqttImpl = impl; }
+        // for unit tests, must be called before client id is set
+        void setMqttImplementation(const std::shared_ptr<IMqttImpl>& impl);
 
     private:
         // publish all data after broker is reconnected
-        void publishAll();
-        void publishState(const std::shared_ptr<MqttObject>&, bool pForce = false);
-        void publishAvailabilityChange(const MqttObject& obj);
+        void publishAll(bool pSessionPresent);
+        // pass message to mqtt library, returns message id
+        // unique for all connections
+        int sendMessage(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps);
+        // index of connection used for publishing on pTopic
+        int getPublishConnection(const std::string& pTopic) const;
+        void publishStats();
+        void publishRpcStats();
+        // publish RPC read response if pSlaveData is not a result of mqtt command
+        void checkRpcResponse(const std::string& pModbusNetworkName, const MsgRegisterValues& pSlaveData);
 
         void handleRpcRequest(const void* pPayload, int pPayloadlen,
                               const char* pResponseTopic,
                               const std::shared_ptr<void>& pCorrelationData, int pCorrelationLen);
+        // send modbus requests for batch operations without result,
+        // pWriteValues contains values for every write operation
+        void sendRpcBatch(const std::shared_ptr<PendingRpcBatch>& pBatch,
+                          const std::vector<std::vector<uint16_t>>& pWriteValues);
+        // send merged read operations, called when batch writes are finished
+        void sendRpcBatchReads(const std::shared_ptr<PendingRpcBatch>& pBatch);
+        void sendRpcRequest(PendingRpcRequest&& pRequest, const std::vector<uint16_t>& pWriteValues);
+        // store results of batch operations answered by pRequest, pValues is nullptr on error
+        void setRpcBatchResults(const PendingRpcRequest& pRequest, const ModbusRegisters* pValues, const std::string& pErrorMsg);
+        void publishRpcBatchResponse(const PendingRpcBatch& pBatch);
         void publishRpcResponse(const std::string& pNetworkName, const MsgRegisterValues& pValues);
+        void publishRpcValues(const PendingRpcRequest& pRequest, const ModbusRegisters& pValues);
+        void failRpcRequest(const PendingRpcRequest& pRequest, const std::string& pErrorMsg);
+        // update pending counters for request removed from mPendingRpc
+        void finishRpcRequest(const PendingRpcRequest& pRequest, int pCommandId);
+        // update pending counter for request dropped on disconnect,
+        // returns false if pCommandId is unknown
+        bool finishAbandonedRpcRequest(int pCommandId);
+        // answer requests with deadline before pNow, returns the next deadline
+        std::chrono::steady_clock::time_point expireRpcRequests(const std::chrono::steady_clock::time_point& pNow);
         void publishRpcError(const std::string& pResponseTopic,
                              const CorrelationData& pCorrelationData, const std::string& pErrorMsg);
 
+        // primary connection with command and RPC subscriptions
         std::shared_ptr<IMqttImpl> mMqttImpl;
 
+        struct Connection {
+            std::shared_ptr<IMqttImpl> mImpl;
+            bool mIsConnected = false;
+        };
+        // all broker connections, the first one is mMqttImpl.
+        // State is published only if all of them are connected
+        std::vector<Connection> mConnections;
+        int mConnectedCount = 0;
+        // all connections resumed previous session
+        bool mSessionPresent = true;
+        std::string mClientId;
+        std::hash<std::string> mTopicHash;
+
         void subscribeToCommandTopic(const std::string& objectName, const MqttObjectCommand& cmd);
 
         ModMqtt& mOwner;
         MqttBrokerConfig mBrokerConfig;
 
         void checkAvailabilityChange(MqttObject& object, const MqttObjectRegisterIdent& ident, uint16_t value);
-        std::map<std::string, MqttObjectCommand>::const_iterator findCommand(const char* pTopic) const;
+        // all topics published by us that cannot be matched by command filters
+        std::vector<std::string> getOwnTopics() const;
 
         std::vector<std::shared_ptr<ModbusClient>> mModbusClients;
 
-        // TODO check in which thread context mConnectionState is changed.
-        // Now it looks like callbacks use mosquitto internal thread and ModMqtt main thread.
+        // all mqtt callbacks are called from ModMqtt main loop thread
         State mConnectionState = State::DISCONNECTED;
         bool mIsStarted = false;
-        /**
-         * Assuming that PollGroups do not overlap hold separate list
-         * per poll group ident. This way for each MsgRegisterValues we can update
-         * objects from single list only.
-         * MqttObject can be a member of multiple lists on this map
-         */
+        // all objects, see MqttObjectPublisher
         MqttPollObjMap mObjects;
-
-        /**
-         * Direct relation between command and objects that poll the
-         * same registers
-         */
         MqttCmdObjMap mCommandObjects;
 
+        // updates objects in the main thread if there are no publish workers
+        MqttObjectPublisher mPublisher;
+        std::unique_ptr<MqttPublishWorkers> mPublishWorkers;
+        int mRepublishRate = 0;
+
+        MqttPublishQueue mPublishQueue;
+        // modbus clients were told that mqtt network is down
+        // until held messages are sent
+        bool mPollingPaused = false;
+
+        std::string mStatsTopic;
+        std::chrono::milliseconds mStatsInterval = std::chrono::milliseconds::zero();
+        std::chrono::steady_clock::time_point mNextStatsTime = std::chrono::steady_clock::time_point::min();
+
         std::map<std::string, MqttObjectCommand> mCommands;
 
-        DefaultCommandConverter mDefaultConverter;
+        // command with modbus client resolved when command is added
+        struct CommandRecord {
+            const MqttObjectCommand* mCommand;
+            // nullptr if modbus network is not found
+            ModbusClient* mClient;
+        };
+        // onMessage() lookup, keys point to mCommands keys
+        std::unordered_map<std::string_view, CommandRecord> mCommandIndex;
+        CommandSubscriptions mCommandSubscriptions = CommandSubscriptions::TOPICS;
+        std::vector<std::string> mCommandFilters;
+        ModbusClient* findModbusClient(const std::string& pNetworkName) const;
+
+        // converts commands if started, see startCommandWorker()
+        std::unique_ptr<MqttCommandWorker> mCommandWorker;
 
         RpcMode mRpcMode = RpcMode::DISABLED;
         std::string mRpcRequestTopic;
         int mNextRpcId = 0;
         MqttRpcPendingMap mPendingRpc;
+        // command id of modbus read sent for RPC read
+        std::map<RpcReadKey, int> mRpcReadsInFlight;
+        std::chrono::milliseconds mRpcTimeout = std::chrono::seconds(10);
+        // command ids of RPC reads in deadline order
+        std::deque<std::pair<std::chrono::steady_clock::time_point, int>> mRpcDeadlines;
+        // network names of requests dropped on disconnect and still held
+        // by modbus threads, counted in mRpcPending until reply or deadline
+        std::map<int, std::string> mAbandonedRpc;
+        struct RpcStats {
+            // answered with modbus reply or with fresh poll data
+            uint64_t mServed = 0;
+            // modbus read or write failed
+            uint64_t mFailed = 0;
+            // too many pending requests for modbus network
+            uint64_t mRejected = 0;
+            // no modbus reply before deadline
+            uint64_t mExpired = 0;
+        } mRpcStats;
+        std::string mRpcStatsTopic;
 };
 
 }
@@ -10,7 +10,11 @@ namespace modmqttd {
 class MqttObjectCommand : public ModbusMessageBase {
     public:
         enum PayloadType {
-            STRING = 1
+            STRING = 1,
+            CBOR = 2,
+            MSGPACK = 3,
+            // register values as big endian 16 bit words, converter is not used
+            RAW = 4
         };
         MqttObjectCommand(
             int pCommandId,
@@ -21,87 +21,6 @@ MqttObjectRegisterValue::setValue(uint16_t val) {
 }
 
 
-bool
-MqttObjectDataNode::updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData) {
-    bool ret = false;
-    if (!isScalar()) {
-        for (MqttObjectDataNode& node: mNodes) {
-            if (node.updateRegisterValues(pNetworkName, pSlaveData))
-                ret = true;
-        }
-    } else {
-        if (
-            pSlaveData.mSlaveId == mIdent->mSlaveId && pSlaveData.mRegisterType == mIdent->mRegisterType && pNetworkName == mIdent->mNetworkName) {
-            // check if our value is in pSlaveData range and update
-            if (mIdent->mRegisterNumber >= pSlaveData.mRegister && mIdent->mRegisterNumber <= (pSlaveData.lastRegister())) {
-                uint16_t idx = mIdent->mRegisterNumber - pSlaveData.mRegister;
-                ret = mValue.setValue(pSlaveData.mRegisters.getValue(idx));
-                mValue.setReadError(false);
-            }
-        }
-    }
-    return ret;
-}
-
-
-bool
-MqttObjectDataNode::updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData) {
-    bool ret = false;
-    if (!isScalar()) {
-        for (MqttObjectDataNode& node: mNodes) {
-            if (node.updateRegistersReadFailed(pNetworkName, pSlaveData))
-                ret = true;
-        }
-    } else {
-        if (
-            pSlaveData.mSlaveId == mIdent->mSlaveId && pSlaveData.mRegisterType == mIdent->mRegisterType && pNetworkName == mIdent->mNetworkName) {
-            // check if our value is in pSlaveData range and update
-            uint16_t idx = abs(mIdent->mRegisterNumber - pSlaveData.mRegister);
-            if (idx < pSlaveData.mCount) {
-                mValue.setReadError(true);
-                ret = true;
-            }
-        }
-    }
-    return ret;
-}
-
-
-bool
-MqttObjectDataNode::setModbusNetworkState(const std::string& pNetworkName, bool isUp) {
-    bool ret = false;
-    if (!isScalar()) {
-        for (MqttObjectDataNode& node: mNodes) {
-            if (node.setModbusNetworkState(pNetworkName, isUp))
-                ret = true;
-        }
-    } else {
-        if (pNetworkName == mIdent->mNetworkName) {
-            if (mValue.isPolling() ^ isUp) {
-                mValue.setReadError(!isUp);
-                ret = true;
-            }
-        }
-    }
-    return ret;
-}
-
-
-bool
-MqttObjectDataNode::isPolling() const {
-    if (isScalar())
-        return mValue.isPolling();
-    else {
-        for (auto it = mNodes.begin(); it != mNodes.end(); it++) {
-            if (!it->isPolling()) {
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-
 AvailableFlag
 MqttObjectAvailability::getAvailableFlag() const {
     // no registers for availability
@@ -115,7 +34,7 @@ MqttObjectAvailability::getAvailableFlag() const {
         return AvailableFlag::NotSet;
 
     // single raw value or MqttObjectDataNode with converter and child nodes
-    if (mNodes.front().getConvertedValue().getInt() != mAvailableValue.getInt())
+    if (mNodes.front().getConvertedValue(mValues).getInt() != mAvailableValue.getInt())
         return AvailableFlag::False;
     return AvailableFlag::True;
 }
@@ -127,64 +46,64 @@ MqttObjectDataNode::setScalarNode(const MqttObjectRegisterIdent& ident) {
 }
 
 
-bool
-MqttObjectDataNode::hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const {
-    if (isScalar()) {
-        assert(mIdent != nullptr);
-        if (mIdent->mSlaveId != pRange.mSlaveId)
-            return false;
-        if (!pRange.overlaps(mIdent->asModbusAddressRange()))
-            return false;
-        if (mIdent->mNetworkName != pNetworkName)
-            return false;
-        return true;
-    } else {
-        for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-            if (it->hasRegisterIn(pNetworkName, pRange))
-                return true;
-        }
-    }
-    return false;
-}
-
-
-bool
-MqttObjectDataNode::hasAllValues() const {
+void
+MqttObjectDataNode::assignSlots(int pFirstSlot, std::vector<MqttObjectRegisterIdent>& pSlotIdents) {
     if (isScalar()) {
         assert(mIdent != nullptr);
-        return mValue.hasValue();
+        mSlot = pFirstSlot + pSlotIdents.size();
+        pSlotIdents.push_back(*mIdent);
     } else {
-        for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-            if (!it->hasAllValues())
-                return false;
-        }
+        for (MqttObjectDataNode& node: mNodes)
+            node.assignSlots(pFirstSlot, pSlotIdents);
     }
-    return true;
 }
 
 
 MqttValue
-MqttObjectDataNode::getConvertedValue() const {
+MqttObjectDataNode::getConvertedValue(const MqttObjectRegisterValues& pValues) const {
     if (mConverter != nullptr) {
-        ModbusRegisters data;
+        // reused by all conversions on this thread to avoid
+        // allocation for every converted value
+        static thread_local ModbusRegisters data;
+        data.clear();
         if (isScalar()) {
-            data.appendValue(getRawValue());
+            data.appendValue(getRawValue(pValues));
         } else {
             for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-                data.appendValue(it->getRawValue());
+                data.appendValue(it->getRawValue(pValues));
             }
         }
         return mConverter->toMqtt(data);
     } else {
-        return MqttValue(mValue.getRawValue());
+        return MqttValue(getRawValue(pValues));
     }
 }
 
 
 uint16_t
-MqttObjectDataNode::getRawValue() const {
+MqttObjectDataNode::getRawValue(const MqttObjectRegisterValues& pValues) const {
     assert(isScalar());
-    return mValue.getRawValue();
+    return pValues[mSlot].getRawValue();
+}
+
+
+void
+MqttObjectDataNode::getSlots(std::vector<int>& pSlots) const {
+    if (isScalar()) {
+        pSlots.push_back(mSlot);
+    } else {
+        for (const MqttObjectDataNode& node: mNodes)
+            node.getSlots(pSlots);
+    }
+}
+
+
+void
+MqttObjectDataNode::setDefaultValueFilter(const MqttValueFilter& pFilter) {
+    if (!mFilter.isSet())
+        mFilter = pFilter;
+    for (MqttObjectDataNode& node: mNodes)
+        node.setDefaultValueFilter(mFilter);
 }
 
 
@@ -195,73 +114,165 @@ MqttObjectDataNode::addChildDataNode(const MqttObjectDataNode& pNode, bool force
 }
 
 
-bool
-MqttObjectState::hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const {
-    for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (it->hasRegisterIn(pNetworkName, pRange))
-            return true;
+// slots of registers in pRange from a register index
+static std::pair<std::vector<std::pair<int, int>>::const_iterator, std::vector<std::pair<int, int>>::const_iterator>
+findIndexSlots(const std::vector<std::pair<int, int>>& pSlots, const ModbusAddressRange& pRange) {
+    std::vector<std::pair<int, int>>::const_iterator first = std::lower_bound(
+        pSlots.begin(), pSlots.end(), pRange.firstRegister(),
+        [](const std::pair<int, int>& slot, int reg) { return slot.first < reg; }
+    );
+    std::vector<std::pair<int, int>>::const_iterator last = std::upper_bound(
+        first, pSlots.end(), pRange.lastRegister(),
+        [](int reg, const std::pair<int, int>& slot) { return reg < slot.first; }
+    );
+    return std::make_pair(first, last);
+}
+
+
+std::pair<MqttObjectState::SlotList::const_iterator, MqttObjectState::SlotList::const_iterator>
+MqttObjectState::findSlots(int pNetworkId, int pSlaveId, const ModbusAddressRange& pRange) const {
+    static const SlotList empty;
+    for (const SlotIndex& index: mSlotIndex) {
+        if (index.mNetworkId == pNetworkId && index.mSlaveId == pSlaveId && index.mRegisterType == pRange.mRegisterType)
+            return findIndexSlots(index.mSlots, pRange);
     }
-    return false;
+    return std::make_pair(empty.end(), empty.end());
 }
 
 
 bool
-MqttObjectState::updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData) {
-    bool ret = false;
-    for (std::vector<MqttObjectDataNode>::iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (it->updateRegisterValues(pNetworkName, pSlaveData))
-            ret = true;
+MqttObjectState::setSlotValue(int pSlot, uint16_t pValue) {
+    MqttObjectRegisterValue& value(mValues[pSlot]);
+    if (!value.hasValue())
+        mMissingValueCount--;
+    if (!value.setValue(pValue))
+        return false;
+    if (!value.isDirty()) {
+        value.setDirty(true);
+        mDirtySlots.push_back(pSlot);
     }
-    return ret;
+    return true;
+}
+
+
+void
+MqttObjectState::setSlotReadError(int pSlot, bool pFlag) {
+    MqttObjectRegisterValue& value(mValues[pSlot]);
+    if (value.isPolling() == pFlag)
+        mReadErrorCount += pFlag ? 1 : -1;
+    value.setReadError(pFlag);
 }
 
 
 bool
-MqttObjectState::updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData) {
-    bool ret = false;
-    for (std::vector<MqttObjectDataNode>::iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (it->updateRegistersReadFailed(pNetworkName, pSlaveData))
-            ret = true;
+MqttObjectState::hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const {
+    // used when objects are configured, network ids are not set yet
+    for (const SlotIndex& index: mSlotIndex) {
+        if (index.mNetworkName == pNetworkName && index.mSlaveId == pRange.mSlaveId && index.mRegisterType == pRange.mRegisterType) {
+            auto slots = findIndexSlots(index.mSlots, pRange);
+            return slots.first != slots.second;
+        }
     }
-    return ret;
+    return false;
+}
+
+
+void
+MqttObjectState::setNetworkIds(ModbusNetworkIds& pIds) {
+    for (SlotIndex& index: mSlotIndex)
+        index.mNetworkId = pIds.add(index.mNetworkName);
 }
 
 
 bool
-MqttObjectState::setModbusNetworkState(const std::string& networkName, bool isUp) {
+MqttObjectState::updateRegisterValues(int pNetworkId, const MsgRegisterValues& pSlaveData) {
     bool ret = false;
-    for (std::vector<MqttObjectDataNode>::iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (it->setModbusNetworkState(networkName, isUp))
+    auto slots = findSlots(pNetworkId, pSlaveData.mSlaveId, pSlaveData);
+    for (auto it = slots.first; it != slots.second; it++) {
+        uint16_t idx = it->first - pSlaveData.mRegister;
+        if (setSlotValue(it->second, pSlaveData.mRegisters.getValue(idx)))
             ret = true;
+        setSlotReadError(it->second, false);
     }
     return ret;
 }
 
 
+void
+MqttObjectState::getSlots(int pNetworkId, const ModbusMessageBase& pRange, std::vector<int>& pSlots) const {
+    auto slots = findSlots(pNetworkId, pRange.mSlaveId, pRange);
+    for (auto it = slots.first; it != slots.second; it++)
+        pSlots.push_back(it->second);
+}
+
+
 bool
-MqttObjectState::hasAllValues() const {
-    for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (!it->hasAllValues())
-            return false;
-    }
-    return true;
+MqttObjectState::updateRegistersReadFailed(int pNetworkId, const ModbusMessageBase& pSlaveData) {
+    auto slots = findSlots(pNetworkId, pSlaveData.mSlaveId, pSlaveData);
+    for (auto it = slots.first; it != slots.second; it++)
+        setSlotReadError(it->second, true);
+    return slots.first != slots.second;
 }
 
 
 bool
-MqttObjectState::isPolling() const {
-    for (std::vector<MqttObjectDataNode>::const_iterator it = mNodes.begin(); it != mNodes.end(); it++) {
-        if (!it->isPolling())
-            return false;
+MqttObjectState::setModbusNetworkState(int pNetworkId, bool isUp) {
+    bool ret = false;
+    for (const SlotIndex& index: mSlotIndex) {
+        if (index.mNetworkId != pNetworkId)
+            continue;
+        for (const std::pair<int, int>& slot: index.mSlots) {
+            if (mValues[slot.second].isPolling() ^ isUp) {
+                setSlotReadError(slot.second, !isUp);
+                ret = true;
+            }
+        }
     }
-    return true;
+    return ret;
+}
+
+
+void
+MqttObjectState::clearDirty() {
+    for (int slot: mDirtySlots)
+        mValues[slot].setDirty(false);
+    mDirtySlots.clear();
 }
 
 
 void
 MqttObjectState::addDataNode(const MqttObjectDataNode& pNode, bool forceList) {
     mNodes.push_back(pNode);
+    mGeneration.mValue = Generation::next();
     mNodes.forceListOutput(forceList || mNodes.size() > 1);
+
+    std::vector<MqttObjectRegisterIdent> idents;
+    const int firstSlot = mValues.size();
+    mNodes.back().assignSlots(firstSlot, idents);
+
+    for (size_t i = 0; i < idents.size(); i++) {
+        const MqttObjectRegisterIdent& ident(idents[i]);
+        const int slot = firstSlot + i;
+        mValues.push_back(MqttObjectRegisterValue());
+        mMissingValueCount++;
+
+        auto index = std::find_if(mSlotIndex.begin(), mSlotIndex.end(), [&ident](const SlotIndex& idx) {
+            return idx.mSlaveId == ident.mSlaveId && idx.mRegisterType == ident.mRegisterType && idx.mNetworkName == ident.mNetworkName;
+        });
+        if (index == mSlotIndex.end()) {
+            mSlotIndex.push_back(SlotIndex{ident.mNetworkName, -1, ident.mSlaveId, ident.mRegisterType, SlotList()});
+            index = std::prev(mSlotIndex.end());
+        }
+        std::pair<int, int> entry(ident.mRegisterNumber, slot);
+        index->mSlots.insert(std::upper_bound(index->mSlots.begin(), index->mSlots.end(), entry), entry);
+    }
+}
+
+
+void
+MqttObjectState::setDefaultValueFilter(const MqttValueFilter& pFilter) {
+    for (MqttObjectDataNode& node: mNodes)
+        node.setDefaultValueFilter(pFilter);
 }
 
 
@@ -269,6 +280,7 @@ MqttObject::MqttObject(const std::string& pTopic)
     : mTopic(pTopic) {
     mStateTopic = mTopic + "/state";
     mAvailabilityTopic = mTopic + "/availability";
+    mStateProps.mRetain = true;
 };
 
 
@@ -279,19 +291,44 @@ MqttObject::hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBa
 
 
 void
-MqttObject::updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData) {
-    bool stateChanged = mState.updateRegisterValues(pNetworkName, pSlaveData);
-    bool availChanged = mAvailability.updateRegisterValues(pNetworkName, pSlaveData);
+MqttObject::setNetworkIds(ModbusNetworkIds& pIds) {
+    mState.setNetworkIds(pIds);
+    mAvailability.setNetworkIds(pIds);
+}
+
+
+bool
+MqttObject::updateRegisterValues(int pNetworkId, const MsgRegisterValues& pSlaveData) {
+    bool stateChanged = mState.updateRegisterValues(pNetworkId, pSlaveData);
+    bool availChanged = mAvailability.updateRegisterValues(pNetworkId, pSlaveData);
     if (stateChanged || availChanged || !mIsAvailable) {
         updateAvailablityFlag();
     }
+
+    if (mAggregate.isSet() && mIsAvailable == AvailableFlag::True) {
+        std::vector<int> slots;
+        mState.getSlots(pNetworkId, pSlaveData, slots);
+        if (!slots.empty())
+            mAggregate.addSamples(mState, slots, std::chrono::steady_clock::now());
+    }
+    return stateChanged;
+}
+
+
+void
+MqttObject::setAggregate(const MqttAggregate& pAggregate) {
+    mAggregate = pAggregate;
+    if (mAggregate.getTopic().empty())
+        mAggregateTopic = mStateTopic;
+    else
+        mAggregateTopic = mTopic + "/" + mAggregate.getTopic();
 }
 
 
 void
-MqttObject::updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData) {
-    bool stateChanged = mState.updateRegistersReadFailed(pNetworkName, pSlaveData);
-    bool availChanged = mAvailability.updateRegistersReadFailed(pNetworkName, pSlaveData);
+MqttObject::updateRegistersReadFailed(int pNetworkId, const ModbusMessageBase& pSlaveData) {
+    bool stateChanged = mState.updateRegistersReadFailed(pNetworkId, pSlaveData);
+    bool availChanged = mAvailability.updateRegistersReadFailed(pNetworkId, pSlaveData);
     if (stateChanged || availChanged) {
         updateAvailablityFlag();
     }
@@ -299,9 +336,9 @@ MqttObject::updateRegistersReadFailed(const std::string& pNetworkName, const Mod
 
 
 bool
-MqttObject::setModbusNetworkState(const std::string& networkName, bool isUp) {
-    bool stateChanged = mState.setModbusNetworkState(networkName, isUp);
-    bool availChanged = mAvailability.setModbusNetworkState(networkName, isUp);
+MqttObject::setModbusNetworkState(int pNetworkId, bool isUp) {
+    bool stateChanged = mState.setModbusNetworkState(pNetworkId, isUp);
+    bool availChanged = mAvailability.setModbusNetworkState(pNetworkId, isUp);
     if (stateChanged || availChanged) {
         updateAvailablityFlag();
         return true;
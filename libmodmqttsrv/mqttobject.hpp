@@ -1,14 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <map>
 #include <iostream>
+#include <vector>
 
 #include <yaml-cpp/yaml.h>
 
 #include "modbus_messages.hpp"
 #include "common.hpp"
 #include "libmodmqttconv/converter.hpp"
+#include "mqttpayload.hpp"
+#include "mqtt_value_filter.hpp"
+#include "mqtt_aggregate.hpp"
 
 namespace modmqttd {
 
@@ -19,6 +25,35 @@ enum AvailableFlag {
 };
 
 
+/**
+ * Interns modbus network names to small integer ids
+ * used in MqttObjectRegisterIdent::key()
+ * */
+class ModbusNetworkIds {
+    public:
+        // returns -1 for unknown network
+        int find(const std::string& pNetworkName) const {
+            // there are only a few networks, linear search is fine
+            for (size_t i = 0; i < mNames.size(); i++)
+                if (mNames[i] == pNetworkName)
+                    return i;
+            return -1;
+        }
+        int add(const std::string& pNetworkName) {
+            int id = find(pNetworkName);
+            if (id != -1)
+                return id;
+            mNames.push_back(pNetworkName);
+            return mNames.size() - 1;
+        }
+        int size() const { return mNames.size(); }
+        void clear() { mNames.clear(); }
+
+    private:
+        std::vector<std::string> mNames;
+};
+
+
 class MqttObjectRegisterIdent {
     public:
         struct Compare {
@@ -54,6 +89,21 @@ class MqttObjectRegisterIdent {
             return ModbusAddressRange(mRegisterNumber, mRegisterType, 1);
         }
 
+        // packed ident for OpenHashMap lookups:
+        // network id (16 bits), slave (16), register type (8), register number (24)
+        static uint64_t key(int pNetworkId, int pSlaveId, RegisterType pRegisterType, int pRegisterNumber) {
+            return (static_cast<uint64_t>(pNetworkId & 0xffff) << 48)
+                | (static_cast<uint64_t>(pSlaveId & 0xffff) << 32)
+                | (static_cast<uint64_t>(pRegisterType & 0xff) << 24)
+                | static_cast<uint64_t>(pRegisterNumber & 0xffffff);
+        }
+        static uint64_t key(int pNetworkId, const ModbusMessageBase& pSlaveData) {
+            return key(pNetworkId, pSlaveData.mSlaveId, pSlaveData.mRegisterType, pSlaveData.mRegister);
+        }
+        uint64_t key(int pNetworkId) const {
+            return key(pNetworkId, mSlaveId, mRegisterType, mRegisterNumber);
+        }
+
         std::string mNetworkName;
         int mSlaveId;
         int mRegisterNumber;
@@ -70,13 +120,19 @@ class MqttObjectRegisterValue {
         uint16_t getRawValue() const { return mValue; }
         bool hasValue() const { return mHasValue; }
         bool isPolling() const { return mReadOk; }
+        // set when value is changed, cleared after publish
+        bool isDirty() const { return mDirty; }
+        void setDirty(bool pFlag) { mDirty = pFlag; }
 
     protected:
         bool mReadOk = false;
         bool mHasValue = false;
+        bool mDirty = false;
         uint16_t mValue = 0;
 };
 
+typedef std::vector<MqttObjectRegisterValue> MqttObjectRegisterValues;
+
 class MqttObjectDataNode;
 
 /**
@@ -97,14 +153,6 @@ class MqttObjectDataNodeList : public std::vector<MqttObjectDataNode> {
 
 class MqttObjectDataNode {
     public:
-        bool updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData);
-        bool updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData);
-        bool setModbusNetworkState(const std::string& networkName, bool isUp);
-
-        bool hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const;
-        bool hasAllValues() const;
-        bool isPolling() const;
-
         bool isUnnamed() const { return mKeyName.empty(); }
         void setName(const std::string& pName) { mKeyName = pName; }
         const std::string& getName() const { return mKeyName; }
@@ -112,12 +160,24 @@ class MqttObjectDataNode {
         void setConverter(std::shared_ptr<DataConverter> conv) { mConverter = conv; }
         bool hasConverter() const { return mConverter != nullptr; }
 
+        void setValueFilter(const MqttValueFilter& pFilter) { mFilter = pFilter; }
+        const MqttValueFilter& getValueFilter() const { return mFilter; }
+        // set pFilter for this node and its children
+        // if they do not have their own filter
+        void setDefaultValueFilter(const MqttValueFilter& pFilter);
+
         bool isScalar() const { return mNodes.size() == 0; }
         void addChildDataNode(const MqttObjectDataNode& pNode, bool forceList = false);
         void setScalarNode(const MqttObjectRegisterIdent& ident);
         const MqttObjectDataNodeList& getChildNodes() const { return mNodes; }
-        MqttValue getConvertedValue() const;
-        uint16_t getRawValue() const;
+
+        // assign consecutive value slots starting from pFirstSlot to scalar nodes
+        // and append their register identifiers to pSlotIdents
+        void assignSlots(int pFirstSlot, std::vector<MqttObjectRegisterIdent>& pSlotIdents);
+        MqttValue getConvertedValue(const MqttObjectRegisterValues& pValues) const;
+        uint16_t getRawValue(const MqttObjectRegisterValues& pValues) const;
+        // append value slots used by this node
+        void getSlots(std::vector<int>& pSlots) const;
 
     private:
         // if not empty then json value is published as json object
@@ -136,35 +196,93 @@ class MqttObjectDataNode {
 
         /**
          * Modbus register identifier used to
-         * update values received from modbus threads.
+         * build MqttObjectState register index.
          */
         std::shared_ptr<MqttObjectRegisterIdent> mIdent;
         /**
-         * if mNodes is empty then this is a scalar value.
+         * if mNodes is empty then this is a scalar value
+         * stored in MqttObjectState value list at mSlot index
          */
-        MqttObjectRegisterValue mValue;
+        int mSlot = -1;
 
         /**
          * A converter used to convert mValue or list of scalars on mNodes list
          */
         std::shared_ptr<DataConverter> mConverter;
+
+        // applied to converted value of this node
+        MqttValueFilter mFilter;
 };
 
+/**
+ * Register values of all scalar data nodes are stored in a flat
+ * list of slots. Modbus updates are applied through a sorted
+ * register->slot index, data node tree is used for payload generation only.
+ */
 class MqttObjectState {
     public:
-        // void addRegister(const std::string& name, const MqttObjectRegisterIdent& regIdent, const std::shared_ptr<DataConverter>& conv);
         bool hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const;
-        bool usesModbusNetwork(const std::string& networkName) const;
-        bool updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData);
-        bool updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData);
-        bool setModbusNetworkState(const std::string& networkName, bool isUp);
-        bool hasAllValues() const;
-        bool isPolling() const;
+        // assign network ids used by methods below, see MqttObjectPublisher::setObjects()
+        void setNetworkIds(ModbusNetworkIds& pIds);
+        bool updateRegisterValues(int pNetworkId, const MsgRegisterValues& pSlaveData);
+        bool updateRegistersReadFailed(int pNetworkId, const ModbusMessageBase& pSlaveData);
+        bool setModbusNetworkState(int pNetworkId, bool isUp);
+        bool hasAllValues() const { return mMissingValueCount == 0; }
+        bool isPolling() const { return mReadErrorCount == 0; }
         void addDataNode(const MqttObjectDataNode& pNode, bool forceList = false);
+        // object level filter for nodes without their own filter
+        void setDefaultValueFilter(const MqttValueFilter& pFilter);
         const MqttObjectDataNodeList& getNodes() const { return mNodes; }
+        const MqttObjectRegisterValues& getValues() const { return mValues; }
+        // append value slots of registers in pRange
+        void getSlots(int pNetworkId, const ModbusMessageBase& pRange, std::vector<int>& pSlots) const;
+
+        // true if any register value was changed since last clearDirty()
+        bool isDirty() const { return !mDirtySlots.empty(); }
+        const std::vector<int>& getDirtySlots() const { return mDirtySlots; }
+        void clearDirty();
+
+        // changed when nodes are added and for every copy of this state,
+        // so data built for node addresses can be checked
+        uint64_t getGeneration() const { return mGeneration.mValue; }
 
     protected:
         MqttObjectDataNodeList mNodes;
+        MqttObjectRegisterValues mValues;
+
+    private:
+        typedef std::vector<std::pair<int, int>> SlotList;
+
+        struct Generation {
+            Generation() : mValue(next()) {}
+            Generation(const Generation&) : mValue(next()) {}
+            Generation& operator=(const Generation&) { mValue = next(); return *this; }
+            static uint64_t next() {
+                static std::atomic<uint64_t> counter(0);
+                return ++counter;
+            }
+            uint64_t mValue;
+        } mGeneration;
+
+        // register number -> slot, sorted by register number
+        struct SlotIndex {
+            std::string mNetworkName;
+            int mNetworkId;
+            int mSlaveId;
+            RegisterType mRegisterType;
+            SlotList mSlots;
+        };
+
+        std::vector<SlotIndex> mSlotIndex;
+
+        // maintained on every update
+        int mMissingValueCount = 0;
+        int mReadErrorCount = 0;
+        std::vector<int> mDirtySlots;
+
+        std::pair<SlotList::const_iterator, SlotList::const_iterator> findSlots(int pNetworkId, int pSlaveId, const ModbusAddressRange& pRange) const;
+        bool setSlotValue(int pSlot, uint16_t pValue);
+        void setSlotReadError(int pSlot, bool pFlag);
 };
 
 
@@ -178,6 +296,37 @@ class MqttObjectAvailability : public MqttObjectState {
 };
 
 
+/**
+ * Publish rate limits for a single object and timers used
+ * to enforce them, see MqttObjectPublisher
+ * */
+struct MqttObjectPublishLimits {
+    // zero if not set
+    std::chrono::milliseconds mMinInterval = std::chrono::milliseconds::zero();
+    std::chrono::milliseconds mMaxInterval = std::chrono::milliseconds::zero();
+    std::chrono::milliseconds mDebounce = std::chrono::milliseconds::zero();
+
+    bool isSet() const {
+        return mMinInterval.count() != 0 || mMaxInterval.count() != 0 || mDebounce.count() != 0;
+    }
+
+    // delayed state publish, max() if none
+    std::chrono::steady_clock::time_point mPendingPublish = std::chrono::steady_clock::time_point::max();
+    bool mPendingForce = false;
+    // state values changed since the last publish decision,
+    // only a real change restarts debounce period
+    bool mChanged = false;
+    // publisher update round that added object to changed objects
+    uint64_t mUpdateRound = 0;
+    // object is waiting in publisher device updates
+    bool mDeviceUpdate = false;
+    // next republish of unchanged state, max() if none
+    std::chrono::steady_clock::time_point mHeartbeat = std::chrono::steady_clock::time_point::max();
+    // time of the only valid timer queue entry for this object
+    std::chrono::steady_clock::time_point mTimer = std::chrono::steady_clock::time_point::max();
+};
+
+
 class MqttObject {
     public:
         MqttObject(const std::string& pTopic);
@@ -185,9 +334,12 @@ class MqttObject {
         const std::string& getStateTopic() const { return mStateTopic; };
         const std::string& getAvailabilityTopic() const { return mAvailabilityTopic; }
         bool hasRegisterIn(const std::string& pNetworkName, const ModbusMessageBase& pRange) const;
-        void updateRegisterValues(const std::string& pNetworkName, const MsgRegisterValues& pSlaveData);
-        void updateRegistersReadFailed(const std::string& pNetworkName, const ModbusMessageBase& pSlaveData);
-        bool setModbusNetworkState(const std::string& networkName, bool isUp);
+        // assign network ids used by methods below, called by the owning publisher
+        void setNetworkIds(ModbusNetworkIds& pIds);
+        // returns true if state values changed
+        bool updateRegisterValues(int pNetworkId, const MsgRegisterValues& pSlaveData);
+        void updateRegistersReadFailed(int pNetworkId, const ModbusMessageBase& pSlaveData);
+        bool setModbusNetworkState(int pNetworkId, bool isUp);
 
         void addAvailabilityDataNode(const MqttObjectDataNode& pNode) { mAvailability.addDataNode(pNode); }
         void setAvailableValue(const MqttValue& pValue) { mAvailability.setAvailableValue(pValue); }
@@ -208,12 +360,60 @@ class MqttObject {
 
         const PublishMode& getPublishMode() const { return mPublishMode; }
 
-        void setRetain(bool pFlag) { mRetain = pFlag; }
-        bool getRetain() const { return mRetain; }
+        void setRetain(bool pFlag) { mStateProps.mRetain = pFlag; }
+        bool getRetain() const { return mStateProps.mRetain; }
+
+        void setQos(int pQos) { mStateProps.mQos = pQos; }
+        int getQos() const { return mStateProps.mQos; }
+
+        void setMessageExpiry(uint32_t pSeconds) { mStateProps.mMessageExpiry = pSeconds; }
+
+        const MqttPublishProps& getStateProps() const { return mStateProps; }
+        // availability is always retained and does not expire,
+        // also used to delete retained state
+        MqttPublishProps getAvailabilityProps() const {
+            MqttPublishProps props;
+            props.mRetain = true;
+            props.mQos = mStateProps.mQos;
+            return props;
+        }
+
+        // if false, then state and availability are not published again
+        // after reconnect if broker resumed previous session
+        void setRepublishOnResume(bool pFlag) { mRepublishOnResume = pFlag; }
+        bool getRepublishOnResume() const { return mRepublishOnResume; }
 
         bool needStateRepublish() const;
 
+        void setPayloadFormat(PayloadFormat pFormat) { mStatePayload.setFormat(pFormat); }
+        PayloadFormat getPayloadFormat() const { return mStatePayload.getFormat(); }
+
+        // state payload, values are converted again only if changed
+        const std::string& getStatePayload() { return mStatePayload.generate(mState); }
+
+        // state is also published as a part of combined payload
+        // for all objects with the same device topic
+        void setDeviceTopic(const std::string& pTopic, bool pOnly) {
+            mDeviceTopic = pTopic;
+            mDeviceTopicOnly = pOnly;
+            mStatePayload.setEmbedded(!pTopic.empty());
+        }
+        const std::string& getDeviceTopic() const { return mDeviceTopic; }
+        // if true, then state is not published on state topic
+        bool isDeviceTopicOnly() const { return mDeviceTopicOnly; }
+        // state payload generated by getStatePayload() as a value
+        // for device payload
+        const std::string& getDeviceValue() const { return mStatePayload.getEmbeddedValue(); }
+        void setLastDeviceValue(const std::string& pVal) { mLastDeviceValue = pVal; }
+        const std::string& getLastDeviceValue() const { return mLastDeviceValue; }
+
+        // statistics published instead of state or on a separate topic
+        void setAggregate(const MqttAggregate& pAggregate);
+        MqttAggregate& getAggregate() { return mAggregate; }
+        const std::string& getAggregateTopic() const { return mAggregateTopic; }
+
         MqttObjectState mState;
+        MqttObjectPublishLimits mPublishLimits;
 
         void dump() const;
 
@@ -223,12 +423,19 @@ class MqttObject {
         std::string mAvailabilityTopic;
 
         MqttObjectAvailability mAvailability;
+        MqttPayload mStatePayload;
+        MqttAggregate mAggregate;
+        std::string mAggregateTopic;
 
         AvailableFlag mIsAvailable = AvailableFlag::NotSet;
 
-        bool mRetain = true;
+        MqttPublishProps mStateProps;
+        bool mRepublishOnResume = true;
         PublishMode mPublishMode;
         std::string mLastPublishedPayload;
+        std::string mDeviceTopic;
+        bool mDeviceTopicOnly = false;
+        std::string mLastDeviceValue;
         std::chrono::steady_clock::time_point mLastPublishTime = std::chrono::steady_clock::time_point::min();
         std::chrono::milliseconds mEveryPollPeriod;
 
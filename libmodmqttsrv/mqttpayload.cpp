@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <charconv>
+
 #include "mqttpayload.hpp"
+#include "mqttobject.hpp"
 
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
@@ -6,9 +10,26 @@
 
 namespace modmqttd {
 
+/**
+ * rapidjson output stream that appends to a string.
+ * Fields are rendered directly to their text buffers, so
+ * a changed value does not allocate if buffer capacity is enough
+ * */
+class StringOutput {
+    public:
+        typedef char Ch;
+        StringOutput(std::string& pOut) : mOut(pOut) {}
+        void Put(char c) { mOut += c; }
+        void Flush() {}
+    private:
+        std::string& mOut;
+};
+
+
+template <typename Writer>
 void
 createConvertedValue(
-    rapidjson::Writer<rapidjson::StringBuffer>& writer,
+    Writer& writer,
     const MqttValue& value
 ) {
     switch(value.getSourceType()) {
@@ -39,6 +60,36 @@ createConvertedValue(
 }
 
 
+void
+renderJson(const MqttValue& value, std::string& out) {
+    out.clear();
+    StringOutput stream(out);
+    rapidjson::Writer<StringOutput> writer(stream);
+    createConvertedValue(writer, value);
+}
+
+
+// the same text as MqttValue::getString()
+void
+renderString(const MqttValue& value, std::string& out) {
+    switch(value.getSourceType()) {
+        case MqttValue::SourceType::BINARY:
+            out.assign(static_cast<const char*>(value.getBinaryPtr()), value.getBinarySize());
+            break;
+        case MqttValue::SourceType::INT:
+        case MqttValue::SourceType::INT64: {
+            char buf[24];
+            std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), value.getInt64());
+            out.assign(buf, res.ptr - buf);
+            break;
+        }
+        case MqttValue::SourceType::DOUBLE:
+            out = value.getString();
+            break;
+    }
+}
+
+
 bool isMap(const MqttObjectDataNodeList& pNodes) {
     // map with one or more elements
     return !pNodes.front().isUnnamed();
@@ -52,57 +103,222 @@ bool isList(const MqttObjectDataNodeList& pNodes) {
 
 
 void
-generateJson(rapidjson::Writer<rapidjson::StringBuffer>& pWriter, const MqttObjectDataNodeList& pNodes) {
+MqttPayload::addField(const MqttObjectDataNode& pNode, std::string& pFragment, bool pRawString) {
+    mFragments.push_back(pFragment);
+    pFragment.clear();
+
+    Field field;
+    field.mNode = &pNode;
+    field.mRawString = pRawString;
+    field.mFilter = pNode.getValueFilter();
+    pNode.getSlots(field.mSlots);
+    for (int slot: field.mSlots)
+        mSlotFields[slot].push_back(mFields.size());
+    mFields.push_back(field);
+}
+
+
+void
+MqttPayload::buildJson(const MqttObjectDataNodeList& pNodes, std::string& pFragment) {
+    if (isMap(pNodes)) {
+        pFragment += '{';
+        for(const MqttObjectDataNode& node: pNodes) {
+            if (&node != &pNodes.front())
+                pFragment += ',';
+            rapidjson::StringBuffer key;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(key);
+            writer.String(node.getName().c_str());
+            pFragment += key.GetString();
+            pFragment += ':';
+            if (node.isScalar() || node.hasConverter()) {
+                addField(node, pFragment, false);
+            } else {
+                buildJson(node.getChildNodes(), pFragment);
+            }
+        }
+        pFragment += '}';
+    } else if (isList(pNodes)) {
+        pFragment += '[';
+        for(const MqttObjectDataNode& node: pNodes) {
+            if (&node != &pNodes.front())
+                pFragment += ',';
+            if (node.isScalar() || node.hasConverter()) {
+                addField(node, pFragment, false);
+            } else {
+                buildJson(node.getChildNodes(), pFragment);
+            }
+        }
+        pFragment += ']';
+    } else {
+        //single scalar
+        addField(pNodes.front(), pFragment, false);
+    }
+}
+
+
+void
+MqttPayload::buildBinary(const MqttObjectDataNodeList& pNodes, std::string& pFragment) {
+    BinaryPayloadWriter writer(mFormat, pFragment);
     if (isMap(pNodes)) {
-        pWriter.StartObject();
+        writer.mapHeader(pNodes.size());
         for(const MqttObjectDataNode& node: pNodes) {
-            pWriter.Key(node.getName().c_str());
+            writer.string(node.getName().c_str(), node.getName().length());
             if (node.isScalar() || node.hasConverter()) {
-                MqttValue v = node.getConvertedValue();
-                createConvertedValue(pWriter, v);
+                addField(node, pFragment, false);
             } else {
-                generateJson(pWriter, node.getChildNodes());
+                buildBinary(node.getChildNodes(), pFragment);
             }
         }
-        pWriter.EndObject();
     } else if (isList(pNodes)) {
-        pWriter.StartArray();
+        writer.arrayHeader(pNodes.size());
         for(const MqttObjectDataNode& node: pNodes) {
             if (node.isScalar() || node.hasConverter()) {
-                MqttValue v = node.getConvertedValue();
-                createConvertedValue(pWriter, v);
+                addField(node, pFragment, false);
             } else {
-                generateJson(pWriter, node.getChildNodes());
+                buildBinary(node.getChildNodes(), pFragment);
             }
         }
-        pWriter.EndArray();
     } else {
         //single scalar
-        MqttValue v = pNodes.front().getConvertedValue();
-        createConvertedValue(pWriter, v);
+        addField(pNodes.front(), pFragment, false);
+    }
+}
+
+
+void
+MqttPayload::buildRaw(const MqttObjectDataNodeList& pNodes, std::string& pFragment) {
+    for(const MqttObjectDataNode& node: pNodes) {
+        if (node.isScalar() || node.hasConverter()) {
+            addField(node, pFragment, false);
+        } else {
+            buildRaw(node.getChildNodes(), pFragment);
+        }
     }
 }
 
 
-std::string
-MqttPayload::generate(const MqttObject& pObj) {
-    const MqttObjectDataNodeList& nodes(pObj.mState.getNodes());
+void
+MqttPayload::build(const MqttObjectState& pState) {
+    const MqttObjectDataNodeList& nodes(pState.getNodes());
 
+    mFragments.clear();
+    mFields.clear();
+    mSlotFields.clear();
+    mSlotFields.resize(pState.getValues().size());
 
-    if (!nodes.outputAsList()) {
+    std::string fragment;
+    if (!nodes.empty()) {
         const MqttObjectDataNode& single(nodes[0]);
-        if (single.isUnnamed() && (single.isScalar() || single.hasConverter())) {
-            MqttValue v = single.getConvertedValue();
-            return v.getString();
+        if (mFormat == PayloadFormat::RAW) {
+            buildRaw(nodes, fragment);
+        } else if (mFormat != PayloadFormat::JSON) {
+            buildBinary(nodes, fragment);
+        } else if (!nodes.outputAsList() && single.isUnnamed() && (single.isScalar() || single.hasConverter())) {
+            addField(single, fragment, true);
+        } else {
+            // single non-scalar node or a list
+            buildJson(nodes, fragment);
+        }
+    }
+    mFragments.push_back(fragment);
+
+    for (Field& field: mFields)
+        renderField(field, pState);
+    mBuiltFor = &pState;
+}
+
+
+bool
+MqttPayload::acceptValue(Field& pField, const MqttValue& pValue, const MqttObjectState& pState) {
+    if (!pField.mFilter.isSet() || pValue.getSourceType() == MqttValue::SourceType::BINARY)
+        return true;
+    const MqttObjectRegisterValues& values(pState.getValues());
+    bool hasValues = std::all_of(pField.mSlots.begin(), pField.mSlots.end(), [&values](int slot) {
+        return values[slot].hasValue();
+    });
+    return !hasValues || pField.mFilter.accept(pValue.getDouble(), std::chrono::steady_clock::now());
+}
+
+
+bool
+MqttPayload::renderField(Field& pField, const MqttObjectState& pState) {
+    const MqttObjectRegisterValues& values(pState.getValues());
+    pField.mStale = false;
+
+    if (mFormat == PayloadFormat::RAW) {
+        // converted value is needed by filter only
+        if (pField.mFilter.isSet() && !acceptValue(pField, pField.mNode->getConvertedValue(values), pState))
+            return false;
+        pField.mText.clear();
+        for (int slot: pField.mSlots) {
+            uint16_t val = values[slot].getRawValue();
+            pField.mText += static_cast<char>(val >> 8);
+            pField.mText += static_cast<char>(val & 0xff);
+        }
+        return true;
+    }
+
+    MqttValue v = pField.mNode->getConvertedValue(values);
+    if (!acceptValue(pField, v, pState))
+        return false;
+
+    if (pField.mRawString) {
+        renderString(v, pField.mText);
+        if (mEmbedded)
+            renderJson(v, pField.mJson);
+    } else if (mFormat == PayloadFormat::JSON) {
+        renderJson(v, pField.mText);
+    } else {
+        pField.mText.clear();
+        BinaryPayloadWriter writer(mFormat, pField.mText);
+        writer.value(v);
+    }
+    return true;
+}
+
+
+void
+MqttPayload::joinFragments() {
+    mPayload.clear();
+    for (size_t i = 0; i < mFields.size(); i++) {
+        mPayload += mFragments[i];
+        mPayload += mFields[i].mText;
+    }
+    mPayload += mFragments.back();
+}
+
+
+const std::string&
+MqttPayload::getEmbeddedValue() const {
+    if (mFields.size() == 1 && mFields.front().mRawString)
+        return mFields.front().mJson;
+    return mPayload;
+}
+
+
+const std::string&
+MqttPayload::generate(MqttObjectState& pState) {
+    if (mBuiltFor != &pState) {
+        build(pState);
+        joinFragments();
+    } else if (pState.isDirty()) {
+        mStaleFields.clear();
+        for (int slot: pState.getDirtySlots()) {
+            for (int idx: mSlotFields[slot]) {
+                if (!mFields[idx].mStale) {
+                    mFields[idx].mStale = true;
+                    mStaleFields.push_back(idx);
+                }
+            }
         }
-    };
-    // single non-scalar node or a list
-    {
-        rapidjson::StringBuffer ret;
-        rapidjson::Writer<rapidjson::StringBuffer> writer(ret);
-        generateJson(writer, nodes);
-        return ret.GetString();
+        bool changed = false;
+        for (int idx: mStaleFields)
+            changed = renderField(mFields[idx], pState) || changed;
+        if (changed)
+            joinFragments();
     }
+    pState.clearDirty();
+    return mPayload;
 }
 
 }
@@ -1,13 +1,84 @@
 #pragma once
 
-#include "mqttobject.hpp"
+#include <string>
+#include <vector>
+
+#include "mqtt_binary_payload.hpp"
+#include "mqtt_value_filter.hpp"
 
 namespace modmqttd {
 
+class MqttObjectState;
+class MqttObjectDataNode;
+class MqttObjectDataNodeList;
+
+/**
+ * State payload of a single MqttObject.
+ *
+ * Payload is split into static fragments (json keys, separators and
+ * brackets or CBOR/MessagePack headers and keys) rendered once, and value fields. A field is converted and
+ * rendered again only when one of its register values is marked as dirty
+ * in MqttObjectState. Changes rejected by field value filter
+ * are not rendered.
+ *
+ * In RAW format there are no fragments, every field is rendered
+ * as its register values.
+ * */
 class MqttPayload {
     public:
-        static std::string generate(const MqttObject& pObj);
+        // returns current payload and clears dirty flags in pState
+        const std::string& generate(MqttObjectState& pState);
+
+        void setFormat(PayloadFormat pFormat) { mFormat = pFormat; mBuiltFor = nullptr; }
+        PayloadFormat getFormat() const { return mFormat; }
+
+        // keep json value of a single scalar that is published
+        // as plain string, see getEmbeddedValue()
+        void setEmbedded(bool pFlag) { mEmbedded = pFlag; mBuiltFor = nullptr; }
+        // payload that can be embedded in a json, CBOR or MessagePack map
+        // as a value, valid after generate()
+        const std::string& getEmbeddedValue() const;
+
+    private:
+        struct Field {
+            const MqttObjectDataNode* mNode;
+            // single unnamed value is published without json formatting
+            bool mRawString = false;
+            bool mStale = false;
+            std::string mText;
+            // json value if mRawString is set and payload is embedded
+            std::string mJson;
+            // copy of node filter with last accepted value
+            MqttValueFilter mFilter;
+            // used to skip filter if some values are not read yet
+            std::vector<int> mSlots;
+        };
+
+        void build(const MqttObjectState& pState);
+        void buildJson(const MqttObjectDataNodeList& pNodes, std::string& pFragment);
+        void buildBinary(const MqttObjectDataNodeList& pNodes, std::string& pFragment);
+        void buildRaw(const MqttObjectDataNodeList& pNodes, std::string& pFragment);
+        void addField(const MqttObjectDataNode& pNode, std::string& pFragment, bool pRawString);
+        // returns false if new value was rejected by field filter
+        bool renderField(Field& pField, const MqttObjectState& pState);
+        bool acceptValue(Field& pField, const MqttValue& pValue, const MqttObjectState& pState);
+        void joinFragments();
+
+        PayloadFormat mFormat = PayloadFormat::JSON;
+        bool mEmbedded = false;
+
+        // nodes are owned by this state, rebuild if object was copied
+        const MqttObjectState* mBuiltFor = nullptr;
+
+        // mFragments.size() == mFields.size() + 1
+        std::vector<std::string> mFragments;
+        std::vector<Field> mFields;
+        // value slot -> indexes of fields that use it
+        std::vector<std::vector<int>> mSlotFields;
+        // fields to render in generate(), kept to reuse its capacity
+        std::vector<int> mStaleFields;
 
+        std::string mPayload;
 };
 
 }
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace modmqttd {
+
+/**
+ * Hash map with 64 bit integer keys for lookups on the update path.
+ *
+ * Open addressing with linear probing in a single power of two sized
+ * array, so lookup does not allocate or follow node pointers like
+ * std::map. Erase uses backward shift deletion, there are no tombstones.
+ *
+ * Pointers returned by find() and references from operator[]
+ * are invalidated by insert.
+ * */
+template <typename V>
+class OpenHashMap {
+    public:
+        V* find(uint64_t pKey) {
+            if (mSize == 0)
+                return nullptr;
+            size_t idx = findSlot(pKey);
+            return mSlots[idx].mUsed ? &mSlots[idx].mValue : nullptr;
+        }
+
+        const V* find(uint64_t pKey) const {
+            return const_cast<OpenHashMap*>(this)->find(pKey);
+        }
+
+        // inserts default constructed value if key is not found
+        V& operator[](uint64_t pKey) {
+            if ((mSize + 1) * 4 > mSlots.size() * 3)
+                rehash(mSlots.empty() ? 16 : mSlots.size() * 2);
+            size_t idx = findSlot(pKey);
+            Slot& slot(mSlots[idx]);
+            if (!slot.mUsed) {
+                slot.mUsed = true;
+                slot.mKey = pKey;
+                mSize++;
+            }
+            return slot.mValue;
+        }
+
+        bool erase(uint64_t pKey) {
+            if (mSize == 0)
+                return false;
+            size_t hole = findSlot(pKey);
+            if (!mSlots[hole].mUsed)
+                return false;
+
+            // move following entries of the probe chain back to the hole
+            // if the hole is between their home slot and current position
+            const size_t mask = mSlots.size() - 1;
+            size_t idx = hole;
+            while(true) {
+                idx = (idx + 1) & mask;
+                if (!mSlots[idx].mUsed)
+                    break;
+                size_t home = hash(mSlots[idx].mKey) & mask;
+                if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+                    mSlots[hole].mKey = mSlots[idx].mKey;
+                    mSlots[hole].mValue = std::move(mSlots[idx].mValue);
+                    hole = idx;
+                }
+            }
+            mSlots[hole].mUsed = false;
+            mSlots[hole].mValue = V();
+            mSize--;
+            return true;
+        }
+
+        // calls pFunc(key, value) for every entry
+        template <typename F>
+        void forEach(F pFunc) const {
+            for (const Slot& slot: mSlots) {
+                if (slot.mUsed)
+                    pFunc(slot.mKey, slot.mValue);
+            }
+        }
+
+        void clear() {
+            mSlots.clear();
+            mSize = 0;
+        }
+
+        size_t size() const { return mSize; }
+        bool empty() const { return mSize == 0; }
+
+    private:
+        struct Slot {
+            uint64_t mKey = 0;
+            bool mUsed = false;
+            V mValue;
+        };
+
+        std::vector<Slot> mSlots;
+        size_t mSize = 0;
+
+        // splitmix64 finalizer, packed keys differ in high bits only
+        static uint64_t hash(uint64_t pKey) {
+            pKey ^= pKey >> 30;
+            pKey *= 0xbf58476d1ce4e5b9ULL;
+            pKey ^= pKey >> 27;
+            pKey *= 0x94d049bb133111ebULL;
+            return pKey ^ (pKey >> 31);
+        }
+
+        // returns slot with pKey or the first free slot in its probe chain
+        size_t findSlot(uint64_t pKey) const {
+            const size_t mask = mSlots.size() - 1;
+            size_t idx = hash(pKey) & mask;
+            while (mSlots[idx].mUsed && mSlots[idx].mKey != pKey)
+                idx = (idx + 1) & mask;
+            return idx;
+        }
+
+        void rehash(size_t pCapacity) {
+            std::vector<Slot> old(pCapacity);
+            old.swap(mSlots);
+            for (Slot& slot: old) {
+                if (!slot.mUsed)
+                    continue;
+                Slot& dest(mSlots[findSlot(slot.mKey)]);
+                dest.mUsed = true;
+                dest.mKey = slot.mKey;
+                dest.mValue = std::move(slot.mValue);
+            }
+        }
+};
+
+}
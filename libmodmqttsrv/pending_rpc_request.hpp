@@ -1,7 +1,9 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "libmodmqttconv/converter.hpp"
 #include "modbus_types.hpp"
@@ -21,6 +23,8 @@ class CorrelationData {
         int mLen = 0;
 };
 
+struct PendingRpcBatch;
+
 struct PendingRpcRequest {
         std::string mNetworkName;
         std::string mResponseTopic;
@@ -33,6 +37,31 @@ struct PendingRpcRequest {
         bool mIsWrite = false;
         // optional converter for a read reply; null ⇒ raw register value(s)
         std::shared_ptr<DataConverter> mConverter;
+        // read may be answered with poll data not older than this, zero ⇒ always read
+        std::chrono::milliseconds mMaxAge = std::chrono::milliseconds::zero();
+        // identical reads received while this one was in flight,
+        // answered with its result
+        std::vector<PendingRpcRequest> mCoalesced;
+        // set if this modbus request is a part of batch request
+        std::shared_ptr<PendingRpcBatch> mBatch;
+        // indexes of batch operations answered by this modbus request,
+        // a coalesced read answers more than one
+        std::vector<int> mBatchItems;
+};
+
+// RPC request with a list of operations, answered
+// when all its modbus requests are finished
+struct PendingRpcBatch {
+        std::string mResponseTopic;
+        CorrelationData mCorrelationData;
+        std::vector<PendingRpcRequest> mOperations;
+        // JSON object with value or error for every operation
+        std::vector<std::string> mResults;
+        // modbus requests in flight
+        int mRemaining = 0;
+        // reads are sent when all writes are finished
+        int mWritesRemaining = 0;
+        std::vector<int> mReads;
 };
 
 }
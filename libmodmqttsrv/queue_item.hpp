@@ -20,6 +20,12 @@ class QueueItem {
         template<typename T> static QueueItem create(const T& data) {
             return QueueItem(typeid(T).hash_code(), new T(data));
         }
+        /**
+         * Insert data into queue without copying it
+         * */
+        template<typename T> static QueueItem create(std::unique_ptr<T>&& data) {
+            return QueueItem(typeid(T).hash_code(), data.release());
+        }
 
         /**
          * Get data from queue item. Once called QueueItem releases its data.
@@ -35,6 +41,18 @@ class QueueItem {
             mItem = NULL;
             return ret;
         }
+        /**
+         * Access data without releasing it
+         * */
+        template<typename T> const T& peekData() const {
+            if (mItem == NULL)
+                throw ModMqttProgramException("Tried to peek data from released queue item");
+            const std::type_info& destType(typeid(T));
+            if (!isSameAs(destType))
+                throw ModMqttProgramException(std::string("Trying to peek ") + destType.name() + " from wrong item");
+            return *((const T*)mItem);
+        }
+
         bool isSameAs(const std::type_info& type) const {
             return type.hash_code() == mTypeHash;
         }
@@ -60,6 +60,11 @@ class RegisterPoll : public RegisterCommand {
         virtual const std::vector<uint16_t>& getValues() const { return mLastValues; }
         virtual bool executedOk() const { return mLastReadOk; };
 
+        // RPC read that should not be executed anymore
+        bool isExpired(const std::chrono::steady_clock::time_point& pNow) const {
+            return isRpc() && mDeadline <= pNow;
+        }
+
 
         void update(const std::vector<uint16_t>& newValues) {
             mLastValues = newValues;
@@ -71,11 +76,16 @@ class RegisterPoll : public RegisterCommand {
         bool mLastReadOk = false;
         std::chrono::steady_clock::time_point mLastReadStartTime;
         std::chrono::steady_clock::time_point mLastReadFinishTime;
+        // time of last successful read of getValues(), not changed
+        // when ModbusScheduler::notifyRpcRead() defers the poll,
+        // reset by ModbusScheduler::invalidatePolls() on write
+        std::chrono::steady_clock::time_point mLastValuesTime;
 
         int mReadErrors;
         std::chrono::steady_clock::time_point mFirstErrorTime;
 
         PublishMode mPublishMode = PublishMode::ON_CHANGE;
+        std::chrono::steady_clock::time_point mDeadline = std::chrono::steady_clock::time_point::max();
     private:
         std::vector<uint16_t> mLastValues;
 };
@@ -0,0 +1,46 @@
+#include "rpc_bus_budget.hpp"
+
+#include <algorithm>
+
+namespace modmqttd {
+
+void
+RpcBusBudget::configure(double pShare, std::chrono::steady_clock::duration pBurst) {
+    mShare = pShare;
+    mBurst = mTokens = pBurst;
+    mRefillTime = std::chrono::steady_clock::now();
+}
+
+void
+RpcBusBudget::refill(const std::chrono::steady_clock::time_point& pNow) {
+    if (pNow <= mRefillTime)
+        return;
+    auto added = std::chrono::duration_cast<std::chrono::steady_clock::duration>((pNow - mRefillTime) * mShare);
+    mTokens = std::min(mBurst, mTokens + added);
+    mRefillTime = pNow;
+}
+
+bool
+RpcBusBudget::isAvailable(const std::chrono::steady_clock::time_point& pNow) {
+    if (!isLimited())
+        return true;
+    refill(pNow);
+    return mTokens > std::chrono::steady_clock::duration::zero();
+}
+
+void
+RpcBusBudget::charge(const std::chrono::steady_clock::duration& pBusTime) {
+    if (isLimited())
+        mTokens -= pBusTime;
+}
+
+std::chrono::steady_clock::duration
+RpcBusBudget::getWaitTime(const std::chrono::steady_clock::time_point& pNow) {
+    if (isAvailable(pNow))
+        return std::chrono::steady_clock::duration::zero();
+    // +1 tick, bucket must be above zero
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(-mTokens / mShare)
+        + std::chrono::steady_clock::duration(1);
+}
+
+}
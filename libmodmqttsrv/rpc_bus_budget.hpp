@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+
+namespace modmqttd {
+
+/**
+ * Token bucket limiting modbus bus time used by RPC reads.
+ *
+ * Bucket is refilled with pShare of elapsed time up to pBurst.
+ * Bus time of every executed RPC read is taken from the bucket, it
+ * can go below zero for a read longer than available time. The next
+ * read can start when bucket is not empty again.
+ * */
+class RpcBusBudget {
+    public:
+        // pShare=1 disables the limit
+        void configure(double pShare, std::chrono::steady_clock::duration pBurst);
+        bool isLimited() const { return mShare < 1.0; }
+
+        // true if RPC read can be started at pNow
+        bool isAvailable(const std::chrono::steady_clock::time_point& pNow);
+        void charge(const std::chrono::steady_clock::duration& pBusTime);
+        // time left to isAvailable() == true
+        std::chrono::steady_clock::duration getWaitTime(const std::chrono::steady_clock::time_point& pNow);
+
+    private:
+        double mShare = 1.0;
+        std::chrono::steady_clock::duration mBurst = std::chrono::seconds(1);
+        std::chrono::steady_clock::duration mTokens = std::chrono::seconds(1);
+        std::chrono::steady_clock::time_point mRefillTime = std::chrono::steady_clock::now();
+
+        void refill(const std::chrono::steady_clock::time_point& pNow);
+};
+
+}
@@ -0,0 +1,32 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocations.hpp"
+
+// other threads started by tests, like publish workers
+// or mocked broker, do not change the result
+static thread_local uint64_t sCount = 0;
+
+uint64_t
+allocations::count() {
+    return sCount;
+}
+
+void*
+operator new(std::size_t pSize) {
+    sCount++;
+    void* ret = std::malloc(pSize == 0 ? 1 : pSize);
+    if (ret == nullptr)
+        throw std::bad_alloc();
+    return ret;
+}
+
+void
+operator delete(void* pPtr) noexcept {
+    std::free(pPtr);
+}
+
+void
+operator delete(void* pPtr, std::size_t) noexcept {
+    std::free(pPtr);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Counts global operator new calls in the current thread,
+ * used to check allocations on publish path.
+ * */
+class allocations {
+    public:
+        static uint64_t count();
+};
@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "mockedmqttimpl.hpp"
 
 #include "libmodmqttsrv/mqttclient.hpp"
+#include "libmodmqttsrv/mqtt_topic_filters.hpp"
 #include "libmodmqttsrv/threadutils.hpp"
 
 #include "timing.hpp"
@@ -13,7 +16,10 @@ struct MsgPublishId {
         int mId;
 };
 
-MockedMqttImpl::MockedMqttImpl() {
+MockedMqttImpl::MockedMqttImpl() : mBroker(this) {
+}
+
+MockedMqttImpl::MockedMqttImpl(MockedMqttImpl& pBroker) : mBroker(&pBroker) {
 }
 
 void
@@ -27,14 +33,41 @@ MockedMqttImpl::threadLoop(MockedMqttImpl& owner) {
         if (item.isSameAs(typeid(MsgPublishId))) {
             auto msg = item.getData<MsgPublishId>();
             std::this_thread::sleep_for(timing::milliseconds(3));
-            owner.on_publish(msg->mId);
+            int id = msg->mId;
+            owner.postAction([&owner, id]() { owner.on_publish(id); });
         }
     }
 }
 
 void
-MockedMqttImpl::init(modmqttd::MqttClient* owner, const char* clientId) {
+MockedMqttImpl::postAction(const std::function<void()>& pAction) {
+    std::unique_lock<std::mutex> lck(mActionsMutex);
+    mPendingActions.push_back(pAction);
+    mEventNotifier.notify();
+}
+
+void
+MockedMqttImpl::loopRead() {
+    mEventNotifier.consume();
+    std::deque<std::function<void()>> actions;
+    {
+        std::unique_lock<std::mutex> lck(mActionsMutex);
+        actions.swap(mPendingActions);
+    }
+    for (const auto& action: actions) {
+        action();
+    }
+}
+
+void
+MockedMqttImpl::init(modmqttd::MqttClient* owner, const char* clientId, int pConnection) {
     mOwner = owner;
+    mConnection = pConnection;
+}
+
+std::shared_ptr<modmqttd::IMqttImpl>
+MockedMqttImpl::createConnection() {
+    return std::shared_ptr<modmqttd::IMqttImpl>(new MockedMqttImpl(*this));
 }
 
 void
@@ -42,7 +75,9 @@ MockedMqttImpl::connect(const modmqttd::MqttBrokerConfig& config) {
     mConfig = config;
     stopThread();
     mThread.reset(new std::thread(threadLoop, std::ref(*this)));
-    mOwner->onConnect();
+    bool sessionPresent = !config.mCleanSession && mHasSession;
+    mHasSession = true;
+    mOwner->onConnect(sessionPresent, mConnection);
 }
 
 void
@@ -53,7 +88,7 @@ MockedMqttImpl::reconnect() {
 void
 MockedMqttImpl::disconnect() {
     stopThread();
-    mOwner->onDisconnect();
+    mOwner->onDisconnect(mConnection);
 }
 
 void
@@ -79,12 +114,13 @@ MockedMqttImpl::subscribe(const char* topic) {
 }
 
 int
-MockedMqttImpl::publish(const char* topic, int len, const void* data, bool retain) {
-    std::unique_lock<std::mutex> lck(mMutex);
+MockedMqttImpl::publish(const char* topic, int len, const void* data, const modmqttd::MqttPublishProps& props) {
+    MockedMqttImpl& broker(*mBroker);
+    std::unique_lock<std::mutex> lck(broker.mMutex);
 
     int publishCount = 0;
-    auto it = mTopics.find(topic);
-    if (it  != mTopics.end()) {
+    auto it = broker.mTopics.find(topic);
+    if (it  != broker.mTopics.end()) {
         publishCount = it->second.publishCount + 1;
     } else {
         publishCount = 1;
@@ -92,20 +128,29 @@ MockedMqttImpl::publish(const char* topic, int len, const void* data, bool retai
 
     MqttValue v(data, len);
     v.publishCount = publishCount;
-    mTopics[topic] = v;
-    std::set<std::string>::const_iterator sit = mSubscriptions.find(topic);
-    if (sit != mSubscriptions.end()) {
-        mOwner->onMessage(topic, data, len);
-    } else {
-        mThreadQueue.enqueue(modmqttd::QueueItem::create(MsgPublishId(++mNextMessageId)));
+    v.props = props;
+    v.connection = mConnection;
+    broker.mTopics[topic] = v;
+    int msgId = ++mNextMessageId;
+    bool subscribed = std::any_of(broker.mSubscriptions.begin(), broker.mSubscriptions.end(), [topic](const std::string& pFilter) -> bool {
+        return modmqttd::MqttTopicFilters::matches(pFilter, topic);
+    });
+    if (subscribed) {
+        std::string t(topic);
+        std::string payload;
+        if (data != nullptr && len > 0)
+            payload.assign(static_cast<const char*>(data), len);
+        // subscriptions are made on primary connection
+        broker.postAction([&broker, t, payload]() { broker.mOwner->onMessage(t.c_str(), payload.c_str(), payload.length()); });
     }
+    mThreadQueue.enqueue(modmqttd::QueueItem::create(MsgPublishId(msgId)));
     spdlog::info("TEST: publish {}: <{}>", topic, v.val);
 
 
-    mPublishedTopics.insert(std::make_pair(topic, mPublishedTopics.size() + 1));
-    mCondition.notify_all();
+    broker.mPublishedTopics.insert(std::make_pair(topic, broker.mPublishedTopics.size() + 1));
+    broker.mCondition.notify_all();
 
-    return mNextMessageId;
+    return msgId;
 }
 
 int
@@ -199,19 +244,25 @@ MockedMqttImpl::injectRpcRequest(const char* pRequestTopic, const void* pAyload,
         corrPtr.reset(copy, free);
         corrLen = sizeof(int);
     }
-    mOwner->onMessage(pRequestTopic, pAyload, pLen,
-                      respTopicPtr ? respTopicPtr.get() : nullptr, corrPtr, corrLen);
+    std::string topic(pRequestTopic);
+    std::string payload;
+    if (pAyload != nullptr && pLen > 0)
+        payload.assign(static_cast<const char*>(pAyload), pLen);
+    postAction([this, topic, payload, respTopicPtr, corrPtr, corrLen]() {
+        mOwner->onMessage(topic.c_str(), payload.c_str(), payload.length(),
+                          respTopicPtr ? respTopicPtr.get() : nullptr, corrPtr, corrLen);
+    });
 }
 
 void
 MockedMqttImpl::on_disconnect(int rc) {}
 
 void
-MockedMqttImpl::on_connect(int rc) {}
+MockedMqttImpl::on_connect(int rc, bool pSessionPresent) {}
 
 void
 MockedMqttImpl::on_publish(int messageId) {
-    mOwner->onPublish(messageId);
+    mOwner->onPublish(messageId, mConnection);
 }
 
 void
@@ -269,6 +320,15 @@ MockedMqttImpl::getPublishCount(const char* topic) {
     return it->second.publishCount;
 }
 
+int
+MockedMqttImpl::getPublishConnection(const char* topic) {
+    std::unique_lock<std::mutex> lck(mMutex);
+    auto it = mTopics.find(topic);
+    if (it == mTopics.end())
+        throw MockedMqttException(std::string(topic) + " not found");
+    return it->second.connection;
+}
+
 std::string
 MockedMqttImpl::waitForFirstPublish(std::chrono::milliseconds timeout) {
     std::unique_lock<std::mutex> lck(mMutex);
@@ -353,7 +413,25 @@ MockedMqttImpl::resetBroker() {
         mPublishedTopics.clear();
         mSubscriptions.clear();
     }
-    disconnect();
+    postAction([this]() {
+        mHasSession = false;
+        disconnect();
+    });
+}
+
+void
+MockedMqttImpl::dropConnection() {
+    spdlog::info("TEST: MQTT connection lost");
+    postAction([this]() { disconnect(); });
+}
+
+modmqttd::MqttPublishProps
+MockedMqttImpl::mqttProps(const char* topic) {
+    std::unique_lock<std::mutex> lck(mMutex);
+    std::map<std::string, MqttValue>::const_iterator it = mTopics.find(topic);
+    if (it == mTopics.end())
+        throw MockedMqttException(std::string(topic) + " not found");
+    return it->second.props;
 }
 
 std::string
@@ -2,11 +2,14 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <set>
 #include <thread>
 
 #include "libmodmqttsrv/imqttimpl.hpp"
+#include "libmodmqttsrv/event_notifier.hpp"
 #include "libmodmqttsrv/logging.hpp"
 #include "libmodmqttsrv/queue_item.hpp"
 
@@ -27,10 +30,14 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
             MqttValue(const MqttValue& from) {
                 copyData(from.val, from.len);
                 publishCount = from.publishCount;
+                props = from.props;
+                connection = from.connection;
             }
             MqttValue& operator=(const MqttValue& other) {
                 copyData(other.val, other.len);
                 publishCount = other.publishCount;
+                props = other.props;
+                connection = other.connection;
                 return *this;
             }
             ~MqttValue() {
@@ -40,6 +47,9 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
             char* val = NULL;
             int len = 0;
             int publishCount = 0;
+            modmqttd::MqttPublishProps props;
+            // index of MqttClient connection used for publishing
+            int connection = 0;
         private:
             void copyData(const void* v, int l) {
                 if (val)
@@ -52,21 +62,32 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
     };
     public:
         MockedMqttImpl();
+        // publisher connection, topics and subscriptions are stored in pBroker
+        MockedMqttImpl(MockedMqttImpl& pBroker);
 
-        virtual void init(modmqttd::MqttClient* owner, const char* clientId);
+        virtual void init(modmqttd::MqttClient* owner, const char* clientId, int pConnection);
+        virtual std::shared_ptr<modmqttd::IMqttImpl> createConnection() override;
         virtual void connect(const modmqttd::MqttBrokerConfig& config);
         virtual void reconnect();
         virtual void disconnect();
         virtual void stop();
 
         virtual void subscribe(const char* topic);
-        virtual int publish(const char* topic, int len, const void* data, bool retain);
+        virtual int publish(const char* topic, int len, const void* data, const modmqttd::MqttPublishProps& props);
         virtual int publishResponse(const char* pTopic, int pLen, const void* pData,
                                     const void* pCorrelationData, int pCorrelationLen,
                                     const std::vector<std::pair<std::string, std::string>>& pUserProperties = {}) override;
 
+        // all callbacks to MqttClient are made from loopRead()
+        // in ModMqtt main thread like in real mosquitto client
+        virtual int getSocket() override { return mEventNotifier.getFd(); }
+        virtual bool wantWrite() override { return false; }
+        virtual void loopRead() override;
+        virtual void loopWrite() override {}
+        virtual void loopMisc() override {}
+
         virtual void on_disconnect(int rc);
-        virtual void on_connect(int rc);
+        virtual void on_connect(int rc, bool pSessionPresent);
         virtual void on_log(int level, const char* message);
         virtual void on_publish(int messageId);
 
@@ -75,8 +96,11 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
         bool waitForPublish(const char* topic, std::chrono::milliseconds timeout);
         std::string waitForFirstPublish(std::chrono::milliseconds timeout);
         int getPublishCount(const char* topic);
+        // index of MqttClient connection used for the last publish on topic
+        int getPublishConnection(const char* topic);
         bool hasTopic(const char* topic);
         std::string mqttValue(const char* topic);
+        modmqttd::MqttPublishProps mqttProps(const char* topic);
         bool mqttNullValue(const char* topic);
         //returns current value on timeout
         std::string waitForMqttValue(const char* topic, const char* expected, std::chrono::milliseconds timeout);
@@ -92,6 +116,8 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
 
         //clear all topics and simulate broker disconnection
         void resetBroker();
+        //simulate network failure, broker keeps session and retained messages
+        void dropConnection();
 
         virtual ~MockedMqttImpl();
     private:
@@ -101,9 +127,14 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
         };
 
         modmqttd::MqttClient* mOwner;
+        int mConnection = 0;
         int mNextMessageId = 0;
+        // this for the primary connection
+        MockedMqttImpl* mBroker;
 
         modmqttd::MqttBrokerConfig mConfig;
+        // broker has session for our client id
+        bool mHasSession = false;
 
         std::map<std::string, MqttValue> mTopics;
         std::set<std::string> mSubscriptions;
@@ -116,6 +147,12 @@ class MockedMqttImpl : public modmqttd::IMqttImpl {
         std::mutex mMutex;
         std::condition_variable mCondition;
 
+        // actions to execute in ModMqtt main thread
+        modmqttd::EventNotifier mEventNotifier;
+        std::mutex mActionsMutex;
+        std::deque<std::function<void()>> mPendingActions;
+        void postAction(const std::function<void()>& pAction);
+
         moodycamel::BlockingReaderWriterQueue<modmqttd::QueueItem> mThreadQueue;
         std::shared_ptr<std::thread> mThread;
         static void threadLoop(MockedMqttImpl& owner);
@@ -60,6 +60,7 @@ class ModMqttServerThread {
         }
 
         const modmqttd::ModMqtt& getServer() const { return mServer; }
+        modmqttd::ModMqtt& getServer() { return mServer; }
 
         ~ModMqttServerThread() {
             stop();
@@ -135,6 +136,10 @@ class MockedModMqttServerThread : public ModMqttServerThread {
         return mMqtt->getPublishCount(topic);
     }
 
+    int getPublishConnection(const char* topic) {
+        return mMqtt->getPublishConnection(topic);
+    }
+
     std::string waitForFirstPublish(std::chrono::milliseconds timeout = timing::defaultWait) {
         std::string topic = mMqtt->waitForFirstPublish(timeout);
         INFO("Getting first published topic");
@@ -143,7 +148,9 @@ class MockedModMqttServerThread : public ModMqttServerThread {
     }
 
     void publish(const char* topic, const std::string& value, bool retain = false) {
-        mMqtt->publish(topic, value.length(), value.c_str(), retain);
+        modmqttd::MqttPublishProps props;
+        props.mRetain = retain;
+        mMqtt->publish(topic, value.length(), value.c_str(), props);
     }
 
     void waitForMqttValue(const char* topic, const char* expected, std::chrono::milliseconds timeout = timing::defaultWait) {
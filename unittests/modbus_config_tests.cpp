@@ -57,6 +57,22 @@ mqtt:
         REQUIRE(server.initOk() == true);
     }
 
+    SECTION("should throw if poll_batch_size is less than 1") {
+        config.mYAML["modbus"]["networks"][0]["poll_batch_size"] = "0";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+    }
+
+    SECTION("should throw if queue_high_water_mark is less than 1") {
+        config.mYAML["modbus"]["networks"][0]["queue_high_water_mark"] = "0";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+    }
+
 }
 
 
@@ -13,8 +13,8 @@
 #include "../readerwriterqueue/readerwriterqueue.h"
 
 TEST_CASE("ModbusExecutor for first delay config") {
-    moodycamel::BlockingReaderWriterQueue<modmqttd::QueueItem> fromModbusQueue;
-    moodycamel::BlockingReaderWriterQueue<modmqttd::QueueItem> toModbusQueue;
+    modmqttd::ModbusResultQueue fromModbusQueue;
+    modmqttd::MpscQueue<modmqttd::QueueItem> toModbusQueue;
     MockedModbusFactory modbus_factory;
 
     modmqttd::ModbusExecutor executor(fromModbusQueue, toModbusQueue);
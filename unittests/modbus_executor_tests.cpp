@@ -13,8 +13,8 @@
 #include "../readerwriterqueue/readerwriterqueue.h"
 
 TEST_CASE("ModbusExecutor") {
-    moodycamel::BlockingReaderWriterQueue<modmqttd::QueueItem> fromModbusQueue;
-    moodycamel::BlockingReaderWriterQueue<modmqttd::QueueItem> toModbusQueue;
+    modmqttd::ModbusResultQueue fromModbusQueue;
+    modmqttd::MpscQueue<modmqttd::QueueItem> toModbusQueue;
 
     MockedModbusFactory modbus_factory;
 
@@ -242,15 +242,18 @@ TEST_CASE("ModbusExecutor") {
         executor.addPollList(registers);
         REQUIRE(executor.getCommandsLeft() == 8);
 
+        // next values of already queued registers replace old ones
         executor.executeNext(); //poll 1,1
-        REQUIRE(fromModbusQueue.size_approx() == 4);
+        REQUIRE(fromModbusQueue.size_approx() == 3);
+        REQUIRE(fromModbusQueue.getConflatedCount() == 1);
         executor.executeNext(); //write 1,20
         REQUIRE(modbus_factory.getModbusRegisterValue("test", 1, 20, modmqttd::RegisterType::HOLDING) == 202);
 
         executor.executeNext(); //poll 1,10
-        REQUIRE(fromModbusQueue.size_approx() == 5);
+        REQUIRE(fromModbusQueue.size_approx() == 3);
         executor.executeNext(); //poll 1,20
-        REQUIRE(fromModbusQueue.size_approx() == 6);
+        REQUIRE(fromModbusQueue.size_approx() == 3);
+        REQUIRE(fromModbusQueue.getConflatedCount() == 3);
 
 
         REQUIRE(executor.getCommandsLeft() == 4);
@@ -374,4 +377,74 @@ TEST_CASE("ModbusExecutor") {
         REQUIRE(executor.getLastCommand()->executedOk() == false);
     }
 
+    SECTION("should send values polled in a single round as one batch") {
+        modbus_factory.setModbusRegisterValue("test",1,1,modmqttd::RegisterType::HOLDING, 1);
+        modbus_factory.setModbusRegisterValue("test",1,2,modmqttd::RegisterType::HOLDING, 2);
+        modbus_factory.setModbusRegisterValue("test",2,3,modmqttd::RegisterType::HOLDING, 3);
+        registers.addPoll(1, 1);
+        registers.addPoll(1, 2);
+        registers.addPoll(2, 3);
+
+        executor.setBatchLimits(10, std::chrono::milliseconds(1000));
+        executor.setupInitialPoll(registers);
+
+        executor.executeNext();
+        executor.executeNext();
+        REQUIRE(fromModbusQueue.size_approx() == 0);
+        REQUIRE(executor.getPendingValuesCount() == 2);
+
+        executor.executeNext();
+        REQUIRE(executor.allDone());
+        REQUIRE(fromModbusQueue.size_approx() == 3);
+
+        modmqttd::QueueItem item;
+        REQUIRE(fromModbusQueue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(modmqttd::MsgRegisterValuesBatch)));
+        std::unique_ptr<modmqttd::MsgRegisterValuesBatch> batch(item.getData<modmqttd::MsgRegisterValuesBatch>());
+        REQUIRE(batch->mValues.size() == 3);
+        REQUIRE(batch->mValues[2].mSlaveId == 2);
+        REQUIRE(batch->mValues[2].mRegisters.getValue(0) == 3);
+    }
+
+    SECTION("should send batch when batch size is reached") {
+        registers.addPoll(1, 1);
+        registers.addPoll(1, 2);
+        registers.addPoll(1, 3);
+
+        executor.setBatchLimits(2, std::chrono::milliseconds(1000));
+        executor.setupInitialPoll(registers);
+
+        executor.executeNext();
+        REQUIRE(fromModbusQueue.size_approx() == 0);
+        executor.executeNext();
+        REQUIRE(fromModbusQueue.size_approx() == 2);
+        executor.executeNext();
+        REQUIRE(fromModbusQueue.size_approx() == 3);
+        REQUIRE(executor.getPendingValuesCount() == 0);
+    }
+
+    SECTION("should send collected values before write result") {
+        registers.addPoll(1, 1);
+        registers.addPoll(1, 2);
+
+        executor.setBatchLimits(10, std::chrono::milliseconds(1000));
+        executor.setupInitialPoll(registers);
+        executor.executeNext(); //poll 1,1
+        REQUIRE(executor.getPendingValuesCount() == 1);
+
+        auto cmd(ModbusExecutorTestRegisters::createWrite(1, 10, 100));
+        cmd->mReturnMessage.reset(new modmqttd::MsgRegisterValues(1, modmqttd::RegisterType::HOLDING, 9, std::vector<uint16_t>({100}), 1));
+        executor.addWriteCommand(cmd);
+        executor.executeNext(); //write 1,10
+
+        REQUIRE(fromModbusQueue.size_approx() == 2);
+        modmqttd::QueueItem item;
+        REQUIRE(fromModbusQueue.try_dequeue(item));
+        std::unique_ptr<modmqttd::MsgRegisterValues> values(item.getData<modmqttd::MsgRegisterValues>());
+        REQUIRE(values->mRegister == 0);
+        REQUIRE(fromModbusQueue.try_dequeue(item));
+        values = item.getData<modmqttd::MsgRegisterValues>();
+        REQUIRE(values->getCommandId() == 1);
+    }
+
 }
@@ -0,0 +1,133 @@
+#include "catch2/catch_all.hpp"
+
+#include "libmodmqttsrv/modbus_result_queue.hpp"
+
+using namespace modmqttd;
+
+TEST_CASE("ModbusResultQueue") {
+    ModbusResultQueue queue;
+    QueueItem item;
+
+    SECTION("should replace queued polled value with a newer one") {
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}))));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 2, std::vector<uint16_t>({2}))));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({3}))));
+
+        REQUIRE(queue.size_approx() == 2);
+        REQUIRE(queue.getConflatedCount() == 1);
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterValuesBatch)));
+        std::unique_ptr<MsgRegisterValuesBatch> batch(item.getData<MsgRegisterValuesBatch>());
+        REQUIRE(batch->mValues.size() == 2);
+        // replaced in place
+        REQUIRE(batch->mValues[0].mRegister == 1);
+        REQUIRE(batch->mValues[0].mRegisters.getValue(0) == 3);
+        REQUIRE(batch->mValues[1].mRegister == 2);
+
+        REQUIRE(!queue.try_dequeue(item));
+        REQUIRE(queue.size_approx() == 0);
+    }
+
+    SECTION("should not replace values with different slave or register type") {
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}))));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(2, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}))));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::INPUT, 1, std::vector<uint16_t>({1}))));
+
+        REQUIRE(queue.size_approx() == 3);
+        REQUIRE(queue.getConflatedCount() == 0);
+    }
+
+    SECTION("should not replace command results") {
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}), 1)));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({2}), 1)));
+
+        REQUIRE(queue.size_approx() == 2);
+        REQUIRE(queue.getConflatedCount() == 0);
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterValues)));
+        REQUIRE(item.getData<MsgRegisterValues>()->mRegisters.getValue(0) == 1);
+    }
+
+    SECTION("should move replaced value after read error") {
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}))));
+        queue.enqueue(QueueItem::create(MsgRegisterReadFailed(1, RegisterType::HOLDING, 1, 1)));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({2}))));
+
+        REQUIRE(queue.size_approx() == 2);
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterReadFailed)));
+        item.getData<MsgRegisterReadFailed>();
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterValues)));
+        REQUIRE(item.getData<MsgRegisterValues>()->mRegisters.getValue(0) == 2);
+    }
+
+    SECTION("should replace values in queued batch") {
+        MsgRegisterValuesBatch batch;
+        batch.mValues.push_back(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1})));
+        batch.mValues.push_back(MsgRegisterValues(1, RegisterType::HOLDING, 2, std::vector<uint16_t>({2})));
+        QueueItem batchItem(QueueItem::create(batch));
+        const MsgRegisterValuesBatch* queued = &batchItem.peekData<MsgRegisterValuesBatch>();
+        queue.enqueue(batchItem);
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 2, std::vector<uint16_t>({3}))));
+        queue.enqueue(QueueItem::create(MsgModbusNetworkState("test", false)));
+
+        REQUIRE(queue.size_approx() == 3);
+        REQUIRE(queue.getConflatedCount() == 1);
+
+        REQUIRE(queue.try_dequeue(item));
+        std::unique_ptr<MsgRegisterValuesBatch> values(item.getData<MsgRegisterValuesBatch>());
+        // received batch is not copied
+        REQUIRE(values.get() == queued);
+        REQUIRE(values->mValues.size() == 2);
+        REQUIRE(values->mValues[1].mRegisters.getValue(0) == 3);
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgModbusNetworkState)));
+        item.getData<MsgModbusNetworkState>();
+    }
+
+    SECTION("should drop value from batch queued before read error") {
+        MsgRegisterValuesBatch batch;
+        batch.mValues.push_back(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1})));
+        batch.mValues.push_back(MsgRegisterValues(1, RegisterType::HOLDING, 2, std::vector<uint16_t>({2})));
+        queue.enqueue(QueueItem::create(batch));
+        queue.enqueue(QueueItem::create(MsgRegisterReadFailed(1, RegisterType::HOLDING, 2, 1)));
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 2, std::vector<uint16_t>({3}))));
+
+        REQUIRE(queue.size_approx() == 3);
+        REQUIRE(queue.getConflatedCount() == 1);
+
+        // register 2 value from the first batch was dropped
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterValues)));
+        REQUIRE(item.getData<MsgRegisterValues>()->mRegister == 1);
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterReadFailed)));
+        item.getData<MsgRegisterReadFailed>();
+
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.isSameAs(typeid(MsgRegisterValues)));
+        REQUIRE(item.getData<MsgRegisterValues>()->mRegisters.getValue(0) == 3);
+
+        REQUIRE(!queue.try_dequeue(item));
+        REQUIRE(queue.size_approx() == 0);
+    }
+
+    SECTION("should not replace dequeued values") {
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({1}))));
+        REQUIRE(queue.try_dequeue(item));
+        item.getData<MsgRegisterValues>();
+
+        queue.enqueue(QueueItem::create(MsgRegisterValues(1, RegisterType::HOLDING, 1, std::vector<uint16_t>({2}))));
+        REQUIRE(queue.size_approx() == 1);
+        REQUIRE(queue.getConflatedCount() == 0);
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(item.getData<MsgRegisterValues>()->mRegisters.getValue(0) == 2);
+    }
+}
@@ -0,0 +1,84 @@
+#include <catch2/catch_all.hpp>
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+TEST_CASE("Modbus networks on worker pool") {
+
+    TestConfig config(R"(
+modbus:
+  worker_threads: 2
+  networks:
+    - name: tcp1
+      address: localhost
+      port: 501
+    - name: tcp2
+      address: localhost
+      port: 502
+    - name: tcp3
+      address: localhost
+      port: 503
+    - name: tcp4
+      address: localhost
+      port: 504
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: sensor1
+      state:
+        register: tcp1.1.2
+        register_type: input
+    - topic: sensor2
+      state:
+        register: tcp2.1.2
+        register_type: input
+    - topic: sensor3
+      state:
+        register: tcp3.1.2
+        register_type: input
+    - topic: switch4
+      commands:
+        - name: set
+          register: tcp4.1.2
+          register_type: holding
+      state:
+        register: tcp4.1.2
+        register_type: holding
+)");
+
+    SECTION("should poll all networks and execute commands") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcp1", 1, 2, modmqttd::RegisterType::INPUT, 1);
+        server.setModbusRegisterValue("tcp2", 1, 2, modmqttd::RegisterType::INPUT, 2);
+        server.setModbusRegisterValue("tcp3", 1, 2, modmqttd::RegisterType::INPUT, 3);
+        server.setModbusRegisterValue("tcp4", 1, 2, modmqttd::RegisterType::HOLDING, 0);
+        server.start();
+
+        server.waitForMqttValue("sensor1/state", "1");
+        server.waitForMqttValue("sensor2/state", "2");
+        server.waitForMqttValue("sensor3/state", "3");
+        server.waitForMqttValue("switch4/state", "0");
+
+        server.setModbusRegisterValue("tcp2", 1, 2, modmqttd::RegisterType::INPUT, 20);
+        server.waitForMqttValue("sensor2/state", "20");
+
+        server.waitForSubscription("switch4/set");
+        server.publish("switch4/set", "7");
+        server.waitForModbusValue("tcp4", 1, 2, modmqttd::RegisterType::HOLDING, 7);
+        server.waitForMqttValue("switch4/state", "7");
+
+        server.stop();
+    }
+
+    SECTION("should fail if worker thread count is negative") {
+        config.mYAML["modbus"]["worker_threads"] = -1;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("worker_threads");
+    }
+}
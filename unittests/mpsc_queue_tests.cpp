@@ -0,0 +1,265 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mpsc_queue.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+namespace {
+
+struct ProducerItem {
+    int mProducer;
+    int mSeq;
+};
+
+}
+
+TEST_CASE("MpscQueue") {
+    modmqttd::MpscQueue<ProducerItem> queue;
+
+    SECTION("should deliver items from multiple producers in per-producer order") {
+        // more producers than lanes to test shared lane
+        const int producerCount = modmqttd::MpscQueue<ProducerItem>::MAX_PRODUCER_LANES + 4;
+        const int itemCount = 5000;
+
+        // keep producers running until all of them got a lane,
+        // lanes are released on thread exit
+        std::atomic<int> finished(0);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < producerCount; p++) {
+            producers.emplace_back([&queue, &finished, p, itemCount, producerCount]() {
+                for (int i = 0; i < itemCount; i++)
+                    queue.enqueue(ProducerItem{p, i});
+                finished++;
+                while (finished.load() < producerCount)
+                    std::this_thread::yield();
+            });
+        }
+
+        std::vector<int> nextSeq(producerCount, 0);
+        int received = 0;
+        ProducerItem item;
+        while (received < producerCount * itemCount) {
+            if (!queue.wait_dequeue_timed(item, timing::defaultWait))
+                break;
+            REQUIRE(item.mSeq == nextSeq[item.mProducer]);
+            nextSeq[item.mProducer]++;
+            received++;
+        }
+
+        for (auto& t: producers)
+            t.join();
+
+        REQUIRE(received == producerCount * itemCount);
+        REQUIRE(!queue.try_dequeue(item));
+        REQUIRE(queue.getLaneCount() == modmqttd::MpscQueue<ProducerItem>::MAX_PRODUCER_LANES);
+    }
+
+    SECTION("should deliver all items when producers run concurrently with consumer") {
+        const int producerCount = 4;
+        const int itemCount = 50000;
+
+        // release all producers at once so their enqueues overlap
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::atomic<int> finished(0);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < producerCount; p++) {
+            producers.emplace_back([&queue, &ready, &go, &finished, p, itemCount, producerCount]() {
+                ready++;
+                while (!go.load())
+                    std::this_thread::yield();
+                for (int i = 0; i < itemCount; i++)
+                    queue.enqueue(ProducerItem{p, i});
+                finished++;
+                while (finished.load() < producerCount)
+                    std::this_thread::yield();
+            });
+        }
+        while (ready.load() < producerCount)
+            std::this_thread::yield();
+        go = true;
+
+        std::vector<int> nextSeq(producerCount, 0);
+        int received = 0;
+        bool ordered = true;
+        ProducerItem item;
+        while (received < producerCount * itemCount) {
+            if (!queue.wait_dequeue_timed(item, timing::defaultWait))
+                break;
+            // REQUIRE is too slow to call for every item
+            if (item.mProducer < 0 || item.mProducer >= producerCount || item.mSeq != nextSeq[item.mProducer]) {
+                ordered = false;
+                break;
+            }
+            nextSeq[item.mProducer]++;
+            received++;
+        }
+
+        for (auto& t: producers)
+            t.join();
+
+        REQUIRE(ordered);
+        REQUIRE(received == producerCount * itemCount);
+        for (int p = 0; p < producerCount; p++)
+            REQUIRE(nextSeq[p] == itemCount);
+        REQUIRE(!queue.try_dequeue(item));
+        // lane 0 is reserved for producers sharing a lane
+        REQUIRE(queue.getLaneCount() == producerCount + 1);
+    }
+
+    SECTION("should not starve producer with less items") {
+        std::thread busy([&queue]() {
+            for (int i = 0; i < 1000; i++)
+                queue.enqueue(ProducerItem{0, i});
+        });
+        busy.join();
+        std::thread single([&queue]() {
+            queue.enqueue(ProducerItem{1, 0});
+        });
+        single.join();
+
+        ProducerItem first, second;
+        REQUIRE(queue.try_dequeue(first));
+        REQUIRE(queue.try_dequeue(second));
+        REQUIRE(first.mProducer == 0);
+        REQUIRE(second.mProducer == 1);
+    }
+
+    SECTION("should reuse lane of finished producer") {
+        ProducerItem item;
+        for (int p = 0; p < 3; p++) {
+            std::thread producer([&queue, p]() {
+                queue.enqueue(ProducerItem{p, 0});
+            });
+            producer.join();
+            REQUIRE(queue.try_dequeue(item));
+            REQUIRE(item.mProducer == p);
+        }
+        REQUIRE(queue.getLaneCount() == 2);
+    }
+
+    SECTION("should not reuse lane with items of finished producer") {
+        std::thread first([&queue]() {
+            queue.enqueue(ProducerItem{0, 0});
+        });
+        first.join();
+        std::thread second([&queue]() {
+            queue.enqueue(ProducerItem{1, 0});
+        });
+        second.join();
+        REQUIRE(queue.getLaneCount() == 3);
+    }
+
+    SECTION("should keep lane for producer thread") {
+        queue.enqueue(ProducerItem{0, 0});
+        queue.enqueue(ProducerItem{0, 1});
+        ProducerItem item;
+        REQUIRE(queue.try_dequeue(item));
+        REQUIRE(queue.try_dequeue(item));
+        queue.enqueue(ProducerItem{0, 2});
+        REQUIRE(queue.getLaneCount() == 2);
+    }
+}
+
+
+TEST_CASE("Commands and RPC requests from multiple threads during polling") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+mqtt:
+  client_id: mqtt_test
+  refresh: 5ms
+  rpc:
+    mode: read
+  broker:
+    host: localhost
+  objects:
+    - topic: test_switch1
+      commands:
+        - name: set
+          register: tcptest.1.2
+          register_type: holding
+      state:
+        register: tcptest.1.2
+        register_type: holding
+    - topic: test_switch2
+      commands:
+        - name: set
+          register: tcptest.1.3
+          register_type: holding
+      state:
+        register: tcptest.1.3
+        register_type: holding
+    - topic: test_sensor
+      state:
+        register: tcptest.1.4
+        register_type: input
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 0);
+    server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 0);
+    server.setModbusRegisterValue("tcptest", 1, 4, modmqttd::RegisterType::INPUT, 7);
+    server.setModbusRegisterValue("tcptest", 1, 10, modmqttd::RegisterType::HOLDING, 42);
+    server.start();
+
+    server.waitForSubscription("mqtt_test/rpc/modbus_request");
+    server.waitForSubscription("test_switch1/set");
+    server.waitForSubscription("test_switch2/set");
+    server.waitForPublish("test_sensor/state");
+
+    const int commandCount = 100;
+    const int rpcCount = 50;
+
+    modmqttd::ModbusClient& client(server.getServer().getModbusClient("tcptest"));
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 2; t++) {
+        producers.emplace_back([&client, t, commandCount]() {
+            for (int i = 1; i <= commandCount; i++) {
+                client.enqueue(modmqttd::QueueItem::create(
+                    modmqttd::MsgRegisterValues(1, modmqttd::RegisterType::HOLDING, t + 1, std::vector<uint16_t>({uint16_t(i)}))
+                ));
+            }
+        });
+    }
+
+    for (int t = 0; t < 2; t++) {
+        producers.emplace_back([&server, t, rpcCount]() {
+            const std::string req = R"({"network":"tcptest","slave":1,"register":"10"})";
+            for (int i = 1; i <= rpcCount; i++) {
+                server.mMqtt->injectRpcRequest(
+                    "mqtt_test/rpc/modbus_request",
+                    req.c_str(), static_cast<int>(req.size()),
+                    "test/response", (t + 1) * 1000 + i);
+            }
+        });
+    }
+
+    for (auto& t: producers)
+        t.join();
+
+    for (int t = 0; t < 2; t++) {
+        for (int i = 1; i <= rpcCount; i++) {
+            int corrId = (t + 1) * 1000 + i;
+            server.waitForRpcResponse(corrId);
+            REQUIRE(server.mMqtt->rpcValue(corrId) == "42");
+        }
+    }
+
+    // commands from single producer must be executed in order
+    server.waitForModbusValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, commandCount);
+    server.waitForModbusValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, commandCount);
+
+    server.stop();
+}
@@ -0,0 +1,110 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_topic_aliases.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+using modmqttd::MqttTopicAliases;
+
+TEST_CASE("MqttTopicAliases") {
+    MqttTopicAliases aliases;
+    bool isNew;
+
+    SECTION("should not assign aliases if maximum is zero") {
+        REQUIRE(aliases.get("a", isNew) == 0);
+        REQUIRE(!isNew);
+    }
+
+    SECTION("should assign aliases up to maximum") {
+        aliases.reset(2);
+        REQUIRE(aliases.get("a", isNew) == 1);
+        REQUIRE(isNew);
+        REQUIRE(aliases.get("b", isNew) == 2);
+        REQUIRE(isNew);
+        REQUIRE(aliases.get("c", isNew) == 0);
+        REQUIRE(!isNew);
+        REQUIRE(aliases.get("a", isNew) == 1);
+        REQUIRE(!isNew);
+    }
+
+    SECTION("should forget aliases after reset") {
+        aliases.reset(1);
+        REQUIRE(aliases.get("a", isNew) == 1);
+        aliases.reset(1);
+        REQUIRE(aliases.get("b", isNew) == 1);
+        REQUIRE(isNew);
+    }
+}
+
+TEST_CASE ("MQTT 5 publish properties") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 1s
+  broker:
+    host: localhost
+    mqtt5: true
+  objects:
+    - topic: test_sensor
+      message_expiry: 90s
+      state:
+        register: tcptest.1.2
+)");
+
+    SECTION("should set message expiry for state only") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 5);
+        server.start();
+        server.waitForPublish("test_sensor/availability");
+        REQUIRE(server.mMqtt->mqttProps("test_sensor/state").mMessageExpiry == 90);
+        REQUIRE(server.mMqtt->mqttProps("test_sensor/availability").mMessageExpiry == 0);
+        server.stop();
+    }
+
+    SECTION("should set message expiry to twice the refresh for every_poll mode") {
+        config.mYAML["mqtt"]["objects"][0]["message_expiry"] = "refresh";
+        config.mYAML["mqtt"]["objects"][0]["publish_mode"] = "every_poll";
+        config.mYAML["mqtt"]["refresh"] = "1500ms";
+        MockedModMqttServerThread server(config.toString());
+        server.start();
+        server.waitForPublish("test_sensor/state");
+        REQUIRE(server.mMqtt->mqttProps("test_sensor/state").mMessageExpiry == 3);
+        server.stop();
+    }
+
+    SECTION("should set message expiry to twice the max_publish_interval") {
+        config.mYAML["mqtt"]["objects"][0]["message_expiry"] = "refresh";
+        config.mYAML["mqtt"]["objects"][0]["max_publish_interval"] = "10s";
+        MockedModMqttServerThread server(config.toString());
+        server.start();
+        server.waitForPublish("test_sensor/state");
+        REQUIRE(server.mMqtt->mqttProps("test_sensor/state").mMessageExpiry == 20);
+        server.stop();
+    }
+
+    SECTION("should fail for refresh based expiry without periodic publish") {
+        config.mYAML["mqtt"]["objects"][0]["message_expiry"] = "refresh";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("message_expiry");
+    }
+
+    SECTION("should fail for topic aliases without mqtt5") {
+        config.mYAML["mqtt"]["broker"]["mqtt5"] = false;
+        config.mYAML["mqtt"]["broker"]["topic_alias_maximum"] = 10;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("topic_alias_maximum");
+    }
+}
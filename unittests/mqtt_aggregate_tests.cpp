@@ -0,0 +1,144 @@
+#include <cmath>
+
+#include <catch2/catch_all.hpp>
+#include "libmodmqttsrv/mqttobject.hpp"
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+#include "jsonutils.hpp"
+
+TEST_CASE ("Aggregated state") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_sensor
+      aggregate:
+        window: 100ms
+        functions: [min, max, count]
+      state:
+        register: tcptest.1.2
+)");
+
+    SECTION("should be published on state topic once per window") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 5);
+        server.start();
+        server.waitForPublish("test_sensor/availability");
+
+        std::this_thread::sleep_for(timing::milliseconds(30));
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        std::this_thread::sleep_for(timing::milliseconds(30));
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 9);
+
+        server.waitForPublish("test_sensor/state");
+        rapidjson::Document doc;
+        doc.Parse(server.mqttValue("test_sensor/state").c_str());
+        REQUIRE(doc.IsObject());
+        REQUIRE(doc["min"].GetDouble() == 1);
+        REQUIRE(doc["max"].GetDouble() == 9);
+        REQUIRE(doc["count"].GetInt() > 3);
+        REQUIRE(!doc.HasMember("mean"));
+        server.stop();
+
+        // one publish per window, no regular state messages
+        int count = server.getPublishCount("test_sensor/state");
+        REQUIRE(count <= 2);
+    }
+
+    SECTION("should be published on sibling topic with state structure") {
+        config.mYAML["mqtt"]["objects"][0]["aggregate"]["topic"] = "stats";
+        config.mYAML["mqtt"]["objects"][0]["aggregate"]["functions"] = YAML::Load("[mean, last, stddev]");
+        config.mYAML["mqtt"]["objects"][0]["state"] = YAML::Load(R"(
+            - name: first
+              register: tcptest.1.2
+            - name: second
+              register: tcptest.1.3
+        )");
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 4);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 7);
+        server.start();
+
+        server.waitForPublish("test_sensor/state");
+        REQUIRE_JSON(server.mqttValue("test_sensor/state"), R"({"first": 4, "second": 7})");
+
+        server.waitForPublish("test_sensor/stats");
+        REQUIRE_JSON(server.mqttValue("test_sensor/stats"), R"({
+            "first": {"mean": 4.0, "last": 4.0, "stddev": 0.0},
+            "second": {"mean": 7.0, "last": 7.0, "stddev": 0.0}
+        })");
+        server.stop();
+    }
+
+    SECTION("should fail for unknown function") {
+        config.mYAML["mqtt"]["objects"][0]["aggregate"]["functions"] = YAML::Load("[min, median]");
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("median");
+    }
+}
+
+
+class NanConverter : public DataConverter {
+    public:
+        virtual MqttValue toMqtt(const ModbusRegisters& data) const {
+            if (data.getValue(0) == 0)
+                return MqttValue::fromDouble(std::nan(""));
+            return MqttValue::fromInt(data.getValue(0));
+        }
+};
+
+
+static modmqttd::MqttObjectDataNode
+createField(const std::string& pName, int pRegister) {
+    modmqttd::MqttObjectDataNode field;
+    field.setName(pName);
+    field.setScalarNode(modmqttd::MqttObjectRegisterIdent("tcptest", 1, modmqttd::RegisterType::HOLDING, pRegister));
+    field.setConverter(std::shared_ptr<DataConverter>(new NanConverter()));
+    return field;
+}
+
+
+TEST_CASE ("MqttAggregate") {
+    modmqttd::MqttObjectState state;
+    state.addDataNode(createField("first", 0));
+    modmqttd::ModbusNetworkIds ids;
+    state.setNetworkIds(ids);
+
+    modmqttd::MqttAggregate aggregate(std::chrono::milliseconds(100), modmqttd::MqttAggregate::ALL, "");
+    auto addSample = [&state, &aggregate](int pRegister, uint16_t pValue) {
+        state.updateRegisterValues(0, modmqttd::MsgRegisterValues(1, modmqttd::RegisterType::HOLDING, pRegister, std::vector<uint16_t>({pValue})));
+        std::vector<int> slots(state.getDirtySlots());
+        state.clearDirty();
+        aggregate.addSamples(state, slots, std::chrono::steady_clock::now());
+    };
+
+    SECTION("should publish null for values that are not finite") {
+        addSample(0, 0);
+        REQUIRE_JSON(aggregate.finishWindow(state), R"({
+            "first": {"min": null, "max": null, "mean": null, "last": null, "count": 1, "stddev": null}
+        })");
+    }
+
+    SECTION("should rebuild fields after state is changed") {
+        addSample(0, 2);
+        state.addDataNode(createField("second", 1));
+        state.setNetworkIds(ids);
+        addSample(1, 4);
+        REQUIRE_JSON(aggregate.finishWindow(state), R"({
+            "first": {"min": null, "max": null, "mean": null, "last": null, "count": 0, "stddev": null},
+            "second": {"min": 4, "max": 4, "mean": 4, "last": 4, "count": 1, "stddev": 0}
+        })");
+    }
+}
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_topic_filters.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+using modmqttd::MqttTopicFilters;
+
+typedef std::vector<std::string> Topics;
+
+TEST_CASE("MqttTopicFilters") {
+
+    SECTION("should match wildcards") {
+        REQUIRE(MqttTopicFilters::matches("a/+/set", "a/b/set"));
+        REQUIRE(!MqttTopicFilters::matches("a/+/set", "a/b/c/set"));
+        REQUIRE(MqttTopicFilters::matches("a/#", "a/b/c"));
+        REQUIRE(MqttTopicFilters::matches("a/#", "a"));
+        REQUIRE(!MqttTopicFilters::matches("a/b", "a/b/c"));
+        REQUIRE(!MqttTopicFilters::matches("a/b/c", "a/b"));
+    }
+
+    SECTION("should merge topics that differ in a single level") {
+        Topics topics;
+        Topics own;
+        for (int i = 0; i < 100; i++) {
+            std::string obj("home/obj_" + std::to_string(i));
+            topics.push_back(obj + "/set");
+            topics.push_back(obj + "/mode");
+            own.push_back(obj + "/state");
+            own.push_back(obj + "/availability");
+        }
+        REQUIRE(MqttTopicFilters::compute(topics, own) == Topics({"home/+/mode", "home/+/set"}));
+    }
+
+    SECTION("should use prefix/# if there are no own topics below prefix") {
+        Topics topics({"cmd/a/set", "cmd/b/c/set", "cmd/d"});
+        Topics own({"state/a", "state/cmd"});
+        REQUIRE(MqttTopicFilters::compute(topics, own) == Topics({"cmd/#"}));
+    }
+
+    SECTION("should not use wildcard on the first level") {
+        Topics topics({"a/set", "b/set", "a/mode", "b/mode"});
+        Topics filters(MqttTopicFilters::compute(topics, Topics()));
+        REQUIRE(filters == Topics({"a/+", "b/+"}));
+        for (const std::string& topic: topics)
+            REQUIRE(std::any_of(filters.begin(), filters.end(), [&topic](const std::string& f) { return MqttTopicFilters::matches(f, topic); }));
+    }
+
+    SECTION("should not merge prefix with wildcard") {
+        Topics topics({"home/a/set", "home/b/set", "home/a/cfg/mode", "home/b/cfg/mode"});
+        // home/# matches own topic, home/+/# would have a wildcard in prefix
+        Topics own({"home"});
+        REQUIRE(MqttTopicFilters::compute(topics, own) == Topics({"home/+/cfg/mode", "home/+/set"}));
+    }
+
+    SECTION("should use single wildcard level in filter") {
+        Topics topics({"a/b/c", "a/x/c", "a/b/y", "a/x/y"});
+        Topics own({"a/state"});
+        REQUIRE(MqttTopicFilters::compute(topics, own) == Topics({"a/+/c", "a/+/y"}));
+    }
+
+    SECTION("should keep topics that cannot be merged without matching own topics") {
+        Topics topics({"a/set", "b/set"});
+        Topics own({"c/set"});
+        REQUIRE(MqttTopicFilters::compute(topics, own) == Topics({"a/set", "b/set"}));
+    }
+}
+
+
+TEST_CASE("Wildcard command subscriptions") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  command_subscriptions: wildcard
+  broker:
+    host: localhost
+  objects:
+    - topic: home/switch1
+      commands:
+        - name: set
+          register: tcptest.1.1
+          register_type: holding
+      state:
+        register: tcptest.1.1
+        register_type: holding
+    - topic: home/switch2
+      commands:
+        - name: set
+          register: tcptest.1.2
+          register_type: holding
+      state:
+        register: tcptest.1.2
+        register_type: holding
+)");
+
+    SECTION("should subscribe single filter for all commands") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 0);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 0);
+        server.start();
+        server.waitForSubscription("home/+/set");
+        server.waitForPublish("home/switch1/state");
+
+        server.publish("home/switch1/set", "10");
+        server.waitForModbusValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 10);
+        server.publish("home/switch2/set", "20");
+        server.waitForModbusValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 20);
+        server.waitForMqttValue("home/switch2/state", "20");
+        // topic of other client matched by filter
+        server.publish("home/other/set", "30");
+        server.stop();
+    }
+
+    SECTION("should fail for unknown mode") {
+        config.mYAML["mqtt"]["command_subscriptions"] = "all";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("command_subscriptions");
+    }
+}
+
+
+// run with ./tests "[benchmark]"
+TEST_CASE("Command subscription filters benchmark", "[.][benchmark]") {
+    const int objects = 5000;
+    Topics topics;
+    Topics own;
+    for (int i = 0; i < objects; i++) {
+        std::string obj("building/floor_" + std::to_string(i % 10) + "/device_" + std::to_string(i));
+        topics.push_back(obj + "/set");
+        own.push_back(obj + "/state");
+        own.push_back(obj + "/availability");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Topics filters(MqttTopicFilters::compute(topics, own));
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << topics.size() << " command topics, " << filters.size() << " subscription(s), computed in "
+        << duration.count() << "ms" << std::endl;
+    for (const std::string& filter: filters)
+        std::cout << "  " << filter << std::endl;
+}
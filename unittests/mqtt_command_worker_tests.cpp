@@ -0,0 +1,152 @@
+#include <chrono>
+#include <iostream>
+
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_command_worker.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+using modmqttd::ModbusClient;
+using modmqttd::MqttCommandWorker;
+using modmqttd::MqttObjectCommand;
+using modmqttd::MsgRegisterValues;
+
+static MqttObjectCommand
+createCommand() {
+    return MqttObjectCommand(1, "test/set", MqttObjectCommand::PayloadType::STRING, "tcptest", 1,
+                             modmqttd::RegisterType::HOLDING, 1, 1, modmqttd::ModbusWriteMode::AUTO);
+}
+
+static std::vector<std::unique_ptr<MsgRegisterValues>>
+takeWrites(ModbusClient& pClient) {
+    std::vector<std::unique_ptr<MsgRegisterValues>> ret;
+    modmqttd::QueueItem item;
+    while (pClient.mToModbusQueue.try_dequeue(item))
+        ret.push_back(item.getData<MsgRegisterValues>());
+    return ret;
+}
+
+
+TEST_CASE("MqttCommandWorker") {
+    MqttObjectCommand command(createCommand());
+    ModbusClient client;
+    MqttCommandWorker worker;
+    worker.start();
+
+    SECTION("should send converted commands in order") {
+        auto received = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+        for (int i = 0; i < 200; i++) {
+            MqttCommandWorker::Command cmd;
+            cmd.mCommand = &command;
+            cmd.mClient = &client;
+            cmd.mPayload = i == 100 ? "not a number" : std::to_string(i);
+            cmd.mReceived = received;
+            worker.enqueue(std::move(cmd));
+        }
+        worker.stop();
+
+        auto writes(takeWrites(client));
+        REQUIRE(writes.size() == 199);
+        REQUIRE(writes[0]->mRegisters.getValue(0) == 0);
+        REQUIRE(writes[100]->mRegisters.getValue(0) == 101);
+        REQUIRE(writes[198]->mRegisters.getValue(0) == 199);
+        // latency is measured from mqtt message receipt
+        REQUIRE(writes[0]->getCreationTime() == received);
+    }
+}
+
+
+TEST_CASE("Commands converted on command worker") {
+
+TestConfig config(R"(
+modmqttd:
+  converter_search_path:
+    - build/stdconv
+  converter_plugins:
+    - stdconv.so
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  command_worker: true
+  broker:
+    host: localhost
+  objects:
+    - topic: test_switch
+      commands:
+        - name: set
+          register: tcptest.1.2
+          register_type: holding
+          converter: std.divide(0.1)
+      state:
+        register: tcptest.1.2
+        register_type: holding
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 0);
+    server.start();
+    server.waitForPublish("test_switch/state");
+
+    server.publish("test_switch/set", "1");
+    server.publish("test_switch/set", "2");
+    server.waitForModbusValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 20);
+    server.waitForMqttValue("test_switch/state", "20");
+    server.stop();
+}
+
+
+// burns CPU like a complex expression converter
+class SlowConverter : public DataConverter {
+    public:
+        virtual ModbusRegisters toModbus(const MqttValue& value, int registerCount) const {
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(50);
+            while (std::chrono::steady_clock::now() < end);
+            return ModbusRegisters(value.getInt());
+        }
+};
+
+
+// run with ./tests "[benchmark]"
+TEST_CASE("Command worker benchmark", "[.][benchmark]") {
+    const int commands = 2000;
+    MqttObjectCommand command(createCommand());
+    command.setConverter(std::shared_ptr<DataConverter>(new SlowConverter()));
+
+    std::cout << "mode     main thread us/command  total ms" << std::endl;
+    for (bool useWorker: {false, true}) {
+        ModbusClient client;
+        MqttCommandWorker worker;
+        if (useWorker)
+            worker.start();
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < commands; i++) {
+            std::string payload(std::to_string(i));
+            auto received = std::chrono::steady_clock::now();
+            if (useWorker) {
+                MqttCommandWorker::Command cmd;
+                cmd.mCommand = &command;
+                cmd.mClient = &client;
+                cmd.mPayload = payload;
+                cmd.mReceived = received;
+                worker.enqueue(std::move(cmd));
+            } else {
+                MqttCommandWorker::execute(command, client, payload.data(), payload.size(), received);
+            }
+        }
+        auto mainThread = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        worker.stop();
+        // until all writes are queued for modbus thread
+        auto total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        REQUIRE(takeWrites(client).size() == commands);
+
+        std::cout << (useWorker ? "worker" : "inline") << "\t " << double(mainThread.count()) / commands
+            << "\t\t\t " << total.count() << std::endl;
+    }
+}
@@ -0,0 +1,136 @@
+#include <catch2/catch_all.hpp>
+#include "mockedserver.hpp"
+#include "jsonutils.hpp"
+#include "yaml_utils.hpp"
+
+TEST_CASE ("Objects on device topic") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+          poll_groups:
+            - register: 1
+              count: 2
+mqtt:
+  client_id: mqtt_test
+  refresh: 50ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_a
+      device_topic: device
+      state:
+        register: tcptest.1.1
+    - topic: test_b
+      device_topic: device
+      state:
+        - name: x
+          register: tcptest.1.2
+)");
+
+    SECTION("should be published in a single json map") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.start();
+        server.waitForPublish("device");
+        REQUIRE_JSON(server.mqttValue("device"), R"({"test_a": 1, "test_b": {"x": 2}})");
+        REQUIRE(server.mqttValue("test_a/state") == "1");
+        REQUIRE(server.mMqtt->mqttProps("device").mRetain == false);
+
+        // only changed objects are published
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 20);
+        server.waitForMqttValue("device", R"({"test_b":{"x":20}})");
+        server.stop();
+    }
+
+    SECTION("should not publish state topic if device_topic_only is set") {
+        config.mYAML["mqtt"]["objects"][0]["device_topic_only"] = true;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("device");
+        REQUIRE(!server.mMqtt->hasTopic("test_a/state"));
+        REQUIRE(server.mMqtt->hasTopic("test_b/state"));
+
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 10);
+        server.waitForMqttValue("device", R"({"test_a":10})");
+        REQUIRE(!server.mMqtt->hasTopic("test_a/state"));
+        server.stop();
+    }
+
+    SECTION("should be published in a single CBOR map") {
+        config.mYAML["mqtt"]["objects"][0]["payload_format"] = "cbor";
+        config.mYAML["mqtt"]["objects"][1]["payload_format"] = "cbor";
+        config.mYAML["mqtt"]["objects"][1]["device_topic"] = "other";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForPublish("device");
+        REQUIRE(server.mqttValue("device") == std::string("\xa1\x66test_a\x01"));
+        server.stop();
+    }
+
+    SECTION("should fail for objects with different payload formats") {
+        config.mYAML["mqtt"]["objects"][1]["payload_format"] = "msgpack";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("payload_format");
+    }
+
+    SECTION("should fail for raw payload format") {
+        config.mYAML["mqtt"]["objects"][0]["payload_format"] = "raw";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("device_topic");
+    }
+}
+
+TEST_CASE ("Device topic with slave placeholder") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+          name: meter1
+        - address: 2
+          name: meter2
+mqtt:
+  client_id: mqtt_test
+  refresh: 50ms
+  broker:
+    host: localhost
+  objects:
+    - topic: ${slave_name}/power
+      network: tcptest
+      slave: 1-2
+      device_topic: devices/${slave_name}
+      device_topic_only: true
+      state:
+        register: 1
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 10);
+    server.setModbusRegisterValue("tcptest", 2, 1, modmqttd::RegisterType::HOLDING, 20);
+    server.start();
+    server.waitForPublish("devices/meter1");
+    server.waitForPublish("devices/meter2");
+    REQUIRE_JSON(server.mqttValue("devices/meter1"), R"({"meter1/power": 10})");
+    REQUIRE_JSON(server.mqttValue("devices/meter2"), R"({"meter2/power": 20})");
+    server.stop();
+}
@@ -195,3 +195,49 @@ mqtt:
     REQUIRE(server.mModbusFactory->getMockedModbusContext("tcptest").getIssuedReadCallsCount(1) == 1);
     server.stop();
 }
+
+
+TEST_CASE ("Named state list should update fields sharing a register") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_state
+      state:
+        - name: last
+          register: tcptest.1.5
+          register_type: input
+        - name: first
+          register: tcptest.1.2
+          register_type: input
+        - name: last_copy
+          register: tcptest.1.5
+          register_type: input
+        - name: other_slave
+          register: tcptest.2.2
+          register_type: input
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::INPUT, 1);
+    server.setModbusRegisterValue("tcptest", 1, 5, modmqttd::RegisterType::INPUT, 5);
+    server.setModbusRegisterValue("tcptest", 2, 2, modmqttd::RegisterType::INPUT, 9);
+    server.start();
+
+    server.waitForPublish("test_state/state");
+    REQUIRE_JSON(server.mqttValue("test_state/state"), R"({ "last": 5, "first": 1, "last_copy": 5, "other_slave": 9 })");
+
+    server.setModbusRegisterValue("tcptest", 1, 5, modmqttd::RegisterType::INPUT, 6);
+    server.waitForPublish("test_state/state");
+    REQUIRE_JSON(server.mqttValue("test_state/state"), R"({ "last": 6, "first": 1, "last_copy": 6, "other_slave": 9 })");
+    server.stop();
+}
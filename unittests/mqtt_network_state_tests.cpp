@@ -0,0 +1,59 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_object_publisher.hpp"
+#include "libmodmqttsrv/mqttobject.hpp"
+
+#include "allocations.hpp"
+
+using modmqttd::MqttObject;
+using modmqttd::MqttObjectDataNode;
+using modmqttd::MqttObjectRegisterIdent;
+using modmqttd::MqttPublishProps;
+using modmqttd::MsgRegisterValues;
+using modmqttd::RegisterType;
+
+class CountingOutput : public modmqttd::MqttObjectPublisher::Output {
+    public:
+        void publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+            mCount++;
+        }
+        int mCount = 0;
+};
+
+
+TEST_CASE("Network state change should update objects from that network only") {
+    modmqttd::MqttObjectPublisher::MqttPollObjMap objects;
+    std::vector<std::shared_ptr<MqttObject>> objs;
+    for (const char* network: {"net1", "net2"}) {
+        for (int i = 0; i < 2; i++) {
+            std::shared_ptr<MqttObject> obj(new MqttObject(std::string(network) + "_" + std::to_string(i)));
+            MqttObjectDataNode field;
+            field.setScalarNode(MqttObjectRegisterIdent(network, 1, RegisterType::HOLDING, i));
+            obj->mState.addDataNode(field);
+            // object listed under two poll groups
+            objects[MqttObjectRegisterIdent(network, 1, RegisterType::HOLDING, 0)].push_back(obj);
+            objects[MqttObjectRegisterIdent(network, 1, RegisterType::HOLDING, 10)].push_back(obj);
+            objs.push_back(obj);
+        }
+    }
+
+    CountingOutput output;
+    modmqttd::MqttObjectPublisher publisher(output);
+    publisher.setObjects(objects);
+    publisher.processRegisterValues("net1", MsgRegisterValues(1, RegisterType::HOLDING, 0, std::vector<uint16_t>{1, 2}));
+    publisher.processRegisterValues("net2", MsgRegisterValues(1, RegisterType::HOLDING, 0, std::vector<uint16_t>{3, 4}));
+    REQUIRE(objs[0]->getAvailableFlag() == modmqttd::AvailableFlag::True);
+
+    int published = output.mCount;
+    uint64_t before = allocations::count();
+    publisher.processModbusNetworkState("net2", false);
+    publisher.processModbusNetworkState("unknown", false);
+    REQUIRE(allocations::count() == before);
+
+    // one availability message per object
+    REQUIRE(output.mCount - published == 2);
+    REQUIRE(objs[0]->getAvailableFlag() == modmqttd::AvailableFlag::True);
+    REQUIRE(objs[1]->getAvailableFlag() == modmqttd::AvailableFlag::True);
+    REQUIRE(objs[2]->getAvailableFlag() == modmqttd::AvailableFlag::False);
+    REQUIRE(objs[3]->getAvailableFlag() == modmqttd::AvailableFlag::False);
+}
@@ -0,0 +1,262 @@
+#include <catch2/catch_all.hpp>
+
+#include <chrono>
+#include <iostream>
+
+#include "libmodmqttsrv/exceptions.hpp"
+#include "libmodmqttsrv/mqtt_binary_payload.hpp"
+#include "libmodmqttsrv/mqttobject.hpp"
+#include "libmodmqttsrv/mqttpayload.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+using modmqttd::BinaryPayloadReader;
+using modmqttd::BinaryPayloadWriter;
+using modmqttd::PayloadFormat;
+
+static std::string
+bytes(std::initializer_list<uint8_t> pBytes) {
+    return std::string(pBytes.begin(), pBytes.end());
+}
+
+
+TEST_CASE("BinaryPayloadWriter") {
+    std::string out;
+
+    SECTION("should write CBOR items") {
+        BinaryPayloadWriter writer(PayloadFormat::CBOR, out);
+        writer.mapHeader(1);
+        writer.string("a", 1);
+        writer.arrayHeader(2);
+        writer.integer(100);
+        writer.integer(-1000);
+        writer.number(1.5);
+        writer.number(0.1);
+        REQUIRE(out == bytes({
+            0xa1, 0x61, 0x61, 0x82, 0x18, 0x64, 0x39, 0x03, 0xe7,
+            0xfa, 0x3f, 0xc0, 0x00, 0x00,
+            0xfb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a
+        }));
+    }
+
+    SECTION("should write MessagePack items") {
+        BinaryPayloadWriter writer(PayloadFormat::MSGPACK, out);
+        writer.mapHeader(1);
+        writer.string("a", 1);
+        writer.arrayHeader(4);
+        writer.integer(100);
+        writer.integer(200);
+        writer.integer(-33);
+        writer.integer(-1);
+        writer.number(1.5);
+        REQUIRE(out == bytes({
+            0x81, 0xa1, 0x61, 0x94, 0x64, 0xcc, 0xc8, 0xd0, 0xdf, 0xff,
+            0xca, 0x3f, 0xc0, 0x00, 0x00
+        }));
+    }
+
+    SECTION("should write integer value of double with zero precision") {
+        BinaryPayloadWriter writer(PayloadFormat::CBOR, out);
+        writer.value(MqttValue::fromDouble(12.0, 0));
+        REQUIRE(out == bytes({0x0c}));
+    }
+}
+
+
+TEST_CASE("BinaryPayloadReader") {
+
+    SECTION("should read CBOR scalars") {
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\x18\x64", 2).getInt() == 100);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\x39\x03\xe7", 3).getInt() == -1000);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\xf9\x3e\x00", 3).getDouble() == 1.5);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\xf5", 1).getInt() == 1);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\x62on", 3).getString() == "on");
+    }
+
+    SECTION("should read MessagePack scalars") {
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\xcd\x01\x2c", 3).getInt() == 300);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\xd0\xdf", 2).getInt() == -33);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\xca\x3f\xc0\x00\x00", 5).getDouble() == 1.5);
+        REQUIRE(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\xa2on", 3).getString() == "on");
+    }
+
+    SECTION("should reject non scalar, truncated and trailing data") {
+        REQUIRE_THROWS_AS(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\x81\x01", 2), modmqttd::MqttPayloadConversionException);
+        REQUIRE_THROWS_AS(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\x91\x01", 2), modmqttd::MqttPayloadConversionException);
+        REQUIRE_THROWS_AS(BinaryPayloadReader::readValue(PayloadFormat::CBOR, "\x19\x01", 2), modmqttd::MqttPayloadConversionException);
+        REQUIRE_THROWS_AS(BinaryPayloadReader::readValue(PayloadFormat::MSGPACK, "\x01\x02", 2), modmqttd::MqttPayloadConversionException);
+    }
+}
+
+
+TEST_CASE ("State payload formats") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 50ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_state
+      payload_format: cbor
+      state:
+        - name: a
+          register: tcptest.1.1
+        - name: b
+          register: tcptest.1.2
+      commands:
+        - name: set
+          register: tcptest.1.1
+          register_type: holding
+          payload_type: cbor
+)");
+
+    SECTION("should publish CBOR map and accept CBOR commands") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 5);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 300);
+        server.start();
+        server.waitForPublish("test_state/state");
+        REQUIRE(server.mqttValue("test_state/state") == bytes({0xa2, 0x61, 0x61, 0x05, 0x61, 0x62, 0x19, 0x01, 0x2c}));
+
+        server.publish("test_state/set", bytes({0x18, 0x64}));
+        server.waitForModbusValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 100);
+        server.stop();
+    }
+
+    SECTION("should publish MessagePack map") {
+        config.mYAML["mqtt"]["objects"][0]["payload_format"] = "msgpack";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 5);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 300);
+        server.start();
+        server.waitForPublish("test_state/state");
+        REQUIRE(server.mqttValue("test_state/state") == bytes({0x82, 0xa1, 0x61, 0x05, 0xa1, 0x62, 0xcd, 0x01, 0x2c}));
+        server.stop();
+    }
+
+    SECTION("should publish raw registers and accept raw commands") {
+        config.mYAML["mqtt"]["objects"][0]["payload_format"] = "raw";
+        config.mYAML["mqtt"]["objects"][0]["commands"][0]["payload_type"] = "raw";
+        config.mYAML["mqtt"]["objects"][0]["commands"][0]["count"] = 2;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 5);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 300);
+        server.start();
+        server.waitForPublish("test_state/state");
+        REQUIRE(server.mqttValue("test_state/state") == bytes({0x00, 0x05, 0x01, 0x2c}));
+
+        server.publish("test_state/set", bytes({0x00, 0x07, 0x01, 0x08}));
+        server.waitForModbusValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 7);
+        server.waitForModbusValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 264);
+        server.stop();
+    }
+
+    SECTION("should fail for unknown payload format") {
+        config.mYAML["mqtt"]["objects"][0]["payload_format"] = "xml";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("payload_format");
+    }
+
+    SECTION("should fail for raw command with converter") {
+        config.mYAML["mqtt"]["objects"][0]["commands"][0]["payload_type"] = "raw";
+        config.mYAML["mqtt"]["objects"][0]["commands"][0]["converter"] = "std.divide(10)";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("raw payload_type");
+    }
+}
+
+
+class TenthsConverter : public DataConverter {
+    public:
+        virtual MqttValue toMqtt(const ModbusRegisters& data) const {
+            return MqttValue::fromDouble(data.getValue(0) / 10.0, 1);
+        }
+};
+
+
+// object with pFields named values, every second one converted to double
+static void
+createWideState(modmqttd::MqttObjectState& pState, int pFields) {
+    std::shared_ptr<DataConverter> conv(new TenthsConverter());
+    for (int i = 0; i < pFields; i++) {
+        modmqttd::MqttObjectDataNode field;
+        field.setName("field_" + std::to_string(i));
+        field.setScalarNode(modmqttd::MqttObjectRegisterIdent("tcptest", 1, modmqttd::RegisterType::HOLDING, i));
+        if (i % 2)
+            field.setConverter(conv);
+        pState.addDataNode(field);
+    }
+    // tcptest gets id 0
+    modmqttd::ModbusNetworkIds ids;
+    pState.setNetworkIds(ids);
+}
+
+
+static void
+updateWideState(modmqttd::MqttObjectState& pState, int pFields, int pSeed) {
+    std::vector<uint16_t> values;
+    for (int i = 0; i < pFields; i++)
+        values.push_back((pSeed + i * 997) % 40000);
+    pState.updateRegisterValues(0, modmqttd::MsgRegisterValues(1, modmqttd::RegisterType::HOLDING, 0, values));
+}
+
+
+TEST_CASE("Binary payloads should be smaller than json") {
+    std::map<PayloadFormat, size_t> sizes;
+    for (PayloadFormat format: {PayloadFormat::JSON, PayloadFormat::CBOR, PayloadFormat::MSGPACK, PayloadFormat::RAW}) {
+        modmqttd::MqttObjectState state;
+        createWideState(state, 100);
+        updateWideState(state, 100, 1);
+        modmqttd::MqttPayload payload;
+        payload.setFormat(format);
+        sizes[format] = payload.generate(state).size();
+    }
+    REQUIRE(sizes[PayloadFormat::CBOR] < sizes[PayloadFormat::JSON]);
+    REQUIRE(sizes[PayloadFormat::MSGPACK] < sizes[PayloadFormat::JSON]);
+    REQUIRE(sizes[PayloadFormat::RAW] == 200);
+}
+
+
+// run with ./tests "[benchmark]"
+TEST_CASE("Payload format benchmark", "[.][benchmark]") {
+    const int fields = 100;
+    const int rounds = 20000;
+
+    std::cout << "format   bytes  ns/payload" << std::endl;
+    for (auto format: std::vector<std::pair<PayloadFormat, const char*>>{
+        {PayloadFormat::JSON, "json"},
+        {PayloadFormat::CBOR, "cbor"},
+        {PayloadFormat::MSGPACK, "msgpack"},
+        {PayloadFormat::RAW, "raw"}
+    }) {
+        modmqttd::MqttObjectState state;
+        createWideState(state, fields);
+        modmqttd::MqttPayload payload;
+        payload.setFormat(format.first);
+
+        size_t size = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            // all fields are changed in every round
+            updateWideState(state, fields, i);
+            size = payload.generate(state).size();
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout << format.second << "\t " << size << "\t" << duration.count() / rounds << std::endl;
+    }
+}
@@ -0,0 +1,73 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqttobject.hpp"
+#include "libmodmqttsrv/mqttpayload.hpp"
+
+using modmqttd::MqttObjectDataNode;
+using modmqttd::MqttObjectRegisterIdent;
+using modmqttd::MqttObjectState;
+using modmqttd::MsgRegisterValues;
+using modmqttd::RegisterType;
+
+class CountingConverter : public DataConverter {
+    public:
+        virtual MqttValue toMqtt(const ModbusRegisters& data) const {
+            mCalls++;
+            return MqttValue::fromInt(data.getValue(0));
+        }
+        mutable int mCalls = 0;
+};
+
+
+static MsgRegisterValues
+createValues(std::vector<uint16_t> pValues) {
+    return MsgRegisterValues(1, RegisterType::HOLDING, 0, pValues);
+}
+
+
+TEST_CASE("Incremental state payload") {
+    const int fields = 3;
+    MqttObjectState state;
+    std::vector<std::shared_ptr<CountingConverter>> converters;
+    for (int i = 0; i < fields; i++) {
+        converters.emplace_back(new CountingConverter());
+        MqttObjectDataNode field;
+        field.setName("f" + std::to_string(i));
+        field.setScalarNode(MqttObjectRegisterIdent("tcptest", 1, RegisterType::HOLDING, i));
+        field.setConverter(converters.back());
+        state.addDataNode(field);
+    }
+    // tcptest gets id 0
+    modmqttd::ModbusNetworkIds ids;
+    state.setNetworkIds(ids);
+
+    auto calls = [&converters]() {
+        std::vector<int> ret;
+        for (const auto& conv: converters)
+            ret.push_back(conv->mCalls);
+        return ret;
+    };
+
+    modmqttd::MqttPayload payload;
+    state.updateRegisterValues(0, createValues({1, 2, 3}));
+    REQUIRE(payload.generate(state) == R"({"f0":1,"f1":2,"f2":3})");
+    REQUIRE(calls() == std::vector<int>({1, 1, 1}));
+
+    SECTION("should convert only the changed field") {
+        state.updateRegisterValues(0, createValues({1, 20, 3}));
+        REQUIRE(payload.generate(state) == R"({"f0":1,"f1":20,"f2":3})");
+        REQUIRE(calls() == std::vector<int>({1, 2, 1}));
+    }
+
+    SECTION("should not convert fields if values did not change") {
+        state.updateRegisterValues(0, createValues({1, 2, 3}));
+        const std::string& first(payload.generate(state));
+        REQUIRE(first == R"({"f0":1,"f1":2,"f2":3})");
+        REQUIRE(calls() == std::vector<int>({1, 1, 1}));
+
+        // nothing is dirty
+        const std::string& second(payload.generate(state));
+        REQUIRE(&second == &first);
+        REQUIRE(calls() == std::vector<int>({1, 1, 1}));
+    }
+}
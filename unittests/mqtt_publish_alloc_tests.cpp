@@ -0,0 +1,261 @@
+#include <catch2/catch_all.hpp>
+
+#include <chrono>
+#include <iostream>
+
+#include <mqtt_protocol.h>
+
+#include "libmodmqttsrv/logging.hpp"
+#include "libmodmqttsrv/modmqtt.hpp"
+#include "libmodmqttsrv/mosquitto.hpp"
+#include "libmodmqttsrv/mqtt_object_publisher.hpp"
+#include "libmodmqttsrv/mqttclient.hpp"
+#include "libmodmqttsrv/mqttobject.hpp"
+#include "libmodmqttsrv/mqttpayload.hpp"
+
+#include "allocations.hpp"
+
+using modmqttd::MqttObject;
+using modmqttd::MqttObjectDataNode;
+using modmqttd::MqttObjectRegisterIdent;
+using modmqttd::MqttObjectState;
+using modmqttd::MqttPublishProps;
+using modmqttd::MsgRegisterValues;
+using modmqttd::PayloadFormat;
+using modmqttd::RegisterType;
+
+class HalfConverter : public DataConverter {
+    public:
+        virtual MqttValue toMqtt(const ModbusRegisters& data) const {
+            return MqttValue::fromDouble(data.getValue(0) / 2.0, 1);
+        }
+};
+
+// keeps the last message only, like mosquitto that copies payload
+class LastMessageOutput : public modmqttd::MqttObjectPublisher::Output {
+    public:
+        void publish(const std::string& pTopic, int pLen, const void* pData, const MqttPublishProps& pProps) {
+            mPayload.assign(static_cast<const char*>(pData), pLen);
+            mCount++;
+        }
+        std::string mPayload;
+        int mCount = 0;
+};
+
+// accepts messages like mosquitto, without copying them
+class NullMqttImpl : public modmqttd::IMqttImpl {
+    public:
+        virtual void init(modmqttd::MqttClient* owner, const char* clientId, int pConnection) {}
+        virtual std::shared_ptr<modmqttd::IMqttImpl> createConnection() { return std::shared_ptr<modmqttd::IMqttImpl>(new NullMqttImpl()); }
+        virtual void connect(const modmqttd::MqttBrokerConfig& config) {}
+        virtual void reconnect() {}
+        virtual void disconnect() {}
+        virtual void stop() {}
+        virtual void subscribe(const char* topic) {}
+        virtual int publish(const char* topic, int len, const void* data, const MqttPublishProps& props) {
+            return ++mCount;
+        }
+        virtual int publishResponse(const char* pTopic, int pLen, const void* pData,
+                                    const void* pCorrelationData, int pCorrelationLen,
+                                    const std::vector<std::pair<std::string, std::string>>& pUserProperties) {
+            return 0;
+        }
+        virtual int getSocket() { return -1; }
+        virtual bool wantWrite() { return false; }
+        virtual void loopRead() {}
+        virtual void loopWrite() {}
+        virtual void loopMisc() {}
+        virtual void on_disconnect(int rc) {}
+        virtual void on_connect(int rc, bool pSessionPresent) {}
+        virtual void on_log(int level, const char* message) {}
+        virtual void on_publish(int messageId) {}
+        int mCount = 0;
+};
+
+static void
+addFields(MqttObjectState& pState, int pFields, bool pConvert) {
+    std::shared_ptr<DataConverter> conv(new HalfConverter());
+    for (int i = 0; i < pFields; i++) {
+        MqttObjectDataNode field;
+        field.setName("field_" + std::to_string(i));
+        field.setScalarNode(MqttObjectRegisterIdent("tcptest", 1, RegisterType::HOLDING, i));
+        if (pConvert)
+            field.setConverter(conv);
+        pState.addDataNode(field);
+    }
+    // tcptest gets id 0
+    modmqttd::ModbusNetworkIds ids;
+    pState.setNetworkIds(ids);
+}
+
+static MsgRegisterValues
+createValues(int pFields, uint16_t pValue) {
+    return MsgRegisterValues(1, RegisterType::HOLDING, 0, std::vector<uint16_t>(pFields, pValue));
+}
+
+
+TEST_CASE("Payload generation should not allocate for changed values") {
+    const int fields = 100;
+    // the longest values are published first to reserve buffers
+    MsgRegisterValues longValues(createValues(fields, 65535));
+    MsgRegisterValues shortValues(createValues(fields, 7));
+
+    for (PayloadFormat format: {PayloadFormat::JSON, PayloadFormat::CBOR, PayloadFormat::MSGPACK, PayloadFormat::RAW}) {
+        MqttObjectState state;
+        addFields(state, fields, false);
+        modmqttd::MqttPayload payload;
+        payload.setFormat(format);
+        state.updateRegisterValues(0, longValues);
+        payload.generate(state);
+        state.updateRegisterValues(0, shortValues);
+        payload.generate(state);
+
+        state.updateRegisterValues(0, longValues);
+        uint64_t before = allocations::count();
+        payload.generate(state);
+        REQUIRE(allocations::count() == before);
+    }
+}
+
+
+TEST_CASE("MqttClient publish should not allocate") {
+    modmqttd::ModMqtt modmqtt;
+    modmqttd::MqttClient client(modmqtt);
+    std::shared_ptr<NullMqttImpl> impl(new NullMqttImpl());
+    client.setMqttImplementation(impl);
+    client.setClientId("mqtt_test");
+
+    const std::string topic("test_sensor/state");
+    const std::string payload(R"({"temperature":21.5,"humidity":45})");
+    MqttPublishProps props;
+
+    // published payload is logged with debug level
+    spdlog::level::level_enum level = spdlog::get_level();
+    spdlog::set_level(spdlog::level::info);
+    uint64_t before = allocations::count();
+    for (int i = 0; i < 100; i++)
+        client.publish(topic, payload.length(), payload.c_str(), props);
+    uint64_t after = allocations::count();
+    spdlog::set_level(level);
+
+    REQUIRE(after == before);
+    REQUIRE(impl->mCount == 100);
+}
+
+
+TEST_CASE("Mosquitto publish with topic aliases should not allocate") {
+    modmqttd::ModMqtt modmqtt;
+    modmqttd::MqttClient client(modmqtt);
+    client.setMqttImplementation(std::shared_ptr<NullMqttImpl>(new NullMqttImpl()));
+    client.setClientId("mqtt_test");
+
+    modmqttd::Mosquitto mosquitto;
+    mosquitto.init(&client, "mqtt_test", 0);
+    modmqttd::MqttBrokerConfig config;
+    config.mHost = "localhost";
+    // no broker there, messages are dropped by libmosquitto
+    config.mPort = 1;
+    config.mProtocolV5 = true;
+    config.mTopicAliasMaximum = 1;
+    mosquitto.connect(config);
+
+    mosquitto_property* connack = nullptr;
+    mosquitto_property_add_int16(&connack, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, 10);
+    mosquitto.onConnectV5(0, 0, connack);
+    mosquitto_property_free_all(&connack);
+
+    // longer than std::string small buffer
+    const std::string aliased("test_sensor/state");
+    const std::string unaliased("test_sensor/availability");
+    const std::string payload("21.5");
+    MqttPublishProps props;
+
+    // assigns the only alias
+    mosquitto.publish(aliased.c_str(), payload.length(), payload.c_str(), props);
+
+    uint64_t before = allocations::count();
+    for (int i = 0; i < 100; i++) {
+        mosquitto.publish(aliased.c_str(), payload.length(), payload.c_str(), props);
+        mosquitto.publish(unaliased.c_str(), payload.length(), payload.c_str(), props);
+    }
+    uint64_t after = allocations::count();
+
+    REQUIRE(after == before);
+}
+
+
+TEST_CASE("Device topic publish should not allocate") {
+    const int fields = 10;
+    modmqttd::MqttObjectPublisher::MqttPollObjMap objects;
+    for (const char* name: {"device/sensor1", "device/sensor2"}) {
+        std::shared_ptr<MqttObject> obj(new MqttObject(name));
+        addFields(obj->mState, fields, false);
+        obj->setDeviceTopic("device/state", false);
+        objects[MqttObjectRegisterIdent("tcptest", 1, RegisterType::HOLDING, 0)].push_back(obj);
+    }
+    LastMessageOutput output;
+    modmqttd::MqttObjectPublisher publisher(output);
+    publisher.setObjects(objects);
+    MsgRegisterValues longValues(createValues(fields, 65535));
+    MsgRegisterValues shortValues(createValues(fields, 7));
+    publisher.processRegisterValues("tcptest", longValues);
+    publisher.processRegisterValues("tcptest", shortValues);
+
+    int published = output.mCount;
+    uint64_t before = allocations::count();
+    publisher.processRegisterValues("tcptest", longValues);
+    REQUIRE(allocations::count() == before);
+    // two states and one device message
+    REQUIRE(output.mCount - published == 3);
+    REQUIRE(output.mPayload.find(R"("device/sensor1":)") != std::string::npos);
+}
+
+
+TEST_CASE("String values should keep their size") {
+    std::string value("ON");
+    MqttValue v(MqttValue::fromString(value));
+    MqttValue copy(v);
+    REQUIRE(copy.getBinarySize() == 2);
+    REQUIRE(memcmp(copy.getBinaryPtr(), "ON", 2) == 0);
+
+    std::string longValue(100, 'x');
+    MqttValue lv(MqttValue::fromString(longValue));
+    MqttValue lcopy(lv);
+    REQUIRE(lcopy.getString() == longValue);
+}
+
+
+// run with ./tests "[benchmark]"
+TEST_CASE("Publish allocations benchmark", "[.][benchmark]") {
+    const int fields = 100;
+    const int rounds = 10000;
+    MsgRegisterValues values[2] = { createValues(fields, 1000), createValues(fields, 2001) };
+
+    std::cout << "format   converter  allocs/message  ns/message" << std::endl;
+    for (PayloadFormat format: {PayloadFormat::JSON, PayloadFormat::CBOR}) {
+        for (bool convert: {false, true}) {
+            std::shared_ptr<MqttObject> obj(new MqttObject("test"));
+            addFields(obj->mState, fields, convert);
+            obj->setPayloadFormat(format);
+
+            modmqttd::MqttObjectPublisher::MqttPollObjMap objects;
+            objects[MqttObjectRegisterIdent("tcptest", 1, RegisterType::HOLDING, 0)].push_back(obj);
+            LastMessageOutput output;
+            modmqttd::MqttObjectPublisher publisher(output);
+            publisher.setObjects(objects);
+            publisher.processRegisterValues("tcptest", values[1]);
+
+            uint64_t before = allocations::count();
+            int published = output.mCount;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < rounds; i++)
+                publisher.processRegisterValues("tcptest", values[i % 2]);
+            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            published = output.mCount - published;
+
+            std::cout << (format == PayloadFormat::JSON ? "json" : "cbor") << "\t " << (convert ? "yes" : "no")
+                << "\t    " << double(allocations::count() - before) / published
+                << "\t\t    " << duration.count() / published << std::endl;
+        }
+    }
+}
@@ -0,0 +1,185 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <thread>
+
+#include <mosquitto.h>
+
+#include <catch2/catch_all.hpp>
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+static std::string
+createConfig(int pObjects, int pConnections, int pMaxQueued = 0) {
+    std::string ret(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  publish_connections: )" + std::to_string(pConnections) + R"(
+  broker:
+    host: localhost
+    max_queued: )" + std::to_string(pMaxQueued) + R"(
+  objects:
+)");
+    for (int i = 0; i < pObjects; i++) {
+        std::string reg("tcptest.1." + std::to_string(i + 1));
+        ret += "    - topic: obj_" + std::to_string(i) + "\n"
+               "      commands:\n"
+               "        - name: set\n"
+               "          register: " + reg + "\n"
+               "          register_type: holding\n"
+               "      state:\n"
+               "        register: " + reg + "\n";
+    }
+    return ret;
+}
+
+
+TEST_CASE("Publish connections") {
+    const int objects = 12;
+    const int connections = 3;
+    TestConfig config(createConfig(objects, connections));
+
+    SECTION("should partition topics between connections") {
+        MockedModMqttServerThread server(config.toString());
+        for (int i = 0; i < objects; i++)
+            server.setModbusRegisterValue("tcptest", 1, i + 1, modmqttd::RegisterType::HOLDING, i);
+        server.start();
+        // commands are subscribed on primary connection
+        server.waitForSubscription("obj_0/set");
+        for (int i = 0; i < objects; i++)
+            server.waitForPublish(("obj_" + std::to_string(i) + "/availability").c_str());
+
+        std::hash<std::string> topicHash;
+        std::set<int> used;
+        for (int i = 0; i < objects; i++) {
+            for (const char* suffix: {"/state", "/availability"}) {
+                std::string topic("obj_" + std::to_string(i) + suffix);
+                CAPTURE(topic);
+                int connection = server.getPublishConnection(topic.c_str());
+                REQUIRE(connection == int(topicHash(topic) % connections));
+                used.insert(connection);
+            }
+        }
+        REQUIRE(used.size() > 1);
+
+        server.publish("obj_5/set", "50");
+        server.waitForModbusValue("tcptest", 1, 6, modmqttd::RegisterType::HOLDING, 50);
+        server.waitForMqttValue("obj_5/state", "50");
+        REQUIRE(server.getPublishConnection("obj_5/state") == int(topicHash("obj_5/state") % connections));
+        server.stop();
+    }
+
+    SECTION("should fail if there are no connections") {
+        config.mYAML["mqtt"]["publish_connections"] = 0;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("publish_connections");
+    }
+}
+
+
+namespace {
+
+// publishes over N libmosquitto connections to a real broker
+// with the same topic partitioning as MqttClient
+class BrokerPublisher {
+    public:
+        bool connect(const char* pHost, int pPort, int pConnections, int pMaxInflight) {
+            for (int i = 0; i < pConnections; i++) {
+                std::string clientId("modmqttd-bench-" + std::to_string(i));
+                mosquitto* mosq = mosquitto_new(clientId.c_str(), true, this);
+                mConnections.push_back(mosq);
+                if (mosq == nullptr)
+                    return false;
+                mosquitto_max_inflight_messages_set(mosq, pMaxInflight);
+                mosquitto_publish_callback_set(mosq, [](mosquitto*, void* pObj, int) {
+                    static_cast<BrokerPublisher*>(pObj)->mAcked++;
+                });
+                if (mosquitto_connect(mosq, pHost, pPort, 60) != MOSQ_ERR_SUCCESS)
+                    return false;
+                if (mosquitto_loop_start(mosq) != MOSQ_ERR_SUCCESS)
+                    return false;
+            }
+            return true;
+        }
+
+        bool publish(const std::string& pTopic, const std::string& pPayload) {
+            mosquitto* mosq = mConnections[mTopicHash(pTopic) % mConnections.size()];
+            return mosquitto_publish(mosq, nullptr, pTopic.c_str(), pPayload.length(), pPayload.c_str(), 1, false) == MOSQ_ERR_SUCCESS;
+        }
+
+        bool waitForAcks(int pCount, std::chrono::seconds pTimeout) {
+            auto end = std::chrono::steady_clock::now() + pTimeout;
+            while (mAcked.load() < pCount) {
+                if (std::chrono::steady_clock::now() > end)
+                    return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return true;
+        }
+
+        ~BrokerPublisher() {
+            for (mosquitto* mosq: mConnections) {
+                if (mosq == nullptr)
+                    continue;
+                mosquitto_disconnect(mosq);
+                mosquitto_loop_stop(mosq, true);
+                mosquitto_destroy(mosq);
+            }
+        }
+    private:
+        std::vector<mosquitto*> mConnections;
+        std::hash<std::string> mTopicHash;
+        std::atomic<int> mAcked = 0;
+};
+
+}
+
+// run with ./tests "Publish connections broker benchmark"
+// Needs a running broker, MODMQTTD_TEST_BROKER sets its host,
+// default is localhost:1883. QoS 1 messages are published on
+// many topics, max_inflight limits unacknowledged messages per
+// connection like max_queued in modmqttd.
+TEST_CASE("Publish connections broker benchmark", "[.][benchmark]") {
+    const char* host = std::getenv("MODMQTTD_TEST_BROKER");
+    if (host == nullptr)
+        host = "localhost";
+    const int topics = 500;
+    const int messages = 50000;
+    const int maxInflight = 20;
+
+    mosquitto_lib_init();
+    {
+        BrokerPublisher probe;
+        if (!probe.connect(host, 1883, 1, maxInflight)) {
+            WARN("No MQTT broker at " << host << ":1883, benchmark skipped");
+            mosquitto_lib_cleanup();
+            return;
+        }
+    }
+
+    std::cout << "connections  messages/s" << std::endl;
+    for (int connections: {1, 2, 4}) {
+        BrokerPublisher publisher;
+        REQUIRE(publisher.connect(host, 1883, connections, maxInflight));
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < messages; i++)
+            REQUIRE(publisher.publish("modmqttd_bench/obj_" + std::to_string(i % topics) + "/state", std::to_string(i)));
+        REQUIRE(publisher.waitForAcks(messages, std::chrono::seconds(120)));
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout << connections << "\t     " << messages * 1000 / std::max<long>(duration.count(), 1) << std::endl;
+    }
+    mosquitto_lib_cleanup();
+}
@@ -0,0 +1,112 @@
+#include "catch2/catch_all.hpp"
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+TEST_CASE ("Publish limits") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_sensor
+      state:
+        register: tcptest.1.2
+)");
+
+    SECTION("max_publish_interval should republish unchanged state") {
+        config.mYAML["mqtt"]["objects"][0]["max_publish_interval"] = "30ms";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForMqttValue("test_sensor/state", "1");
+        std::this_thread::sleep_for(timing::milliseconds(100));
+        server.stop();
+
+        int count = server.getPublishCount("test_sensor/state");
+        REQUIRE(count >= 3);
+        REQUIRE(server.mqttValue("test_sensor/state") == "1");
+    }
+
+    SECTION("max_publish_interval should republish unchanged state in publish worker") {
+        config.mYAML["mqtt"]["publish_workers"] = 2;
+        config.mYAML["mqtt"]["objects"][0]["max_publish_interval"] = "30ms";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForMqttValue("test_sensor/state", "1");
+        std::this_thread::sleep_for(timing::milliseconds(100));
+        server.stop();
+
+        int count = server.getPublishCount("test_sensor/state");
+        REQUIRE(count >= 3);
+    }
+
+    SECTION("min_publish_interval should publish the latest of coalesced changes") {
+        config.mYAML["mqtt"]["objects"][0]["min_publish_interval"] = "200ms";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForMqttValue("test_sensor/state", "1");
+        auto firstPublish = std::chrono::steady_clock::now();
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        std::this_thread::sleep_for(timing::milliseconds(40));
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 3);
+        server.waitForMqttValue("test_sensor/state", "3");
+        auto dur = std::chrono::steady_clock::now() - firstPublish;
+        server.stop();
+
+        REQUIRE(dur > std::chrono::milliseconds(150));
+        server.requirePublishCount("test_sensor/state", 2);
+    }
+
+    SECTION("debounce should publish state after value is stable") {
+        config.mYAML["mqtt"]["objects"][0]["debounce"] = "60ms";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForMqttValue("test_sensor/state", "1");
+
+        for (int i = 2; i < 6; i++) {
+            server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, i);
+            std::this_thread::sleep_for(timing::milliseconds(20));
+        }
+        server.waitForMqttValue("test_sensor/state", "5");
+        std::this_thread::sleep_for(timing::milliseconds(80));
+        server.stop();
+
+        server.requirePublishCount("test_sensor/state", 2);
+    }
+
+    SECTION("debounce should publish changed state with every_poll publish mode") {
+        // every poll is faster than debounce period
+        config.mYAML["mqtt"]["objects"][0]["publish_mode"] = "every_poll";
+        config.mYAML["mqtt"]["objects"][0]["debounce"] = "60ms";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForMqttValue("test_sensor/state", "1");
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.waitForMqttValue("test_sensor/state", "2", timing::milliseconds(500));
+        server.stop();
+    }
+
+    SECTION("max_publish_interval lower than min_publish_interval should fail") {
+        config.mYAML["mqtt"]["objects"][0]["min_publish_interval"] = "100ms";
+        config.mYAML["mqtt"]["objects"][0]["max_publish_interval"] = "50ms";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("max_publish_interval");
+    }
+}
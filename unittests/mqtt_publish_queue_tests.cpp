@@ -0,0 +1,162 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_publish_queue.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+#include "jsonutils.hpp"
+
+using modmqttd::MqttPublishProps;
+using modmqttd::MqttPublishQueue;
+using modmqttd::QueueFullPolicy;
+
+TEST_CASE("MqttPublishQueue") {
+    MqttPublishQueue queue;
+    MqttPublishQueue::Message msg;
+
+    SECTION("should track sent messages up to the limit") {
+        queue.setLimit(2, QueueFullPolicy::DROP_OLD);
+        REQUIRE(queue.hasCapacity());
+        queue.addSent(1);
+        queue.addSent(2);
+        REQUIRE(!queue.hasCapacity());
+        REQUIRE(!queue.removeSent(3));
+        REQUIRE(queue.removeSent(1));
+        REQUIRE(queue.hasCapacity());
+        REQUIRE(queue.getSentCount() == 1);
+    }
+
+    SECTION("should keep the latest message for a topic with drop_old policy") {
+        queue.setLimit(1, QueueFullPolicy::DROP_OLD);
+        MqttPublishProps props;
+        props.mRetain = true;
+        queue.hold("a", 1, "1", props);
+        queue.hold("b", 1, "2", props);
+        props.mRetain = false;
+        props.mQos = 1;
+        queue.hold("a", 1, "3", props);
+        REQUIRE(queue.getHeldCount() == 2);
+        REQUIRE(queue.getDroppedCount() == 1);
+
+        REQUIRE(queue.popHeld(msg));
+        REQUIRE(msg.mTopic == "a");
+        REQUIRE(msg.mPayload == "3");
+        REQUIRE(!msg.mProps.mRetain);
+        REQUIRE(msg.mProps.mQos == 1);
+        REQUIRE(queue.popHeld(msg));
+        REQUIRE(msg.mTopic == "b");
+        REQUIRE(!queue.popHeld(msg));
+
+        // topic is held again after it was sent
+        queue.hold("a", 1, "4", props);
+        REQUIRE(queue.getHeldCount() == 1);
+        REQUIRE(queue.getDroppedCount() == 1);
+    }
+
+    SECTION("should keep all messages with pause_polling policy") {
+        queue.setLimit(1, QueueFullPolicy::PAUSE_POLLING);
+        queue.hold("a", 1, "1", MqttPublishProps());
+        queue.hold("a", 1, "2", MqttPublishProps());
+        REQUIRE(queue.getHeldCount() == 2);
+        REQUIRE(queue.getDroppedCount() == 0);
+        REQUIRE(queue.popHeld(msg));
+        REQUIRE(msg.mPayload == "1");
+        REQUIRE(queue.popHeld(msg));
+        REQUIRE(msg.mPayload == "2");
+    }
+}
+
+TEST_CASE ("Publish queue limits") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+    max_queued: 1
+  objects:
+    - topic: test_a
+      qos: 1
+      state:
+        register: tcptest.1.1
+    - topic: test_b
+      state:
+        register: tcptest.1.2
+    - topic: test_c
+      state:
+        register: tcptest.1.3
+)");
+
+    SECTION("should publish all messages with drop_old policy") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 3);
+        server.start();
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("test_b/availability");
+        server.waitForPublish("test_c/availability");
+        REQUIRE(server.mqttValue("test_a/state") == "1");
+        REQUIRE(server.mqttValue("test_b/state") == "2");
+        REQUIRE(server.mqttValue("test_c/state") == "3");
+        REQUIRE(server.mMqtt->mqttProps("test_a/state").mQos == 1);
+        REQUIRE(server.mMqtt->mqttProps("test_b/state").mQos == 0);
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 20);
+        server.waitForMqttValue("test_b/state", "20");
+        server.stop();
+    }
+
+    SECTION("should resume polling when held messages are sent") {
+        config.mYAML["mqtt"]["broker"]["on_queue_full"] = "pause_polling";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForPublish("test_c/availability");
+
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 10);
+        server.waitForMqttValue("test_a/state", "10");
+        server.stop();
+    }
+
+    SECTION("should publish queue stats") {
+        config.mYAML["mqtt"]["stats_interval"] = "50ms";
+        MockedModMqttServerThread server(config.toString());
+        server.start();
+        server.waitForPublish("mqtt_test/stats/publish");
+        rapidjson::Document doc;
+        doc.Parse(server.mqttValue("mqtt_test/stats/publish").c_str());
+        REQUIRE(doc.IsObject());
+        REQUIRE(doc.HasMember("queued"));
+        REQUIRE(doc.HasMember("held"));
+        REQUIRE(doc.HasMember("dropped"));
+        REQUIRE(doc["polling_paused"].IsBool());
+        REQUIRE(doc["modbus"]["tcptest"]["queued"].IsUint64());
+        REQUIRE(doc["modbus"]["tcptest"]["conflated"].IsUint64());
+        server.stop();
+    }
+
+    SECTION("should fail for unknown queue full policy") {
+        config.mYAML["mqtt"]["broker"]["on_queue_full"] = "block";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("on_queue_full");
+    }
+
+    SECTION("should fail for invalid qos") {
+        config.mYAML["mqtt"]["objects"][0]["qos"] = 3;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("qos");
+    }
+}
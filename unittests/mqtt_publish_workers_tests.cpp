@@ -0,0 +1,108 @@
+#include <catch2/catch_all.hpp>
+
+#include "mockedserver.hpp"
+#include "jsonutils.hpp"
+#include "yaml_utils.hpp"
+
+TEST_CASE("Objects processed by publish workers") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+    - name: tcptest2
+      address: localhost
+      port: 502
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  publish_workers: 3
+  broker:
+    host: localhost
+  objects:
+    - topic: sensor1
+      state:
+        register: tcptest.1.1
+        register_type: input
+    - topic: sensor2
+      state:
+        register: tcptest.1.2
+        register_type: input
+    - topic: sensor3
+      state:
+        register: tcptest2.1.1
+        register_type: input
+    - topic: combined
+      state:
+        - name: first
+          register: tcptest.1.1
+          register_type: input
+        - name: second
+          register: tcptest2.1.1
+          register_type: input
+    - topic: switch
+      commands:
+        - name: set
+          register: tcptest.1.10
+          register_type: holding
+      state:
+        register: tcptest.1.10
+        register_type: holding
+)");
+
+    SECTION("should publish state of all objects") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::INPUT, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::INPUT, 2);
+        server.setModbusRegisterValue("tcptest2", 1, 1, modmqttd::RegisterType::INPUT, 3);
+        server.setModbusRegisterValue("tcptest", 1, 10, modmqttd::RegisterType::HOLDING, 0);
+        server.start();
+
+        server.waitForMqttValue("sensor1/state", "1");
+        server.waitForMqttValue("sensor2/state", "2");
+        server.waitForMqttValue("sensor3/state", "3");
+        server.waitForMqttValue("switch/state", "0");
+        server.waitForPublish("combined/state");
+        REQUIRE_JSON(server.mqttValue("combined/state"), R"({"first": 1, "second": 3})");
+        REQUIRE(server.mqttValue("combined/availability") == "1");
+
+        server.setModbusRegisterValue("tcptest2", 1, 1, modmqttd::RegisterType::INPUT, 30);
+        server.waitForMqttValue("sensor3/state", "30");
+        server.waitForPublish("combined/state");
+        REQUIRE_JSON(server.mqttValue("combined/state"), R"({"first": 1, "second": 30})");
+
+        server.waitForSubscription("switch/set");
+        server.publish("switch/set", "5");
+        server.waitForModbusValue("tcptest", 1, 10, modmqttd::RegisterType::HOLDING, 5);
+        server.waitForMqttValue("switch/state", "5");
+
+        server.stop();
+    }
+
+    SECTION("should publish availability 0 for all objects on shutdown") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::INPUT, 1);
+        server.setModbusRegisterValue("tcptest2", 1, 1, modmqttd::RegisterType::INPUT, 3);
+        server.start();
+
+        server.waitForMqttValue("sensor1/availability", "1");
+        server.waitForMqttValue("sensor3/availability", "1");
+        server.waitForMqttValue("combined/availability", "1");
+        server.stop();
+
+        REQUIRE(server.mqttValue("sensor1/availability") == "0");
+        REQUIRE(server.mqttValue("sensor3/availability") == "0");
+        REQUIRE(server.mqttValue("combined/availability") == "0");
+    }
+
+    SECTION("should fail if worker count is negative") {
+        config.mYAML["mqtt"]["publish_workers"] = -1;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("publish_workers");
+    }
+}
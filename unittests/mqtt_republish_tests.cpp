@@ -0,0 +1,119 @@
+#include <catch2/catch_all.hpp>
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+
+TEST_CASE ("Republish after broker reconnect") {
+
+TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_a
+      state:
+        register: tcptest.1.1
+    - topic: test_b
+      state:
+        register: tcptest.1.2
+    - topic: test_c
+      state:
+        register: tcptest.1.3
+)");
+
+    SECTION("should be paced by republish_rate") {
+        // two messages per object, 200ms between objects
+        config.mYAML["mqtt"]["republish_rate"] = 10;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 3);
+        server.start();
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("test_b/availability");
+        server.waitForPublish("test_c/availability");
+
+        server.mMqtt->resetBroker();
+        std::this_thread::sleep_for(timing::milliseconds(100));
+        int published = 0;
+        for (const char* topic: {"test_a/availability", "test_b/availability", "test_c/availability"}) {
+            if (server.mMqtt->hasTopic(topic))
+                published++;
+        }
+        REQUIRE(published < 3);
+
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("test_b/availability");
+        server.waitForPublish("test_c/availability");
+        REQUIRE(server.mqttValue("test_a/state") == "1");
+        REQUIRE(server.mqttValue("test_b/state") == "2");
+        REQUIRE(server.mqttValue("test_c/state") == "3");
+        server.stop();
+    }
+
+    SECTION("should publish new values during paced republish") {
+        config.mYAML["mqtt"]["republish_rate"] = 1;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 3);
+        server.start();
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("test_b/availability");
+        server.waitForPublish("test_c/availability");
+
+        server.mMqtt->resetBroker();
+        std::this_thread::sleep_for(timing::milliseconds(50));
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 10);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 20);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 30);
+
+        server.waitForMqttValue("test_a/state", "10");
+        server.waitForMqttValue("test_b/state", "20");
+        server.waitForMqttValue("test_c/state", "30");
+        server.stop();
+    }
+
+    SECTION("should skip objects with republish_on_resume disabled if session was resumed") {
+        config.mYAML["mqtt"]["broker"]["clean_session"] = false;
+        config.mYAML["mqtt"]["objects"][0]["republish_on_resume"] = false;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 2);
+        server.start();
+        server.waitForPublish("test_a/state");
+        server.waitForPublish("test_b/state");
+        server.waitForPublish("test_a/availability");
+        server.waitForPublish("test_b/availability");
+
+        server.mMqtt->dropConnection();
+        server.waitForPublish("test_b/state");
+        server.waitForPublish("test_b/availability");
+
+        REQUIRE(server.getPublishCount("test_a/state") == 1);
+        REQUIRE(server.getPublishCount("test_a/availability") == 1);
+        REQUIRE(server.getPublishCount("test_b/state") == 2);
+        server.stop();
+    }
+
+    SECTION("should republish all objects after clean session reconnect") {
+        config.mYAML["mqtt"]["objects"][0]["republish_on_resume"] = false;
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 1, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForPublish("test_a/state");
+        server.waitForPublish("test_a/availability");
+
+        server.mMqtt->dropConnection();
+        server.waitForPublish("test_a/state");
+
+        REQUIRE(server.getPublishCount("test_a/state") == 2);
+        server.stop();
+    }
+}
@@ -0,0 +1,149 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqtt_value_filter.hpp"
+
+#include "mockedserver.hpp"
+#include "yaml_utils.hpp"
+#include "jsonutils.hpp"
+
+using modmqttd::MqttValueFilter;
+
+TEST_CASE("MqttValueFilter") {
+    std::chrono::steady_clock::time_point ts = std::chrono::steady_clock::now();
+
+    SECTION("deadband should accept changes greater or equal to deviation") {
+        MqttValueFilter filter(MqttValueFilter::Type::DEADBAND, 0.5);
+        REQUIRE(filter.accept(10, ts));
+        REQUIRE(!filter.accept(10.4, ts));
+        REQUIRE(!filter.accept(9.6, ts));
+        REQUIRE(filter.accept(10.5, ts));
+        REQUIRE(!filter.accept(10.1, ts));
+        REQUIRE(filter.accept(9.9, ts));
+    }
+
+    SECTION("relative deadband should compare with the last accepted value") {
+        MqttValueFilter filter(MqttValueFilter::Type::DEADBAND_PERCENT, 10);
+        REQUIRE(filter.accept(100, ts));
+        REQUIRE(!filter.accept(109, ts));
+        REQUIRE(filter.accept(110, ts));
+        REQUIRE(!filter.accept(120, ts));
+        REQUIRE(filter.accept(121, ts));
+    }
+
+    SECTION("max interval should accept any changed value") {
+        MqttValueFilter filter(MqttValueFilter::Type::DEADBAND, 5, std::chrono::seconds(10));
+        REQUIRE(filter.accept(10, ts));
+        REQUIRE(!filter.accept(11, ts + std::chrono::seconds(9)));
+        REQUIRE(filter.accept(11, ts + std::chrono::seconds(10)));
+    }
+
+    SECTION("swinging door should reject values on a straight line") {
+        MqttValueFilter filter(MqttValueFilter::Type::SWINGING_DOOR, 0.5);
+        REQUIRE(filter.accept(0, ts));
+        for (int i = 1; i < 10; i++)
+            REQUIRE(!filter.accept(i, ts + std::chrono::seconds(i)));
+        // slope change
+        REQUIRE(filter.accept(5, ts + std::chrono::seconds(10)));
+    }
+
+    SECTION("swinging door should reject noise within door width") {
+        MqttValueFilter filter(MqttValueFilter::Type::SWINGING_DOOR, 1);
+        REQUIRE(filter.accept(10, ts));
+        REQUIRE(!filter.accept(10.4, ts + std::chrono::seconds(1)));
+        REQUIRE(!filter.accept(9.7, ts + std::chrono::seconds(2)));
+        REQUIRE(!filter.accept(10.2, ts + std::chrono::seconds(3)));
+        REQUIRE(filter.accept(14, ts + std::chrono::seconds(4)));
+    }
+}
+
+
+TEST_CASE ("State value filter") {
+
+TestConfig config(R"(
+modmqttd:
+  converter_search_path:
+    - build/stdconv
+  converter_plugins:
+    - stdconv.so
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+mqtt:
+  client_id: mqtt_test
+  refresh: 10ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_sensor
+      state:
+        - name: temp
+          register: tcptest.1.2
+          converter: std.divide(10,precision=1)
+          deadband: 0.5
+        - name: other
+          register: tcptest.1.3
+)");
+
+    SECTION("should not publish changes within deadband") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 200);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForPublish("test_sensor/state");
+        REQUIRE_JSON(server.mqttValue("test_sensor/state"), R"({"temp": 20.0, "other": 1})");
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 203);
+        std::this_thread::sleep_for(timing::milliseconds(50));
+        server.requirePublishCount("test_sensor/state", 1);
+
+        // field without filter
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 2);
+        server.waitForPublish("test_sensor/state");
+        REQUIRE_JSON(server.mqttValue("test_sensor/state"), R"({"temp": 20.0, "other": 2})");
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 206);
+        server.waitForPublish("test_sensor/state");
+        REQUIRE_JSON(server.mqttValue("test_sensor/state"), R"({"temp": 20.6, "other": 2})");
+        server.stop();
+    }
+
+    SECTION("should be set on object level") {
+        config.mYAML["mqtt"]["objects"][0]["state"][0].remove("deadband");
+        config.mYAML["mqtt"]["objects"][0]["deadband"] = "10%";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 200);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 100);
+        server.start();
+        server.waitForPublish("test_sensor/state");
+
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 210);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 95);
+        std::this_thread::sleep_for(timing::milliseconds(50));
+        server.requirePublishCount("test_sensor/state", 1);
+
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 120);
+        server.waitForPublish("test_sensor/state");
+        REQUIRE_JSON(server.mqttValue("test_sensor/state"), R"({"temp": 20.0, "other": 120})");
+        server.stop();
+    }
+
+    SECTION("should fail for invalid deadband") {
+        config.mYAML["mqtt"]["objects"][0]["state"][0]["deadband"] = "x%";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("deadband");
+    }
+
+    SECTION("should fail if deadband and swinging_door are both set") {
+        config.mYAML["mqtt"]["objects"][0]["state"][0]["swinging_door"] = "0.5";
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("swinging_door");
+    }
+}
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/mqttobject.hpp"
+#include "libmodmqttsrv/open_hash_map.hpp"
+
+using modmqttd::ModbusNetworkIds;
+using modmqttd::MqttObjectRegisterIdent;
+using modmqttd::OpenHashMap;
+using modmqttd::RegisterType;
+
+TEST_CASE("OpenHashMap") {
+    OpenHashMap<int> map;
+
+    SECTION("should insert, find and erase values") {
+        REQUIRE(map.find(1) == nullptr);
+        REQUIRE(!map.erase(1));
+        map[1] = 10;
+        map[uint64_t(-5)] = 50;
+        REQUIRE(map.size() == 2);
+        REQUIRE(*map.find(1) == 10);
+        REQUIRE(*map.find(uint64_t(-5)) == 50);
+        REQUIRE(map.erase(1));
+        REQUIRE(map.find(1) == nullptr);
+        REQUIRE(map.size() == 1);
+    }
+
+    SECTION("should behave like std::map for random operations") {
+        std::map<uint64_t, int> expected;
+        std::mt19937 rnd(1);
+        // small key range for long probe chains and many erases
+        std::uniform_int_distribution<int> keys(0, 300);
+        for (int i = 0; i < 20000; i++) {
+            uint64_t key = uint64_t(keys(rnd)) << 40;
+            if (rnd() % 3 == 0) {
+                REQUIRE(map.erase(key) == (expected.erase(key) == 1));
+            } else {
+                map[key] = i;
+                expected[key] = i;
+            }
+        }
+        REQUIRE(map.size() == expected.size());
+        for (int k = 0; k <= 300; k++) {
+            uint64_t key = uint64_t(k) << 40;
+            auto it = expected.find(key);
+            if (it == expected.end())
+                REQUIRE(map.find(key) == nullptr);
+            else
+                REQUIRE(*map.find(key) == it->second);
+        }
+    }
+}
+
+
+TEST_CASE("Packed register ident keys should be unique") {
+    ModbusNetworkIds ids;
+    REQUIRE(ids.add("tcptest") == 0);
+    REQUIRE(ids.add("rtutest") == 1);
+    REQUIRE(ids.add("tcptest") == 0);
+    REQUIRE(ids.find("other") == -1);
+
+    std::set<uint64_t> keys;
+    for (int net = 0; net < 2; net++)
+        for (int slave: {1, 247})
+            for (RegisterType type: {RegisterType::COIL, RegisterType::HOLDING})
+                for (int reg: {0, 1, 65535})
+                    keys.insert(MqttObjectRegisterIdent::key(net, slave, type, reg));
+    REQUIRE(keys.size() == 24);
+}
+
+
+// run with ./tests "[benchmark]"
+TEST_CASE("Poll group lookup benchmark", "[.][benchmark]") {
+    const int networks = 30;
+    const int groups = 100;
+    const int rounds = 1000000;
+
+    std::map<MqttObjectRegisterIdent, int, MqttObjectRegisterIdent::Compare> treeMap;
+    OpenHashMap<int> hashMap;
+    ModbusNetworkIds ids;
+    std::vector<std::string> names;
+    for (int n = 0; n < networks; n++) {
+        names.push_back("modbus_network_" + std::to_string(n));
+        int id = ids.add(names.back());
+        for (int g = 0; g < groups; g++) {
+            MqttObjectRegisterIdent ident(names.back(), 1, RegisterType::HOLDING, g * 10);
+            treeMap[ident] = g;
+            hashMap[ident.key(id)] = g;
+        }
+    }
+    std::vector<modmqttd::MsgRegisterValues> messages;
+    for (int i = 0; i < 1000; i++)
+        messages.emplace_back(1, RegisterType::HOLDING, (i % groups) * 10, std::vector<uint16_t>{1});
+
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        const std::string& network(names[i % networks]);
+        MqttObjectRegisterIdent ident(network, messages[i % messages.size()]);
+        sum += treeMap.find(ident)->second;
+    }
+    auto treeTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        const std::string& network(names[i % networks]);
+        int id = ids.find(network);
+        sum -= *hashMap.find(MqttObjectRegisterIdent::key(id, messages[i % messages.size()]));
+    }
+    auto hashTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    REQUIRE(sum == 0);
+    std::cout << "std::map with string ident: " << treeTime.count() / rounds << " ns/lookup" << std::endl;
+    std::cout << "interned id + OpenHashMap:  " << hashTime.count() / rounds << " ns/lookup" << std::endl;
+}
@@ -52,9 +52,5 @@ mqtt:
 
     ModMqttServerThread server(config.toString());
     server.start();
-    // we need to sleep to let mqtt server to start waiting on gHasMessagesCondition
-    // in mqtt initial connection loop
-    // otherwise stop signal is missed and test will last for 5 seconds
-    std::this_thread::sleep_for(timing::milliseconds(50));
     server.stop();
 }
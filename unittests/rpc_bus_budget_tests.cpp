@@ -0,0 +1,39 @@
+#include <catch2/catch_all.hpp>
+
+#include "libmodmqttsrv/rpc_bus_budget.hpp"
+
+using modmqttd::RpcBusBudget;
+using std::chrono::milliseconds;
+
+TEST_CASE("RpcBusBudget") {
+    RpcBusBudget budget;
+    const auto start = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    SECTION("should not limit by default") {
+        REQUIRE(!budget.isLimited());
+        budget.charge(std::chrono::hours(1));
+        REQUIRE(budget.isAvailable(start));
+        REQUIRE(budget.getWaitTime(start) == std::chrono::steady_clock::duration::zero());
+    }
+
+    SECTION("should refill with share of elapsed time") {
+        budget.configure(0.25, milliseconds(100));
+        REQUIRE(budget.isLimited());
+        REQUIRE(budget.isAvailable(start));
+
+        budget.charge(milliseconds(150));
+        REQUIRE(!budget.isAvailable(start));
+        // 50ms debt at 1/4 of elapsed time
+        REQUIRE(budget.getWaitTime(start) > milliseconds(199));
+        REQUIRE(budget.getWaitTime(start) < milliseconds(201));
+        REQUIRE(!budget.isAvailable(start + milliseconds(200)));
+        REQUIRE(budget.isAvailable(start + milliseconds(201)));
+    }
+
+    SECTION("should not refill above burst") {
+        budget.configure(0.5, milliseconds(100));
+        budget.isAvailable(start + std::chrono::seconds(10));
+        budget.charge(milliseconds(100));
+        REQUIRE(!budget.isAvailable(start + std::chrono::seconds(10)));
+    }
+}
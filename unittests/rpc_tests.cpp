@@ -885,3 +885,459 @@ mqtt:
         server.stop();
     }
 }
+
+
+TEST_CASE("RPC batch request") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+mqtt:
+  client_id: mqtt_test
+  rpc:
+    mode: readwrite
+  broker:
+    host: localhost
+  objects: []
+)");
+
+    // modbus reads issued for RPC requests
+    auto rpcReads = [](MockedModMqttServerThread& pServer) -> std::vector<int> {
+        auto& ctx = pServer.getMockedModbusContext("tcptest");
+        std::vector<int> counts;
+        for (int i = 0; i < ctx.getIssuedReadCallsCount(1); i++) {
+            const modmqttd::RegisterPoll& call(ctx.getIssuedReadCall(1, i));
+            if (call.getCommandId() != 0)
+                counts.push_back(call.getCount());
+        }
+        return counts;
+    };
+
+    SECTION("should coalesce adjacent and overlapping reads") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 10);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 20);
+        server.setModbusRegisterValue("tcptest", 1, 4, modmqttd::RegisterType::HOLDING, 30);
+        server.setModbusRegisterValue("tcptest", 1, 5, modmqttd::RegisterType::HOLDING, 40);
+        server.setModbusRegisterValue("tcptest", 1, 10, modmqttd::RegisterType::HOLDING, 99);
+        server.start();
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        const std::string req = R"([
+            {"network":"tcptest","slave":1,"register":"5"},
+            {"network":"tcptest","slave":1,"register":"2","count":2},
+            {"network":"tcptest","slave":1,"register":"10"},
+            {"network":"tcptest","slave":1,"register":"3","count":2},
+            {"network":"other","slave":1,"register":"2"}
+        ])";
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            req.c_str(), static_cast<int>(req.size()),
+            "test/response", 1);
+
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) ==
+            R"([{"value":40},{"value":[10,20]},{"value":99},{"value":[20,30]},{"error":"network not found: other"}])");
+        REQUIRE(server.mMqtt->rpcUserProperty(1, "error").empty());
+        server.stop();
+
+        REQUIRE(rpcReads(server) == std::vector<int>({4, 1}));
+    }
+
+    SECTION("should execute writes before reads") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.start();
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        const std::string req = R"([
+            {"network":"tcptest","slave":1,"register":"2"},
+            {"network":"tcptest","slave":1,"register":"2","value":5},
+            {"network":"tcptest","slave":1,"register":"2","register_type":"input","value":5}
+        ])";
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            req.c_str(), static_cast<int>(req.size()),
+            "test/response", 1);
+
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) ==
+            R"([{"value":5},{"value":5},{"error":"register_type is read-only"}])");
+        server.stop();
+    }
+
+    SECTION("should read after all writes are finished") {
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 1);
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 1);
+        server.setSlaveWriteTime("tcptest", 1, timing::milliseconds(100));
+        server.start();
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        // batch operations are queued together while this write is executed
+        const std::string write = R"({"network":"tcptest","slave":1,"register":"10","value":1})";
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            write.c_str(), static_cast<int>(write.size()),
+            "test/response", 2);
+
+        const std::string req = R"([
+            {"network":"tcptest","slave":1,"register":"2","count":2},
+            {"network":"tcptest","slave":1,"register":"2","value":5},
+            {"network":"tcptest","slave":1,"register":"3","value":6}
+        ])";
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            req.c_str(), static_cast<int>(req.size()),
+            "test/response", 1);
+
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) ==
+            R"([{"value":[5,6]},{"value":5},{"value":6}])");
+        server.stop();
+    }
+
+    SECTION("empty list should return error property") {
+        MockedModMqttServerThread server(config.toString());
+        server.start();
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        const std::string req = "[]";
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            req.c_str(), static_cast<int>(req.size()),
+            "test/response", 1);
+
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1).empty());
+        REQUIRE(server.mMqtt->rpcUserProperty(1, "error") == "empty operation list");
+        server.stop();
+    }
+}
+
+
+TEST_CASE("RPC read with max_age_ms") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+mqtt:
+  client_id: mqtt_test
+  rpc:
+    mode: readwrite
+  broker:
+    host: localhost
+  objects:
+    - topic: test_state
+      state:
+        register: tcptest.1.2
+        count: 3
+        refresh: 10s
+        register_type: holding
+)");
+
+    // modbus reads issued for RPC requests
+    auto rpcReadCount = [](MockedModMqttServerThread& pServer) -> int {
+        auto& ctx = pServer.getMockedModbusContext("tcptest");
+        int count = 0;
+        for (int i = 0; i < ctx.getIssuedReadCallsCount(1); i++) {
+            if (ctx.getIssuedReadCall(1, i).getCommandId() != 0)
+                count++;
+        }
+        return count;
+    };
+
+    auto sendRequest = [](MockedModMqttServerThread& pServer, const std::string& pReq, int pCorrelationId) {
+        pServer.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            pReq.c_str(), static_cast<int>(pReq.size()),
+            "test/response", pCorrelationId);
+    };
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 10);
+    server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 20);
+    server.setModbusRegisterValue("tcptest", 1, 4, modmqttd::RegisterType::HOLDING, 30);
+    server.start();
+    server.waitForPublish("test_state/state");
+    server.waitForSubscription("mqtt_test/rpc/modbus_request");
+    // changed after poll, visible only with modbus read
+    server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 21);
+
+    SECTION("should return fresh poll data without modbus read") {
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3","count":2,"max_age_ms":60000})", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) == "[20,30]");
+        server.stop();
+        REQUIRE(rpcReadCount(server) == 0);
+    }
+
+    SECTION("should read registers if poll data is too old") {
+        std::this_thread::sleep_for(timing::milliseconds(50));
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3","max_age_ms":10})", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) == "21");
+        server.stop();
+        REQUIRE(rpcReadCount(server) == 1);
+    }
+
+    SECTION("should read registers not covered by poll") {
+        server.setModbusRegisterValue("tcptest", 1, 5, modmqttd::RegisterType::HOLDING, 40);
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"4","count":2,"max_age_ms":60000})", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) == "[30,40]");
+        server.stop();
+        REQUIRE(rpcReadCount(server) == 1);
+    }
+
+    SECTION("should read registers after write") {
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3","value":5})", 1);
+        server.waitForRpcResponse(1);
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"2","count":2,"max_age_ms":60000})", 2);
+        server.waitForRpcResponse(2);
+        REQUIRE(server.mMqtt->rpcValue(2) == "[10,5]");
+        server.stop();
+        REQUIRE(rpcReadCount(server) == 1);
+    }
+
+    SECTION("should read registers written in the same batch") {
+        sendRequest(server, R"([
+            {"network":"tcptest","slave":1,"register":"3","value":7},
+            {"network":"tcptest","slave":1,"register":"3","max_age_ms":60000}
+        ])", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) == R"([{"value":7},{"value":7}])");
+        server.stop();
+        REQUIRE(rpcReadCount(server) == 1);
+    }
+
+    SECTION("should return error property for write") {
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3","value":1,"max_age_ms":100})", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcUserProperty(1, "error") == "max_age_ms is not allowed for writes");
+        server.stop();
+    }
+}
+
+
+TEST_CASE("RPC identical reads in flight") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      slaves:
+        - address: 1
+          delay_before_command: 50ms
+mqtt:
+  client_id: mqtt_test
+  rpc:
+    mode: read
+  broker:
+    host: localhost
+  objects: []
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setModbusRegisterValue("tcptest", 1, 2, modmqttd::RegisterType::HOLDING, 11);
+    server.start();
+    server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+    SECTION("should be answered with a single modbus read") {
+        const std::string req = R"({"network":"tcptest","slave":1,"register":"2"})";
+        const std::string batch = R"([{"network":"tcptest","slave":1,"register":"2"}])";
+        for (int i = 1; i <= 3; i++) {
+            server.mMqtt->injectRpcRequest(
+                "mqtt_test/rpc/modbus_request",
+                req.c_str(), static_cast<int>(req.size()),
+                "test/response", i);
+        }
+        server.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            batch.c_str(), static_cast<int>(batch.size()),
+            "test/response", 4);
+
+        for (int i = 1; i <= 4; i++)
+            server.waitForRpcResponse(i);
+        REQUIRE(server.mMqtt->rpcValue(1) == "11");
+        REQUIRE(server.mMqtt->rpcValue(2) == "11");
+        REQUIRE(server.mMqtt->rpcValue(3) == "11");
+        REQUIRE(server.mMqtt->rpcValue(4) == R"([{"value":11}])");
+        server.stop();
+        REQUIRE(server.getMockedModbusContext("tcptest").getIssuedReadCallsCount(1) == 1);
+    }
+}
+
+
+TEST_CASE("RPC admission control") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      rpc_max_pending: 1
+      slaves:
+        - address: 1
+          delay_before_command: 300ms
+mqtt:
+  client_id: mqtt_test
+  stats_interval: 50ms
+  rpc:
+    mode: read
+    timeout: 100ms
+  broker:
+    host: localhost
+  objects:
+    - topic: test_state
+      state:
+        register: tcptest.1.2
+        refresh: 10s
+        register_type: holding
+)");
+
+    auto sendRequest = [](MockedModMqttServerThread& pServer, const std::string& pReq, int pCorrelationId) {
+        pServer.mMqtt->injectRpcRequest(
+            "mqtt_test/rpc/modbus_request",
+            pReq.c_str(), static_cast<int>(pReq.size()),
+            "test/response", pCorrelationId);
+    };
+
+    SECTION("should reject requests over pending limit") {
+        config.mYAML["mqtt"]["rpc"]["timeout"] = "10s";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 11);
+        server.start();
+        server.waitForPublish("test_state/state");
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3"})", 1);
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"4"})", 2);
+        sendRequest(server, R"([{"network":"tcptest","slave":1,"register":"5"}])", 3);
+
+        server.waitForRpcResponse(2);
+        REQUIRE(server.mMqtt->rpcUserProperty(2, "error") == "too many pending requests");
+        server.waitForRpcResponse(3);
+        REQUIRE(server.mMqtt->rpcValue(3) == R"([{"error":"too many pending requests"}])");
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcValue(1) == "11");
+        server.waitForMqttValue("mqtt_test/stats/rpc", R"({"pending":0,"served":1,"failed":0,"rejected":2,"expired":0})");
+        server.stop();
+    }
+
+    SECTION("should count requests held by modbus thread after reconnect") {
+        config.mYAML["mqtt"]["rpc"]["timeout"] = "10s";
+        MockedModMqttServerThread server(config.toString());
+        server.setModbusRegisterValue("tcptest", 1, 3, modmqttd::RegisterType::HOLDING, 11);
+        server.start();
+        server.waitForPublish("test_state/state");
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3"})", 1);
+        server.waitForMqttValue("mqtt_test/stats/rpc", R"({"pending":1,"served":0,"failed":0,"rejected":0,"expired":0})");
+
+        // request 1 is not answered after reconnect, but it is
+        // still queued in modbus thread
+        server.mMqtt->dropConnection();
+        server.waitForMqttValue("mqtt_test/stats/rpc", R"({"pending":0,"served":0,"failed":0,"rejected":0,"expired":0})");
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"4"})", 2);
+        server.waitForRpcResponse(2);
+        REQUIRE(server.mMqtt->rpcUserProperty(2, "error") == "too many pending requests");
+
+        // wait for request 1 to finish
+        std::this_thread::sleep_for(timing::milliseconds(700));
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3"})", 3);
+        server.waitForRpcResponse(3);
+        REQUIRE(server.mMqtt->rpcValue(3) == "11");
+        server.stop();
+    }
+
+    SECTION("should answer expired read and drop it from modbus queue") {
+        MockedModMqttServerThread server(config.toString());
+        server.start();
+        server.waitForPublish("test_state/state");
+        server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+        // waits for delay_before_command after scheduled poll
+        sendRequest(server, R"({"network":"tcptest","slave":1,"register":"3"})", 1);
+        server.waitForRpcResponse(1);
+        REQUIRE(server.mMqtt->rpcUserProperty(1, "error") == "request timed out");
+        server.waitForMqttValue("mqtt_test/stats/rpc", R"({"pending":0,"served":0,"failed":0,"rejected":0,"expired":1})");
+
+        std::this_thread::sleep_for(timing::milliseconds(400));
+        server.stop();
+        auto& ctx = server.getMockedModbusContext("tcptest");
+        for (int i = 0; i < ctx.getIssuedReadCallsCount(1); i++)
+            REQUIRE(ctx.getIssuedReadCall(1, i).getCommandId() == 0);
+    }
+
+    SECTION("should fail for invalid bus share") {
+        config.mYAML["modbus"]["networks"][0]["rpc_bus_share"] = 0;
+        MockedModMqttServerThread server(config.toString(), false);
+        server.start();
+        server.stop();
+        REQUIRE(server.initOk() == false);
+        server.requireException<modmqttd::ConfigurationException>("rpc_bus_share");
+    }
+}
+
+
+TEST_CASE("RPC bus time budget") {
+
+    TestConfig config(R"(
+modbus:
+  networks:
+    - name: tcptest
+      address: localhost
+      port: 501
+      rpc_bus_share: 0.2
+      rpc_bus_burst: 10ms
+      slaves:
+        - address: 1
+mqtt:
+  client_id: mqtt_test
+  rpc:
+    mode: read
+  broker:
+    host: localhost
+  objects: []
+)");
+
+    MockedModMqttServerThread server(config.toString());
+    server.setSlaveReadTime("tcptest", 1, std::chrono::milliseconds(20));
+    for (int i = 1; i <= 5; i++)
+        server.setModbusRegisterValue("tcptest", 1, i, modmqttd::RegisterType::HOLDING, i * 10);
+    server.start();
+    server.waitForSubscription("mqtt_test/rpc/modbus_request");
+
+    SECTION("should delay reads over bus time share") {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 1; i <= 5; i++) {
+            const std::string req = R"({"network":"tcptest","slave":1,"register":")" + std::to_string(i) + R"("})";
+            server.mMqtt->injectRpcRequest(
+                "mqtt_test/rpc/modbus_request",
+                req.c_str(), static_cast<int>(req.size()),
+                "test/response", i);
+        }
+        for (int i = 1; i <= 5; i++) {
+            server.waitForRpcResponse(i);
+            REQUIRE(server.mMqtt->rpcValue(i) == std::to_string(i * 10));
+        }
+        // 100ms of bus time, 400ms of debt must be paid by 4 last reads
+        REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(300));
+        server.stop();
+    }
+}